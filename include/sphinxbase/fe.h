@@ -348,7 +348,8 @@ SPHINXBASE_EXPORT
 const cmd_ln_t *fe_get_config(fe_t *fe);
 
 /**
- * Start processing of the stream, resets processed frame counter
+ * Start processing of the stream, resets processed frame counter and
+ * restarts the dither sequence (if -dither is enabled) from -seed.
  */
 SPHINXBASE_EXPORT
 void fe_start_stream(fe_t *fe);
@@ -516,6 +517,27 @@ int fe_process_frames(fe_t *fe,
                       int32 *inout_nframes,
                       int32 *out_frameidx);
 
+/**
+ * Process a block of samples, computing several frames at a time.
+ *
+ * This function has exactly the same interface and produces the same
+ * output as fe_process_frames(), but it runs each stage of feature
+ * extraction (spectrum, mel filterbank, cepstral transform) over
+ * blocks of frames rather than one frame at a time, which is
+ * considerably faster when processing large amounts of audio, as is
+ * usually the case in batch mode.  It does not return voiced audio,
+ * so do not mix it with fe_process_frames_ext().
+ *
+ * @return 0 for success, <0 for failure (see enum fe_error_e)
+ */
+SPHINXBASE_EXPORT
+int fe_process_frames_batch(fe_t *fe,
+                            int16 const **inout_spch,
+                            size_t *inout_nsamps,
+                            mfcc_t **buf_cep,
+                            int32 *inout_nframes,
+                            int32 *out_frameidx);
+
 /** 
  * Process a block of samples, returning as many frames as possible.
  *
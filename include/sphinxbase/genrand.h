@@ -119,6 +119,7 @@
 
 /* Win32/WinCE DLL gunk */
 #include <sphinxbase/sphinxbase_export.h>
+#include <sphinxbase/prim_type.h>
 
 /** \file genrand.h
  *\brief High performance prortable random generator created by Takuji
@@ -170,6 +171,68 @@ double genrand_real3(void);
 SPHINXBASE_EXPORT
 double genrand_res53(void);
 
+/**
+ * Random generator with its own state.
+ *
+ * The functions above share a single generator for the whole
+ * process.  Each genrand_t is independent of them and of the others,
+ * so it can be used from any one thread at a time without locking.
+ * Seeded the same way, it produces the same sequence as the global
+ * generator.
+ */
+typedef struct genrand_s genrand_t;
+
+/**
+ * Create a random generator with a given seed.
+ */
+SPHINXBASE_EXPORT
+genrand_t *genrand_init(unsigned long s);
+
+/**
+ * Free a random generator.
+ */
+SPHINXBASE_EXPORT
+void genrand_free(genrand_t *g);
+
+/**
+ * Re-initialize the seed of a random generator.
+ */
+SPHINXBASE_EXPORT
+void genrand_seed_r(genrand_t *g, unsigned long s);
+
+/**
+ * Generate a random number on [0,0xffffffff]-interval.
+ */
+SPHINXBASE_EXPORT
+uint32 genrand_int32_r(genrand_t *g);
+
+/**
+ * Fill a buffer with random numbers on [0,0xffffffff]-interval.
+ *
+ * This produces the same numbers as calling genrand_int32_r() n
+ * times, but much faster.
+ */
+SPHINXBASE_EXPORT
+void genrand_fill_r(genrand_t *g, uint32 *out, size_t n);
+
+/**
+ * Generate a random number on [0,0x7fffffff]-interval.
+ */
+SPHINXBASE_EXPORT
+long genrand_int31_r(genrand_t *g);
+
+/**
+ * Generate a random number on (0,1)-real-interval.
+ */
+SPHINXBASE_EXPORT
+double genrand_real3_r(genrand_t *g);
+
+/**
+ * Generate a random number on [0,1) with 53-bit resolution.
+ */
+SPHINXBASE_EXPORT
+double genrand_res53_r(genrand_t *g);
+
 #ifdef __cplusplus
 }
 #endif
@@ -139,11 +139,12 @@ extern "C" {
 
 /**
  * The hash table structures.
- * Each hash table is identified by a hash_table_t structure.  hash_table_t.table is
- * pre-allocated for a user-controlled max size, and is initially empty.  As new
- * entries are created (using hash_enter()), the empty entries get filled.  If multiple
- * keys hash to the same entry, new entries are allocated and linked together in a
- * linear list.
+ * Each hash table is identified by a hash_table_t structure.  Entries
+ * are stored directly in hash_table_t.table using open addressing,
+ * and the table is enlarged as needed when new entries are created
+ * (using hash_table_enter()).  Pointers to entries and iterators are
+ * therefore only valid until the next insertion or deletion, and
+ * builds without NDEBUG abort if an iterator is used after one.
  */
 
 typedef struct hash_entry_s {
@@ -153,22 +154,24 @@ typedef struct hash_entry_s {
 	size_t len;			/** Key-length; the key string does not have to be a C-style NULL
 					    terminated string; it can have arbitrary binary bytes */
 	void *val;			/** Value associated with above key */
-	struct hash_entry_s *next;	/** For collision resolution */
 } hash_entry_t;
 
 typedef struct hash_table_s {
-	hash_entry_t *table;	/**Primary hash table, excluding entries that collide */
-	int32 size;		/** Primary hash table size, (is a prime#); NOTE: This is the
-				    number of primary entries ALLOCATED, NOT the number of valid
+	hash_entry_t *table;	/**Slots of the hash table */
+	int32 size;		/** Number of slots (a power of 2); NOTE: This is the
+				    number of entries ALLOCATED, NOT the number of valid
 				    entries in the table */
 	int32 inuse;		/** Number of valid entries in the table. */
 	int32 nocase;		/** Whether case insensitive for key comparisons */
+	uint32 *hashes;		/** Full hash value of the key in each slot, 0 if empty */
+	uint32 mods;		/** Count of insertions and deletions */
 } hash_table_t;
 
 typedef struct hash_iter_s {
 	hash_table_t *ht;  /**< Hash table we are iterating over. */
 	hash_entry_t *ent; /**< Current entry in that table. */
 	size_t idx;        /**< Index of next bucket to search. */
+	uint32 mods;       /**< Value of ht->mods when iteration started. */
 } hash_iter_t;
 
 /** Access macros */
@@ -425,7 +428,7 @@ glist_t hash_table_tolist(hash_table_t *h,	/**< In: Hash table from which list i
 	);
 
 /**
- * Display a hash-with-chaining representation on the screen.
+ * Display the slots of a hash table on the screen.
  * Currently, it will only works for situation where hash_enter was
  * used to enter the keys. 
  */
@@ -80,6 +80,10 @@
    *      integer value; the heap is maintained in ascending order of the integer value).
    *   2. Return the currently topmost item (i.e., item with smallest associated value).
    *   3. Return the currently topmost item and pop it off the heap.
+   *
+   * The heap is stored in a single array.  Items can also be
+   * inserted with a handle, which allows their value to be changed or
+   * the item to be removed without searching for it.
    */
 
 #ifdef __cplusplus
@@ -110,6 +114,26 @@ int heap_insert(heap_t *heap,	/**< In: Heap into which item is to be inserted */
                 void *data,	/**< In: Application-determined data pointer */
                 int32 val	/**< In: According to item entered in sorted heap */
 	);
+/**
+ * Insert a new item into the given heap and return a handle to it.
+ * The handle stays valid until the item is popped or removed, after
+ * which it may be reused for another item.
+ * @return handle for use with heap_update() and heap_remove_handle().
+ */
+SPHINXBASE_EXPORT
+int32 heap_insert_handle(heap_t *heap, void *data, int32 val);
+
+/**
+ * Insert n items at once, rebuilding the heap in linear time.
+ * Return value: 0 if successful, -1 otherwise.
+ */
+SPHINXBASE_EXPORT
+int heap_insert_array(heap_t *heap,	/**< In: Heap into which items are to be inserted */
+                      void **data,	/**< In: Application-determined data pointers */
+                      int32 const *vals,	/**< In: Values for each item in data */
+                      size_t n		/**< In: Number of items */
+	);
+
 /**
  * Return the topmost item in the heap.
  * Return value: 1 if heap is not empty and the topmost value is returned;
@@ -127,11 +151,27 @@ SPHINXBASE_EXPORT
 int heap_pop(heap_t *heap, void **data, int32 *val);
 
 /**
- * Remove an item from the heap.
+ * Remove an item from the heap.  This has to search the whole heap,
+ * use heap_remove_handle() if possible.
+ * Return value: 0 if successful, -1 if data is not in the heap.
  */
 SPHINXBASE_EXPORT
 int heap_remove(heap_t *heap, void *data);
 
+/**
+ * Change the value of an item inserted with heap_insert_handle().
+ * Return value: 0 if successful, -1 if handle is not in the heap.
+ */
+SPHINXBASE_EXPORT
+int heap_update(heap_t *heap, int32 handle, int32 val);
+
+/**
+ * Remove an item inserted with heap_insert_handle().
+ * Return value: 0 if successful, -1 if handle is not in the heap.
+ */
+SPHINXBASE_EXPORT
+int heap_remove_handle(heap_t *heap, int32 handle);
+
 /**
  * Return the number of items in the heap.
  */
@@ -193,6 +193,17 @@ int logmath_add_exact(logmath_t *lmath, int logb_p, int logb_q);
 SPHINXBASE_EXPORT
 int logmath_add(logmath_t *lmath, int logb_p, int logb_q);
 
+/**
+ * Add up an array of values in log space.
+ *
+ * This gives the same result as adding them one at a time, in order,
+ * with logmath_add(), but faster.
+ *
+ * @return The sum, or zero (in log space) if n is 0.
+ */
+SPHINXBASE_EXPORT
+int logmath_add_array(logmath_t *lmath, const int *logb_x, int n);
+
 /**
  * Convert linear floating point number to integer log in base B.
  */
@@ -70,6 +70,40 @@ typedef struct ngram_model_s ngram_model_t;
  */
 typedef struct ngram_class_s ngram_class_t;
 
+/**
+ * Per-thread history cache for scoring.
+ *
+ * Scoring through ngram_ng_score() updates a history cache stored in
+ * the model itself, so a model cannot be used from several threads at
+ * once that way.  Each thread may instead allocate its own cache with
+ * ngram_hist_cache_init() and score with ngram_ng_score_r().
+ */
+typedef struct ngram_hist_cache_s ngram_hist_cache_t;
+
+/**
+ * Maximum number of context words held in an ngram_state_t.
+ */
+#define NGRAM_STATE_MAX_HIST 4
+
+/**
+ * Language model context for scoring word by word.
+ *
+ * A state stands for the words preceding the next one to be scored,
+ * as far back as the model can use them.  It is initialized with
+ * ngram_state_init() and extended one word at a time with
+ * ngram_score_state(), so that a decoder can keep one in each
+ * hypothesis rather than passing the whole history each time.  States
+ * are plain values which may be copied, compared with
+ * ngram_state_equal(), or thrown away freely, but their contents
+ * belong to the model that made them.
+ */
+typedef struct ngram_state_s {
+    int32 n_hist;                        /**< Number of words of context */
+    int32 hist[NGRAM_STATE_MAX_HIST];    /**< Context, most recent first */
+    float32 backoff[NGRAM_STATE_MAX_HIST]; /**< Backoff weight of each
+                                              prefix of hist, if known */
+} ngram_state_t;
+
 /**
  * File types for N-Gram files
  */
@@ -89,6 +123,8 @@ typedef enum ngram_file_type_e {
  * Recognized arguments are:
  *
  *  - -mmap (boolean) whether to use memory-mapped I/O
+ *  - -nthreads (int32) number of threads to use for parsing and
+ *    building the trie from ARPA or DMP files
  *  - -lw (float32) language weight to apply to the model
  *  - -wip (float32) word insertion penalty to apply to the model
  *
@@ -116,6 +152,37 @@ SPHINXBASE_EXPORT
 int ngram_model_write(ngram_model_t *model, const char *file_name,
 		      ngram_file_type_t format);
 
+/**
+ * Convert an ARPA format N-Gram model to a binary file without
+ * reading it all into memory.
+ *
+ * N-Grams are read in sorted runs which are written to temporary
+ * files, then merged into the output file as the trie is built, so
+ * this can convert models which are too big for ngram_model_read().
+ * Only the unigrams and word strings are kept in memory, besides the
+ * budget.  The output is the same as that of ngram_model_write(),
+ * unless the budget is too small to hold the probabilities of every
+ * N-Gram order, in which case the quantizer is trained on a sample
+ * of them.
+ *
+ * @param config Pointer to a set of command-line arguments.
+ * Recognized arguments are:
+ *
+ *  - -membudget (float32) megabytes of memory to use for N-Grams
+ *  - -tmpdir (string) directory for temporary files, instead of
+ *    the system default
+ *  - -nthreads (int32) number of threads to use for parsing and
+ *    sorting
+ *
+ * @param arpa_path path to the ARPA file to read, which may be compressed.
+ * @param bin_path path to the binary file to write.
+ * @param lmath Log-math parameters to use, which are not retained.
+ * @return 0 for success, <0 on error
+ */
+SPHINXBASE_EXPORT
+int ngram_model_convert_arpa_bin(cmd_ln_t *config, const char *arpa_path,
+                                 const char *bin_path, logmath_t *lmath);
+
 /**
  * Guess the file type for an N-Gram model from the filename.
  *
@@ -257,6 +324,90 @@ SPHINXBASE_EXPORT
 int32 ngram_ng_score(ngram_model_t *model, int32 wid, int32 *history,
                      int32 n_hist, int32 *n_used);
 
+/**
+ * Allocate a history cache for use with ngram_ng_score_r().
+ */
+SPHINXBASE_EXPORT
+ngram_hist_cache_t *ngram_hist_cache_init(void);
+
+/**
+ * Free a history cache.
+ */
+SPHINXBASE_EXPORT
+void ngram_hist_cache_free(ngram_hist_cache_t *cache);
+
+/**
+ * Quick general N-Gram score lookup using a caller-owned history cache.
+ *
+ * This gives the same results as ngram_ng_score(), but does not
+ * modify the model, so any number of threads may score with the same
+ * model at once, as long as each uses its own cache.  Models which do
+ * not support this (such as interpolated sets) are scored with
+ * ngram_ng_score() and are not thread-safe.
+ */
+SPHINXBASE_EXPORT
+int32 ngram_ng_score_r(ngram_model_t *model, ngram_hist_cache_t *cache,
+                       int32 wid, int32 *history, int32 n_hist,
+                       int32 *n_used);
+
+/**
+ * General N-Gram score lookup for many N-Grams at once.
+ *
+ * Query i is the word wids[i] with the n_hists[i] words of history
+ * in histories[i], and its score and N-Gram length go into
+ * out_scores[i] and out_n_used[i], as ngram_ng_score() would give
+ * them.  Histories containing class words are rewritten in place, as
+ * they are by ngram_ng_score().
+ *
+ * Lookups for a window of queries are interleaved, so that on large
+ * models the memory accesses of one query overlap those of the
+ * others.  Trie models do not use or modify the history cache for
+ * this, so they can score batches from several threads at once.
+ * Other models (such as interpolated sets) score each query with
+ * ngram_ng_score().
+ */
+SPHINXBASE_EXPORT
+void ngram_ng_score_batch(ngram_model_t *model, int32 *wids,
+                          int32 **histories, int32 *n_hists,
+                          int32 n_queries, int32 *out_scores,
+                          int32 *out_n_used);
+
+/**
+ * Set up a language model state for a given history.
+ *
+ * @param state State to initialize.
+ * @param history Preceding words, most recent first, as for
+ *        ngram_ng_score().  Class words are rewritten in place.
+ * @param n_hist Number of words in history, or 0 for no context.
+ */
+SPHINXBASE_EXPORT
+void ngram_state_init(ngram_model_t *model, ngram_state_t *state,
+                      int32 *history, int32 n_hist);
+
+/**
+ * Score a word following a language model state.
+ *
+ * This gives the same score as ngram_ng_score() with the history that
+ * state stands for, but for trie models only looks up the N-Grams
+ * ending in wid, since the backoff weights of the history are kept in
+ * the state.
+ *
+ * @param state Context to score wid in.
+ * @param out_state Output, context after wid.  This may be the same
+ *        as state.
+ * @return The score, or the model's zero probability for unknown words,
+ *         in which case out_state has no context.
+ */
+SPHINXBASE_EXPORT
+int32 ngram_score_state(ngram_model_t *model, const ngram_state_t *state,
+                        int32 wid, ngram_state_t *out_state);
+
+/**
+ * Check whether two language model states give the same scores.
+ */
+SPHINXBASE_EXPORT
+int ngram_state_equal(const ngram_state_t *a, const ngram_state_t *b);
+
 /**
  * Get the "raw" log-probability for a general N-Gram.
  *
@@ -658,6 +809,24 @@ ngram_model_t *ngram_model_set_remove(ngram_model_t *set,
                                       const char *name,
                                       int reuse_widmap);
 
+/**
+ * Compile an interpolated set into a single language model.
+ *
+ * The new model has the N-Grams of all the set's models, each with the
+ * probability the set gives it when interpolating with its current
+ * weights, and backoff weights recomputed to match.  It scores those
+ * N-Grams as the set would, and others by backing off, at the speed
+ * and size of a single model.  All models in the set must be trie
+ * models, and word classes are left out.
+ *
+ * @param config Configuration for building the new model, which
+ *               may give -probbits, -bobits and -nthreads, or NULL.
+ * @param set The language model set to compile.
+ * @return A newly created language model, or NULL on failure.
+ */
+SPHINXBASE_EXPORT
+ngram_model_t *ngram_model_set_compile(cmd_ln_t *config, ngram_model_t *set);
+
 /**
  * Set the word-to-ID mapping for this model set.
  */
@@ -691,10 +860,46 @@ int32 ngram_model_set_known_wid(ngram_model_t *set, int32 set_wid);
 
 /**
  * Flush any cached N-Gram information
+ *
+ * This includes the shared score cache, if there is one.
  */
 SPHINXBASE_EXPORT
 void ngram_model_flush(ngram_model_t *lm);
 
+/**
+ * Set up a score cache shared by all users of a model.
+ *
+ * Scores looked up with ngram_ng_score() and ngram_ng_score_r() (and
+ * the functions built on them) are kept in a direct-mapped table of
+ * n_entries entries, indexed by a hash of the word and its history.
+ * The cache never blocks, so threads scoring with ngram_ng_score_r()
+ * may share it.  It is flushed when the model's weights or words
+ * change, or with ngram_model_flush(), which must be called after the
+ * change, not before it.
+ *
+ * @param n_entries Number of entries, which is rounded up to a power
+ *        of two, or 0 to remove the cache.
+ * @return 0 for success, <0 if not supported on this platform.
+ */
+SPHINXBASE_EXPORT
+int ngram_model_cache_init(ngram_model_t *model, int32 n_entries);
+
+/**
+ * Get the number of score cache lookups that hit and missed.
+ *
+ * Lookups made with ngram_ng_score() are counted since
+ * ngram_model_cache_init().  Those made with ngram_ng_score_r() are
+ * counted in the history cache they used, since it was created, so
+ * that threads do not contend for the counters.
+ *
+ * @param caches History caches whose lookups to add in, or NULL.
+ * @param n_caches Number of entries in caches.
+ */
+SPHINXBASE_EXPORT
+void ngram_model_cache_stats(ngram_model_t *model,
+                             ngram_hist_cache_t **caches, int32 n_caches,
+                             uint64 *out_hits, uint64 *out_misses);
+
 #ifdef __cplusplus
 }
 #endif
@@ -66,6 +66,11 @@ typedef struct sbthread_s sbthread_t;
  */
 typedef struct sbmsgq_s sbmsgq_t;
 
+/**
+ * Lock-free ring buffer object.
+ */
+typedef struct sbring_s sbring_t;
+
 /**
  * Mutex (critical section) object.
  */
@@ -76,11 +81,31 @@ typedef struct sbmtx_s sbmtx_t;
  */
 typedef struct sbevent_s sbevent_t;
 
+/**
+ * Thread pool object.
+ */
+typedef struct sbpool_s sbpool_t;
+
+/**
+ * Group of tasks run by a thread pool.
+ */
+typedef struct sbtaskgroup_s sbtaskgroup_t;
+
 /**
  * Entry point for a thread.
  */
 typedef int (*sbthread_main)(sbthread_t *th);
 
+/**
+ * Task run by a thread pool.
+ */
+typedef void (*sbtask_func)(void *arg);
+
+/**
+ * Task run by a thread pool for the indices from start to end - 1.
+ */
+typedef void (*sbrange_func)(void *arg, int start, int end);
+
 /**
  * Start a new thread.
  */
@@ -153,11 +178,85 @@ SPHINXBASE_EXPORT
 int sbmsgq_send(sbmsgq_t *q, size_t len, void const *data);
 
 /**
- * Wait for a message from a queue.
+ * Wait for a message from a queue.  The returned message is valid
+ * until the next call to sbmsgq_wait().
  */
 SPHINXBASE_EXPORT
 void *sbmsgq_wait(sbmsgq_t *q, size_t *out_len, int sec, int nsec);
 
+/**
+ * Create a ring buffer for passing messages from one or more producer
+ * threads to a single consumer thread without locking.
+ *
+ * Producers call sbring_reserve() to get space for a message, fill it
+ * in place, and call sbring_commit() to pass it on.  The consumer
+ * calls sbring_peek() to get the next message, which it can use in
+ * place until it calls sbring_release() or sbring_peek() again.
+ * Threads only block when the ring is empty or full.
+ *
+ * @param size Size of the buffer in bytes, rounded up to a power of two.
+ * @param multi_producer Whether more than one thread may send
+ *        messages.  If not, reservations are cheaper.
+ */
+SPHINXBASE_EXPORT
+sbring_t *sbring_init(size_t size, int multi_producer);
+
+/**
+ * Free a ring buffer.
+ */
+SPHINXBASE_EXPORT
+void sbring_free(sbring_t *r);
+
+/**
+ * Get the largest message that will fit in a ring buffer.
+ */
+SPHINXBASE_EXPORT
+size_t sbring_max_len(sbring_t *r);
+
+/**
+ * Reserve contiguous space for a message, waiting if the ring is full.
+ *
+ * A thread must commit each reservation before making another one,
+ * as later messages from all producers are held back until it does.
+ *
+ * @param len Size of the message in bytes.
+ * @param sec Seconds to wait for space, or -1 to wait forever.
+ * @param nsec Nanoseconds to wait for space.
+ * @return pointer to len bytes, aligned to 8 bytes, or NULL if the
+ *         message is too large or no space became available in time.
+ */
+SPHINXBASE_EXPORT
+void *sbring_reserve(sbring_t *r, size_t len, int sec, int nsec);
+
+/**
+ * Pass a message in reserved space on to the consumer.
+ *
+ * @param ptr Pointer returned by sbring_reserve().
+ * @param len Actual size of the message, no more than was reserved.
+ * @return 0 on success, -1 if len was too large (in which case the
+ *         whole reservation is passed on).
+ */
+SPHINXBASE_EXPORT
+int sbring_commit(sbring_t *r, void *ptr, size_t len);
+
+/**
+ * Get the next message from a ring buffer, waiting if it is empty.
+ * Any message returned by a previous call is released first.
+ *
+ * @param out_len Output: size of the message.
+ * @param sec Seconds to wait for a message, or -1 to wait forever.
+ * @param nsec Nanoseconds to wait for a message.
+ * @return pointer to the message, or NULL if none arrived in time.
+ */
+SPHINXBASE_EXPORT
+void *sbring_peek(sbring_t *r, size_t *out_len, int sec, int nsec);
+
+/**
+ * Release the space used by the message returned by sbring_peek().
+ */
+SPHINXBASE_EXPORT
+void sbring_release(sbring_t *r);
+
 /**
  * Create a mutex.
  */
@@ -212,6 +311,92 @@ int sbevent_signal(sbevent_t *evt);
 SPHINXBASE_EXPORT
 int sbevent_wait(sbevent_t *evt, int sec, int nsec);
 
+/**
+ * Create a thread pool.
+ *
+ * Each worker thread has its own queue of tasks, and steals tasks
+ * from the others when it runs out.  Threads outside the pool can
+ * spawn tasks and wait for them, running tasks themselves while they
+ * wait, so they count as one of the threads.
+ *
+ * @param config Configuration passed to the worker threads.  If
+ *        nthreads is zero, it is taken from the -nthreads argument
+ *        in this, if there is one.
+ * @param nthreads Number of threads, including the calling one.  If
+ *        this is 1, all tasks are run by the threads which wait for
+ *        them.
+ */
+SPHINXBASE_EXPORT
+sbpool_t *sbpool_init(cmd_ln_t *config, int nthreads);
+
+/**
+ * Stop the worker threads and free a thread pool.  All task groups
+ * must be finished first.
+ */
+SPHINXBASE_EXPORT
+void sbpool_free(sbpool_t *pool);
+
+/**
+ * Get the number of threads in a thread pool, including the calling
+ * one.
+ */
+SPHINXBASE_EXPORT
+int sbpool_nthreads(sbpool_t *pool);
+
+/**
+ * Get the index of the current thread in a thread pool.
+ *
+ * @return a number from 1 to sbpool_nthreads() - 1 for worker
+ *         threads, or 0 for any thread outside the pool.  Tasks can
+ *         use this to find per-thread state, provided that only one
+ *         outside thread uses the pool at a time.
+ */
+SPHINXBASE_EXPORT
+int sbpool_worker(sbpool_t *pool);
+
+/**
+ * Run func on the indices from start to end - 1 in parallel, and
+ * wait for it to finish.
+ *
+ * The range is split in half repeatedly, so that func is called on
+ * consecutive pieces of no more than grain indices each (unless the
+ * pool only has one thread, in which case it is called once on the
+ * whole range).
+ *
+ * @param grain Largest piece of the range to give to one call, or 0
+ *        to make a few pieces for each thread.
+ */
+SPHINXBASE_EXPORT
+void sbpool_parallel_for(sbpool_t *pool, int start, int end, int grain,
+                         sbrange_func func, void *arg);
+
+/**
+ * Create a group of tasks to run in a thread pool.
+ */
+SPHINXBASE_EXPORT
+sbtaskgroup_t *sbtaskgroup_init(sbpool_t *pool);
+
+/**
+ * Wait for the tasks in a group and free it.
+ */
+SPHINXBASE_EXPORT
+void sbtaskgroup_free(sbtaskgroup_t *g);
+
+/**
+ * Spawn a task in a group.  Tasks may spawn more tasks in the same
+ * or other groups.
+ */
+SPHINXBASE_EXPORT
+void sbtaskgroup_run(sbtaskgroup_t *g, sbtask_func func, void *arg);
+
+/**
+ * Wait for all the tasks in a group to finish, including any they
+ * spawned, running tasks from the pool in the meantime.  The group
+ * can be used again afterwards.
+ */
+SPHINXBASE_EXPORT
+void sbtaskgroup_wait(sbtaskgroup_t *g);
+
 
 #ifdef __cplusplus
 }
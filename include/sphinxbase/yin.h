@@ -58,13 +58,38 @@ extern "C" {
  */
 typedef struct yin_s yin_t;
 
+/**
+ * Method used to compute the difference function.
+ */
+typedef enum yin_diff_method_e {
+    YIN_DIFF_DIRECT, /**< Direct O(N^2) summation in fixed-point. */
+    YIN_DIFF_FFT     /**< O(N log N) floating-point autocorrelation via FFT. */
+} yin_diff_method_t;
+
 /**
  * Initialize moving-window pitch estimation.
+ *
+ * This uses the direct method (YIN_DIFF_DIRECT) for the difference
+ * function.
  */
 SPHINXBASE_EXPORT
 yin_t *yin_init(int frame_size, float search_threshold,
                 float search_range, int smooth_window);
 
+/**
+ * Initialize moving-window pitch estimation with a given method for
+ * computing the difference function.
+ *
+ * YIN_DIFF_FFT is much faster for long frames, but requires
+ * floating-point.  Its output is normalized the same way as
+ * YIN_DIFF_DIRECT, but rounding differs slightly, so near-ties may
+ * occasionally be resolved to a neighbouring period.
+ */
+SPHINXBASE_EXPORT
+yin_t *yin_init_method(int frame_size, float search_threshold,
+                       float search_range, int smooth_window,
+                       yin_diff_method_t method);
+
 /**
  * Free a moving-window pitch estimator.
  */
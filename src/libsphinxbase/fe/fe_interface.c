@@ -253,7 +253,7 @@ fe_init_auto_r(cmd_ln_t *config)
     }
 
     if (fe->dither)
-        fe_init_dither(fe->dither_seed);
+        fe_init_dither(fe);
 
     /* establish buffers for overflow samps and hamming window */
     fe->overflow_samps = ckd_calloc(fe->frame_size, sizeof(int16));
@@ -292,9 +292,10 @@ fe_init_auto_r(cmd_ln_t *config)
     fe->spec = ckd_calloc(fe->fft_size, sizeof(*fe->spec));
     fe->mfspec = ckd_calloc(fe->mel_fb->num_filters, sizeof(*fe->mfspec));
 
-    /* create twiddle factors */
-    fe->ccc = ckd_calloc(fe->fft_size / 4, sizeof(*fe->ccc));
-    fe->sss = ckd_calloc(fe->fft_size / 4, sizeof(*fe->sss));
+    /* create twiddle factors and bit-reversal table */
+    fe->ccc = ckd_calloc(fe->fft_size / 2, sizeof(*fe->ccc));
+    fe->sss = ckd_calloc(fe->fft_size / 2, sizeof(*fe->sss));
+    fe->fft_swaps = ckd_calloc(fe->fft_size, sizeof(*fe->fft_swaps));
     fe_create_twiddle(fe);
 
     if (cmd_ln_boolean_r(config, "-verbose")) {
@@ -319,10 +320,11 @@ fe_get_config(fe_t *fe)
 }
 
 void
-fe_init_dither(int32 seed)
+fe_init_dither(fe_t *fe)
 {
-    E_INFO("Using %d as the seed.\n", seed);
-    s3_rand_seed(seed);
+    E_INFO("Using %d as the seed.\n", fe->dither_seed);
+    fe->rng = genrand_init(fe->dither_seed);
+    fe->dither_buf = ckd_calloc(fe->frame_size, sizeof(*fe->dither_buf));
 }
 
 static void
@@ -349,6 +351,10 @@ fe_start_stream(fe_t *fe)
 {
     fe->num_processed_samps = 0;
     fe_reset_noisestats(fe->noise_stats);
+    /* Restart the dither sequence, so that the output for a stream
+     * does not depend on what was processed before it. */
+    if (fe->rng)
+        genrand_seed_r(fe->rng, fe->dither_seed);
 }
 
 int
@@ -427,15 +433,70 @@ fe_check_prespeech(fe_t *fe, int32 *inout_nframes, mfcc_t **buf_cep, int outidx,
     return outidx;
 }
 
-int 
-fe_process_frames_ext(fe_t *fe,
-                  int16 const **inout_spch,
-                  size_t *inout_nsamps,
-                  mfcc_t **buf_cep,
-                  int32 *inout_nframes,
-                  int16 *voiced_spch,
-                  int32 *voiced_spch_nsamps,
-                  int32 *out_frameidx)
+/**
+ * Process as many frames as possible from the input in blocks of up
+ * to FE_BLOCK_SIZE, running each stage of processing over the whole
+ * block.  Returns the updated output index.
+ */
+static int
+fe_process_blocks(fe_t *fe, int16 const **inout_spch, size_t *inout_nsamps,
+                  mfcc_t **buf_cep, int32 *inout_nframes, int outidx,
+                  int32 *out_frameidx, size_t orig_nsamps)
+{
+    if (fe->spec_block == NULL) {
+        fe->spec_block = ckd_calloc((fe->fft_size / 2 + 1) * FE_BLOCK_SIZE,
+                                    sizeof(*fe->spec_block));
+        fe->mfspec_block = ckd_calloc(fe->mel_fb->num_filters * FE_BLOCK_SIZE,
+                                      sizeof(*fe->mfspec_block));
+        fe->cep_block = ckd_calloc_2d(FE_BLOCK_SIZE, fe->feature_dimension,
+                                      sizeof(**fe->cep_block));
+        fe->is_speech_block = ckd_calloc(FE_BLOCK_SIZE,
+                                         sizeof(*fe->is_speech_block));
+    }
+
+    while (*inout_nframes > 0 && *inout_nsamps >= (size_t)fe->frame_shift) {
+        int32 nfr, i;
+
+        /* Every frame produces at most one output frame, plus those
+         * already waiting in the prespeech buffer, so limit the
+         * block size to what is guaranteed to fit in the output.
+         * Otherwise we would have to undo the processing of frames
+         * which can't be returned. */
+        nfr = *inout_nsamps / fe->frame_shift;
+        if (nfr > FE_BLOCK_SIZE)
+            nfr = FE_BLOCK_SIZE;
+        if (nfr > *inout_nframes - fe_prespch_ncep(fe->vad_data->prespch_buf))
+            nfr = *inout_nframes - fe_prespch_ncep(fe->vad_data->prespch_buf);
+        if (nfr < 1)
+            break;
+
+        fe_write_frames_block(fe, *inout_spch, nfr);
+        for (i = 0; i < nfr; ++i) {
+            memcpy(buf_cep[outidx], fe->cep_block[i],
+                   fe->feature_dimension * sizeof(**buf_cep));
+            fe_vad_hangover(fe, buf_cep[outidx],
+                            fe->is_speech_block[i], FALSE);
+            outidx = fe_check_prespeech(fe, inout_nframes, buf_cep, outidx,
+                                        out_frameidx, inout_nsamps,
+                                        orig_nsamps);
+            /* Update input-output pointers and counters. */
+            *inout_spch += fe->frame_shift;
+            *inout_nsamps -= fe->frame_shift;
+        }
+    }
+    return outidx;
+}
+
+static int
+fe_process_frames_int(fe_t *fe,
+                      int16 const **inout_spch,
+                      size_t *inout_nsamps,
+                      mfcc_t **buf_cep,
+                      int32 *inout_nframes,
+                      int16 *voiced_spch,
+                      int32 *voiced_spch_nsamps,
+                      int32 *out_frameidx,
+                      int batch)
 {
     int outidx, n_overflow, orig_n_overflow;
     int16 const *orig_spch;
@@ -522,6 +583,12 @@ fe_process_frames_ext(fe_t *fe,
     fe_write_frame(fe, buf_cep[outidx], voiced_spch != NULL);
     outidx = fe_check_prespeech(fe, inout_nframes, buf_cep, outidx, out_frameidx, inout_nsamps, orig_nsamps);
 
+    /* Process remaining frames in blocks if requested. */
+    if (batch)
+        outidx = fe_process_blocks(fe, inout_spch, inout_nsamps, buf_cep,
+                                   inout_nframes, outidx, out_frameidx,
+                                   orig_nsamps);
+
     /* Process all remaining frames. */
     while (*inout_nframes > 0 && *inout_nsamps >= (size_t)fe->frame_shift) {
         fe_shift_frame(fe, *inout_spch, fe->frame_shift);
@@ -582,6 +649,34 @@ fe_process_frames_ext(fe_t *fe,
     return 0;
 }
 
+int
+fe_process_frames_ext(fe_t *fe,
+                      int16 const **inout_spch,
+                      size_t *inout_nsamps,
+                      mfcc_t **buf_cep,
+                      int32 *inout_nframes,
+                      int16 *voiced_spch,
+                      int32 *voiced_spch_nsamps,
+                      int32 *out_frameidx)
+{
+    return fe_process_frames_int(fe, inout_spch, inout_nsamps, buf_cep,
+                                 inout_nframes, voiced_spch,
+                                 voiced_spch_nsamps, out_frameidx, FALSE);
+}
+
+int
+fe_process_frames_batch(fe_t *fe,
+                        int16 const **inout_spch,
+                        size_t *inout_nsamps,
+                        mfcc_t **buf_cep,
+                        int32 *inout_nframes,
+                        int32 *out_frameidx)
+{
+    return fe_process_frames_int(fe, inout_spch, inout_nsamps, buf_cep,
+                                 inout_nframes, NULL, NULL, out_frameidx,
+                                 TRUE);
+}
+
 int
 fe_process_utt(fe_t * fe, int16 const * spch, size_t nsamps,
                mfcc_t *** cep_block, int32 * nframes)
@@ -596,8 +691,8 @@ fe_process_utt(fe_t * fe, int16 const * spch, size_t nsamps,
         cep = (mfcc_t **)ckd_calloc_2d(*nframes, fe->feature_dimension, sizeof(**cep));
     else
         cep = (mfcc_t **)ckd_calloc_2d(1, fe->feature_dimension, sizeof(**cep));
-    /* Now just call fe_process_frames() with the allocated buffer. */
-    rv = fe_process_frames(fe, &spch, &nsamps, cep, nframes, NULL);
+    /* Now just call fe_process_frames_batch() with the allocated buffer. */
+    rv = fe_process_frames_batch(fe, &spch, &nsamps, cep, nframes, NULL);
     *cep_block = cep;
 
     return rv;
@@ -644,7 +739,6 @@ fe_free(fe_t * fe)
         ckd_free(fe->mel_fb->lifter);
         ckd_free(fe->mel_fb->spec_start);
         ckd_free(fe->mel_fb->filt_start);
-        ckd_free(fe->mel_fb->filt_width);
         ckd_free(fe->mel_fb->filt_coeffs);
         ckd_free(fe->mel_fb);
     }
@@ -652,10 +746,19 @@ fe_free(fe_t * fe)
     ckd_free(fe->frame);
     ckd_free(fe->ccc);
     ckd_free(fe->sss);
+    ckd_free(fe->fft_swaps);
     ckd_free(fe->spec);
     ckd_free(fe->mfspec);
     ckd_free(fe->overflow_samps);
     ckd_free(fe->hamming_window);
+    genrand_free(fe->rng);
+    ckd_free(fe->dither_buf);
+    if (fe->spec_block) {
+        ckd_free(fe->spec_block);
+        ckd_free(fe->mfspec_block);
+        ckd_free_2d(fe->cep_block);
+        ckd_free(fe->is_speech_block);
+    }
 
     if (fe->noise_stats)
         fe_free_noisestats(fe->noise_stats);
@@ -44,6 +44,7 @@
 
 #include "sphinxbase/fe.h"
 #include "sphinxbase/fixpoint.h"
+#include "sphinxbase/genrand.h"
 
 #include "fe_noise.h"
 #include "fe_prespch_buf.h"
@@ -70,6 +71,18 @@ enum {
         DCT_HTK = 2
 };
 
+/* Maximum number of parameters taken by a warping function. */
+#define FE_WARP_MAX_PARAM 2
+
+/** Frequency warping parameters, kept per front end (see fe_warp.h). */
+typedef struct fe_warp_state_s {
+    float params[FE_WARP_MAX_PARAM];
+    float final_piece[2];       /* Used by piecewise linear only. */
+    int32 is_neutral;
+    char p_str[256];
+    float nyquist_frequency;
+} fe_warp_state_t;
+
 typedef struct melfb_s melfb_t;
 /** Base Struct to hold all structure for MFCC computation. */
 struct melfb_s {
@@ -81,16 +94,19 @@ struct melfb_s {
     float32 upper_filt_freq;
     /* DCT coefficients. */
     mfcc_t **mel_cosine;
-    /* Filter coefficients. */
+    /* Filter coefficients, in compressed sparse row form: the
+     * coefficients for filter i are filt_coeffs[filt_start[i]] to
+     * filt_coeffs[filt_start[i + 1] - 1], and apply to the power
+     * spectrum starting at spec_start[i]. */
     mfcc_t *filt_coeffs;
     int16 *spec_start;
-    int16 *filt_start;
-    int16 *filt_width;
+    int32 *filt_start;
     /* Luxury mobile home. */
     int32 doublewide;
     char const *warp_type;
     char const *warp_params;
     uint32 warp_id;
+    fe_warp_state_t warp;
     /* Precomputed normalization constants for unitary DCT-II/DCT-III */
     mfcc_t sqrt_inv_n, sqrt_inv_2n;
     /* Value and coefficients for HTK-style liftering */
@@ -106,6 +122,10 @@ struct melfb_s {
 /* sqrt(1/2), also used for unitary DCT-II/DCT-III */
 #define SQRT_HALF FLOAT2MFCC(0.707106781186548)
 
+/* Maximum number of frames processed together by
+ * fe_write_frames_block(). */
+#define FE_BLOCK_SIZE 32
+
 typedef struct vad_data_s {
     uint8 in_speech;
     int16 pre_speech_frames;
@@ -140,12 +160,18 @@ struct fe_s {
     float32 pre_emphasis_alpha;
     int16 pre_emphasis_prior;
     int32 dither_seed;
+    /* Random generator and buffer for dithering. */
+    genrand_t *rng;
+    uint32 *dither_buf;
 
     int16 num_overflow_samps;    
     size_t num_processed_samps;
 
-    /* Twiddle factors for FFT. */
+    /* Twiddle factors for FFT, laid out contiguously for each stage. */
     frame_t *ccc, *sss;
+    /* Index pairs to exchange for the FFT bit-reversal permutation. */
+    int16 *fft_swaps;
+    int32 n_fft_swaps;
     /* Mel filter parameters. */
     melfb_t *mel_fb;
     /* Half of a Hamming Window. */
@@ -167,12 +193,20 @@ struct fe_s {
     frame_t *frame;
     powspec_t *spec, *mfspec;
     int16 *overflow_samps;
+
+    /* Block buffers for fe_process_frames_batch(), allocated on
+     * first use.  Spectra are stored bin-major, i.e. with
+     * FE_BLOCK_SIZE frames per bin. */
+    powspec_t *spec_block, *mfspec_block;
+    mfcc_t **cep_block;
+    int32 *is_speech_block;
 };
 
-void fe_init_dither(int32 seed);
+/* Create the dither generator, seeded with fe->dither_seed. */
+void fe_init_dither(fe_t *fe);
 
-/* Apply 1/2 bit noise to a buffer of audio. */
-int32 fe_dither(int16 *buffer, int32 nsamps);
+/* Apply 1/2 bit noise to a buffer of audio (at most frame_size samples). */
+void fe_dither(fe_t *fe, int16 *buffer, int32 nsamps);
 
 /* Load a frame of data into the fe. */
 int fe_read_frame(fe_t *fe, int16 const *in, int32 len);
@@ -183,18 +217,32 @@ int fe_shift_frame(fe_t *fe, int16 const *in, int32 len);
 /* Process a frame of data into features. */
 void fe_write_frame(fe_t *fe, mfcc_t *feat, int32 store_pcm);
 
+/* Shift in nfr frames of data starting at in and process them into
+ * features in fe->cep_block, leaving the local VAD decisions in
+ * fe->is_speech_block.  VAD hangover is left to the caller. */
+void fe_write_frames_block(fe_t *fe, int16 const *in, int32 nfr);
+
 /* Initialization functions. */
 int32 fe_build_melfilters(melfb_t *MEL_FB);
 int32 fe_compute_melcosine(melfb_t *MEL_FB);
 void fe_create_hamming(window_t *in, int32 in_len);
 void fe_create_twiddle(fe_t *fe);
 
+/* In-place real FFT of fe->frame, using the tables built above. */
+int fe_fft_real(fe_t *fe);
+
 fixed32 fe_log_add(fixed32 x, fixed32 y);
 fixed32 fe_log_sub(fixed32 x, fixed32 y);
 
 /* Miscellaneous processing functions. */
 void fe_spec2cep(fe_t * fe, const powspec_t * mflogspec, mfcc_t * mfcep);
 void fe_dct2(fe_t *fe, const powspec_t *mflogspec, mfcc_t *mfcep, int htk);
+/* Versions of the above for a block of nfr frames.  Input is stored
+ * bin-major with leading dimension ld, output is frame-major. */
+void fe_spec2cep_block(fe_t *fe, const powspec_t *mflogspec, mfcc_t *mfcep,
+                       int32 nfr, int32 ld);
+void fe_dct2_block(fe_t *fe, const powspec_t *mflogspec, mfcc_t *mfcep,
+                   int32 nfr, int32 ld, int htk);
 void fe_dct3(fe_t *fe, const mfcc_t *mfcep, powspec_t *mflogspec);
 
 #ifdef __cplusplus
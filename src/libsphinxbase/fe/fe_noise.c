@@ -321,12 +321,11 @@ fe_free_noisestats(noise_stats_t * noise_stats)
  * so we have to add many processing cases.
  */
 void
-fe_track_snr(fe_t * fe, int32 *in_speech)
+fe_track_snr(fe_t * fe, powspec_t *mfspec, int32 *in_speech)
 {
     powspec_t *signal;
     powspec_t *gain;
     noise_stats_t *noise_stats;
-    powspec_t *mfspec;
     int32 i, num_filts;
     int16 is_quiet;
     powspec_t lrt, snr;
@@ -337,7 +336,6 @@ fe_track_snr(fe_t * fe, int32 *in_speech)
     }
 
     noise_stats = fe->noise_stats;
-    mfspec = fe->mfspec;
     num_filts = noise_stats->num_filters;
 
     signal = (powspec_t *) ckd_calloc(num_filts, sizeof(powspec_t));
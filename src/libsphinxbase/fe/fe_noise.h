@@ -55,8 +55,10 @@ void fe_free_noisestats(noise_stats_t * noise_stats);
 /**
  * Process frame, update noise statistics, remove noise components if needed, 
  * and return local vad decision.
+ *
+ * @param mfspec Mel spectrum of the frame, modified in place.
  */
-void fe_track_snr(fe_t *fe, int32 *in_speech);
+void fe_track_snr(fe_t *fe, powspec_t *mfspec, int32 *in_speech);
 
 /**
  * Updates global state based on local VAD state smoothing the estimate.
@@ -556,13 +556,11 @@ fe_build_melfilters(melfb_t * mel_fb)
     int n_coeffs, i, j;
 
 
-    /* Filter coefficient matrix, in flattened form. */
+    /* Filter coefficient matrix, in compressed sparse row form. */
     mel_fb->spec_start =
         ckd_calloc(mel_fb->num_filters, sizeof(*mel_fb->spec_start));
     mel_fb->filt_start =
-        ckd_calloc(mel_fb->num_filters, sizeof(*mel_fb->filt_start));
-    mel_fb->filt_width =
-        ckd_calloc(mel_fb->num_filters, sizeof(*mel_fb->filt_width));
+        ckd_calloc(mel_fb->num_filters + 1, sizeof(*mel_fb->filt_start));
 
     /* First calculate the widths of each filter. */
     /* Minimum and maximum frequencies in mel scale. */
@@ -607,23 +605,24 @@ fe_build_melfilters(melfb_t * mel_fb)
 
         /* spec_start is the start of this filter in the power spectrum. */
         mel_fb->spec_start[i] = -1;
+        /* filt_start is the start of this filter in the filt_coeffs
+         * array, the next one gives its end. */
+        mel_fb->filt_start[i] = n_coeffs;
         /* There must be a better way... */
         for (j = 0; j < mel_fb->fft_size / 2 + 1; ++j) {
             float32 hz = j * fftfreq;
             if (hz < freqs[0])
                 continue;
             else if (hz > freqs[2] || j == mel_fb->fft_size / 2) {
-                /* filt_width is the width in DFT points of this filter. */
-                mel_fb->filt_width[i] = j - mel_fb->spec_start[i];
-                /* filt_start is the start of this filter in the filt_coeffs array. */
-                mel_fb->filt_start[i] = n_coeffs;
-                n_coeffs += mel_fb->filt_width[i];
+                /* Add the width in DFT points of this filter. */
+                n_coeffs += j - mel_fb->spec_start[i];
                 break;
             }
             if (mel_fb->spec_start[i] == -1)
                 mel_fb->spec_start[i] = j;
         }
     }
+    mel_fb->filt_start[mel_fb->num_filters] = n_coeffs;
 
     /* Now go back and allocate the coefficient array. */
     mel_fb->filt_coeffs =
@@ -645,7 +644,8 @@ fe_build_melfilters(melfb_t * mel_fb)
                 freqs[j] = ((int) (freqs[j] / fftfreq + 0.5)) * fftfreq;
         }
 
-        for (j = 0; j < mel_fb->filt_width[i]; ++j) {
+        for (j = 0; j < mel_fb->filt_start[i + 1] - mel_fb->filt_start[i];
+             ++j) {
             float32 hz, loslope, hislope;
 
             hz = (mel_fb->spec_start[i] + j) * fftfreq;
@@ -818,6 +818,19 @@ fe_spch_to_frame(fe_t * fe, int len)
     return len;
 }
 
+void
+fe_dither(fe_t * fe, int16 *buffer, int32 nsamps)
+{
+    uint32 const *rnd = fe->dither_buf;
+    int32 i;
+
+    /* Add one to a quarter of the samples (as chosen by bits 1 and 2
+     * of the random numbers, for compatibility). */
+    genrand_fill_r(fe->rng, fe->dither_buf, nsamps);
+    for (i = 0; i < nsamps; ++i)
+        buffer[i] += (int16) (((rnd[i] >> 1) & 3) == 0);
+}
+
 int
 fe_read_frame(fe_t * fe, int16 const *in, int32 len)
 {
@@ -833,8 +846,7 @@ fe_read_frame(fe_t * fe, int16 const *in, int32 len)
         for (i = 0; i < len; ++i)
             SWAP_INT16(&fe->spch[i]);
     if (fe->dither)
-        for (i = 0; i < len; ++i)
-            fe->spch[i] += (int16) ((!(s3_rand_int31() % 4)) ? 1 : 0);
+        fe_dither(fe, fe->spch, len);
 
     return fe_spch_to_frame(fe, len);
 }
@@ -857,51 +869,44 @@ fe_shift_frame(fe_t * fe, int16 const *in, int32 len)
         for (i = 0; i < len; ++i)
             SWAP_INT16(&fe->spch[offset + i]);
     if (fe->dither)
-        for (i = 0; i < len; ++i)
-            fe->spch[offset + i]
-                += (int16) ((!(s3_rand_int31() % 4)) ? 1 : 0);
+        fe_dither(fe, fe->spch + offset, len);
 
     return fe_spch_to_frame(fe, offset + len);
 }
 
 /**
- * Create arrays of twiddle factors.
+ * Create arrays of twiddle factors and the bit-reversal permutation.
+ *
+ * Stage k of the FFT (1 <= k < fft_order) uses the twiddle factors
+ * W[j * n / (1<<(k+1))] for 0 <= j < (1<<(k-1)), which we store
+ * contiguously starting at offset (1<<(k-1)) - 1 so that the inner
+ * butterfly loop reads them sequentially.
  */
 void
 fe_create_twiddle(fe_t * fe)
-{
-    int i;
-
-    for (i = 0; i < fe->fft_size / 4; ++i) {
-        float64 a = 2 * M_PI * i / fe->fft_size;
-#if defined(FIXED_POINT)
-        fe->ccc[i] = FLOAT2COS(cos(a));
-        fe->sss[i] = FLOAT2COS(sin(a));
-#else
-        fe->ccc[i] = cos(a);
-        fe->sss[i] = sin(a);
-#endif
-    }
-}
-
-
-static int
-fe_fft_real(fe_t * fe)
 {
     int i, j, k, m, n;
-    frame_t *x, xt;
 
-    x = fe->frame;
     m = fe->fft_order;
     n = fe->fft_size;
+    for (k = 1; k < m; ++k) {
+        int base = (1 << (k - 1)) - 1;
+        for (j = 0; j < (1 << (k - 1)); ++j) {
+            float64 a = 2 * M_PI * (j << (m - k - 1)) / n;
+            fe->ccc[base + j] = FLOAT2COS(cos(a));
+            fe->sss[base + j] = FLOAT2COS(sin(a));
+        }
+    }
 
-    /* Bit-reverse the input. */
+    /* Precompute the swaps needed to bit-reverse the input, there
+     * are fewer than n/2 of them. */
+    fe->n_fft_swaps = 0;
     j = 0;
     for (i = 0; i < n - 1; ++i) {
         if (i < j) {
-            xt = x[j];
-            x[j] = x[i];
-            x[i] = xt;
+            fe->fft_swaps[fe->n_fft_swaps * 2] = i;
+            fe->fft_swaps[fe->n_fft_swaps * 2 + 1] = j;
+            ++fe->n_fft_swaps;
         }
         k = n / 2;
         while (k <= j) {
@@ -910,26 +915,75 @@ fe_fft_real(fe_t * fe)
         }
         j += k;
     }
+}
+
+int
+fe_fft_real(fe_t * fe)
+{
+    int i, j, k, m, n;
+    frame_t *x, xt;
+    int16 const *swap;
+
+    x = fe->frame;
+    m = fe->fft_order;
+    n = fe->fft_size;
+
+    /* Bit-reverse the input. */
+    for (i = 0, swap = fe->fft_swaps; i < fe->n_fft_swaps; ++i, swap += 2) {
+        xt = x[swap[0]];
+        x[swap[0]] = x[swap[1]];
+        x[swap[1]] = xt;
+    }
+
+    if (m < 2) {
+        /* Basic butterflies (2-point FFT, real twiddle factors):
+         * x[i]   = x[i] +  1 * x[i+1]
+         * x[i+1] = x[i] + -1 * x[i+1]
+         */
+        for (i = 0; i < n; i += 2) {
+            xt = x[i];
+            x[i] = (xt + x[i + 1]);
+            x[i + 1] = (xt - x[i + 1]);
+        }
+        return m;
+    }
 
-    /* Basic butterflies (2-point FFT, real twiddle factors):
-     * x[i]   = x[i] +  1 * x[i+1]
-     * x[i+1] = x[i] + -1 * x[i+1]
+    /* The first two stages have only real twiddle factors, so do
+     * them together as a radix-4 pass:
+     * x[i]   = (x[i] + x[i+1]) + (x[i+2] + x[i+3])
+     * x[i+1] =  x[i] - x[i+1]
+     * x[i+2] = (x[i] + x[i+1]) - (x[i+2] + x[i+3])
+     * x[i+3] = -(x[i+2] - x[i+3])
      */
-    for (i = 0; i < n; i += 2) {
-        xt = x[i];
-        x[i] = (xt + x[i + 1]);
-        x[i + 1] = (xt - x[i + 1]);
+    for (i = 0; i < n; i += 4) {
+        frame_t t0, t2;
+
+        t0 = x[i] + x[i + 1];
+        t2 = x[i + 2] + x[i + 3];
+        x[i + 1] = x[i] - x[i + 1];
+        x[i + 3] = -(x[i + 2] - x[i + 3]);
+        x[i] = t0 + t2;
+        x[i + 2] = t0 - t2;
     }
 
-    /* The rest of the butterflies, in stages from 1..m */
-    for (k = 1; k < m; ++k) {
+    /* The rest of the butterflies, in stages from 2..m */
+    for (k = 2; k < m; ++k) {
+        frame_t const *ccc, *sss;
         int n1, n2, n4;
 
         n4 = k - 1;
         n2 = k;
         n1 = k + 1;
+        /* Twiddle factors for this stage:
+         * ccc[j] = real(W[j * n / (1<<(k+1))])
+         * sss[j] = imag(W[j * n / (1<<(k+1))])
+         */
+        ccc = fe->ccc + (1 << n4) - 1;
+        sss = fe->sss + (1 << n4) - 1;
         /* Stride over each (1 << (k+1)) points */
         for (i = 0; i < n; i += (1 << n1)) {
+            frame_t *x1, *x2, *x4;
+
             /* Basic butterfly with real twiddle factors:
              * x[i]          = x[i] +  1 * x[i + (1<<k)]
              * x[i + (1<<k)] = x[i] + -1 * x[i + (1<<k)]
@@ -945,36 +999,32 @@ fe_fft_real(fe_t * fe)
              *   = 1 * x[i + (1<<k-1)] +  0 * x[i + (1<<k) + (1<<k-1)]
              */
             x[i + (1 << n2) + (1 << n4)] = -x[i + (1 << n2) + (1 << n4)];
-            x[i + (1 << n4)] = x[i + (1 << n4)];
 
             /* Butterflies with complex twiddle factors.
-             * There are (1<<k-1) of them.
+             * There are (1<<k-1) of them, operating on:
+             * i1 = i + j             = x1[j]
+             * i2 = i + (1<<k) - j    = x2[-j]
+             * i3 = i + (1<<k) + j    = x2[j]
+             * i4 = i + (1<<k+1) - j  = x4[-j]
              */
+            x1 = x + i;
+            x2 = x + i + (1 << n2);
+            x4 = x + i + (1 << n1);
             for (j = 1; j < (1 << n4); ++j) {
                 frame_t cc, ss, t1, t2;
-                int i1, i2, i3, i4;
-
-                i1 = i + j;
-                i2 = i + (1 << n2) - j;
-                i3 = i + (1 << n2) + j;
-                i4 = i + (1 << n2) + (1 << n2) - j;
 
-                /*
-                 * cc = real(W[j * n / (1<<(k+1))])
-                 * ss = imag(W[j * n / (1<<(k+1))])
-                 */
-                cc = fe->ccc[j << (m - n1)];
-                ss = fe->sss[j << (m - n1)];
+                cc = ccc[j];
+                ss = sss[j];
 
                 /* There are some symmetry properties which allow us
                  * to get away with only four multiplications here. */
-                t1 = COSMUL(x[i3], cc) + COSMUL(x[i4], ss);
-                t2 = COSMUL(x[i3], ss) - COSMUL(x[i4], cc);
+                t1 = COSMUL(x2[j], cc) + COSMUL(x4[-j], ss);
+                t2 = COSMUL(x2[j], ss) - COSMUL(x4[-j], cc);
 
-                x[i4] = (x[i2] - t2);
-                x[i3] = (-x[i2] - t2);
-                x[i2] = (x[i1] - t1);
-                x[i1] = (x[i1] + t1);
+                x4[-j] = (x2[-j] - t2);
+                x2[j] = (-x2[-j] - t2);
+                x2[-j] = (x1[j] - t1);
+                x1[j] = (x1[j] + t1);
             }
         }
     }
@@ -983,11 +1033,16 @@ fe_fft_real(fe_t * fe)
     return m;
 }
 
+/**
+ * Compute the power spectrum of the current frame.
+ *
+ * Spectral bins are written ld elements apart, so that a block of
+ * frames can be stored with frames varying fastest.
+ */
 static void
-fe_spec_magnitude(fe_t * fe)
+fe_spec_magnitude(fe_t * fe, powspec_t * spec, int32 ld)
 {
     frame_t *fft;
-    powspec_t *spec;
     int32 j, scale, fftsize;
 
     /* Do FFT and get the scaling factor back (only actually used in
@@ -996,7 +1051,6 @@ fe_spec_magnitude(fe_t * fe)
 
     /* Convenience pointers to make things less awkward below. */
     fft = fe->frame;
-    spec = fe->spec;
     fftsize = fe->fft_size;
 
     /* We need to scale things up the rest of the way to N. */
@@ -1015,86 +1069,111 @@ fe_spec_magnitude(fe_t * fe)
 #if defined(FIXED_POINT)
         int32 rr = FIXLN(abs(fft[j]) << scale) * 2;
         int32 ii = FIXLN(abs(fft[fftsize - j]) << scale) * 2;
-        spec[j] = fe_log_add(rr, ii);
+        spec[j * ld] = fe_log_add(rr, ii);
 #else
-        spec[j] = fft[j] * fft[j] + fft[fftsize - j] * fft[fftsize - j];
+        spec[j * ld] = fft[j] * fft[j] + fft[fftsize - j] * fft[fftsize - j];
 #endif
     }
 }
 
+/**
+ * Apply the mel filterbank to a block of nfr power spectra.
+ *
+ * Input and output are stored bin-major with leading dimension ld,
+ * i.e. bin j of frame t is at spec[j * ld + t], and filter output i
+ * of frame t is at mfspec[i * ld + t].  The innermost loop then runs
+ * over frames with unit stride, which the compiler can vectorize
+ * without changing the order of summation for any frame.
+ */
 static void
-fe_mel_spec(fe_t * fe)
+fe_mel_spec_block(fe_t * fe, const powspec_t * spec, powspec_t * mfspec,
+                  int32 nfr, int32 ld)
 {
-    int whichfilt;
-    powspec_t *spec, *mfspec;
+    melfb_t *mel_fb = fe->mel_fb;
+    int32 whichfilt;
 
-    /* Convenience poitners. */
-    spec = fe->spec;
-    mfspec = fe->mfspec;
-    for (whichfilt = 0; whichfilt < fe->mel_fb->num_filters; whichfilt++) {
-        int spec_start, filt_start, i;
+    for (whichfilt = 0; whichfilt < mel_fb->num_filters; whichfilt++) {
+        mfcc_t const *coeffs;
+        powspec_t const *s;
+        powspec_t *m;
+        int32 filt_width, i, t;
 
-        spec_start = fe->mel_fb->spec_start[whichfilt];
-        filt_start = fe->mel_fb->filt_start[whichfilt];
+        coeffs = mel_fb->filt_coeffs + mel_fb->filt_start[whichfilt];
+        filt_width = mel_fb->filt_start[whichfilt + 1]
+            - mel_fb->filt_start[whichfilt];
+        s = spec + mel_fb->spec_start[whichfilt] * ld;
+        m = mfspec + whichfilt * ld;
 
 #ifdef FIXED_POINT
-        mfspec[whichfilt] =
-            spec[spec_start] + fe->mel_fb->filt_coeffs[filt_start];
-        for (i = 1; i < fe->mel_fb->filt_width[whichfilt]; i++) {
-            mfspec[whichfilt] = fe_log_add(mfspec[whichfilt],
-                                           spec[spec_start + i] +
-                                           fe->mel_fb->
-                                           filt_coeffs[filt_start + i]);
+        for (t = 0; t < nfr; ++t)
+            m[t] = s[t] + coeffs[0];
+        for (i = 1; i < filt_width; i++) {
+            s += ld;
+            for (t = 0; t < nfr; ++t)
+                m[t] = fe_log_add(m[t], s[t] + coeffs[i]);
         }
 #else                           /* !FIXED_POINT */
-        mfspec[whichfilt] = 0;
-        for (i = 0; i < fe->mel_fb->filt_width[whichfilt]; i++)
-            mfspec[whichfilt] +=
-                spec[spec_start + i] * fe->mel_fb->filt_coeffs[filt_start +
-                                                               i];
+        for (t = 0; t < nfr; ++t)
+            m[t] = 0;
+        for (i = 0; i < filt_width; i++, s += ld) {
+            mfcc_t c = coeffs[i];
+            for (t = 0; t < nfr; ++t)
+                m[t] += s[t] * c;
+        }
 #endif                          /* !FIXED_POINT */
     }
-
 }
 
 #define LOG_FLOOR 1e-4
 
+/**
+ * Compute cepstra (or log spectra) for a block of nfr mel spectra.
+ *
+ * The input is stored bin-major with leading dimension ld (see
+ * fe_mel_spec_block()) and is modified in place (it is converted to
+ * the log domain).  Output frames are contiguous rows of
+ * feature_dimension elements.
+ */
 static void
-fe_mel_cep(fe_t * fe, mfcc_t * mfcep)
+fe_mel_cep_block(fe_t * fe, powspec_t * mfspec, mfcc_t * mfcep,
+                 int32 nfr, int32 ld)
 {
-    int32 i;
-    powspec_t *mfspec;
+    int32 i, t, nfilt, ndim;
 
-    /* Convenience pointer. */
-    mfspec = fe->mfspec;
+    nfilt = fe->mel_fb->num_filters;
+    ndim = fe->feature_dimension;
 
-    for (i = 0; i < fe->mel_fb->num_filters; ++i) {
 #ifndef FIXED_POINT             /* It's already in log domain for fixed point */
-        mfspec[i] = log(mfspec[i] + LOG_FLOOR);
+    for (i = 0; i < nfilt; ++i)
+        for (t = 0; t < nfr; ++t)
+            mfspec[i * ld + t] = log(mfspec[i * ld + t] + LOG_FLOOR);
 #endif                          /* !FIXED_POINT */
-    }
 
     /* If we are doing LOG_SPEC, then do nothing. */
     if (fe->log_spec == RAW_LOG_SPEC) {
-        for (i = 0; i < fe->feature_dimension; i++) {
-            mfcep[i] = (mfcc_t) mfspec[i];
-        }
+        for (t = 0; t < nfr; ++t)
+            for (i = 0; i < ndim; i++)
+                mfcep[t * ndim + i] = (mfcc_t) mfspec[i * ld + t];
     }
     /* For smoothed spectrum, do DCT-II followed by (its inverse) DCT-III */
     else if (fe->log_spec == SMOOTH_LOG_SPEC) {
+        powspec_t *row = fe->mfspec;
         /* FIXME: This is probably broken for fixed-point. */
-        fe_dct2(fe, mfspec, mfcep, 0);
-        fe_dct3(fe, mfcep, mfspec);
-        for (i = 0; i < fe->feature_dimension; i++) {
-            mfcep[i] = (mfcc_t) mfspec[i];
+        for (t = 0; t < nfr; ++t) {
+            for (i = 0; i < nfilt; ++i)
+                row[i] = mfspec[i * ld + t];
+            fe_dct2(fe, row, mfcep + t * ndim, 0);
+            fe_dct3(fe, mfcep + t * ndim, row);
+            for (i = 0; i < ndim; i++)
+                mfcep[t * ndim + i] = (mfcc_t) row[i];
         }
     }
     else if (fe->transform == DCT_II)
-        fe_dct2(fe, mfspec, mfcep, FALSE);
+        fe_dct2_block(fe, mfspec, mfcep, nfr, ld, FALSE);
     else if (fe->transform == DCT_HTK)
-        fe_dct2(fe, mfspec, mfcep, TRUE);
+        fe_dct2_block(fe, mfspec, mfcep, nfr, ld, TRUE);
     else
-        fe_spec2cep(fe, mfspec, mfcep);
+        fe_spec2cep_block(fe, mfspec, mfcep, nfr, ld);
 
     return;
 }
@@ -1102,53 +1181,89 @@ fe_mel_cep(fe_t * fe, mfcc_t * mfcep)
 void
 fe_spec2cep(fe_t * fe, const powspec_t * mflogspec, mfcc_t * mfcep)
 {
-    int32 i, j, beta;
+    fe_spec2cep_block(fe, mflogspec, mfcep, 1, 1);
+}
+
+void
+fe_spec2cep_block(fe_t * fe, const powspec_t * mflogspec, mfcc_t * mfcep,
+                  int32 nfr, int32 ld)
+{
+    mfcc_t acc[FE_BLOCK_SIZE];
+    int32 i, j, t, nfilt, ncep;
+
+    assert(nfr <= FE_BLOCK_SIZE);
+    nfilt = fe->mel_fb->num_filters;
+    ncep = fe->num_cepstra;
 
     /* Compute C0 separately (its basis vector is 1) to avoid
      * costly multiplications. */
-    mfcep[0] = mflogspec[0] / 2;        /* beta = 0.5 */
-    for (j = 1; j < fe->mel_fb->num_filters; j++)
-        mfcep[0] += mflogspec[j];       /* beta = 1.0 */
-    mfcep[0] /= (frame_t) fe->mel_fb->num_filters;
-
-    for (i = 1; i < fe->num_cepstra; ++i) {
-        mfcep[i] = 0;
-        for (j = 0; j < fe->mel_fb->num_filters; j++) {
-            if (j == 0)
-                beta = 1;       /* 0.5 */
-            else
-                beta = 2;       /* 1.0 */
-            mfcep[i] += COSMUL(mflogspec[j],
-                               fe->mel_fb->mel_cosine[i][j]) * beta;
-        }
+    for (t = 0; t < nfr; ++t)
+        acc[t] = mflogspec[t] / 2;      /* beta = 0.5 */
+    for (j = 1; j < nfilt; j++)
+        for (t = 0; t < nfr; ++t)
+            acc[t] += mflogspec[j * ld + t];    /* beta = 1.0 */
+    for (t = 0; t < nfr; ++t)
+        mfcep[t * ncep] = acc[t] / (frame_t) nfilt;
+
+    for (i = 1; i < ncep; ++i) {
+        mfcc_t const *cosine = fe->mel_fb->mel_cosine[i];
+
+        /* beta = 0.5 for the first filter, 1.0 for the others, but
+         * doubled here to avoid a division. */
+        for (t = 0; t < nfr; ++t)
+            acc[t] = COSMUL(mflogspec[t], cosine[0]);
+        for (j = 1; j < nfilt; j++)
+            for (t = 0; t < nfr; ++t)
+                acc[t] += COSMUL(mflogspec[j * ld + t], cosine[j]) * 2;
         /* Note that this actually normalizes by num_filters, like the
          * original Sphinx front-end, due to the doubled 'beta' factor
          * above.  */
-        mfcep[i] /= (frame_t) fe->mel_fb->num_filters * 2;
+        for (t = 0; t < nfr; ++t)
+            mfcep[t * ncep + i] = acc[t] / ((frame_t) nfilt * 2);
     }
 }
 
 void
 fe_dct2(fe_t * fe, const powspec_t * mflogspec, mfcc_t * mfcep, int htk)
 {
-    int32 i, j;
+    fe_dct2_block(fe, mflogspec, mfcep, 1, 1, htk);
+}
+
+void
+fe_dct2_block(fe_t * fe, const powspec_t * mflogspec, mfcc_t * mfcep,
+              int32 nfr, int32 ld, int htk)
+{
+    mfcc_t acc[FE_BLOCK_SIZE];
+    int32 i, j, t, nfilt, ncep;
+
+    assert(nfr <= FE_BLOCK_SIZE);
+    nfilt = fe->mel_fb->num_filters;
+    ncep = fe->num_cepstra;
 
     /* Compute C0 separately (its basis vector is 1) to avoid
      * costly multiplications. */
-    mfcep[0] = mflogspec[0];
-    for (j = 1; j < fe->mel_fb->num_filters; j++)
-        mfcep[0] += mflogspec[j];
-    if (htk)
-        mfcep[0] = COSMUL(mfcep[0], fe->mel_fb->sqrt_inv_2n);
-    else                        /* sqrt(1/N) = sqrt(2/N) * 1/sqrt(2) */
-        mfcep[0] = COSMUL(mfcep[0], fe->mel_fb->sqrt_inv_n);
-
-    for (i = 1; i < fe->num_cepstra; ++i) {
-        mfcep[i] = 0;
-        for (j = 0; j < fe->mel_fb->num_filters; j++) {
-            mfcep[i] += COSMUL(mflogspec[j], fe->mel_fb->mel_cosine[i][j]);
-        }
-        mfcep[i] = COSMUL(mfcep[i], fe->mel_fb->sqrt_inv_2n);
+    for (t = 0; t < nfr; ++t)
+        acc[t] = mflogspec[t];
+    for (j = 1; j < nfilt; j++)
+        for (t = 0; t < nfr; ++t)
+            acc[t] += mflogspec[j * ld + t];
+    for (t = 0; t < nfr; ++t) {
+        if (htk)
+            mfcep[t * ncep] = COSMUL(acc[t], fe->mel_fb->sqrt_inv_2n);
+        else                    /* sqrt(1/N) = sqrt(2/N) * 1/sqrt(2) */
+            mfcep[t * ncep] = COSMUL(acc[t], fe->mel_fb->sqrt_inv_n);
+    }
+
+    for (i = 1; i < ncep; ++i) {
+        mfcc_t const *cosine = fe->mel_fb->mel_cosine[i];
+
+        for (t = 0; t < nfr; ++t)
+            acc[t] = 0;
+        for (j = 0; j < nfilt; j++)
+            for (t = 0; t < nfr; ++t)
+                acc[t] += COSMUL(mflogspec[j * ld + t], cosine[j]);
+        for (t = 0; t < nfr; ++t)
+            mfcep[t * ncep + i] = COSMUL(acc[t], fe->mel_fb->sqrt_inv_2n);
     }
 }
 
@@ -1184,14 +1299,44 @@ fe_write_frame(fe_t * fe, mfcc_t * feat, int32 store_pcm)
 {
     int32 is_speech;
 
-    fe_spec_magnitude(fe);
-    fe_mel_spec(fe);
-    fe_track_snr(fe, &is_speech);
-    fe_mel_cep(fe, feat);
+    fe_spec_magnitude(fe, fe->spec, 1);
+    fe_mel_spec_block(fe, fe->spec, fe->mfspec, 1, 1);
+    fe_track_snr(fe, fe->mfspec, &is_speech);
+    fe_mel_cep_block(fe, fe->mfspec, feat, 1, 1);
     fe_lifter(fe, feat);
     fe_vad_hangover(fe, feat, is_speech, store_pcm);
 }
 
+void
+fe_write_frames_block(fe_t * fe, int16 const *in, int32 nfr)
+{
+    int32 t, i, nfilt;
+    powspec_t *mfspec;
+
+    assert(nfr <= FE_BLOCK_SIZE);
+    nfilt = fe->mel_fb->num_filters;
+    mfspec = fe->mfspec_block;
+
+    /* Windowing and the FFT depend on the previous frame, so do
+     * them one frame at a time. */
+    for (t = 0; t < nfr; ++t) {
+        fe_shift_frame(fe, in + t * fe->frame_shift, fe->frame_shift);
+        fe_spec_magnitude(fe, fe->spec_block + t, FE_BLOCK_SIZE);
+    }
+    fe_mel_spec_block(fe, fe->spec_block, mfspec, nfr, FE_BLOCK_SIZE);
+    /* Noise tracking is also sequential, and works on one frame. */
+    for (t = 0; t < nfr; ++t) {
+        for (i = 0; i < nfilt; ++i)
+            fe->mfspec[i] = mfspec[i * FE_BLOCK_SIZE + t];
+        fe_track_snr(fe, fe->mfspec, &fe->is_speech_block[t]);
+        for (i = 0; i < nfilt; ++i)
+            mfspec[i * FE_BLOCK_SIZE + t] = fe->mfspec[i];
+    }
+    fe_mel_cep_block(fe, mfspec, fe->cep_block[0], nfr, FE_BLOCK_SIZE);
+    for (t = 0; t < nfr; ++t)
+        fe_lifter(fe, fe->cep_block[t]);
+}
+
 
 void *
 fe_create_2d(int32 d1, int32 d2, int32 elem_size)
@@ -102,6 +102,9 @@ fe_warp_set(melfb_t *mel, const char *id_name)
 {
     uint32 i;
 
+    memset(&mel->warp, 0, sizeof(mel->warp));
+    mel->warp.is_neutral = TRUE;
+
     for (i = 0; name2id[i]; i++) {
         if (strcmp(id_name, name2id[i]) == 0) {
             mel->warp_id = i;
@@ -135,7 +138,8 @@ void
 fe_warp_set_parameters(melfb_t *mel, char const *param_str, float sampling_rate)
 {
     if (mel->warp_id <= FE_WARP_ID_MAX) {
-        fe_warp_conf[mel->warp_id].set_parameters(param_str, sampling_rate);
+        fe_warp_conf[mel->warp_id].set_parameters(&mel->warp, param_str,
+                                                  sampling_rate);
     }
     else if (mel->warp_id == FE_WARP_ID_NONE) {
         E_FATAL("feat module must be configured w/ a valid ID\n");
@@ -203,7 +207,8 @@ float
 fe_warp_warped_to_unwarped(melfb_t *mel, float nonlinear)
 {
     if (mel->warp_id <= FE_WARP_ID_MAX) {
-        return fe_warp_conf[mel->warp_id].warped_to_unwarped(nonlinear);
+        return fe_warp_conf[mel->warp_id].warped_to_unwarped(&mel->warp,
+                                                             nonlinear);
     }
     else if (mel->warp_id == FE_WARP_ID_NONE) {
         E_FATAL("fe_warp module must be configured w/ a valid ID\n");
@@ -221,7 +226,8 @@ float
 fe_warp_unwarped_to_warped(melfb_t *mel,float linear)
 {
     if (mel->warp_id <= FE_WARP_ID_MAX) {
-        return fe_warp_conf[mel->warp_id].unwarped_to_warped(linear);
+        return fe_warp_conf[mel->warp_id].unwarped_to_warped(&mel->warp,
+                                                             linear);
     }
     else if (mel->warp_id == FE_WARP_ID_NONE) {
         E_FATAL("fe_warp module must be configured w/ a valid ID\n");
@@ -239,7 +245,7 @@ void
 fe_warp_print(melfb_t *mel, const char *label)
 {
     if (mel->warp_id <= FE_WARP_ID_MAX) {
-        fe_warp_conf[mel->warp_id].print(label);
+        fe_warp_conf[mel->warp_id].print(&mel->warp, label);
     }
     else if (mel->warp_id == FE_WARP_ID_NONE) {
         E_FATAL("fe_warp module must be configured w/ a valid ID\n");
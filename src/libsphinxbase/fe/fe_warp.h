@@ -55,13 +55,14 @@ extern "C" {
 #define FE_WARP_ID_NONE	       0xffffffff
 
 typedef struct {
-    void (*set_parameters)(char const *param_str, float sampling_rate);
+    void (*set_parameters)(fe_warp_state_t *warp, char const *param_str,
+                           float sampling_rate);
     const char * (*doc)(void);
     uint32 (*id)(void);
     uint32 (*n_param)(void);
-    float (*warped_to_unwarped)(float nonlinear);
-    float (*unwarped_to_warped)(float linear);
-    void (*print)(const char *label);
+    float (*warped_to_unwarped)(fe_warp_state_t *warp, float nonlinear);
+    float (*unwarped_to_warped)(fe_warp_state_t *warp, float linear);
+    void (*print)(fe_warp_state_t *warp, const char *label);
 } fe_warp_conf_t;
 
 int fe_warp_set(melfb_t *mel, const char *id_name);
@@ -70,10 +70,6 @@
  * params[0] : a
  * params[1] : b
  */
-static float params[N_PARAM] = { 1.0f, 0.0f };
-static int32 is_neutral = YES;
-static char p_str[256] = "";
-static float nyquist_frequency = 0.0f;
 
 
 const char *
@@ -95,87 +91,90 @@ fe_warp_affine_n_param()
 }
 
 void
-fe_warp_affine_set_parameters(char const *param_str, float sampling_rate)
+fe_warp_affine_set_parameters(fe_warp_state_t *warp,
+                              char const *param_str,
+                              float sampling_rate)
 {
-    char *tok;
+    char *line, *tok;
     char *seps = " \t";
     char temp_param_str[256];
+    char delimfound;
     int param_index = 0;
+    int32 len;
 
-    nyquist_frequency = sampling_rate / 2;
+    warp->nyquist_frequency = sampling_rate / 2;
     if (param_str == NULL) {
-        is_neutral = YES;
+        warp->is_neutral = YES;
         return;
     }
     /* The new parameters are the same as the current ones, so do nothing. */
-    if (strcmp(param_str, p_str) == 0) {
+    if (strcmp(param_str, warp->p_str) == 0) {
         return;
     }
-    is_neutral = NO;
+    warp->is_neutral = NO;
     strcpy(temp_param_str, param_str);
-    memset(params, 0, N_PARAM * sizeof(float));
-    strcpy(p_str, param_str);
-    /* FIXME: strtok() is not re-entrant... */
-    tok = strtok(temp_param_str, seps);
-    while (tok != NULL) {
-        params[param_index++] = (float) atof_c(tok);
-        tok = strtok(NULL, seps);
-        if (param_index >= N_PARAM) {
+    memset(warp->params, 0, N_PARAM * sizeof(float));
+    strcpy(warp->p_str, param_str);
+    line = temp_param_str;
+    while ((len = nextword(line, seps, &tok, &delimfound)) >= 0) {
+        if (param_index >= N_PARAM)
             break;
-        }
+        warp->params[param_index++] = (float) atof_c(tok);
+        tok[len] = delimfound;
+        line = tok + len;
     }
-    if (tok != NULL) {
+    if (len >= 0) {
         E_INFO
             ("Affine warping takes up to two arguments, %s ignored.\n",
              tok);
     }
-    if (params[0] == 0) {
-        is_neutral = YES;
+    if (warp->params[0] == 0) {
+        warp->is_neutral = YES;
         E_INFO
             ("Affine warping cannot have slope zero, warping not applied.\n");
     }
 }
 
 float
-fe_warp_affine_warped_to_unwarped(float nonlinear)
+fe_warp_affine_warped_to_unwarped(fe_warp_state_t *warp, float nonlinear)
 {
-    if (is_neutral) {
+    if (warp->is_neutral) {
         return nonlinear;
     }
     else {
         /* linear = (nonlinear - b) / a */
-        float temp = nonlinear - params[1];
-        temp /= params[0];
-        if (temp > nyquist_frequency) {
+        float temp = nonlinear - warp->params[1];
+        temp /= warp->params[0];
+        if (temp > warp->nyquist_frequency) {
             E_WARN
                 ("Warp factor %g results in frequency (%.1f) higher than Nyquist (%.1f)\n",
-                 params[0], temp, nyquist_frequency);
+                 warp->params[0], temp, warp->nyquist_frequency);
         }
         return temp;
     }
 }
 
 float
-fe_warp_affine_unwarped_to_warped(float linear)
+fe_warp_affine_unwarped_to_warped(fe_warp_state_t *warp, float linear)
 {
-    if (is_neutral) {
+    if (warp->is_neutral) {
         return linear;
     }
     else {
         /* nonlinear = a * linear - b */
-        float temp = linear * params[0];
-        temp += params[1];
+        float temp = linear * warp->params[0];
+        temp += warp->params[1];
         return temp;
     }
 }
 
 void
-fe_warp_affine_print(const char *label)
+fe_warp_affine_print(fe_warp_state_t *warp, const char *label)
 {
     uint32 i;
 
     for (i = 0; i < N_PARAM; i++) {
-        printf("%s[%04u]: %6.3f ", label, i, params[i]);
+        printf("%s[%04u]: %6.3f ", label, i, warp->params[i]);
     }
     printf("\n");
 }
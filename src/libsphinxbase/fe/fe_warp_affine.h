@@ -38,6 +38,7 @@
 #define FE_WARP_AFFINE_H
 
 #include "sphinxbase/fe.h"
+#include "fe_internal.h"
 
 
 #ifdef __cplusplus
@@ -58,16 +59,17 @@ uint32
 fe_warp_affine_n_param(void);
 
 void
-fe_warp_affine_set_parameters(char const *param_str, float sampling_rate);
+fe_warp_affine_set_parameters(fe_warp_state_t *warp,
+                              char const *param_str, float sampling_rate);
 
 float
-fe_warp_affine_warped_to_unwarped(float nonlinear);
+fe_warp_affine_warped_to_unwarped(fe_warp_state_t *warp, float nonlinear);
 
 float
-fe_warp_affine_unwarped_to_warped(float linear);
+fe_warp_affine_unwarped_to_warped(fe_warp_state_t *warp, float linear);
 
 void
-fe_warp_affine_print(const char *label);
+fe_warp_affine_print(fe_warp_state_t *warp, const char *label);
 
 #ifdef __cplusplus
 }
@@ -47,6 +47,11 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
 
 struct yin_s {
     uint16 frame_size;       /** Size of analysis frame. */
@@ -61,8 +66,65 @@ struct yin_s {
 
     fixed32 **diff_window;  /**< Window of difference function outputs. */
     uint16 *period_window;  /**< Window of best period estimates. */
+
+    /* Only used by YIN_DIFF_FFT. */
+    int32 fft_size;         /**< Size of FFT used for autocorrelation. */
+    int32 *fft_bitrev;      /**< Bit-reversal permutation. */
+    float64 *fft_cos;       /**< Twiddle factors (fft_size/2). */
+    float64 *fft_sin;       /**< Twiddle factors (fft_size/2). */
+    float64 *fft_re;        /**< Real part of FFT work buffer. */
+    float64 *fft_im;        /**< Imaginary part of FFT work buffer. */
 };
 
+/**
+ * Determine how many bits we can scale t up by in cmn_norm().
+ */
+static int32
+cmn_tscale(int ndiff)
+{
+    int32 tscale;
+
+    for (tscale = 0; tscale < 32; ++tscale)
+        if (ndiff & (1<<(31-tscale)))
+            break;
+    return tscale - 1; /* Avoid teh overflowz. */
+}
+
+/**
+ * Accumulate the difference dd (scaled down by dshift bits) at lag t
+ * and return its cumulative mean normalized value in Q15.
+ */
+static int32
+cmn_norm(uint32 dd, uint32 dshift, int32 t, int32 tscale,
+         uint32 *inout_cum, uint32 *inout_cshift)
+{
+    uint32 cum = *inout_cum, cshift = *inout_cshift, norm;
+
+    /* Make sure the diffs and cum are shifted to the same
+     * scaling factor (usually dshift will be zero) */
+    if (dshift > cshift) {
+        cum += dd << (dshift-cshift);
+    }
+    else {
+        cum += dd >> (cshift-dshift);
+    }
+
+    /* Guard against overflows and also ensure that (t<<tscale) > cum. */
+    while (cum > (1UL<<tscale)) {
+        cum >>= 1;
+        ++cshift;
+    }
+    /* Avoid divide-by-zero! */
+    if (cum == 0) cum = 1;
+    *inout_cum = cum;
+    *inout_cshift = cshift;
+    /* Calculate the normalizer in high precision. */
+    norm = (t << tscale) / cum;
+    /* Do a long multiply and shift down to Q15. */
+    return (int32)(((long long)dd * norm)
+                   >> (tscale - 15 + cshift - dshift));
+}
+
 /**
  * The core of YIN: cumulative mean normalized difference function.
  */
@@ -75,19 +137,12 @@ cmn_diff(int16 const *signal, int32 *out_diff, int ndiff)
     out_diff[0] = 32768;
     cum = 0;
     cshift = 0;
-
-    /* Determine how many bits we can scale t up by below. */
-    for (tscale = 0; tscale < 32; ++tscale)
-        if (ndiff & (1<<(31-tscale)))
-            break;
-    --tscale; /* Avoid teh overflowz. */
-    /* printf("tscale is %d (ndiff - 1) << tscale is %d\n",
-       tscale, (ndiff-1) << tscale); */
+    tscale = cmn_tscale(ndiff);
 
     /* Somewhat elaborate block floating point implementation.
      * The fp implementation of this is really a lot simpler. */
     for (t = 1; t < ndiff; ++t) {
-        uint32 dd, dshift, norm;
+        uint32 dd, dshift;
         int j;
 
         dd = 0;
@@ -101,35 +156,126 @@ cmn_diff(int16 const *signal, int32 *out_diff, int ndiff)
             }
             dd += (diff * diff) >> dshift;
         }
-        /* Make sure the diffs and cum are shifted to the same
-         * scaling factor (usually dshift will be zero) */
-        if (dshift > cshift) {
-            cum += dd << (dshift-cshift);
+        out_diff[t] = cmn_norm(dd, dshift, t, tscale, &cum, &cshift);
+    }
+}
+
+/**
+ * In-place radix-2 complex FFT of size pe->fft_size.  If inverse is
+ * non-zero, the (unnormalized) inverse transform is computed.
+ */
+static void
+yin_fft(yin_t *pe, float64 *re, float64 *im, int inverse)
+{
+    int32 n, i, j, k, len, half, step;
+
+    n = pe->fft_size;
+    for (i = 0; i < n; ++i) {
+        j = pe->fft_bitrev[i];
+        if (i < j) {
+            float64 tmp;
+            tmp = re[i]; re[i] = re[j]; re[j] = tmp;
+            tmp = im[i]; im[i] = im[j]; im[j] = tmp;
         }
-        else {
-            cum += dd >> (cshift-dshift);
+    }
+    for (len = 2; len <= n; len <<= 1) {
+        half = len >> 1;
+        step = n / len;
+        for (i = 0; i < n; i += len) {
+            for (j = i, k = 0; j < i + half; ++j, k += step) {
+                float64 wr = pe->fft_cos[k];
+                float64 wi = inverse ? pe->fft_sin[k] : -pe->fft_sin[k];
+                float64 xr = re[j + half] * wr - im[j + half] * wi;
+                float64 xi = re[j + half] * wi + im[j + half] * wr;
+                re[j + half] = re[j] - xr;
+                im[j + half] = im[j] - xi;
+                re[j] += xr;
+                im[j] += xi;
+            }
         }
+    }
+}
 
-        /* Guard against overflows and also ensure that (t<<tscale) > cum. */
-        while (cum > (1UL<<tscale)) {
-            cum >>= 1;
-            ++cshift;
-        }
-        /* Avoid divide-by-zero! */
-        if (cum == 0) cum = 1;
-        /* Calculate the normalizer in high precision. */
-        norm = (t << tscale) / cum;
-        /* Do a long multiply and shift down to Q15. */
-        out_diff[t] = (int32)(((long long)dd * norm)
-                              >> (tscale - 15 + cshift - dshift));
-        /* printf("dd %d cshift %d dshift %d scaledt %d cum %d norm %d cmn %d\n",
-           dd, cshift, dshift, (t<<tscale), cum, norm, out_diff[t]); */
+/**
+ * Cumulative mean normalized difference function computed from the
+ * autocorrelation in O(N log N) time.
+ *
+ * Since d(t) = r_t(0) + r_{t+N}(0) - 2 r(t), only the cross-correlation
+ * of the first ndiff samples against the first 2*ndiff samples needs
+ * the FFT, the energy terms are running sums.  Both real sequences are
+ * packed into a single complex transform.  The input is integer, so
+ * d(t) is an integer as well and can be rounded back to its exact
+ * value before being normalized exactly as in cmn_diff().
+ */
+static void
+cmn_diff_fft(yin_t *pe, int16 const *signal, int32 *out_diff, int ndiff)
+{
+    float64 *re = pe->fft_re, *im = pe->fft_im;
+    float64 e0, et, scale;
+    uint32 cum, cshift;
+    int32 n, j, t, tscale;
+
+    n = pe->fft_size;
+    for (j = 0; j < n; ++j) {
+        re[j] = (j < ndiff) ? signal[j] : 0.0;
+        im[j] = (j < 2 * ndiff - 1) ? signal[j] : 0.0;
+    }
+    yin_fft(pe, re, im, FALSE);
+
+    /* Unpack A = FFT(a), B = FFT(b) and form conj(A) * B. */
+    for (j = 0; j <= n / 2; ++j) {
+        int32 k = (n - j) & (n - 1);
+        float64 ar = 0.5 * (re[j] + re[k]);
+        float64 ai = 0.5 * (im[j] - im[k]);
+        float64 br = 0.5 * (im[j] + im[k]);
+        float64 bi = -0.5 * (re[j] - re[k]);
+        float64 pr = ar * br + ai * bi;
+        float64 pi = ar * bi - ai * br;
+        re[j] = pr;
+        im[j] = pi;
+        re[k] = pr;
+        im[k] = -pi;
+    }
+    yin_fft(pe, re, im, TRUE);
+
+    e0 = 0.0;
+    for (j = 0; j < ndiff; ++j)
+        e0 += (float64)signal[j] * signal[j];
+    et = e0;
+    scale = 1.0 / n;
+    tscale = cmn_tscale(ndiff);
+    cum = 0;
+    cshift = 0;
+    out_diff[0] = 32768;
+    for (t = 1; t < ndiff; ++t) {
+        float64 d;
+        uint64 dd;
+        uint32 dshift;
+
+        et += (float64)signal[t + ndiff - 1] * signal[t + ndiff - 1]
+            - (float64)signal[t - 1] * signal[t - 1];
+        d = floor(e0 + et - 2.0 * re[t] * scale + 0.5);
+        dd = (d > 0.0) ? (uint64)d : 0;
+        /* Scale down to the same range as cmn_diff() does. */
+        for (dshift = 0; (dd >> dshift) > (1UL<<tscale); ++dshift)
+            ;
+        out_diff[t] = cmn_norm((uint32)(dd >> dshift), dshift,
+                               t, tscale, &cum, &cshift);
     }
 }
 
 yin_t *
 yin_init(int frame_size, float search_threshold,
          float search_range, int smooth_window)
+{
+    return yin_init_method(frame_size, search_threshold,
+                           search_range, smooth_window, YIN_DIFF_DIRECT);
+}
+
+yin_t *
+yin_init_method(int frame_size, float search_threshold,
+                float search_range, int smooth_window,
+                yin_diff_method_t method)
 {
     yin_t *pe;
 
@@ -143,6 +289,30 @@ yin_init(int frame_size, float search_threshold,
                                     sizeof(**pe->diff_window));
     pe->period_window = ckd_calloc(pe->wsize,
                                    sizeof(*pe->period_window));
+    if (method == YIN_DIFF_FFT) {
+        int32 i, j, log2n;
+
+        /* Need room for a linear (not circular) correlation. */
+        for (log2n = 1; (1 << log2n) < frame_size; ++log2n)
+            ;
+        pe->fft_size = 1 << log2n;
+        pe->fft_bitrev = ckd_calloc(pe->fft_size, sizeof(*pe->fft_bitrev));
+        for (i = 0; i < pe->fft_size; ++i) {
+            int32 r = 0;
+            for (j = 0; j < log2n; ++j)
+                if (i & (1 << j))
+                    r |= 1 << (log2n - 1 - j);
+            pe->fft_bitrev[i] = r;
+        }
+        pe->fft_cos = ckd_calloc(pe->fft_size / 2, sizeof(*pe->fft_cos));
+        pe->fft_sin = ckd_calloc(pe->fft_size / 2, sizeof(*pe->fft_sin));
+        for (i = 0; i < pe->fft_size / 2; ++i) {
+            pe->fft_cos[i] = cos(2 * M_PI * i / pe->fft_size);
+            pe->fft_sin[i] = sin(2 * M_PI * i / pe->fft_size);
+        }
+        pe->fft_re = ckd_calloc(pe->fft_size, sizeof(*pe->fft_re));
+        pe->fft_im = ckd_calloc(pe->fft_size, sizeof(*pe->fft_im));
+    }
     return pe;
 }
 
@@ -151,6 +321,11 @@ yin_free(yin_t *pe)
 {
     ckd_free_2d(pe->diff_window);
     ckd_free(pe->period_window);
+    ckd_free(pe->fft_bitrev);
+    ckd_free(pe->fft_cos);
+    ckd_free(pe->fft_sin);
+    ckd_free(pe->fft_re);
+    ckd_free(pe->fft_im);
     ckd_free(pe);
 }
 
@@ -206,7 +381,10 @@ yin_write(yin_t *pe, int16 const *frame)
 
     /* Now calculate normalized difference function. */
     difflen = pe->frame_size / 2;
-    cmn_diff(frame, pe->diff_window[outptr], difflen);
+    if (pe->fft_size)
+        cmn_diff_fft(pe, frame, pe->diff_window[outptr], difflen);
+    else
+        cmn_diff(frame, pe->diff_window[outptr], difflen);
 
     /* Find the first point under threshold.  If not found, then
      * use the absolute minimum. */
@@ -33,6 +33,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
@@ -802,6 +803,54 @@ fsg_model_free(fsg_model_t * fsg)
 }
 
 
+typedef struct sorted_arc_s {
+    fsg_link_t *link;
+    int32 idx;
+} sorted_arc_t;
+
+static int
+sorted_arc_cmp(const void *a, const void *b)
+{
+    sorted_arc_t const *sa = (sorted_arc_t const *) a;
+    sorted_arc_t const *sb = (sorted_arc_t const *) b;
+
+    /* Non-null arcs first, then by destination, then in list order. */
+    if ((sa->link->wid < 0) != (sb->link->wid < 0))
+        return (sa->link->wid < 0) ? 1 : -1;
+    if (sa->link->to_state != sb->link->to_state)
+        return sa->link->to_state < sb->link->to_state ? -1 : 1;
+    return sa->idx - sb->idx;
+}
+
+/*
+ * Get the arcs leaving state i ordered by destination, so that output
+ * does not depend on the layout of the transition hash tables.
+ */
+static sorted_arc_t *
+fsg_model_sorted_arcs(fsg_model_t * fsg, int32 i, int32 * out_n_arcs)
+{
+    fsg_arciter_t *itor;
+    sorted_arc_t *arcs;
+    int32 n_arcs, n_alloc;
+
+    arcs = NULL;
+    n_arcs = n_alloc = 0;
+    for (itor = fsg_model_arcs(fsg, i); itor;
+         itor = fsg_arciter_next(itor)) {
+        if (n_arcs == n_alloc) {
+            n_alloc = n_alloc ? n_alloc * 2 : 16;
+            arcs = ckd_realloc(arcs, n_alloc * sizeof(*arcs));
+        }
+        arcs[n_arcs].link = fsg_arciter_get(itor);
+        arcs[n_arcs].idx = n_arcs;
+        ++n_arcs;
+    }
+    if (n_arcs > 1)
+        qsort(arcs, n_arcs, sizeof(*arcs), sorted_arc_cmp);
+    *out_n_arcs = n_arcs;
+    return arcs;
+}
+
 void
 fsg_model_write(fsg_model_t * fsg, FILE * fp)
 {
@@ -814,11 +863,12 @@ fsg_model_write(fsg_model_t * fsg, FILE * fp)
     fprintf(fp, "%s %d\n", FSG_MODEL_FINAL_STATE_DECL, fsg->final_state);
 
     for (i = 0; i < fsg->n_state; i++) {
-        fsg_arciter_t *itor;
+        sorted_arc_t *arcs;
+        int32 j, n_arcs;
 
-        for (itor = fsg_model_arcs(fsg, i); itor;
-             itor = fsg_arciter_next(itor)) {
-            fsg_link_t *tl = fsg_arciter_get(itor);
+        arcs = fsg_model_sorted_arcs(fsg, i, &n_arcs);
+        for (j = 0; j < n_arcs; j++) {
+            fsg_link_t *tl = arcs[j].link;
 
             fprintf(fp, "%s %d %d %f %s\n", FSG_MODEL_TRANSITION_DECL,
                     tl->from_state, tl->to_state,
@@ -826,6 +876,7 @@ fsg_model_write(fsg_model_t * fsg, FILE * fp)
                                 (int32) (tl->logs2prob / fsg->lw)),
                     (tl->wid < 0) ? "" : fsg_model_word_str(fsg, tl->wid));
         }
+        ckd_free(arcs);
     }
 
     fprintf(fp, "%s\n", FSG_MODEL_END_DECL);
@@ -855,16 +906,18 @@ fsg_model_writefile(fsg_model_t * fsg, char const *file)
 static void
 fsg_model_write_fsm_trans(fsg_model_t * fsg, int i, FILE * fp)
 {
-    fsg_arciter_t *itor;
+    sorted_arc_t *arcs;
+    int32 j, n_arcs;
 
-    for (itor = fsg_model_arcs(fsg, i); itor;
-         itor = fsg_arciter_next(itor)) {
-        fsg_link_t *tl = fsg_arciter_get(itor);
+    arcs = fsg_model_sorted_arcs(fsg, i, &n_arcs);
+    for (j = 0; j < n_arcs; j++) {
+        fsg_link_t *tl = arcs[j].link;
         fprintf(fp, "%d %d %s %f\n",
                 tl->from_state, tl->to_state,
                 (tl->wid < 0) ? "<eps>" : fsg_model_word_str(fsg, tl->wid),
                 -logmath_log_to_ln(fsg->lmath, tl->logs2prob / fsg->lw));
     }
+    ckd_free(arcs);
 }
 
 void
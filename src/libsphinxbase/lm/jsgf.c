@@ -819,7 +819,12 @@ jsgf_import_rule(jsgf_t * jsgf, char *name)
     }
     if (imp != NULL) {
         hash_iter_t *itor;
-        /* Look for public rules matching rulename. */
+        glist_t matches = NULL;
+        gnode_t *gn;
+
+        /* Look for public rules matching rulename.  The imported
+         * grammar shares our rule table, so collect them first, as
+         * adding to the table would disturb the iteration. */
         for (itor = hash_table_iter(imp->rules); itor;
              itor = hash_table_iter_next(itor)) {
             hash_entry_t *he = itor->ent;
@@ -838,26 +843,36 @@ jsgf_import_rule(jsgf_t * jsgf, char *name)
             }
             ckd_free(rule_name);
             if (rule->is_public && rule_matches) {
-                void *val;
-                char *newname;
-
-                /* Link this rule into the current namespace. */
-                c = strrchr(rule->name, '.');
-                assert(c != NULL);
-                newname = jsgf_fullname(jsgf, c);
-
-                E_INFO("Imported %s\n", newname);
-                val = hash_table_enter(jsgf->rules, newname,
-                                       jsgf_rule_retain(rule));
-                if (val != (void *) rule) {
-                    E_WARN("Multiply defined symbol: %s\n", newname);
-                }
+                matches = glist_add_ptr(matches, rule);
                 if (!import_all) {
                     hash_table_iter_free(itor);
-                    return rule;
+                    break;
                 }
             }
         }
+        /* Link these rules into the current namespace. */
+        matches = glist_reverse(matches);
+        for (gn = matches; gn; gn = gnode_next(gn)) {
+            jsgf_rule_t *rule = gnode_ptr(gn);
+            void *val;
+            char *newname;
+
+            c = strrchr(rule->name, '.');
+            assert(c != NULL);
+            newname = jsgf_fullname(jsgf, c);
+
+            E_INFO("Imported %s\n", newname);
+            val = hash_table_enter(jsgf->rules, newname,
+                                   jsgf_rule_retain(rule));
+            if (val != (void *) rule) {
+                E_WARN("Multiply defined symbol: %s\n", newname);
+            }
+            if (!import_all) {
+                glist_free(matches);
+                return rule;
+            }
+        }
+        glist_free(matches);
     }
 
     return NULL;
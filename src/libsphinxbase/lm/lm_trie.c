@@ -43,11 +43,15 @@
 #include <sphinxbase/ckd_alloc.h>
 #include <sphinxbase/err.h>
 #include <sphinxbase/priority_queue.h>
+#include <sphinxbase/sbthread.h>
 
 #include "lm_trie.h"
 #include "lm_trie_quant.h"
 
 static void lm_trie_alloc_ngram(lm_trie_t * trie, uint32 * counts, int order);
+static size_t lm_trie_ngram_mem_size(lm_trie_t * trie, uint32 * counts,
+                                     int order);
+static void lm_trie_init_ngram(lm_trie_t * trie, uint32 * counts, int order);
 
 static uint32
 base_size(uint32 entries, uint32 max_vocab, uint8 remaining_bits)
@@ -114,42 +118,120 @@ longest_init(longest_t * longest, void *base_mem, uint8 quant_bits,
     base_init(&longest->base, base_mem, max_vocab, quant_bits);
 }
 
+/*
+ * The trie is built in chunks, each covering a range of first words.
+ * Since raw N-Grams are sorted lexicographically, each chunk owns a
+ * contiguous run of entries in every order, so chunks can be counted
+ * and filled independently once their starting offsets are known.
+ * Orders are indexed from 0 for bigrams up to order - 2 for the
+ * longest N-Grams.
+ */
+typedef struct trie_chunk_s {
+    uint32 ug_begin;            /**< First unigram in this chunk */
+    uint32 ug_end;              /**< One past the last unigram */
+    uint32 raw_begin[NGRAM_MAX_ORDER - 1]; /**< Raw N-Gram ranges */
+    uint32 raw_end[NGRAM_MAX_ORDER - 1];
+    uint32 counts[NGRAM_MAX_ORDER - 1]; /**< Entries, including the
+                                           ones for missing prefixes */
+    uint32 begin[NGRAM_MAX_ORDER - 1];  /**< Index of first entry */
+    uint32 insert[NGRAM_MAX_ORDER - 1]; /**< Index of next entry */
+    uint8 *mem[NGRAM_MAX_ORDER - 1];    /**< Private bit array, or NULL
+                                           to write to trie->ngram_mem */
+    uint8 shift[NGRAM_MAX_ORDER - 1];   /**< Bit offset of first entry
+                                           in mem */
+    FILE *out;                          /**< File to stream entries to
+                                           when mem fills up, or NULL */
+    long out_offset[NGRAM_MAX_ORDER - 1]; /**< Position in out of the
+                                             first byte of mem */
+    size_t mem_size[NGRAM_MAX_ORDER - 1]; /**< Bytes of mem to fill
+                                             before writing it out */
+    int error;                          /**< Set if writing out failed */
+} trie_chunk_t;
+
+static base_t *
+chunk_base(lm_trie_t * trie, int k, int order)
+{
+    if (k == order - 2)
+        return &trie->longest->base;
+    return &trie->middle_begin[k].base;
+}
+
+/*
+ * Write out the complete bytes of a streamed chunk's entries of order
+ * k before index, and keep the partial last one at the start of mem.
+ */
+static void
+chunk_flush(trie_chunk_t * chunk, base_t * base, int k, uint32 index)
+{
+    size_t bits = (size_t) (index - chunk->begin[k]) * base->total_bits
+        + chunk->shift[k];
+    size_t len = bits >> 3;
+
+    if (fseek(chunk->out, chunk->out_offset[k], SEEK_SET) < 0
+        || fwrite(chunk->mem[k], 1, len, chunk->out) != len) {
+        E_ERROR_SYSTEM("Failed to write LM trie");
+        chunk->error = TRUE;
+    }
+    chunk->out_offset[k] += len;
+    chunk->mem[k][0] = chunk->mem[k][len];
+    memset(chunk->mem[k] + 1, 0, chunk->mem_size[k] + sizeof(uint64) - 1);
+    chunk->begin[k] = index;
+    chunk->shift[k] = bits & 7;
+}
+
+/* Claim the next entry of order k in a chunk and return its address. */
 static bitarr_address_t
-middle_insert(middle_t * middle, uint32 word, int order, int max_order)
+chunk_next_address(trie_chunk_t * chunk, base_t * base, int k)
 {
-    uint32 at_pointer;
-    uint32 next;
     bitarr_address_t address;
+    uint32 index = chunk->insert[k]++;
+
+    if (chunk->out
+        && (size_t) (index + 1 - chunk->begin[k]) * base->total_bits
+        + chunk->shift[k] > chunk->mem_size[k] * 8)
+        chunk_flush(chunk, base, k, index);
+    if (chunk->mem[k]) {
+        address.base = chunk->mem[k];
+        address.offset = (index - chunk->begin[k]) * base->total_bits
+            + chunk->shift[k];
+    }
+    else {
+        address.base = base->base;
+        address.offset = index * base->total_bits;
+    }
+    return address;
+}
+
+static bitarr_address_t
+middle_insert(lm_trie_t * trie, trie_chunk_t * chunk, int k, uint32 word)
+{
+    middle_t *middle = &trie->middle_begin[k];
+    bitarr_address_t address;
+    uint32 at_pointer;
+
     assert(word <= middle->base.word_mask);
-    address.base = middle->base.base;
-    address.offset = middle->base.insert_index * middle->base.total_bits;
+    address = chunk_next_address(chunk, &middle->base, k);
     bitarr_write_int25(address, middle->base.word_bits, word);
     address.offset += middle->base.word_bits;
     at_pointer = address.offset;
     address.offset += middle->quant_bits;
-    if (order == max_order - 1) {
-        next = ((longest_t *) middle->next_source)->base.insert_index;
-    }
-    else {
-        next = ((middle_t *) middle->next_source)->base.insert_index;
-    }
-
-    bitarr_write_int25(address, middle->next_mask.bits, next);
-    middle->base.insert_index++;
+    /* Children of this entry start at the next one of order k + 1. */
+    bitarr_write_int25(address, middle->next_mask.bits,
+                       chunk->insert[k + 1]);
     address.offset = at_pointer;
     return address;
 }
 
 static bitarr_address_t
-longest_insert(longest_t * longest, uint32 index)
+longest_insert(lm_trie_t * trie, trie_chunk_t * chunk, int k, uint32 word)
 {
+    longest_t *longest = trie->longest;
     bitarr_address_t address;
-    assert(index <= longest->base.word_mask);
-    address.base = longest->base.base;
-    address.offset = longest->base.insert_index * longest->base.total_bits;
-    bitarr_write_int25(address, longest->base.word_bits, index);
+
+    assert(word <= longest->base.word_mask);
+    address = chunk_next_address(chunk, &longest->base, k);
+    bitarr_write_int25(address, longest->base.word_bits, word);
     address.offset += longest->base.word_bits;
-    longest->base.insert_index++;
     return address;
 }
 
@@ -164,132 +246,217 @@ middle_finish_loading(middle_t * middle, uint32 next_end)
     bitarr_write_int25(address, middle->next_mask.bits, next_end);
 }
 
-static uint32
-unigram_next(lm_trie_t * trie, int order)
+/*
+ * Sorted raw N-Grams to build the trie from, either in arrays or in
+ * runs spilled to files, which are merged as they are read.
+ */
+typedef struct raw_source_s {
+    ngram_raw_t **raw_ngrams;
+    uint32 **raw_words;
+    ngram_runs_t *runs;         /**< Runs of each order, or NULL */
+    size_t run_buf_size;        /**< Bytes to read ahead from each run */
+    float *samples[NGRAM_MAX_ORDER - 1][2]; /**< Probabilities and
+                                               backoffs to train the
+                                               quantizer, or NULL */
+    uint32 sample_step[NGRAM_MAX_ORDER - 1]; /**< Keep one N-Gram in
+                                                this many */
+    uint32 n_samples[NGRAM_MAX_ORDER - 1];
+    int error;                  /**< Set if a run could not be read */
+} raw_source_t;
+
+/* Position in the raw N-Grams of one order, for merging them. */
+typedef struct raw_cursor_s {
+    ngram_raw_t *raw;           /**< Current N-Gram, or NULL for unigrams */
+    uint32 *words;              /**< Its word indexes */
+    int order;
+    ngram_run_reader_t *reader; /**< Run it is read from, or NULL */
+} raw_cursor_t;
+
+static int
+raw_cursor_comparator(const void *a_raw, const void *b_raw)
 {
-    return order ==
-        2 ? trie->longest->base.insert_index : trie->middle_begin->base.
-        insert_index;
+    const raw_cursor_t *a = (const raw_cursor_t *) a_raw;
+    const raw_cursor_t *b = (const raw_cursor_t *) b_raw;
+
+    return ngram_words_compare(a->words, a->order, b->words, b->order);
 }
 
-void
-lm_trie_fix_counts(ngram_raw_t ** raw_ngrams, uint32 * counts,
-                   uint32 * fixed_counts, int order)
+static void
+raw_cursor_set(raw_cursor_t * cursor, ngram_raw_t * raw_ngrams,
+               uint32 * raw_words, uint32 idx)
 {
-    priority_queue_t *ngrams =
-        priority_queue_create(order - 1, &ngram_ord_comparator);
-    uint32 raw_ngram_ptrs[NGRAM_MAX_ORDER - 1];
-    uint32 words[NGRAM_MAX_ORDER];
-    int i;
-
-    memset(words, -1, sizeof(words));
-    memcpy(fixed_counts, counts, order * sizeof(*fixed_counts));
-    for (i = 2; i <= order; i++) {
-        ngram_raw_t *tmp_ngram;
-        
-        if (counts[i - 1] <= 0)
-            continue;
+    cursor->raw = &raw_ngrams[idx];
+    cursor->words = ngram_raw_words(raw_words, cursor->raw);
+}
 
-        raw_ngram_ptrs[i - 2] = 0;
+/* Read the next N-Gram of a run, returning FALSE if there is none. */
+static int
+raw_cursor_read(raw_cursor_t * cursor)
+{
+    if (!ngram_run_reader_next(cursor->reader))
+        return FALSE;
+    cursor->raw = &cursor->reader->raw;
+    cursor->words = cursor->reader->words;
+    return TRUE;
+}
 
-        tmp_ngram =
-            (ngram_raw_t *) ckd_calloc(1, sizeof(*tmp_ngram));
-        *tmp_ngram = raw_ngrams[i - 2][0];
-        tmp_ngram->order = i;
-        priority_queue_add(ngrams, tmp_ngram);
+static void
+raw_cursor_free(raw_source_t * source, raw_cursor_t * cursor)
+{
+    if (cursor->reader) {
+        if (cursor->reader->error)
+            source->error = TRUE;
+        ngram_run_reader_free(cursor->reader);
+        ckd_free(cursor->reader);
     }
+    ckd_free(cursor);
+}
 
-    for (;;) {
-        int32 to_increment = TRUE;
-        ngram_raw_t *top;
-        if (priority_queue_size(ngrams) == 0) {
-            break;
-        }
-        top = (ngram_raw_t *) priority_queue_poll(ngrams);
-        if (top->order == 2) {
-            memcpy(words, top->words, 2 * sizeof(*words));
-        }
-        else {
-            for (i = 0; i < top->order - 1; i++) {
-                if (words[i] != top->words[i]) {
-                    int num;
-                    num = (i == 0) ? 1 : i;
-                    memcpy(words, top->words,
-                           (num + 1) * sizeof(*words));
-                    fixed_counts[num]++;
-                    to_increment = FALSE;
-                    break;
-                }
+/* Queue the first raw N-Gram of every order (or run) in a chunk. */
+static priority_queue_t *
+chunk_queue(raw_source_t * source, trie_chunk_t * chunk, int order,
+            uint32 * raw_ptrs)
+{
+    priority_queue_t *ngrams;
+    int k, r, n_cursors;
+
+    n_cursors = order;
+    if (source->runs)
+        for (k = 0; k < order - 1; k++)
+            n_cursors += source->runs[k].n_runs;
+    ngrams = priority_queue_create(n_cursors, &raw_cursor_comparator);
+    for (k = 0; k < order - 1; k++) {
+        raw_cursor_t *cursor;
+
+        if (source->runs) {
+            ngram_runs_t *runs = &source->runs[k];
+
+            for (r = 0; r < runs->n_runs; r++) {
+                cursor = (raw_cursor_t *) ckd_calloc(1, sizeof(*cursor));
+                cursor->order = k + 2;
+                cursor->reader = (ngram_run_reader_t *)
+                    ckd_calloc(1, sizeof(*cursor->reader));
+                ngram_run_reader_init(cursor->reader, runs->files[r],
+                                      runs->counts[r], k + 2,
+                                      source->run_buf_size);
+                if (raw_cursor_read(cursor))
+                    priority_queue_add(ngrams, cursor);
+                else
+                    raw_cursor_free(source, cursor);
             }
-            words[top->order - 1] = top->words[top->order - 1];
-        }
-        if (to_increment) {
-            raw_ngram_ptrs[top->order - 2]++;
-        }
-        if (raw_ngram_ptrs[top->order - 2] < counts[top->order - 1]) {
-            *top = raw_ngrams[top->order - 2][raw_ngram_ptrs[top->order - 2]];
-            priority_queue_add(ngrams, top);
-        }
-        else {
-            ckd_free(top);
+            continue;
         }
+        raw_ptrs[k] = chunk->raw_begin[k];
+        if (raw_ptrs[k] >= chunk->raw_end[k])
+            continue;
+        cursor = (raw_cursor_t *) ckd_calloc(1, sizeof(*cursor));
+        cursor->order = k + 2;
+        raw_cursor_set(cursor, source->raw_ngrams[k], source->raw_words[k],
+                       raw_ptrs[k]);
+        priority_queue_add(ngrams, cursor);
     }
+    return ngrams;
+}
 
-    assert(priority_queue_size(ngrams) == 0);
-    priority_queue_free(ngrams, NULL);
+/* Move on to the next raw N-Gram of the same order (or run) as top. */
+static void
+chunk_queue_advance(priority_queue_t * ngrams, raw_source_t * source,
+                    trie_chunk_t * chunk, uint32 * raw_ptrs,
+                    raw_cursor_t * top)
+{
+    int k = top->order - 2;
+
+    if (top->reader ? raw_cursor_read(top)
+        : ++raw_ptrs[k] < chunk->raw_end[k]) {
+        if (!top->reader)
+            raw_cursor_set(top, source->raw_ngrams[k], source->raw_words[k],
+                           raw_ptrs[k]);
+        priority_queue_add(ngrams, top);
+    }
+    else {
+        raw_cursor_free(source, top);
+    }
 }
 
+/*
+ * Count the entries of each order in a chunk, including the ones
+ * which must be added for prefixes missing from the model.  Samples
+ * for the quantizer are taken on the way, if the source wants them.
+ */
+static void
+chunk_count(raw_source_t * source, trie_chunk_t * chunk, int order)
+{
+    priority_queue_t *ngrams;
+    uint32 raw_ptrs[NGRAM_MAX_ORDER - 1];
+    uint32 seen[NGRAM_MAX_ORDER - 1];
+    uint32 words[NGRAM_MAX_ORDER];
+    int i;
+
+    memset(words, -1, sizeof(words));
+    memset(seen, 0, sizeof(seen));
+    for (i = 0; i < order - 1; i++)
+        chunk->counts[i] = chunk->raw_end[i] - chunk->raw_begin[i];
+    ngrams = chunk_queue(source, chunk, order, raw_ptrs);
+    while (priority_queue_size(ngrams) > 0) {
+        raw_cursor_t *top = (raw_cursor_t *) priority_queue_poll(ngrams);
+        int k = top->order - 2;
+
+        if (source->samples[k][0]
+            && seen[k]++ % source->sample_step[k] == 0) {
+            uint32 n = source->n_samples[k]++;
+            source->samples[k][0][n] = top->raw->prob;
+            if (source->samples[k][1])
+                source->samples[k][1][n] = top->raw->backoff;
+        }
+        /* Every prefix from the first one that differs from the
+         * previous path onwards is missing, except for unigrams,
+         * which always exist. */
+        for (i = 0; i < top->order - 1; i++)
+            if (words[i] != top->words[i])
+                break;
+        for (i = (i > 0) ? i : 1; i < top->order - 1; i++)
+            chunk->counts[i - 1]++;
+        memcpy(words, top->words, top->order * sizeof(*words));
+        memset(words + top->order, -1,
+               (NGRAM_MAX_ORDER - top->order) * sizeof(*words));
+        chunk_queue_advance(ngrams, source, chunk, raw_ptrs, top);
+    }
+    priority_queue_free(ngrams, NULL);
+}
 
+/* Fill in all the entries for a chunk. */
 static void
-recursive_insert(lm_trie_t * trie, ngram_raw_t ** raw_ngrams,
-                 uint32 * counts, int order)
-{
-    uint32 unigram_idx = 0;
-    uint32 *words;
-    float *probs;
-    const uint32 unigram_count = (uint32) counts[0];
-    priority_queue_t *ngrams =
-        priority_queue_create(order, &ngram_ord_comparator);
-    ngram_raw_t *ngram;
-    uint32 *raw_ngrams_ptr;
+chunk_insert(lm_trie_t * trie, raw_source_t * source, trie_chunk_t * chunk,
+             int order)
+{
+    uint32 unigram_idx = chunk->ug_begin;
+    uint32 words[NGRAM_MAX_ORDER];
+    float probs[NGRAM_MAX_ORDER - 1];
+    priority_queue_t *ngrams;
+    raw_cursor_t *ngram;
+    uint32 raw_ptrs[NGRAM_MAX_ORDER - 1];
     int i;
 
-    words = (uint32 *) ckd_calloc(order, sizeof(*words));
-    probs = (float *) ckd_calloc(order - 1, sizeof(*probs));
-    ngram = (ngram_raw_t *) ckd_calloc(1, sizeof(*ngram));
+    memset(words, -1, sizeof(words));
+    ngrams = chunk_queue(source, chunk, order, raw_ptrs);
+    ngram = (raw_cursor_t *) ckd_calloc(1, sizeof(*ngram));
     ngram->order = 1;
     ngram->words = &unigram_idx;
     priority_queue_add(ngrams, ngram);
-    raw_ngrams_ptr =
-        (uint32 *) ckd_calloc(order - 1, sizeof(*raw_ngrams_ptr));
-    for (i = 2; i <= order; ++i) {
-        ngram_raw_t *tmp_ngram;
-        
-        if (counts[i - 1] <= 0)
-            continue;
 
-        raw_ngrams_ptr[i - 2] = 0;
-        tmp_ngram =
-            (ngram_raw_t *) ckd_calloc(1, sizeof(*tmp_ngram));
-        *tmp_ngram = raw_ngrams[i - 2][0];
-        tmp_ngram->order = i;
-
-        priority_queue_add(ngrams, tmp_ngram);
-    }
-
-    for (;;) {
-        ngram_raw_t *top =
-            (ngram_raw_t *) priority_queue_poll(ngrams);
+    while (priority_queue_size(ngrams) > 0) {
+        raw_cursor_t *top =
+            (raw_cursor_t *) priority_queue_poll(ngrams);
 
         if (top->order == 1) {
-            trie->unigrams[unigram_idx].next = unigram_next(trie, order);
+            trie->unigrams[unigram_idx].next = chunk->insert[0];
+            memset(words, -1, sizeof(words));
             words[0] = unigram_idx;
             probs[0] = trie->unigrams[unigram_idx].prob;
-            if (++unigram_idx == unigram_count + 1) {
+            if (++unigram_idx == chunk->ug_end)
                 ckd_free(top);
-                break;
-            }
-            priority_queue_add(ngrams, top);
+            else
+                priority_queue_add(ngrams, top);
         }
         else {
             for (i = 0; i < top->order - 1; i++) {
@@ -298,10 +465,9 @@ recursive_insert(lm_trie_t * trie, ngram_raw_t ** raw_ngrams,
                     int j;
                     assert(i > 0);  /* unigrams are not pruned without removing ngrams that contains them */
                     for (j = i; j < top->order - 1; j++) {
-                        middle_t *middle = &trie->middle_begin[j - 1];
                         bitarr_address_t address =
-                            middle_insert(middle, top->words[j],
-                                          j + 1, order);
+                            middle_insert(trie, chunk, j - 1,
+                                          top->words[j]);
                         /* calculate prob for blank */
                         float calc_prob =
                             probs[j - 1] +
@@ -310,75 +476,215 @@ recursive_insert(lm_trie_t * trie, ngram_raw_t ** raw_ngrams,
                         lm_trie_quant_mwrite(trie->quant, address, j - 1,
                                              calc_prob, 0.0f);
                     }
+                    break;
                 }
             }
             memcpy(words, top->words,
                    top->order * sizeof(*words));
+            memset(words + top->order, -1,
+                   (NGRAM_MAX_ORDER - top->order) * sizeof(*words));
             if (top->order == order) {
                 bitarr_address_t address =
-                    longest_insert(trie->longest,
+                    longest_insert(trie, chunk, top->order - 2,
                                    top->words[top->order - 1]);
-                lm_trie_quant_lwrite(trie->quant, address, top->prob);
+                lm_trie_quant_lwrite(trie->quant, address, top->raw->prob);
             }
             else {
-                middle_t *middle = &trie->middle_begin[top->order - 2];
                 bitarr_address_t address =
-                    middle_insert(middle,
-                                  top->words[top->order - 1],
-                                  top->order, order);
+                    middle_insert(trie, chunk, top->order - 2,
+                                  top->words[top->order - 1]);
                 /* write prob and backoff */
-                probs[top->order - 1] = top->prob;
+                probs[top->order - 1] = top->raw->prob;
                 lm_trie_quant_mwrite(trie->quant, address, top->order - 2,
-                                     top->prob, top->backoff);
-            }
-            raw_ngrams_ptr[top->order - 2]++;
-            if (raw_ngrams_ptr[top->order - 2] < counts[top->order - 1]) {
-        	*top = raw_ngrams[top->order -
-                               2][raw_ngrams_ptr[top->order - 2]];
-
-                priority_queue_add(ngrams, top);
-            }
-            else {
-                ckd_free(top);
+                                     top->raw->prob, top->raw->backoff);
             }
+            chunk_queue_advance(ngrams, source, chunk, raw_ptrs, top);
         }
     }
-    assert(priority_queue_size(ngrams) == 0);
     priority_queue_free(ngrams, NULL);
-    ckd_free(raw_ngrams_ptr);
-    ckd_free(words);
-    ckd_free(probs);
+    /* Streamed chunks move begin along as they are written out. */
+    for (i = 0; i < order - 1; i++)
+        assert(chunk->out
+               || chunk->insert[i] == chunk->begin[i] + chunk->counts[i]);
+}
+
+/* Copy a chunk's private bit array into trie->ngram_mem. */
+static void
+chunk_merge(lm_trie_t * trie, trie_chunk_t * chunk, int k, int order)
+{
+    base_t *base = chunk_base(trie, k, order);
+    uint8 *dest;
+    uint32 len;
+
+    if (chunk->mem[k] == NULL)
+        return;
+    dest = base->base + (chunk->begin[k] * base->total_bits >> 3);
+    len = (chunk->shift[k] + chunk->counts[k] * base->total_bits + 7) >> 3;
+    /* The first and last bytes may be shared with the neighbouring
+     * chunks, everything in between belongs to this one. */
+    dest[0] |= chunk->mem[k][0];
+    if (len > 2)
+        memcpy(dest + 1, chunk->mem[k] + 1, len - 2);
+    if (len > 1)
+        dest[len - 1] |= chunk->mem[k][len - 1];
+    ckd_free(chunk->mem[k]);
+    chunk->mem[k] = NULL;
+}
+
+/* Find the first raw N-Gram whose first word is at least word. */
+static uint32
+raw_lower_bound(ngram_raw_t * raw_ngrams, uint32 * raw_words, uint32 count,
+                uint32 word)
+{
+    uint32 lo = 0, hi = count;
+
+    while (lo < hi) {
+        uint32 mid = lo + (hi - lo) / 2;
+        if (ngram_raw_words(raw_words, &raw_ngrams[mid])[0] < word)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/*
+ * Split the unigrams (including the sentinel one at the end) into
+ * about n_chunks ranges with similar numbers of N-Grams of the
+ * largest order.
+ */
+static trie_chunk_t *
+chunks_create(ngram_raw_t ** raw_ngrams, uint32 ** raw_words,
+              uint32 * counts, int order, int n_chunks, int *out_n_chunks)
+{
+    trie_chunk_t *chunks;
+    uint32 *bounds;
+    int c, k, n, biggest;
+
+    biggest = 0;
+    for (k = 1; k < order - 1; k++)
+        if (counts[k + 1] > counts[biggest + 1])
+            biggest = k;
+    if ((uint32) n_chunks > counts[biggest + 1])
+        n_chunks = counts[biggest + 1] ? counts[biggest + 1] : 1;
+
+    bounds = (uint32 *) ckd_calloc(n_chunks + 1, sizeof(*bounds));
+    n = 0;
+    for (c = 1; c < n_chunks; c++) {
+        uint32 idx = (uint32) ((uint64) counts[biggest + 1] * c / n_chunks);
+        uint32 word =
+            ngram_raw_words(raw_words[biggest], &raw_ngrams[biggest][idx])[0];
+        if (word > bounds[n])
+            bounds[++n] = word;
+    }
+    bounds[++n] = counts[0] + 1;
+
+    chunks = (trie_chunk_t *) ckd_calloc(n, sizeof(*chunks));
+    for (c = 0; c < n; c++) {
+        chunks[c].ug_begin = bounds[c];
+        chunks[c].ug_end = bounds[c + 1];
+        for (k = 0; k < order - 1; k++) {
+            chunks[c].raw_begin[k] = (c == 0) ? 0
+                : chunks[c - 1].raw_end[k];
+            chunks[c].raw_end[k] = (c == n - 1) ? counts[k + 1]
+                : raw_lower_bound(raw_ngrams[k], raw_words[k],
+                                  counts[k + 1], bounds[c + 1]);
+        }
+    }
+    ckd_free(bounds);
+    *out_n_chunks = n;
+    return chunks;
+}
+
+enum {
+    BUILD_COUNT,                /**< Train quantizers and count chunks */
+    BUILD_INSERT                /**< Fill in chunks */
+};
+
+typedef struct trie_builder_s {
+    lm_trie_t *trie;
+    raw_source_t source;
+    uint32 *counts;
+    int order;
+    trie_chunk_t *chunks;
+    int n_chunks;
+    int stage;
+} trie_builder_t;
+
+static void
+builder_run_task(trie_builder_t * b, int task)
+{
+    if (b->stage == BUILD_INSERT) {
+        chunk_insert(b->trie, &b->source, &b->chunks[task], b->order);
+    }
+    else if (task >= b->order - 1) {
+        chunk_count(&b->source, &b->chunks[task - (b->order - 1)],
+                    b->order);
+    }
+    else if (task < b->order - 2) {
+        lm_trie_quant_train(b->trie->quant, task + 2,
+                            b->counts[task + 1],
+                            b->source.raw_ngrams[task]);
+    }
+    else {
+        lm_trie_quant_train_prob(b->trie->quant, b->order,
+                                 b->counts[b->order - 1],
+                                 b->source.raw_ngrams[b->order - 2]);
+    }
+}
+
+static void
+builder_run_tasks(void *arg, int start, int end)
+{
+    trie_builder_t *b = (trie_builder_t *) arg;
+    int task;
+
+    for (task = start; task < end; task++)
+        builder_run_task(b, task);
+}
+
+/* Run all the tasks for a stage in the pool, one at a time. */
+static void
+builder_run(trie_builder_t * b, sbpool_t * pool, int stage, int n_tasks)
+{
+    b->stage = stage;
+    sbpool_parallel_for(pool, 0, n_tasks, 1, builder_run_tasks, b);
 }
 
 static lm_trie_t *
-lm_trie_init(uint32 unigram_count)
+lm_trie_init(void)
 {
     lm_trie_t *trie;
 
     trie = (lm_trie_t *) ckd_calloc(1, sizeof(*trie));
-    memset(trie->hist_cache, -1, sizeof(trie->hist_cache)); /* prepare request history */
-    memset(trie->backoff_cache, 0, sizeof(trie->backoff_cache));
-    trie->unigrams =
-        (unigram_t *) ckd_calloc((unigram_count + 1),
-                                 sizeof(*trie->unigrams));
     trie->ngram_mem = NULL;
     return trie;
 }
 
 lm_trie_t *
-lm_trie_create(uint32 unigram_count, int order)
+lm_trie_create(uint32 unigram_count, int order, const uint8 * prob_bits,
+               const uint8 * bo_bits)
 {
-    lm_trie_t *trie = lm_trie_init(unigram_count);
+    lm_trie_t *trie = lm_trie_init();
+    trie->unigrams =
+        (unigram_t *) ckd_calloc((unigram_count + 1),
+                                 sizeof(*trie->unigrams));
     trie->quant =
-        (order > 1) ? lm_trie_quant_create(order) : 0;
+        (order > 1) ? lm_trie_quant_create(order, prob_bits, bo_bits) : 0;
     return trie;
 }
 
 lm_trie_t *
 lm_trie_read_bin(uint32 * counts, int order, FILE * fp)
 {
-    lm_trie_t *trie = lm_trie_init(counts[0]);
+    lm_trie_t *trie = lm_trie_init();
+    trie->unigrams =
+        (unigram_t *) ckd_calloc((counts[0] + 1), sizeof(*trie->unigrams));
     trie->quant = (order > 1) ? lm_trie_quant_read_bin(fp, order) : NULL;
+    if (order > 1 && trie->quant == NULL) {
+        lm_trie_free(trie);
+        return NULL;
+    }
     fread(trie->unigrams, sizeof(*trie->unigrams), (counts[0] + 1), fp);
     if (order > 1) {
         lm_trie_alloc_ngram(trie, counts, order);
@@ -387,6 +693,55 @@ lm_trie_read_bin(uint32 * counts, int order, FILE * fp)
     return trie;
 }
 
+lm_trie_t *
+lm_trie_read_mmap(uint32 * counts, int order, FILE * fp,
+                  mmio_file_t * filemem)
+{
+    lm_trie_t *trie;
+    uint8 *mem;
+    long offset, flen;
+    size_t size;
+
+    trie = lm_trie_init();
+    trie->quant = (order > 1) ? lm_trie_quant_read_bin(fp, order) : NULL;
+    if (order > 1 && trie->quant == NULL) {
+        lm_trie_free(trie);
+        return NULL;
+    }
+    if ((offset = ftell(fp)) < 0
+        || fseek(fp, 0, SEEK_END) < 0 || (flen = ftell(fp)) < 0) {
+        E_ERROR_SYSTEM("Failed to find size of binary LM file");
+        lm_trie_free(trie);
+        return NULL;
+    }
+    size = (counts[0] + 1) * sizeof(*trie->unigrams);
+    if (order > 1)
+        size += lm_trie_ngram_mem_size(trie, counts, order);
+    if ((size_t) (flen - offset) < size) {
+        E_ERROR("Binary LM file is truncated: expected %lu bytes, got %ld\n",
+                (unsigned long) size, flen - offset);
+        lm_trie_free(trie);
+        return NULL;
+    }
+    /* The header and quantization tables are a multiple of 4 bytes
+     * long, so the unigrams are suitably aligned in the file. */
+    assert(offset % sizeof(float) == 0);
+
+    mem = (uint8 *) mmio_file_ptr(filemem) + offset;
+    trie->unigrams = (unigram_t *) mem;
+    trie->unigrams_mapped = TRUE;
+    mem += (counts[0] + 1) * sizeof(*trie->unigrams);
+    if (order > 1) {
+        trie->ngram_mem_size = lm_trie_ngram_mem_size(trie, counts, order);
+        trie->ngram_mem = mem;
+        lm_trie_init_ngram(trie, counts, order);
+    }
+    /* Leave fp positioned after the trie, as lm_trie_read_bin() does. */
+    fseek(fp, offset + size, SEEK_SET);
+    trie->filemem = filemem;
+    return trie;
+}
+
 void
 lm_trie_write_bin(lm_trie_t * trie, uint32 unigram_count, FILE * fp)
 {
@@ -402,54 +757,81 @@ lm_trie_write_bin(lm_trie_t * trie, uint32 unigram_count, FILE * fp)
 void
 lm_trie_free(lm_trie_t * trie)
 {
-    if (trie->ngram_mem) {
+    if (trie == NULL)
+        return;
+    if (trie->ngram_mem && !trie->filemem)
         ckd_free(trie->ngram_mem);
-        ckd_free(trie->middle_begin);
-        ckd_free(trie->longest);
-    }
+    ckd_free(trie->middle_begin);
+    ckd_free(trie->longest);
     if (trie->quant)
         lm_trie_quant_free(trie->quant);
-    ckd_free(trie->unigrams);
+    if (!trie->unigrams_mapped)
+        ckd_free(trie->unigrams);
+    if (trie->filemem)
+        mmio_file_unmap(trie->filemem);
     ckd_free(trie);
 }
 
-static void
-lm_trie_alloc_ngram(lm_trie_t * trie, uint32 * counts, int order)
+static size_t
+lm_trie_ngram_mem_size(lm_trie_t * trie, uint32 * counts, int order)
 {
+    size_t size;
     int i;
-    uint8 *mem_ptr;
-    uint8 **middle_starts;
 
-    trie->ngram_mem_size = 0;
+    size = 0;
     for (i = 1; i < order - 1; i++) {
-        trie->ngram_mem_size +=
-            middle_size(lm_trie_quant_msize(trie->quant), counts[i],
+        size +=
+            middle_size(lm_trie_quant_msize(trie->quant, i - 1), counts[i],
                         counts[0], counts[i + 1]);
     }
-    trie->ngram_mem_size +=
+    size +=
         longest_size(lm_trie_quant_lsize(trie->quant), counts[order - 1],
                      counts[0]);
+    return size;
+}
+
+static void
+lm_trie_alloc_ngram(lm_trie_t * trie, uint32 * counts, int order)
+{
+    trie->ngram_mem_size = lm_trie_ngram_mem_size(trie, counts, order);
     trie->ngram_mem =
         (uint8 *) ckd_calloc(trie->ngram_mem_size,
                              sizeof(*trie->ngram_mem));
-    mem_ptr = trie->ngram_mem;
+    lm_trie_init_ngram(trie, counts, order);
+}
+
+/*
+ * Lay out the middle and longest arrays in trie->ngram_mem, or just
+ * set up their sizes if it is NULL because they are streamed to a file.
+ */
+static void
+lm_trie_init_ngram(lm_trie_t * trie, uint32 * counts, int order)
+{
+    int i;
+    size_t offset;
+    uint8 *mem_ptr;
+    uint8 **middle_starts;
+
+    offset = 0;
     trie->middle_begin =
         (middle_t *) ckd_calloc(order - 2, sizeof(*trie->middle_begin));
     trie->middle_end = trie->middle_begin + (order - 2);
     middle_starts =
         (uint8 **) ckd_calloc(order - 2, sizeof(*middle_starts));
     for (i = 2; i < order; i++) {
-        middle_starts[i - 2] = mem_ptr;
-        mem_ptr +=
-            middle_size(lm_trie_quant_msize(trie->quant), counts[i - 1],
-                        counts[0], counts[i]);
+        middle_starts[i - 2] = trie->ngram_mem
+            ? trie->ngram_mem + offset : NULL;
+        offset +=
+            middle_size(lm_trie_quant_msize(trie->quant, i - 2),
+                        counts[i - 1], counts[0], counts[i]);
     }
+    mem_ptr = trie->ngram_mem ? trie->ngram_mem + offset : NULL;
     trie->longest = (longest_t *) ckd_calloc(1, sizeof(*trie->longest));
     /* Crazy backwards thing so we initialize using pointers to ones that have already been initialized */
     for (i = order - 1; i >= 2; --i) {
         middle_t *middle_ptr = &trie->middle_begin[i - 2];
         middle_init(middle_ptr, middle_starts[i - 2],
-                    lm_trie_quant_msize(trie->quant), counts[i - 1],
+                    lm_trie_quant_msize(trie->quant, i - 2), counts[i - 1],
                     counts[0], counts[i],
                     (i ==
                      order -
@@ -462,25 +844,74 @@ lm_trie_alloc_ngram(lm_trie_t * trie, uint32 * counts, int order)
 }
 
 void
-lm_trie_build(lm_trie_t * trie, ngram_raw_t ** raw_ngrams, uint32 * counts, uint32 *out_counts,
-              int order)
+lm_trie_build(lm_trie_t * trie, ngram_raw_t ** raw_ngrams,
+              uint32 ** raw_words, uint32 * counts, uint32 * out_counts,
+              int order, int nthreads)
 {
-    int i;
+    trie_builder_t builder;
+    sbpool_t *pool;
+    uint32 next[NGRAM_MAX_ORDER - 1];
+    int c, k;
+
+    memset(&builder, 0, sizeof(builder));
+    builder.trie = trie;
+    builder.source.raw_ngrams = raw_ngrams;
+    builder.source.raw_words = raw_words;
+    builder.counts = counts;
+    builder.order = order;
+    pool = sbpool_init(NULL, nthreads);
+    nthreads = pool ? sbpool_nthreads(pool) : 1;
+    /* Use a few chunks per thread so that they finish together. */
+    builder.chunks = chunks_create(raw_ngrams, raw_words, counts, order,
+                                   nthreads > 1 ? nthreads * 4 : 1,
+                                   &builder.n_chunks);
 
-    lm_trie_fix_counts(raw_ngrams, counts, out_counts, order);
-    lm_trie_alloc_ngram(trie, out_counts, order);
-    
     if (order > 1)
         E_INFO("Training quantizer\n");
-    for (i = 2; i < order; i++) {
-        lm_trie_quant_train(trie->quant, i, counts[i - 1],
-                            raw_ngrams[i - 2]);
+    builder_run(&builder, pool, BUILD_COUNT, order - 1 + builder.n_chunks);
+
+    /* Entries of each chunk follow those of the previous ones. */
+    out_counts[0] = counts[0];
+    memset(next, 0, sizeof(next));
+    for (c = 0; c < builder.n_chunks; c++) {
+        trie_chunk_t *chunk = &builder.chunks[c];
+        for (k = 0; k < order - 1; k++) {
+            chunk->begin[k] = chunk->insert[k] = next[k];
+            next[k] += chunk->counts[k];
+        }
+    }
+    for (k = 0; k < order - 1; k++)
+        out_counts[k + 1] = next[k];
+    lm_trie_alloc_ngram(trie, out_counts, order);
+
+    /* All but the first chunk write to private memory, since the
+     * bytes at the edges of each chunk are shared with its
+     * neighbours. */
+    for (c = 1; c < builder.n_chunks; c++) {
+        trie_chunk_t *chunk = &builder.chunks[c];
+        for (k = 0; k < order - 1; k++) {
+            uint32 total_bits = chunk_base(trie, k, order)->total_bits;
+            if (chunk->counts[k] == 0)
+                continue;
+            chunk->shift[k] = (chunk->begin[k] * total_bits) & 7;
+            chunk->mem[k] = (uint8 *)
+                ckd_calloc(((chunk->shift[k]
+                             + chunk->counts[k] * total_bits + 7) >> 3)
+                           + sizeof(uint64), 1);
+        }
     }
-    lm_trie_quant_train_prob(trie->quant, order, counts[order - 1],
-                             raw_ngrams[order - 2]);
 
     E_INFO("Building LM trie\n");
-    recursive_insert(trie, raw_ngrams, counts, order);
+    builder_run(&builder, pool, BUILD_INSERT, builder.n_chunks);
+    sbpool_free(pool);
+    for (c = 1; c < builder.n_chunks; c++)
+        for (k = 0; k < order - 1; k++)
+            chunk_merge(trie, &builder.chunks[c], k, order);
+    ckd_free(builder.chunks);
+
+    for (k = 0; k < order - 2; k++)
+        trie->middle_begin[k].base.insert_index = out_counts[k + 1];
+    trie->longest->base.insert_index = out_counts[order - 1];
     /* Set ending offsets so the last entry will be sized properly */
     /* Last entry for unigrams was already set. */
     if (trie->middle_begin != trie->middle_end) {
@@ -497,6 +928,153 @@ lm_trie_build(lm_trie_t * trie, ngram_raw_t ** raw_ngrams, uint32 * counts, uint
     }
 }
 
+/*
+ * Smallest buffer for writing out each order when streaming, which
+ * must hold a few entries.
+ */
+#define STREAM_MIN_WRITE_BYTES 256
+
+/* Write out the rest of a streamed array and zeros up to its end. */
+static void
+chunk_finish(trie_chunk_t * chunk, base_t * base, int k, long end)
+{
+    size_t len;
+
+    chunk_flush(chunk, base, k, chunk->insert[k]);
+    len = end - chunk->out_offset[k];
+    assert(len <= chunk->mem_size[k] + sizeof(uint64));
+    if (fseek(chunk->out, chunk->out_offset[k], SEEK_SET) < 0
+        || fwrite(chunk->mem[k], 1, len, chunk->out) != len) {
+        E_ERROR_SYSTEM("Failed to write LM trie");
+        chunk->error = TRUE;
+    }
+}
+
+int
+lm_trie_build_stream(lm_trie_t * trie, ngram_runs_t * runs,
+                     uint32 * counts, uint32 * out_counts, int order,
+                     size_t budget, FILE * fp)
+{
+    raw_source_t source;
+    trie_chunk_t chunk;
+    long ug_offset, offset, end[NGRAM_MAX_ORDER - 1];
+    size_t max_samples, write_size;
+    int k, n_runs, sampled, rv;
+
+    out_counts[0] = counts[0];
+    if (order == 1) {
+        if (fwrite(trie->unigrams, sizeof(*trie->unigrams), counts[0] + 1,
+                   fp) != counts[0] + 1) {
+            E_ERROR_SYSTEM("Failed to write LM trie");
+            return -1;
+        }
+        return 0;
+    }
+
+    /* Half of the budget goes to samples for the quantizer, a
+     * quarter to reading runs and a quarter to writing the trie. */
+    memset(&source, 0, sizeof(source));
+    source.runs = runs;
+    for (n_runs = 0, k = 0; k < order - 1; k++)
+        n_runs += runs[k].n_runs;
+    source.run_buf_size = budget / 4 / (n_runs ? n_runs : 1);
+    max_samples = budget / 2 / (order - 1) / (2 * sizeof(float));
+    if (max_samples == 0)
+        max_samples = 1;
+    sampled = FALSE;
+    for (k = 0; k < order - 1; k++) {
+        uint32 n;
+
+        source.sample_step[k] =
+            (uint32) ((counts[k + 1] + max_samples - 1) / max_samples);
+        if (source.sample_step[k] == 0)
+            source.sample_step[k] = 1;
+        if (source.sample_step[k] > 1)
+            sampled = TRUE;
+        n = (counts[k + 1] + source.sample_step[k] - 1)
+            / source.sample_step[k];
+        source.samples[k][0] =
+            (float *) ckd_calloc(n ? n : 1, sizeof(float));
+        if (k < order - 2)
+            source.samples[k][1] =
+                (float *) ckd_calloc(n ? n : 1, sizeof(float));
+    }
+
+    /* A single chunk covers all the unigrams. */
+    memset(&chunk, 0, sizeof(chunk));
+    chunk.ug_end = counts[0] + 1;
+    for (k = 0; k < order - 1; k++)
+        chunk.raw_end[k] = counts[k + 1];
+    E_INFO("Counting N-Grams\n");
+    chunk_count(&source, &chunk, order);
+
+    E_INFO("Training quantizer%s\n", sampled ? " on a sample of N-Grams" : "");
+    for (k = 0; k < order - 1; k++) {
+        lm_trie_quant_train_values(trie->quant, k + 2, source.n_samples[k],
+                                   source.samples[k][0],
+                                   source.samples[k][1]);
+        ckd_free(source.samples[k][0]);
+        ckd_free(source.samples[k][1]);
+        source.samples[k][0] = source.samples[k][1] = NULL;
+        out_counts[k + 1] = chunk.counts[k];
+    }
+    if (source.error)
+        return -1;
+
+    /* The quantizer comes first, then the unigrams, then the arrays
+     * for each order, which are written out as they fill up. */
+    lm_trie_quant_write_bin(trie->quant, fp);
+    if ((ug_offset = ftell(fp)) < 0) {
+        E_ERROR_SYSTEM("Failed to find position in LM trie");
+        return -1;
+    }
+    lm_trie_init_ngram(trie, out_counts, order);
+    write_size = budget / 4 / (order - 1);
+    if (write_size < STREAM_MIN_WRITE_BYTES)
+        write_size = STREAM_MIN_WRITE_BYTES;
+    offset = ug_offset + (long) ((counts[0] + 1) * sizeof(*trie->unigrams));
+    for (k = 0; k < order - 1; k++) {
+        chunk.out_offset[k] = offset;
+        if (k < order - 2)
+            offset += middle_size(lm_trie_quant_msize(trie->quant, k),
+                                  out_counts[k + 1], out_counts[0],
+                                  out_counts[k + 2]);
+        else
+            offset += longest_size(lm_trie_quant_lsize(trie->quant),
+                                   out_counts[k + 1], out_counts[0]);
+        end[k] = offset;
+        chunk.mem_size[k] = write_size;
+        chunk.mem[k] = (uint8 *) ckd_calloc(write_size + sizeof(uint64), 1);
+    }
+    chunk.out = fp;
+
+    E_INFO("Building LM trie\n");
+    chunk_insert(trie, &source, &chunk, order);
+    /* Set ending offsets so the last entry will be sized properly */
+    for (k = 0; k < order - 2; k++) {
+        middle_t *middle = &trie->middle_begin[k];
+        bitarr_address_t address =
+            chunk_next_address(&chunk, &middle->base, k);
+        address.offset += middle->base.total_bits - middle->next_mask.bits;
+        bitarr_write_int25(address, middle->next_mask.bits,
+                           out_counts[k + 2]);
+    }
+    for (k = 0; k < order - 1; k++) {
+        chunk_finish(&chunk, chunk_base(trie, k, order), k, end[k]);
+        ckd_free(chunk.mem[k]);
+    }
+
+    rv = (source.error || chunk.error) ? -1 : 0;
+    if (fseek(fp, ug_offset, SEEK_SET) < 0
+        || fwrite(trie->unigrams, sizeof(*trie->unigrams), counts[0] + 1,
+                  fp) != counts[0] + 1
+        || fseek(fp, offset, SEEK_SET) < 0) {
+        E_ERROR_SYSTEM("Failed to write LM trie");
+        rv = -1;
+    }
+    return rv;
+}
+
 unigram_t *
 unigram_find(unigram_t * u, uint32 word, node_range_t * next)
 {
@@ -663,20 +1241,21 @@ get_available_backoff(lm_trie_t * trie, int32 start, int32 * hist,
     int32 *hist_iter;
     node_range_t node;
     unigram_t *first_hist = unigram_find(trie->unigrams, hist[0], &node);
-    if (start <= 1) {
+    if (start <= 1)
         backoff += first_hist->bo;
-        start = 2;
-    }
-    order_minus_2 = start - 2;
-    for (hist_iter = hist + start - 1; hist_iter < hist + n_hist;
+    /* Histories shorter than start are walked through but their
+     * backoff weights are not needed. */
+    order_minus_2 = 0;
+    for (hist_iter = hist + 1; hist_iter < hist + n_hist;
          hist_iter++, order_minus_2++) {
         bitarr_address_t address =
             middle_find(&trie->middle_begin[order_minus_2], *hist_iter,
                         &node);
         if (address.base == NULL)
             break;
-        backoff +=
-            lm_trie_quant_mboread(trie->quant, address, order_minus_2);
+        if (order_minus_2 + 2 >= start)
+            backoff +=
+                lm_trie_quant_mboread(trie->quant, address, order_minus_2);
     }
     return backoff;
 }
@@ -693,10 +1272,10 @@ lm_trie_nobo_score(lm_trie_t * trie, int32 wid, int32 * hist,
 }
 
 static float
-lm_trie_hist_score(lm_trie_t * trie, int32 wid, int32 * hist, int32 n_hist,
-                   int32 * n_used)
+lm_trie_hist_score(lm_trie_t * trie, ngram_hist_cache_t * cache,
+                   int32 wid, int32 * hist, int32 n_hist, int32 * n_used)
 {
-    float prob;
+    float prob, backoff;
     int i, j;
     node_range_t node;
     bitarr_address_t address;
@@ -708,10 +1287,12 @@ lm_trie_hist_score(lm_trie_t * trie, int32 wid, int32 * hist, int32 n_hist,
     for (i = 0; i < n_hist - 1; i++) {
         address = middle_find(&trie->middle_begin[i], hist[i], &node);
         if (address.base == NULL) {
-            for (j = i; j < n_hist; j++) {
-                prob += trie->backoff_cache[j];
+            /* Summed as in lm_trie_nobo_score() so that scores do
+             * not depend on which path gave them. */
+            for (backoff = 0.0f, j = i; j < n_hist; j++) {
+                backoff += cache->backoff[j];
             }
-            return prob;
+            return prob + backoff;
         }
         else {
             (*n_used)++;
@@ -720,7 +1301,7 @@ lm_trie_hist_score(lm_trie_t * trie, int32 wid, int32 * hist, int32 n_hist,
     }
     address = longest_find(trie->longest, hist[n_hist - 1], &node);
     if (address.base == NULL) {
-        return prob + trie->backoff_cache[n_hist - 1];
+        return prob + cache->backoff[n_hist - 1];
     }
     else {
         (*n_used)++;
@@ -741,27 +1322,29 @@ history_matches(int32 * hist, int32 * prev_hist, int32 n_hist)
 }
 
 static void
-update_backoff(lm_trie_t * trie, int32 * hist, int32 n_hist)
+update_backoff(lm_trie_t * trie, ngram_hist_cache_t * cache,
+               int32 * hist, int32 n_hist)
 {
     int i;
     node_range_t node;
     bitarr_address_t address;
 
-    memset(trie->backoff_cache, 0, sizeof(trie->backoff_cache));
-    trie->backoff_cache[0] = unigram_find(trie->unigrams, hist[0], &node)->bo;
+    memset(cache->backoff, 0, sizeof(cache->backoff));
+    cache->backoff[0] = unigram_find(trie->unigrams, hist[0], &node)->bo;
     for (i = 1; i < n_hist; i++) {
         address = middle_find(&trie->middle_begin[i - 1], hist[i], &node);
         if (address.base == NULL) {
             break;
         }
-        trie->backoff_cache[i] =
+        cache->backoff[i] =
             lm_trie_quant_mboread(trie->quant, address, i - 1);
     }
-    memcpy(trie->hist_cache, hist, n_hist * sizeof(*hist));
+    memcpy(cache->hist, hist, n_hist * sizeof(*hist));
 }
 
 float
-lm_trie_score(lm_trie_t * trie, int order, int32 wid, int32 * hist,
+lm_trie_score(lm_trie_t * trie, ngram_hist_cache_t * cache,
+              int order, int32 wid, int32 * hist,
               int32 n_hist, int32 * n_used)
 {
     if (n_hist < order - 1) {
@@ -769,16 +1352,283 @@ lm_trie_score(lm_trie_t * trie, int order, int32 wid, int32 * hist,
     }
     else {
         assert(n_hist == order - 1);
-        if (!history_matches(hist, (int32 *) trie->hist_cache, n_hist)) {
-            update_backoff(trie, hist, n_hist);
+        if (!history_matches(hist, (int32 *) cache->hist, n_hist)) {
+            update_backoff(trie, cache, hist, n_hist);
+        }
+        return lm_trie_hist_score(trie, cache, wid, hist, n_hist, n_used);
+    }
+}
+
+void
+lm_trie_state_init(lm_trie_t * trie, int order, ngram_state_t * state)
+{
+    node_range_t node;
+    bitarr_address_t address;
+    int i;
+
+    if (state->n_hist > order - 1)
+        state->n_hist = order - 1;
+    if (state->n_hist == 0)
+        return;
+    /* Keep only the part of the history that is itself an N-Gram, as
+     * longer ones have no backoff weight. */
+    state->backoff[0] =
+        unigram_find(trie->unigrams, state->hist[0], &node)->bo;
+    for (i = 1; i < state->n_hist; i++) {
+        address = middle_find(&trie->middle_begin[i - 1], state->hist[i],
+                              &node);
+        if (address.base == NULL) {
+            state->n_hist = i;
+            break;
+        }
+        state->backoff[i] =
+            lm_trie_quant_mboread(trie->quant, address, i - 1);
+    }
+}
+
+float
+lm_trie_score_state(lm_trie_t * trie, int order,
+                    const ngram_state_t * state, int32 wid,
+                    ngram_state_t * out_state, int32 * n_used)
+{
+    ngram_state_t next;
+    float prob, backoff;
+    node_range_t node;
+    bitarr_address_t address;
+    int i, j;
+
+    /* The trie is searched from wid back through its history, and
+     * each N-Gram found along the way is also the next context. */
+    unigram_t *unigram = unigram_find(trie->unigrams, wid, &node);
+    prob = unigram->prob;
+    *n_used = 1;
+    next.n_hist = (order > 1);
+    next.hist[0] = wid;
+    next.backoff[0] = unigram->bo;
+    for (i = 0; i < state->n_hist; i++) {
+        if (i == order - 2) {
+            address = longest_find(trie->longest, state->hist[i], &node);
+            if (address.base == NULL)
+                break;
+            prob = lm_trie_quant_lpread(trie->quant, address);
+        }
+        else {
+            address = middle_find(&trie->middle_begin[i], state->hist[i],
+                                  &node);
+            if (address.base == NULL)
+                break;
+            prob = lm_trie_quant_mpread(trie->quant, address, i);
+            next.hist[i + 1] = state->hist[i];
+            next.backoff[i + 1] =
+                lm_trie_quant_mboread(trie->quant, address, i);
+            next.n_hist = i + 2;
+        }
+        *n_used = i + 2;
+    }
+    /* Summed as in lm_trie_nobo_score(). */
+    for (backoff = 0.0f, j = i; j < state->n_hist; j++)
+        backoff += state->backoff[j];
+    *out_state = next;
+    if (i < state->n_hist)
+        return prob + backoff;
+    return prob;
+}
+
+/*
+ * Batched lookups follow the same paths as lm_trie_score(), but one
+ * trie level at a time for each of a window of queries, so that the
+ * memory for a query's next probe can be prefetched while the others
+ * are worked on.  Backoff weights are looked up along the history
+ * only once the probability shows they are needed.
+ */
+#define LOOKUP_WINDOW 16
+
+enum {
+    LOOKUP_PROB,                /**< Looking for the longest N-Gram */
+    LOOKUP_BACKOFF,             /**< Looking for history backoffs */
+    LOOKUP_DONE
+};
+
+typedef struct trie_lookup_s {
+    int32 query;                /**< Index of this query */
+    int32 wid;
+    int32 *hist;
+    int32 n_hist;
+    int stage;
+    int level;                  /**< Next level to probe in this stage */
+    node_range_t node;          /**< Range to search at that level */
+    float prob;
+    int32 n_used;
+    float backoff[NGRAM_MAX_ORDER]; /**< As in ngram_hist_cache_t */
+} trie_lookup_t;
+
+/* Prefetch the entry a search of node for word will look at first. */
+static void
+lookup_prefetch_find(base_t * base, node_range_t * node, uint32 word)
+{
+    uint32 pivot;
+
+    if (node->end <= node->begin || word > base->max_vocab)
+        return;
+    pivot = node->begin + calc_pivot(word, base->max_vocab,
+                                     node->end - node->begin);
+    ngram_prefetch(base->base
+                   + ((size_t) pivot * base->total_bits >> 3));
+}
+
+static void
+lookup_prefetch(lm_trie_t * trie, int order, trie_lookup_t * q)
+{
+    int32 word;
+
+    if (q->stage == LOOKUP_DONE)
+        return;
+    word = (q->stage == LOOKUP_PROB)
+        ? (q->level == 0 ? q->wid : q->hist[q->level - 1])
+        : q->hist[q->level];
+    if (q->level == 0)
+        ngram_prefetch(&trie->unigrams[word]);
+    else if (q->stage == LOOKUP_PROB && q->level == order - 1)
+        lookup_prefetch_find(&trie->longest->base, &q->node, word);
+    else
+        lookup_prefetch_find(&trie->middle_begin[q->level - 1].base,
+                             &q->node, word);
+}
+
+/* Probe the next level of a lookup. */
+static void
+lookup_step(lm_trie_t * trie, int order, trie_lookup_t * q)
+{
+    bitarr_address_t address;
+
+    if (q->stage == LOOKUP_PROB) {
+        if (q->level == 0) {
+            q->prob = unigram_find(trie->unigrams, q->wid, &q->node)->prob;
+            q->n_used = 1;
+        }
+        else if (q->level == order - 1) {
+            address = longest_find(trie->longest, q->hist[q->level - 1],
+                                   &q->node);
+            if (address.base != NULL) {
+                q->prob = lm_trie_quant_lpread(trie->quant, address);
+                q->n_used = q->level + 1;
+            }
+        }
+        else {
+            address = middle_find(&trie->middle_begin[q->level - 1],
+                                  q->hist[q->level - 1], &q->node);
+            if (address.base != NULL) {
+                q->prob = lm_trie_quant_mpread(trie->quant, address,
+                                               q->level - 1);
+                q->n_used = q->level + 1;
+            }
+        }
+        if (q->n_used == q->level + 1 && q->level < q->n_hist) {
+            q->level++;
+            return;
+        }
+        /* Backoff weights are needed from the first missing level. */
+        if (q->n_used > q->n_hist) {
+            q->stage = LOOKUP_DONE;
+            return;
+        }
+        q->stage = LOOKUP_BACKOFF;
+        q->level = 0;
+        return;
+    }
+
+    if (q->level == 0) {
+        q->backoff[0] =
+            unigram_find(trie->unigrams, q->hist[0], &q->node)->bo;
+    }
+    else {
+        address = middle_find(&trie->middle_begin[q->level - 1],
+                              q->hist[q->level], &q->node);
+        if (address.base == NULL) {
+            q->stage = LOOKUP_DONE;
+            return;
+        }
+        q->backoff[q->level] =
+            lm_trie_quant_mboread(trie->quant, address, q->level - 1);
+    }
+    if (++q->level == q->n_hist)
+        q->stage = LOOKUP_DONE;
+}
+
+/* Add up the result of a finished lookup the way lm_trie_score() does. */
+static float
+lookup_score(trie_lookup_t * q)
+{
+    float backoff;
+    int j;
+
+    if (q->n_used > q->n_hist)
+        return q->prob;
+    for (backoff = 0.0f, j = q->n_used - 1; j < q->n_hist; j++)
+        backoff += q->backoff[j];
+    return q->prob + backoff;
+}
+
+static void
+lookup_start(trie_lookup_t * q, int32 query, int32 wid, int32 * hist,
+             int32 n_hist)
+{
+    memset(q, 0, sizeof(*q));
+    q->query = query;
+    q->wid = wid;
+    q->hist = hist;
+    q->n_hist = n_hist;
+    q->stage = LOOKUP_PROB;
+}
+
+void
+lm_trie_score_batch(lm_trie_t * trie, int order, int32 * wids,
+                    int32 ** hists, int32 * n_hists, int32 n_queries,
+                    float *out_probs, int32 * out_n_used)
+{
+    trie_lookup_t window[LOOKUP_WINDOW];
+    int32 next;
+    int i, n_active;
+
+    /* Fill the window and prefetch everyone's unigrams. */
+    for (n_active = 0, next = 0;
+         n_active < LOOKUP_WINDOW && next < n_queries; n_active++, next++) {
+        lookup_start(&window[n_active], next, wids[next], hists[next],
+                     n_hists[next]);
+        lookup_prefetch(trie, order, &window[n_active]);
+    }
+    while (n_active > 0) {
+        for (i = 0; i < n_active; i++) {
+            trie_lookup_t *q = &window[i];
+
+            lookup_step(trie, order, q);
+            if (q->stage != LOOKUP_DONE) {
+                lookup_prefetch(trie, order, q);
+                continue;
+            }
+            out_probs[q->query] = lookup_score(q);
+            out_n_used[q->query] = q->n_used;
+            /* Take the next query, or close the gap. */
+            if (next < n_queries) {
+                lookup_start(q, next, wids[next], hists[next],
+                             n_hists[next]);
+                next++;
+            }
+            else {
+                *q = window[--n_active];
+                /* The one moved here hasn't had its turn yet. */
+                i--;
+                continue;
+            }
+            lookup_prefetch(trie, order, q);
         }
-        return lm_trie_hist_score(trie, wid, hist, n_hist, n_used);
     }
 }
 
 void
 lm_trie_fill_raw_ngram(lm_trie_t * trie,
-    		       ngram_raw_t * raw_ngrams, uint32 * raw_ngram_idx,
+    		       ngram_raw_t * raw_ngrams, uint32 * raw_words,
+                       uint32 * raw_ngram_idx,
             	       uint32 * counts, node_range_t range, uint32 * hist,
     	               int n_hist, int order, int max_order)
 {
@@ -791,8 +1641,9 @@ lm_trie_fill_raw_ngram(lm_trie_t * trie,
             node_range_t node;
             unigram_find(trie->unigrams, i, &node);
             hist[0] = i;
-            lm_trie_fill_raw_ngram(trie, raw_ngrams, raw_ngram_idx, counts,
-                           node, hist, 1, order, max_order);
+            lm_trie_fill_raw_ngram(trie, raw_ngrams, raw_words,
+                                   raw_ngram_idx, counts, node, hist, 1,
+                                   order, max_order);
         }
     }
     else if (n_hist < order - 1) {
@@ -818,8 +1669,9 @@ lm_trie_fill_raw_ngram(lm_trie_t * trie,
             node.end =
                 bitarr_read_int25(address, middle->next_mask.bits,
                                   middle->next_mask.mask);
-            lm_trie_fill_raw_ngram(trie, raw_ngrams, raw_ngram_idx, counts,
-                           node, hist, n_hist + 1, order, max_order);
+            lm_trie_fill_raw_ngram(trie, raw_ngrams, raw_words,
+                                   raw_ngram_idx, counts, node, hist,
+                                   n_hist + 1, order, max_order);
         }
     }
     else {
@@ -856,10 +1708,10 @@ lm_trie_fill_raw_ngram(lm_trie_t * trie,
                 raw_ngram->backoff = backoff;
             }
             raw_ngram->prob = prob;
-            raw_ngram->words =
-                (uint32 *) ckd_calloc(order, sizeof(*raw_ngram->words));
+            raw_ngram->order = order;
+            raw_ngram->offset = *raw_ngram_idx;
             for (i = 0; i <= n_hist; i++) {
-                raw_ngram->words[i] = hist[n_hist - i];
+                ngram_raw_words(raw_words, raw_ngram)[i] = hist[n_hist - i];
             }
             (*raw_ngram_idx)++;
         }
@@ -40,6 +40,7 @@
 
 #include <sphinxbase/pio.h>
 #include <sphinxbase/bitarr.h>
+#include <sphinxbase/mmio.h>
 
 #include "ngram_model_internal.h"
 #include "lm_trie_quant.h"
@@ -84,31 +85,96 @@ typedef struct lm_trie_s {
     middle_t *middle_end;
     longest_t *longest;
     lm_trie_quant_t *quant;
-
-    float backoff_cache[NGRAM_MAX_ORDER];
-    uint32 hist_cache[NGRAM_MAX_ORDER - 1];
+    mmio_file_t *filemem;       /**< Mapped binary file, or NULL */
+    uint8 unigrams_mapped;      /**< Unigrams point into filemem */
 } lm_trie_t;
 
 /**
- * Creates lm_trie structure. Fills it if binary file with correspondent data is provided
+ * Creates lm_trie structure. Fills it if binary file with correspondent data is provided.
+ * prob_bits and bo_bits are passed on to lm_trie_quant_create().
  */
-lm_trie_t *lm_trie_create(uint32 unigram_count, int order);
+lm_trie_t *lm_trie_create(uint32 unigram_count, int order,
+                          const uint8 * prob_bits, const uint8 * bo_bits);
 
 lm_trie_t *lm_trie_read_bin(uint32 * counts, int order, FILE * fp);
 
+/**
+ * Creates lm_trie structure whose unigram and n-gram arrays point
+ * directly into a memory-mapped binary file.  fp must be positioned
+ * just after the counts, at the offset corresponding to the same
+ * position in filemem, and is left just after the trie.  Takes
+ * ownership of filemem on success.
+ */
+lm_trie_t *lm_trie_read_mmap(uint32 * counts, int order, FILE * fp,
+                             mmio_file_t * filemem);
+
 void lm_trie_write_bin(lm_trie_t * trie, uint32 unigram_count, FILE * fp);
 
 void lm_trie_free(lm_trie_t * trie);
 
+/**
+ * Fills the trie from sorted raw N-Grams, adding entries for any
+ * missing prefixes.  The entries are split up by their first word and
+ * filled in by up to nthreads threads.  out_counts receives the
+ * number of entries of each order.
+ */
 void lm_trie_build(lm_trie_t * trie, ngram_raw_t ** raw_ngrams,
-                   uint32 * counts, uint32 *out_counts, int order);
+                   uint32 ** raw_words, uint32 * counts,
+                   uint32 *out_counts, int order, int nthreads);
+
+/**
+ * Builds the trie for the binary file fp from sorted runs of raw
+ * N-Grams, which are merged as they are read, writing the
+ * quantization tables, unigrams and N-Gram arrays from the current
+ * position onwards.  The arrays are written out as they fill up, so
+ * only about budget bytes are kept in memory besides the unigrams.
+ * If the quantizer would need more, it is trained on a sample of the
+ * N-Grams.  out_counts receives the number of entries of each order.
+ * Returns 0 on success, or -1 if the runs or fp can't be read or
+ * written.
+ */
+int lm_trie_build_stream(lm_trie_t * trie, ngram_runs_t * runs,
+                         uint32 * counts, uint32 * out_counts, int order,
+                         size_t budget, FILE * fp);
 
 void lm_trie_fill_raw_ngram(lm_trie_t * trie,
-			    ngram_raw_t * raw_ngrams, uint32 * raw_ngram_idx,
+			    ngram_raw_t * raw_ngrams, uint32 * raw_words,
+                            uint32 * raw_ngram_idx,
             	            uint32 * counts, node_range_t range, uint32 * hist,
     	                    int n_hist, int order, int max_order);
 
-float lm_trie_score(lm_trie_t * trie, int order, int32 wid, int32 * hist,
+/**
+ * Look up the probability of an N-Gram.  The trie itself is not
+ * modified; backoff weights for the full-length history are kept in
+ * cache, so calls with the same cache must not run concurrently.
+ */
+float lm_trie_score(lm_trie_t * trie, ngram_hist_cache_t * cache,
+                    int order, int32 wid, int32 * hist,
                     int32 n_hist, int32 * n_used);
 
+/**
+ * Fill in the backoff weights of a language model state whose history
+ * has been set, shortening it to the longest part found in the trie.
+ */
+void lm_trie_state_init(lm_trie_t * trie, int order, ngram_state_t * state);
+
+/**
+ * Look up the probability of wid following state, giving the same
+ * result as lm_trie_score() with the state's history, and the state
+ * following wid.
+ */
+float lm_trie_score_state(lm_trie_t * trie, int order,
+                          const ngram_state_t * state, int32 wid,
+                          ngram_state_t * out_state, int32 * n_used);
+
+/**
+ * Look up the probabilities of many N-Grams at once, giving the same
+ * results as lm_trie_score() without using a cache.  Lookups are
+ * interleaved, prefetching the memory each one needs next, so that
+ * cache misses overlap.  n_hists must already be limited to order - 1.
+ */
+void lm_trie_score_batch(lm_trie_t * trie, int order, int32 * wids,
+                         int32 ** hists, int32 * n_hists, int32 n_queries,
+                         float *out_probs, int32 * out_n_used);
+
 #endif                          /* __LM_TRIE_H__ */
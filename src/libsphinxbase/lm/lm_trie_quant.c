@@ -36,6 +36,7 @@
  */
 
 #include <math.h>
+#include <string.h>
 
 #include <sphinxbase/prim_type.h>
 #include <sphinxbase/ckd_alloc.h>
@@ -46,9 +47,24 @@
 
 #define FLOAT_INF (0x7f800000)
 
+/* Quantizer types stored in binary files.  Files with the default
+ * widths keep the original type so that older readers can load them. */
+#define QUANT_TYPE_DEFAULT 1
+#define QUANT_TYPE_BITS 2
+
+/* Bit widths of probabilities, then backoff weights, are stored as
+ * bytes, padded so that the tables and unigrams after them stay
+ * aligned. */
+#define QUANT_BITS_SIZE ((2 * (NGRAM_MAX_ORDER - 1) + 3) & ~3)
+
+/* Maximum number of refinement passes over the bin centers. */
+#define LLOYD_ITERATIONS 20
+
 typedef struct bins_s {
     float *begin;
     const float *end;
+    uint8 bits;
+    uint32 mask;
 } bins_t;
 
 struct lm_trie_quant_s {
@@ -56,10 +72,9 @@ struct lm_trie_quant_s {
     bins_t *longest;
     uint8 *mem;
     size_t mem_size;
-    uint8 prob_bits;
-    uint8 bo_bits;
-    uint32 prob_mask;
-    uint32 bo_mask;
+    int order;
+    uint8 prob_bits[NGRAM_MAX_ORDER - 1];
+    uint8 bo_bits[NGRAM_MAX_ORDER - 1];
 };
 
 static void
@@ -67,6 +82,8 @@ bins_create(bins_t * bins, uint8 bits, float *begin)
 {
     bins->begin = begin;
     bins->end = bins->begin + (1ULL << bits);
+    bins->bits = bits;
+    bins->mask = (1U << bits) - 1;
 }
 
 static float *
@@ -109,54 +126,114 @@ bins_decode(bins_t * bins, size_t off)
 }
 
 static size_t
-quant_size(int order)
+quant_size(int order, const uint8 * prob_bits, const uint8 * bo_bits)
 {
-    int prob_bits = 16;
-    int bo_bits = 16;
-    size_t longest_table = (1U << prob_bits) * sizeof(float);
-    size_t middle_table = (1U << bo_bits) * sizeof(float) + longest_table;
+    size_t size = 0;
+    int i;
+
     /* unigrams are currently not quantized so no need for a table. */
-    return (order - 2) * middle_table + longest_table;
+    for (i = 0; i < order - 1; i++) {
+        size += (1ULL << prob_bits[i]) * sizeof(float);
+        if (i < order - 2)
+            size += (1ULL << bo_bits[i]) * sizeof(float);
+    }
+    return size;
 }
 
 lm_trie_quant_t *
-lm_trie_quant_create(int order)
+lm_trie_quant_create(int order, const uint8 * prob_bits,
+                     const uint8 * bo_bits)
 {
     float *start;
     int i;
     lm_trie_quant_t *quant =
         (lm_trie_quant_t *) ckd_calloc(1, sizeof(*quant));
-    quant->mem_size = quant_size(order);
+
+    quant->order = order;
+    for (i = 0; i < order - 1; i++) {
+        quant->prob_bits[i] =
+            prob_bits ? prob_bits[i] : LM_TRIE_QUANT_DEFAULT_BITS;
+        quant->bo_bits[i] = (i == order - 2) ? 0
+            : bo_bits ? bo_bits[i] : LM_TRIE_QUANT_DEFAULT_BITS;
+    }
+    quant->mem_size = quant_size(order, quant->prob_bits, quant->bo_bits);
     quant->mem =
         (uint8 *) ckd_calloc(quant->mem_size, sizeof(*quant->mem));
 
-    quant->prob_bits = 16;
-    quant->bo_bits = 16;
-    quant->prob_mask = (1U << quant->prob_bits) - 1;
-    quant->bo_mask = (1U << quant->bo_bits) - 1;
-
     start = (float *) (quant->mem);
     for (i = 0; i < order - 2; i++) {
-        bins_create(&quant->tables[i][0], quant->prob_bits, start);
-        start += (1ULL << quant->prob_bits);
-        bins_create(&quant->tables[i][1], quant->bo_bits, start);
-        start += (1ULL << quant->bo_bits);
+        bins_create(&quant->tables[i][0], quant->prob_bits[i], start);
+        start += (1ULL << quant->prob_bits[i]);
+        bins_create(&quant->tables[i][1], quant->bo_bits[i], start);
+        start += (1ULL << quant->bo_bits[i]);
     }
-    bins_create(&quant->tables[order - 2][0], quant->prob_bits, start);
+    bins_create(&quant->tables[order - 2][0], quant->prob_bits[order - 2],
+                start);
     quant->longest = &quant->tables[order - 2][0];
     return quant;
 }
 
+/* Whether all orders use the default widths. */
+static int
+quant_is_default(lm_trie_quant_t * quant)
+{
+    int i;
+
+    for (i = 0; i < quant->order - 1; i++) {
+        if (quant->prob_bits[i] != LM_TRIE_QUANT_DEFAULT_BITS)
+            return FALSE;
+        if (i < quant->order - 2
+            && quant->bo_bits[i] != LM_TRIE_QUANT_DEFAULT_BITS)
+            return FALSE;
+    }
+    return TRUE;
+}
 
 lm_trie_quant_t *
 lm_trie_quant_read_bin(FILE * fp, int order)
 {
-    int dummy;
+    int type;
+    uint8 bits[QUANT_BITS_SIZE];
+    uint8 *bo_bits = bits + NGRAM_MAX_ORDER - 1;
     lm_trie_quant_t *quant;
 
-    fread(&dummy, sizeof(dummy), 1, fp);
-    quant = lm_trie_quant_create(order);
-    fread(quant->mem, sizeof(*quant->mem), quant->mem_size, fp);
+    if (fread(&type, sizeof(type), 1, fp) != 1) {
+        E_ERROR("Failed to read quantizer type\n");
+        return NULL;
+    }
+    if (type == QUANT_TYPE_DEFAULT) {
+        quant = lm_trie_quant_create(order, NULL, NULL);
+    }
+    else if (type == QUANT_TYPE_BITS) {
+        int i;
+
+        if (fread(bits, 1, QUANT_BITS_SIZE, fp) != QUANT_BITS_SIZE) {
+            E_ERROR("Failed to read quantizer bit widths\n");
+            return NULL;
+        }
+        for (i = 0; i < order - 1; i++) {
+            if (bits[i] < LM_TRIE_QUANT_MIN_BITS
+                || bits[i] > LM_TRIE_QUANT_MAX_BITS
+                || (i < order - 2
+                    && (bo_bits[i] < LM_TRIE_QUANT_MIN_BITS
+                        || bo_bits[i] > LM_TRIE_QUANT_MAX_BITS))) {
+                E_ERROR("Invalid quantizer bit widths for %d-grams\n",
+                        i + 2);
+                return NULL;
+            }
+        }
+        quant = lm_trie_quant_create(order, bits, bo_bits);
+    }
+    else {
+        E_ERROR("Unknown quantizer type %d\n", type);
+        return NULL;
+    }
+    if (fread(quant->mem, sizeof(*quant->mem), quant->mem_size, fp)
+        != quant->mem_size) {
+        E_ERROR("Failed to read quantization tables\n");
+        lm_trie_quant_free(quant);
+        return NULL;
+    }
 
     return quant;
 }
@@ -164,9 +241,23 @@ lm_trie_quant_read_bin(FILE * fp, int order)
 void
 lm_trie_quant_write_bin(lm_trie_quant_t * quant, FILE * fp)
 {
-    /* Before it was quantization type */
-    int dummy = 1;
-    fwrite(&dummy, sizeof(dummy), 1, fp);
+    int type;
+
+    if (quant_is_default(quant)) {
+        type = QUANT_TYPE_DEFAULT;
+        fwrite(&type, sizeof(type), 1, fp);
+    }
+    else {
+        uint8 bits[QUANT_BITS_SIZE];
+
+        memset(bits, 0, sizeof(bits));
+        memcpy(bits, quant->prob_bits, NGRAM_MAX_ORDER - 1);
+        memcpy(bits + NGRAM_MAX_ORDER - 1, quant->bo_bits,
+               NGRAM_MAX_ORDER - 1);
+        type = QUANT_TYPE_BITS;
+        fwrite(&type, sizeof(type), 1, fp);
+        fwrite(bits, 1, QUANT_BITS_SIZE, fp);
+    }
     fwrite(quant->mem, sizeof(*quant->mem), quant->mem_size, fp);
 }
 
@@ -179,21 +270,86 @@ lm_trie_quant_free(lm_trie_quant_t * quant)
 }
 
 uint8
-lm_trie_quant_msize(lm_trie_quant_t * quant)
+lm_trie_quant_msize(lm_trie_quant_t * quant, int order_minus_2)
 {
-    return 32;
+    return quant->prob_bits[order_minus_2] + quant->bo_bits[order_minus_2];
 }
 
 uint8
 lm_trie_quant_lsize(lm_trie_quant_t * quant)
 {
-    return 16;
+    return quant->longest->bits;
 }
 
 static int
 weights_comparator(const void *a, const void *b)
 {
-    return (int) (*(float *) a - *(float *) b);
+    float fa = *(const float *) a, fb = *(const float *) b;
+
+    return (fa > fb) - (fa < fb);
+}
+
+static float *
+upper_bound(float *first, const float *last, float val)
+{
+    int count, step;
+    float *it;
+
+    count = last - first;
+    while (count > 0) {
+        it = first;
+        step = count / 2;
+        it += step;
+        if (!(val < *it)) {
+            first = ++it;
+            count -= step + 1;
+        }
+        else {
+            count = step;
+        }
+    }
+    return first;
+}
+
+/*
+ * Refine bin centers with Lloyd's algorithm: assign each value to its
+ * nearest center, then move each center to the mean of its values,
+ * until the centers stop moving.  Values are sorted, so the values of
+ * a bin are those between the midpoints to its neighbours.  Bins left
+ * without values keep their centers.
+ */
+static void
+refine_bins(float *values, uint32 values_num, float *centers, uint32 bins)
+{
+    const float *end = values + values_num;
+    int iter;
+
+    for (iter = 0; iter < LLOYD_ITERATIONS; iter++) {
+        float *start, *finish;
+        int changed = FALSE;
+        uint32 i;
+
+        for (i = 0, start = values; i < bins; i++, start = finish) {
+            double sum = 0.0;
+            float *ptr;
+
+            /* Midpoints use the old centers, so find this boundary
+             * before moving the center. */
+            finish = (i + 1 < bins)
+                ? upper_bound(start, end,
+                              (centers[i] + centers[i + 1]) / 2) : (float *) end;
+            if (finish == start)
+                continue;
+            for (ptr = start; ptr != finish; ptr++)
+                sum += *ptr;
+            if ((float) (sum / (finish - start)) != centers[i]) {
+                centers[i] = (float) (sum / (finish - start));
+                changed = TRUE;
+            }
+        }
+        if (!changed)
+            break;
+    }
 }
 
 static void
@@ -219,6 +375,18 @@ make_bins(float *values, uint32 values_num, float *centers, uint32 bins)
             *centers = sum / (float) (finish - start);
         }
     }
+    refine_bins(values, values_num, centers - bins, bins);
+}
+
+void
+lm_trie_quant_train_values(lm_trie_quant_t * quant, int order,
+                           uint32 counts, float *probs, float *backoffs)
+{
+    make_bins(probs, counts, quant->tables[order - 2][0].begin,
+              1ULL << quant->prob_bits[order - 2]);
+    if (backoffs)
+        make_bins(backoffs, counts, quant->tables[order - 2][1].begin,
+                  1ULL << quant->bo_bits[order - 2]);
 }
 
 void
@@ -227,25 +395,15 @@ lm_trie_quant_train(lm_trie_quant_t * quant, int order, uint32 counts,
 {
     float *probs;
     float *backoffs;
-    float *centers;
-    uint32 backoff_num;
-    uint32 prob_num;
-    ngram_raw_t *raw_ngrams_end;
+    uint32 i;
 
     probs = (float *) ckd_calloc(counts, sizeof(*probs));
     backoffs = (float *) ckd_calloc(counts, sizeof(*backoffs));
-    raw_ngrams_end = raw_ngrams + counts;
-
-    for (backoff_num = 0, prob_num = 0; raw_ngrams != raw_ngrams_end;
-         raw_ngrams++) {
-        probs[prob_num++] = raw_ngrams->prob;
-        backoffs[backoff_num++] = raw_ngrams->backoff;
+    for (i = 0; i < counts; i++) {
+        probs[i] = raw_ngrams[i].prob;
+        backoffs[i] = raw_ngrams[i].backoff;
     }
-
-    make_bins(probs, prob_num, quant->tables[order - 2][0].begin,
-              1ULL << quant->prob_bits);
-    centers = quant->tables[order - 2][1].begin;
-    make_bins(backoffs, backoff_num, centers, (1ULL << quant->bo_bits));
+    lm_trie_quant_train_values(quant, order, counts, probs, backoffs);
     ckd_free(probs);
     ckd_free(backoffs);
 }
@@ -255,18 +413,12 @@ lm_trie_quant_train_prob(lm_trie_quant_t * quant, int order, uint32 counts,
                          ngram_raw_t * raw_ngrams)
 {
     float *probs;
-    uint32 prob_num;
-    ngram_raw_t *raw_ngrams_end;
+    uint32 i;
 
     probs = (float *) ckd_calloc(counts, sizeof(*probs));
-    raw_ngrams_end = raw_ngrams + counts;
-
-    for (prob_num = 0; raw_ngrams != raw_ngrams_end; raw_ngrams++) {
-        probs[prob_num++] = raw_ngrams->prob;
-    }
-
-    make_bins(probs, prob_num, quant->tables[order - 2][0].begin,
-              1ULL << quant->prob_bits);
+    for (i = 0; i < counts; i++)
+        probs[i] = raw_ngrams[i].prob;
+    lm_trie_quant_train_values(quant, order, counts, probs, NULL);
     ckd_free(probs);
 }
 
@@ -274,22 +426,20 @@ void
 lm_trie_quant_mwrite(lm_trie_quant_t * quant, bitarr_address_t address,
                      int order_minus_2, float prob, float backoff)
 {
-    bitarr_write_int57(address, quant->prob_bits + quant->bo_bits,
-                       (uint64) ((bins_encode
-                                  (&quant->tables[order_minus_2][0],
-                                   prob) << quant->
-                                  bo_bits) | bins_encode(&quant->
-                                                         tables
-                                                         [order_minus_2]
-                                                         [1],
-                                                         backoff)));
+    bins_t *prob_bins = &quant->tables[order_minus_2][0];
+    bins_t *bo_bins = &quant->tables[order_minus_2][1];
+
+    bitarr_write_int57(address, prob_bins->bits + bo_bins->bits,
+                       (uint64) ((bins_encode(prob_bins, prob)
+                                  << bo_bins->bits)
+                                 | bins_encode(bo_bins, backoff)));
 }
 
 void
 lm_trie_quant_lwrite(lm_trie_quant_t * quant, bitarr_address_t address,
                      float prob)
 {
-    bitarr_write_int25(address, quant->prob_bits,
+    bitarr_write_int25(address, quant->longest->bits,
                        (uint32) bins_encode(quant->longest, prob));
 }
 
@@ -297,25 +447,29 @@ float
 lm_trie_quant_mboread(lm_trie_quant_t * quant, bitarr_address_t address,
                       int order_minus_2)
 {
-    return bins_decode(&quant->tables[order_minus_2][1],
-                       bitarr_read_int25(address, quant->bo_bits,
-                                         quant->bo_mask));
+    bins_t *bo_bins = &quant->tables[order_minus_2][1];
+
+    return bins_decode(bo_bins,
+                       bitarr_read_int25(address, bo_bins->bits,
+                                         bo_bins->mask));
 }
 
 float
 lm_trie_quant_mpread(lm_trie_quant_t * quant, bitarr_address_t address,
                      int order_minus_2)
 {
-    address.offset += quant->bo_bits;
-    return bins_decode(&quant->tables[order_minus_2][0],
-                       bitarr_read_int25(address, quant->prob_bits,
-                                         quant->prob_mask));
+    bins_t *prob_bins = &quant->tables[order_minus_2][0];
+
+    address.offset += quant->tables[order_minus_2][1].bits;
+    return bins_decode(prob_bins,
+                       bitarr_read_int25(address, prob_bins->bits,
+                                         prob_bins->mask));
 }
 
 float
 lm_trie_quant_lpread(lm_trie_quant_t * quant, bitarr_address_t address)
 {
     return bins_decode(quant->longest,
-                       bitarr_read_int25(address, quant->prob_bits,
-                                         quant->prob_mask));
+                       bitarr_read_int25(address, quant->longest->bits,
+                                         quant->longest->mask));
 }
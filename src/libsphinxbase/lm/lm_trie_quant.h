@@ -43,13 +43,22 @@
 
 typedef struct lm_trie_quant_s lm_trie_quant_t;
 
+/** Bits per quantized weight unless others are given. */
+#define LM_TRIE_QUANT_DEFAULT_BITS 16
+/** Range of bits per quantized weight. */
+#define LM_TRIE_QUANT_MIN_BITS 1
+#define LM_TRIE_QUANT_MAX_BITS 16
+
 /**
- * Create qunatizing
+ * Create qunatizing.  prob_bits and bo_bits give the bits per
+ * probability and backoff weight for each order from bigrams up, or
+ * are NULL to use LM_TRIE_QUANT_DEFAULT_BITS.
  */
-lm_trie_quant_t *lm_trie_quant_create(int order);
+lm_trie_quant_t *lm_trie_quant_create(int order, const uint8 * prob_bits,
+                                      const uint8 * bo_bits);
 
 /**
- * Write quant data to binary file
+ * Read quant data from binary file, or return NULL if it is invalid
  */
 lm_trie_quant_t *lm_trie_quant_read_bin(FILE * fp, int order);
 
@@ -67,7 +76,7 @@ void lm_trie_quant_free(lm_trie_quant_t * quant);
  * Memory required for storing weights of middle-order ngrams.
  * Both backoff and probability should be stored
  */
-uint8 lm_trie_quant_msize(lm_trie_quant_t * quant);
+uint8 lm_trie_quant_msize(lm_trie_quant_t * quant, int order_minus_2);
 
 /**
  * Memory required for storing weights of largest-order ngrams.
@@ -87,6 +96,16 @@ void lm_trie_quant_train(lm_trie_quant_t * quant, int order, uint32 counts,
 void lm_trie_quant_train_prob(lm_trie_quant_t * quant, int order,
                               uint32 counts, ngram_raw_t * raw_ngrams);
 
+/**
+ * Trains quantizer for specified ngram order on arrays of values,
+ * which are sorted in place.  backoffs is NULL for the largest order.
+ * Bins start out holding equal numbers of values and are then refined
+ * to minimize the quantization error.
+ */
+void lm_trie_quant_train_values(lm_trie_quant_t * quant, int order,
+                                uint32 counts, float *probs,
+                                float *backoffs);
+
 /**
  * Writes specified weight for middle-order ngram. Quantize it if needed
  */
@@ -158,6 +158,9 @@ ngram_model_read(cmd_ln_t * config,
         return NULL;
     }
 
+    if (model == NULL)
+        return NULL;
+
     /* Now set weights based on config if present. */
     if (config) {
         float32 lw = 1.0;
@@ -198,6 +201,14 @@ ngram_model_write(ngram_model_t * model, const char *file_name,
     return -1;
 }
 
+int
+ngram_model_convert_arpa_bin(cmd_ln_t * config, const char *arpa_path,
+                             const char *bin_path, logmath_t * lmath)
+{
+    return ngram_model_trie_convert_arpa_bin(config, arpa_path, bin_path,
+                                             lmath);
+}
+
 int32
 ngram_model_init(ngram_model_t * base,
                  ngram_funcs_t * funcs,
@@ -252,9 +263,177 @@ ngram_model_retain(ngram_model_t * model)
     return model;
 }
 
+/*
+ * Shared score cache.  Each entry is guarded by a sequence number
+ * which is odd while it is being written, so readers never wait: they
+ * treat an entry that is being written or that changed under them as
+ * a miss.  A writer that finds an entry busy just doesn't store its
+ * score.  Flushing bumps a generation number instead of clearing the
+ * entries.  Scores are stored under the generation that was current
+ * before they were computed, so one computed across a flush is never
+ * taken for a current one.
+ */
+#if defined(__GNUC__)
+#define score_cache_load(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define score_cache_store(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+#define HAVE_SCORE_CACHE 1
+#endif
+
+typedef struct ngram_score_entry_s {
+    uint32 seq;             /**< Odd while the entry is being written */
+    uint32 gen;             /**< Generation the entry belongs to */
+    int32 wid;
+    int32 n_hist;
+    int32 hist[NGRAM_MAX_ORDER - 1];
+    int32 score;
+    int32 n_used;
+} ngram_score_entry_t;
+
+struct ngram_score_cache_s {
+    ngram_score_entry_t *entries;
+    uint32 mask;            /**< Number of entries minus one */
+    /* Every lookup reads gen, keep it on a cache line of its own. */
+    char pad0[64];
+    uint32 gen;             /**< Current generation */
+    char pad1[64];
+    uint64 hits;            /**< Lookups without a history cache */
+    uint64 misses;
+};
+
+static void
+ngram_score_cache_free(ngram_score_cache_t * cache)
+{
+    if (cache == NULL)
+        return;
+    ckd_free(cache->entries);
+    ckd_free(cache);
+}
+
+#ifdef HAVE_SCORE_CACHE
+static uint32
+ngram_score_hash(int32 wid, int32 * history, int32 n_hist)
+{
+    uint32 h = (uint32) wid * 0x9e3779b1;
+    int32 i;
+
+    for (i = 0; i < n_hist; ++i)
+        h = (h ^ (uint32) history[i]) * 0x85ebca6b + 0xc2b2ae35;
+    return h ^ (h >> 15);
+}
+
+static int
+ngram_score_cache_get(ngram_score_cache_t * cache, uint32 gen, int32 wid,
+                      int32 * history, int32 n_hist, int32 * out_score,
+                      int32 * out_n_used)
+{
+    ngram_score_entry_t *ent =
+        &cache->entries[ngram_score_hash(wid, history, n_hist)
+                        & cache->mask];
+    uint32 seq = __atomic_load_n(&ent->seq, __ATOMIC_ACQUIRE);
+    int32 score, n_used, i;
+    int found;
+
+    found = !(seq & 1)
+        && score_cache_load(&ent->gen) == gen
+        && score_cache_load(&ent->wid) == wid
+        && score_cache_load(&ent->n_hist) == n_hist;
+    for (i = 0; found && i < n_hist; ++i)
+        found = (score_cache_load(&ent->hist[i]) == history[i]);
+    score = score_cache_load(&ent->score);
+    n_used = score_cache_load(&ent->n_used);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (!found || score_cache_load(&ent->seq) != seq)
+        return FALSE;
+    *out_score = score;
+    *out_n_used = n_used;
+    return TRUE;
+}
+
+static void
+ngram_score_cache_put(ngram_score_cache_t * cache, uint32 gen, int32 wid,
+                      int32 * history, int32 n_hist, int32 score,
+                      int32 n_used)
+{
+    ngram_score_entry_t *ent =
+        &cache->entries[ngram_score_hash(wid, history, n_hist)
+                        & cache->mask];
+    uint32 seq = score_cache_load(&ent->seq);
+    int32 i;
+
+    if ((seq & 1)
+        || !__atomic_compare_exchange_n(&ent->seq, &seq, seq + 1, FALSE,
+                                        __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED))
+        return;
+    /* Readers must see the odd sequence number before any of the
+     * new data, or they could take a torn entry for a whole one. */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    score_cache_store(&ent->gen, gen);
+    score_cache_store(&ent->wid, wid);
+    score_cache_store(&ent->n_hist, n_hist);
+    for (i = 0; i < n_hist; ++i)
+        score_cache_store(&ent->hist[i], history[i]);
+    score_cache_store(&ent->score, score);
+    score_cache_store(&ent->n_used, n_used);
+    __atomic_store_n(&ent->seq, seq + 2, __ATOMIC_RELEASE);
+}
+#endif /* HAVE_SCORE_CACHE */
+
+int
+ngram_model_cache_init(ngram_model_t * model, int32 n_entries)
+{
+    ngram_score_cache_t *cache;
+    uint32 size;
+
+    ngram_score_cache_free(model->score_cache);
+    model->score_cache = NULL;
+    if (n_entries <= 0)
+        return 0;
+#ifdef HAVE_SCORE_CACHE
+    for (size = 1; size < (uint32) n_entries; size <<= 1)
+        ;
+    cache = (ngram_score_cache_t *) ckd_calloc(1, sizeof(*cache));
+    cache->entries =
+        (ngram_score_entry_t *) ckd_calloc(size, sizeof(*cache->entries));
+    cache->mask = size - 1;
+    /* Entries start out in generation 0, which is never current. */
+    cache->gen = 1;
+    model->score_cache = cache;
+    return 0;
+#else
+    (void) cache;
+    (void) size;
+    E_WARN("Score cache is not supported by this compiler\n");
+    return -1;
+#endif
+}
+
+void
+ngram_model_cache_stats(ngram_model_t * model,
+                        ngram_hist_cache_t ** caches, int32 n_caches,
+                        uint64 * out_hits, uint64 * out_misses)
+{
+    ngram_score_cache_t *cache = model->score_cache;
+    int32 i;
+
+    *out_hits = *out_misses = 0;
+    if (cache == NULL)
+        return;
+    *out_hits = cache->hits;
+    *out_misses = cache->misses;
+    for (i = 0; i < n_caches; ++i) {
+        *out_hits += caches[i]->hits;
+        *out_misses += caches[i]->misses;
+    }
+}
+
 void
 ngram_model_flush(ngram_model_t * model)
 {
+#ifdef HAVE_SCORE_CACHE
+    if (model->score_cache)
+        __atomic_add_fetch(&model->score_cache->gen, 1, __ATOMIC_RELEASE);
+#endif
     if (model->funcs && model->funcs->flush)
         (*model->funcs->flush) (model);
 }
@@ -300,6 +479,7 @@ ngram_model_free(ngram_model_t * model)
     hash_table_free(model->wid);
     ckd_free(model->word_str);
     ckd_free(model->n_counts);
+    ngram_score_cache_free(model->score_cache);
     ckd_free(model);
     return 0;
 }
@@ -359,7 +539,12 @@ ngram_model_casefold(ngram_model_t * model, int kase)
 int
 ngram_model_apply_weights(ngram_model_t * model, float32 lw, float32 wip)
 {
-    return (*model->funcs->apply_weights) (model, lw, wip);
+    int rv;
+
+    rv = (*model->funcs->apply_weights) (model, lw, wip);
+    /* Cached scores are weighted. */
+    ngram_model_flush(model);
+    return rv;
 }
 
 float32
@@ -371,11 +556,15 @@ ngram_model_get_weights(ngram_model_t * model, int32 * out_log_wip)
 }
 
 
-int32
-ngram_ng_score(ngram_model_t * model, int32 wid, int32 * history,
-               int32 n_hist, int32 * n_used)
+static int32
+ngram_ng_score_cache(ngram_model_t * model, ngram_hist_cache_t * cache,
+                     int32 wid, int32 * history, int32 n_hist,
+                     int32 * n_used)
 {
     int32 score, class_weight = 0;
+#ifdef HAVE_SCORE_CACHE
+    uint32 gen = 0;
+#endif
     int i;
 
     /* Closed vocabulary, OOV word probability is zero */
@@ -397,12 +586,235 @@ ngram_ng_score(ngram_model_t * model, int32 wid, int32 * history,
             history[i] =
                 model->classes[NGRAM_CLASSID(history[i])]->tag_wid;
     }
-    score = (*model->funcs->score) (model, wid, history, n_hist, n_used);
+#ifdef HAVE_SCORE_CACHE
+    /* Words beyond what the model can use don't change the score. */
+    if (n_hist > model->n - 1)
+        n_hist = model->n - 1;
+    if (model->score_cache) {
+        int found;
+
+        /* Read before scoring, see ngram_score_cache_put(). */
+        gen = __atomic_load_n(&model->score_cache->gen, __ATOMIC_ACQUIRE);
+        found = ngram_score_cache_get(model->score_cache, gen, wid,
+                                      history, n_hist, &score, n_used);
+        /* Threads count in their own history caches, so that they
+         * don't contend for the counters. */
+        if (cache)
+            ++*(found ? &cache->hits : &cache->misses);
+        else
+            ++*(found ? &model->score_cache->hits
+                : &model->score_cache->misses);
+        if (found)
+            return score + class_weight;
+    }
+#endif
+    if (cache && model->funcs->score_r)
+        score = (*model->funcs->score_r) (model, cache, wid, history,
+                                          n_hist, n_used);
+    else
+        score = (*model->funcs->score) (model, wid, history, n_hist,
+                                        n_used);
+#ifdef HAVE_SCORE_CACHE
+    if (model->score_cache)
+        ngram_score_cache_put(model->score_cache, gen, wid, history,
+                              n_hist, score, *n_used);
+#endif
+
+    /* Multiply by unigram in-class weight. */
+    return score + class_weight;
+}
+
+int32
+ngram_ng_score(ngram_model_t * model, int32 wid, int32 * history,
+               int32 n_hist, int32 * n_used)
+{
+    return ngram_ng_score_cache(model, NULL, wid, history, n_hist, n_used);
+}
+
+ngram_hist_cache_t *
+ngram_hist_cache_init(void)
+{
+    ngram_hist_cache_t *cache;
+
+    cache = (ngram_hist_cache_t *) ckd_calloc(1, sizeof(*cache));
+    ngram_hist_cache_reset(cache);
+    return cache;
+}
+
+void
+ngram_hist_cache_reset(ngram_hist_cache_t * cache)
+{
+    memset(cache->hist, -1, sizeof(cache->hist));
+    memset(cache->backoff, 0, sizeof(cache->backoff));
+}
+
+void
+ngram_hist_cache_free(ngram_hist_cache_t * cache)
+{
+    ckd_free(cache);
+}
+
+int32
+ngram_ng_score_r(ngram_model_t * model, ngram_hist_cache_t * cache,
+                 int32 wid, int32 * history, int32 n_hist, int32 * n_used)
+{
+    return ngram_ng_score_cache(model, cache, wid, history, n_hist,
+                                n_used);
+}
+
+void
+ngram_ng_score_batch(ngram_model_t * model, int32 * wids,
+                     int32 ** histories, int32 * n_hists, int32 n_queries,
+                     int32 * out_scores, int32 * out_n_used)
+{
+    int32 *class_weights, *idx, *b_wids, **b_hists, *b_n_hists;
+    int32 *b_scores, *b_n_used;
+    int32 i, j, n_batch;
+
+    if (n_queries <= 0)
+        return;
+    if (model->funcs->score_batch == NULL) {
+        for (i = 0; i < n_queries; i++) {
+            out_n_used[i] = 0;
+            out_scores[i] = ngram_ng_score(model, wids[i], histories[i],
+                                           n_hists[i], &out_n_used[i]);
+        }
+        return;
+    }
+
+    class_weights = (int32 *) ckd_calloc(n_queries, sizeof(*class_weights));
+    idx = (int32 *) ckd_calloc(n_queries, sizeof(*idx));
+    b_wids = (int32 *) ckd_calloc(n_queries, sizeof(*b_wids));
+    b_hists = (int32 **) ckd_calloc(n_queries, sizeof(*b_hists));
+    b_n_hists = (int32 *) ckd_calloc(n_queries, sizeof(*b_n_hists));
+    b_scores = (int32 *) ckd_calloc(n_queries, sizeof(*b_scores));
+    b_n_used = (int32 *) ckd_calloc(n_queries, sizeof(*b_n_used));
+
+    /* "Declassify" words and histories as ngram_ng_score() does,
+     * leaving out queries for words that have no probability. */
+    for (n_batch = i = 0; i < n_queries; i++) {
+        int32 wid = wids[i];
+
+        out_scores[i] = model->log_zero;
+        out_n_used[i] = 0;
+        if (wid == NGRAM_INVALID_WID)
+            continue;
+        if (NGRAM_IS_CLASSWID(wid)) {
+            ngram_class_t *lmclass = model->classes[NGRAM_CLASSID(wid)];
+
+            class_weights[i] = ngram_class_prob(lmclass, wid);
+            if (class_weights[i] == 1)  /* Meaning, not found in class. */
+                continue;
+            wid = lmclass->tag_wid;
+        }
+        for (j = 0; j < n_hists[i]; ++j) {
+            if (histories[i][j] != NGRAM_INVALID_WID
+                && NGRAM_IS_CLASSWID(histories[i][j]))
+                histories[i][j] =
+                    model->classes[NGRAM_CLASSID(histories[i][j])]->tag_wid;
+        }
+        idx[n_batch] = i;
+        b_wids[n_batch] = wid;
+        b_hists[n_batch] = histories[i];
+        b_n_hists[n_batch] = n_hists[i];
+        n_batch++;
+    }
+
+    if (n_batch > 0)
+        (*model->funcs->score_batch) (model, b_wids, b_hists, b_n_hists,
+                                      n_batch, b_scores, b_n_used);
+    for (i = 0; i < n_batch; i++) {
+        /* Multiply by unigram in-class weight. */
+        out_scores[idx[i]] = b_scores[i] + class_weights[idx[i]];
+        out_n_used[idx[i]] = b_n_used[i];
+    }
+
+    ckd_free(b_n_used);
+    ckd_free(b_scores);
+    ckd_free(b_n_hists);
+    ckd_free(b_hists);
+    ckd_free(b_wids);
+    ckd_free(idx);
+    ckd_free(class_weights);
+}
+
+void
+ngram_state_init(ngram_model_t * model, ngram_state_t * state,
+                 int32 * history, int32 n_hist)
+{
+    int32 i;
+
+    assert(NGRAM_MAX_ORDER - 1 <= NGRAM_STATE_MAX_HIST);
+    memset(state, 0, sizeof(*state));
+    if (n_hist > model->n - 1)
+        n_hist = model->n - 1;
+    /* Unknown words end the usable history. */
+    for (i = 0; i < n_hist && history[i] != NGRAM_INVALID_WID; ++i) {
+        if (NGRAM_IS_CLASSWID(history[i]))
+            history[i] =
+                model->classes[NGRAM_CLASSID(history[i])]->tag_wid;
+        state->hist[i] = history[i];
+    }
+    state->n_hist = i;
+    if (model->funcs->state_init)
+        (*model->funcs->state_init) (model, state);
+}
+
+int32
+ngram_score_state(ngram_model_t * model, const ngram_state_t * state,
+                  int32 wid, ngram_state_t * out_state)
+{
+    ngram_state_t next;
+    int32 score, class_weight = 0;
+
+    /* Closed vocabulary, OOV word probability is zero */
+    if (wid == NGRAM_INVALID_WID) {
+        memset(out_state, 0, sizeof(*out_state));
+        return model->log_zero;
+    }
+
+    /* "Declassify" wid, history is already declassified */
+    if (NGRAM_IS_CLASSWID(wid)) {
+        ngram_class_t *lmclass = model->classes[NGRAM_CLASSID(wid)];
+
+        class_weight = ngram_class_prob(lmclass, wid);
+        if (class_weight == 1) {        /* Meaning, not found in class. */
+            memset(out_state, 0, sizeof(*out_state));
+            return model->log_zero;
+        }
+        wid = lmclass->tag_wid;
+    }
+    if (model->funcs->score_state)
+        score = (*model->funcs->score_state) (model, state, wid, &next);
+    else {
+        int32 hist[NGRAM_STATE_MAX_HIST], n_used;
+
+        memcpy(hist, state->hist, sizeof(hist));
+        score = ngram_ng_score(model, wid, hist, state->n_hist, &n_used);
+        memset(&next, 0, sizeof(next));
+        next.n_hist = state->n_hist + 1;
+        if (next.n_hist > model->n - 1)
+            next.n_hist = model->n - 1;
+        if (next.n_hist > 0) {
+            next.hist[0] = wid;
+            memcpy(next.hist + 1, state->hist,
+                   (next.n_hist - 1) * sizeof(*next.hist));
+        }
+    }
+    *out_state = next;
 
     /* Multiply by unigram in-class weight. */
     return score + class_weight;
 }
 
+int
+ngram_state_equal(const ngram_state_t * a, const ngram_state_t * b)
+{
+    if (a->n_hist != b->n_hist)
+        return FALSE;
+    return memcmp(a->hist, b->hist, a->n_hist * sizeof(*a->hist)) == 0;
+}
+
 int32
 ngram_score(ngram_model_t * model, const char *word, ...)
 {
@@ -667,6 +1079,7 @@ ngram_model_add_word(ngram_model_t * model,
         prob =
             (*model->funcs->add_ug) (model, wid,
                                      logmath_log(model->lmath, weight));
+    ngram_model_flush(model);
     if (prob == 0)
         return -1;
 
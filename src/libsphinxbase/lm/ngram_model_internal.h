@@ -73,6 +73,7 @@ struct ngram_model_s {
     int32 *tmp_wids;    /**< Temporary array of word IDs for ngram_model_get_ngram() */
     struct ngram_class_s **classes; /**< Word class definitions. */
     struct ngram_funcs_s *funcs;   /**< Implementation-specific methods. */
+    struct ngram_score_cache_s *score_cache; /**< Shared score cache, or NULL */
 };
 
 /**
@@ -95,8 +96,33 @@ struct ngram_class_s {
     int32 n_hash_inuse; /**< Number of words in nword_hash */
 };
 
+/**
+ * Hint that memory at addr will be read soon.
+ */
+#if defined(__GNUC__)
+#define ngram_prefetch(addr) __builtin_prefetch(addr)
+#else
+#define ngram_prefetch(addr) ((void) 0)
+#endif
+
+/**
+ * Shared cache of N-Gram scores, see ngram_model_cache_init().
+ */
+typedef struct ngram_score_cache_s ngram_score_cache_t;
+
+/* NGRAM_STATE_MAX_HIST must be at least NGRAM_MAX_ORDER - 1 */
 #define NGRAM_MAX_ORDER 5
 
+/**
+ * Implementation of ngram_hist_cache_t.
+ */
+struct ngram_hist_cache_s {
+    float backoff[NGRAM_MAX_ORDER];  /**< Backoff weights for each order of hist */
+    uint32 hist[NGRAM_MAX_ORDER - 1]; /**< History these weights belong to */
+    uint64 hits;                      /**< Score cache lookups that hit */
+    uint64 misses;                    /**< Score cache lookups that missed */
+};
+
 #define NGRAM_HASH_SIZE 128
 
 #define NGRAM_BASEWID(wid) ((wid)&0xffffff)
@@ -146,6 +172,42 @@ typedef struct ngram_funcs_s {
      * Implementation-specific function for purging N-Gram cache
      */
     void (*flush) (ngram_model_t * model);
+
+    /**
+     * Implementation-specific function for querying language model
+     * score with a caller-owned history cache, without modifying the
+     * model.  May be NULL if not supported.
+     */
+     int32(*score_r) (ngram_model_t * model, ngram_hist_cache_t * cache,
+                      int32 wid,
+                      int32 * history, int32 n_hist, int32 * n_used);
+
+    /**
+     * Implementation-specific function for querying language model
+     * scores of many N-Grams at once.  Word IDs and histories are
+     * already declassified.  May be NULL if not supported.
+     */
+    void (*score_batch) (ngram_model_t * model, int32 * wids,
+                         int32 ** histories, int32 * n_hists,
+                         int32 n_queries, int32 * out_scores,
+                         int32 * out_n_used);
+
+    /**
+     * Implementation-specific function for filling in a language
+     * model state whose history has been set.  It may shorten the
+     * history to what the model can use.  May be NULL if the history
+     * is all a state needs.
+     */
+    void (*state_init) (ngram_model_t * model, ngram_state_t * state);
+
+    /**
+     * Implementation-specific function for scoring a (declassified)
+     * word following a language model state.  May be NULL if not
+     * supported.
+     */
+     int32(*score_state) (ngram_model_t * model,
+                          const ngram_state_t * state, int32 wid,
+                          ngram_state_t * out_state);
 } ngram_funcs_t;
 
 /**
@@ -194,4 +256,9 @@ void ngram_class_free(ngram_class_t * lmclass);
  */
 int32 ngram_class_prob(ngram_class_t * lmclass, int32 wid);
 
+/**
+ * Reset a history cache so that nothing matches it.
+ */
+void ngram_hist_cache_reset(ngram_hist_cache_t * cache);
+
 #endif                          /* __NGRAM_MODEL_INTERNAL_H__ */
@@ -41,6 +41,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
 
 #include "sphinxbase/err.h"
 #include "sphinxbase/ckd_alloc.h"
@@ -48,6 +49,8 @@
 #include "sphinxbase/filename.h"
 
 #include "ngram_model_set.h"
+#include "ngram_model_trie.h"
+#include "ngrams_raw.h"
 
 static ngram_funcs_t ngram_model_set_funcs;
 
@@ -102,20 +105,17 @@ build_widmap(ngram_model_t * base, logmath_t * lmath, int32 n)
           my_compare);
 
     /* Now create the word ID mappings. */
-    if (set->widmap)
-        ckd_free_2d((void **) set->widmap);
-    set->widmap = (int32 **) ckd_calloc_2d(base->n_words, set->n_models,
-                                           sizeof(**set->widmap));
+    ckd_free(set->widmap);
+    set->widmap = (int32 *) ckd_calloc((size_t) base->n_words
+                                       * set->n_models,
+                                       sizeof(*set->widmap));
     for (i = 0; i < base->n_words; ++i) {
+        int32 *mapwid = NGRAM_SET_WIDMAP(set, i);
         int32 j;
         /* Also create the master wid mapping. */
         (void) hash_table_enter_int32(base->wid, base->word_str[i], i);
-        /* printf("%s: %d => ", base->word_str[i], i); */
-        for (j = 0; j < set->n_models; ++j) {
-            set->widmap[i][j] = ngram_wid(models[j], base->word_str[i]);
-            /* printf("%d ", set->widmap[i][j]); */
-        }
-        /* printf("\n"); */
+        for (j = 0; j < set->n_models; ++j)
+            mapwid[j] = ngram_wid(models[j], base->word_str[i]);
     }
     hash_table_free(vocab);
 }
@@ -173,9 +173,6 @@ ngram_model_set_init(cmd_ln_t * config,
         if (models[i]->n > n)
             n = models[i]->n;
     }
-    /* Allocate the history mapping table. */
-    model->maphist = ckd_calloc(n - 1, sizeof(*model->maphist));
-
     /* Now build the word-ID mapping and merged vocabulary. */
     build_widmap(base, lmath, n);
     return base;
@@ -444,6 +441,7 @@ ngram_model_set_select(ngram_model_t * base, const char *name)
     if (i == set->n_models)
         return NULL;
     set->cur = i;
+    ngram_model_flush(base);
     return set->lms[set->cur];
 }
 
@@ -466,7 +464,7 @@ ngram_model_set_current_wid(ngram_model_t * base, int32 set_wid)
     if (set->cur == -1 || set_wid >= base->n_words)
         return NGRAM_INVALID_WID;
     else
-        return set->widmap[set_wid][set->cur];
+        return NGRAM_SET_WIDMAP(set, set_wid)[set->cur];
 }
 
 int32
@@ -479,13 +477,14 @@ ngram_model_set_known_wid(ngram_model_t * base, int32 set_wid)
     else if (set->cur == -1) {
         int32 i;
         for (i = 0; i < set->n_models; ++i) {
-            if (set->widmap[set_wid][i] != ngram_unknown_wid(set->lms[i]))
+            if (NGRAM_SET_WIDMAP(set, set_wid)[i]
+                != ngram_unknown_wid(set->lms[i]))
                 return TRUE;
         }
         return FALSE;
     }
     else
-        return (set->widmap[set_wid][set->cur]
+        return (NGRAM_SET_WIDMAP(set, set_wid)[set->cur]
                 != ngram_unknown_wid(set->lms[set->cur]));
 }
 
@@ -517,6 +516,7 @@ ngram_model_set_interp(ngram_model_t * base,
     }
     /* Otherwise just enable existing weights. */
     set->cur = -1;
+    ngram_model_flush(base);
     return base;
 }
 
@@ -536,12 +536,8 @@ ngram_model_set_add(ngram_model_t * base,
     set->names =
         ckd_realloc(set->names, set->n_models * sizeof(*set->names));
     set->names[set->n_models - 1] = ckd_salloc(name);
-    /* Expand the history mapping table if necessary. */
-    if (model->n > base->n) {
+    if (model->n > base->n)
         base->n = model->n;
-        set->maphist = ckd_realloc(set->maphist,
-                                   (model->n - 1) * sizeof(*set->maphist));
-    }
 
     /* Renormalize the interpolation weights. */
     fprob = weight * 1.0f / set->n_models;
@@ -557,25 +553,27 @@ ngram_model_set_add(ngram_model_t * base,
 
     /* Reuse the old word ID mapping if requested. */
     if (reuse_widmap) {
-        int32 **new_widmap;
+        int32 *new_widmap;
 
         /* Tack another column onto the widmap array. */
-        new_widmap = (int32 **) ckd_calloc_2d(base->n_words, set->n_models,
-                                              sizeof(**new_widmap));
+        new_widmap = (int32 *) ckd_calloc((size_t) base->n_words
+                                          * set->n_models,
+                                          sizeof(*new_widmap));
         for (i = 0; i < base->n_words; ++i) {
+            int32 *row = new_widmap + (size_t) i * set->n_models;
             /* Copy all the existing mappings. */
-            memcpy(new_widmap[i], set->widmap[i],
-                   (set->n_models - 1) * sizeof(**new_widmap));
+            memcpy(row, set->widmap + (size_t) i * (set->n_models - 1),
+                   (set->n_models - 1) * sizeof(*new_widmap));
             /* Create the new mapping. */
-            new_widmap[i][set->n_models - 1] =
-                ngram_wid(model, base->word_str[i]);
+            row[set->n_models - 1] = ngram_wid(model, base->word_str[i]);
         }
-        ckd_free_2d((void **) set->widmap);
+        ckd_free(set->widmap);
         set->widmap = new_widmap;
     }
     else {
         build_widmap(base, base->lmath, base->n);
     }
+    ngram_model_flush(base);
     return model;
 }
 
@@ -619,19 +617,22 @@ ngram_model_set_remove(ngram_model_t * base,
     /* There's no need to shrink these arrays. */
     set->lms[set->n_models] = NULL;
     set->lweights[set->n_models] = base->log_zero;
-    /* No need to shrink maphist either. */
 
     /* Reuse the existing word ID mapping if requested. */
     if (reuse_widmap) {
-        /* Just go through and shrink each row. */
+        /* Just go through and pack the rows without this model. */
+        int32 *src = set->widmap, *dst = set->widmap;
         for (i = 0; i < base->n_words; ++i) {
-            memmove(set->widmap[i] + lmidx, set->widmap[i] + lmidx + 1,
-                    (set->n_models - lmidx) * sizeof(**set->widmap));
+            int32 j;
+            for (j = 0; j <= set->n_models; ++j, ++src)
+                if (j != lmidx)
+                    *dst++ = *src;
         }
     }
     else {
         build_widmap(base, base->lmath, n);
     }
+    ngram_model_flush(base);
     return submodel;
 }
 
@@ -649,20 +650,22 @@ ngram_model_set_map_words(ngram_model_t * base,
         }
     }
     ckd_free(base->word_str);
-    ckd_free_2d((void **) set->widmap);
+    ckd_free(set->widmap);
     base->writable = TRUE;
     base->n_words = base->n_1g_alloc = n_words;
     base->word_str = ckd_calloc(n_words, sizeof(*base->word_str));
     set->widmap =
-        (int32 **) ckd_calloc_2d(n_words, set->n_models,
-                                 sizeof(**set->widmap));
+        (int32 *) ckd_calloc((size_t) n_words * set->n_models,
+                             sizeof(*set->widmap));
     hash_table_empty(base->wid);
+    ngram_model_flush(base);
     for (i = 0; i < n_words; ++i) {
         int32 j;
         base->word_str[i] = ckd_salloc(words[i]);
         (void) hash_table_enter_int32(base->wid, base->word_str[i], i);
         for (j = 0; j < set->n_models; ++j) {
-            set->widmap[i][j] = ngram_wid(set->lms[j], base->word_str[i]);
+            NGRAM_SET_WIDMAP(set, i)[j] =
+                ngram_wid(set->lms[j], base->word_str[i]);
         }
     }
 }
@@ -680,12 +683,36 @@ ngram_model_set_apply_weights(ngram_model_t * base, float32 lw,
     return 0;
 }
 
+/* Number of submodels whose scores fit in a stack buffer. */
+#define SET_LOCAL_MODELS 16
+
+typedef int32(*set_score_func_t) (ngram_model_t * model, int32 wid,
+                                  int32 * history, int32 n_hist,
+                                  int32 * n_used);
+
+/* Map a history into the word IDs of submodel i. */
+static void
+set_map_hist(ngram_model_set_t * set, int32 i, int32 * history,
+             int32 n_hist, int32 * maphist)
+{
+    int32 j;
+
+    for (j = 0; j < n_hist; ++j) {
+        if (history[j] == NGRAM_INVALID_WID)
+            maphist[j] = NGRAM_INVALID_WID;
+        else
+            maphist[j] = NGRAM_SET_WIDMAP(set, history[j])[i];
+    }
+}
+
 static int32
-ngram_model_set_score(ngram_model_t * base, int32 wid,
-                      int32 * history, int32 n_hist, int32 * n_used)
+set_score(ngram_model_t * base, set_score_func_t score_func, int32 wid,
+          int32 * history, int32 n_hist, int32 * n_used)
 {
     ngram_model_set_t *set = (ngram_model_set_t *) base;
-    int32 mapwid;
+    int32 maphist[NGRAM_MAX_ORDER - 1];
+    int local_scores[SET_LOCAL_MODELS] = { 0 }, *scores;
+    int32 *mapwid;
     int32 score;
     int32 i;
 
@@ -693,91 +720,46 @@ ngram_model_set_score(ngram_model_t * base, int32 wid,
     if (n_hist > base->n - 1)
         n_hist = base->n - 1;
 
-    /* Interpolate if there is no current. */
-    if (set->cur == -1) {
-        score = base->log_zero;
-        for (i = 0; i < set->n_models; ++i) {
-            int32 j;
-            /* Map word and history IDs for each model. */
-            mapwid = set->widmap[wid][i];
-            for (j = 0; j < n_hist; ++j) {
-                if (history[j] == NGRAM_INVALID_WID)
-                    set->maphist[j] = NGRAM_INVALID_WID;
-                else
-                    set->maphist[j] = set->widmap[history[j]][i];
-            }
-            score = logmath_add(base->lmath, score,
-                                set->lweights[i] +
-                                ngram_ng_score(set->lms[i],
-                                               mapwid, set->maphist,
-                                               n_hist, n_used));
-        }
-    }
-    else {
-        int32 j;
-        /* Map word and history IDs (FIXME: do this in a function?) */
-        mapwid = set->widmap[wid][set->cur];
-        for (j = 0; j < n_hist; ++j) {
-            if (history[j] == NGRAM_INVALID_WID)
-                set->maphist[j] = NGRAM_INVALID_WID;
-            else
-                set->maphist[j] = set->widmap[history[j]][set->cur];
-        }
-        score = ngram_ng_score(set->lms[set->cur],
-                               mapwid, set->maphist, n_hist, n_used);
+    /* Each word's mappings for all submodels are together, so fetch
+     * them all while working on the first one. */
+    mapwid = NGRAM_SET_WIDMAP(set, wid);
+    for (i = 0; i < n_hist; ++i)
+        if (history[i] != NGRAM_INVALID_WID)
+            ngram_prefetch(NGRAM_SET_WIDMAP(set, history[i]));
+
+    if (set->cur != -1) {
+        set_map_hist(set, set->cur, history, n_hist, maphist);
+        return (*score_func) (set->lms[set->cur], mapwid[set->cur],
+                              maphist, n_hist, n_used);
     }
 
+    /* Interpolate if there is no current. */
+    scores = (set->n_models > SET_LOCAL_MODELS)
+        ? ckd_calloc(set->n_models, sizeof(*scores)) : local_scores;
+    for (i = 0; i < set->n_models; ++i) {
+        set_map_hist(set, i, history, n_hist, maphist);
+        scores[i] = set->lweights[i]
+            + (*score_func) (set->lms[i], mapwid[i], maphist, n_hist,
+                             n_used);
+    }
+    score = logmath_add_array(base->lmath, scores, set->n_models);
+    if (scores != local_scores)
+        ckd_free(scores);
     return score;
 }
 
+static int32
+ngram_model_set_score(ngram_model_t * base, int32 wid,
+                      int32 * history, int32 n_hist, int32 * n_used)
+{
+    return set_score(base, ngram_ng_score, wid, history, n_hist, n_used);
+}
+
 static int32
 ngram_model_set_raw_score(ngram_model_t * base, int32 wid,
                           int32 * history, int32 n_hist, int32 * n_used)
 {
-    ngram_model_set_t *set = (ngram_model_set_t *) base;
-    int32 mapwid;
-    int32 score;
-    int32 i;
-
-    /* Truncate the history. */
-    if (n_hist > base->n - 1)
-        n_hist = base->n - 1;
-
-    /* Interpolate if there is no current. */
-    if (set->cur == -1) {
-        score = base->log_zero;
-        for (i = 0; i < set->n_models; ++i) {
-            int32 j;
-            /* Map word and history IDs for each model. */
-            mapwid = set->widmap[wid][i];
-            for (j = 0; j < n_hist; ++j) {
-                if (history[j] == NGRAM_INVALID_WID)
-                    set->maphist[j] = NGRAM_INVALID_WID;
-                else
-                    set->maphist[j] = set->widmap[history[j]][i];
-            }
-            score = logmath_add(base->lmath, score,
-                                set->lweights[i] +
-                                ngram_ng_prob(set->lms[i],
-                                              mapwid, set->maphist, n_hist,
-                                              n_used));
-        }
-    }
-    else {
-        int32 j;
-        /* Map word and history IDs (FIXME: do this in a function?) */
-        mapwid = set->widmap[wid][set->cur];
-        for (j = 0; j < n_hist; ++j) {
-            if (history[j] == NGRAM_INVALID_WID)
-                set->maphist[j] = NGRAM_INVALID_WID;
-            else
-                set->maphist[j] = set->widmap[history[j]][set->cur];
-        }
-        score = ngram_ng_prob(set->lms[set->cur],
-                              mapwid, set->maphist, n_hist, n_used);
-    }
-
-    return score;
+    return set_score(base, ngram_ng_prob, wid, history, n_hist, n_used);
 }
 
 static int32
@@ -826,16 +808,12 @@ ngram_model_set_add_ug(ngram_model_t * base, int32 wid, int32 lweight)
         }
     }
     /* Okay we have the word IDs for this in all the submodels.  Now
-       do some complicated memory mangling to add this to the
-       widmap. */
+       add them to the widmap. */
     set->widmap =
-        ckd_realloc(set->widmap, base->n_words * sizeof(*set->widmap));
-    set->widmap[0] =
-        ckd_realloc(set->widmap[0],
-                    base->n_words * set->n_models * sizeof(**set->widmap));
-    for (i = 0; i < base->n_words; ++i)
-        set->widmap[i] = set->widmap[0] + i * set->n_models;
-    memcpy(set->widmap[wid], newwid, set->n_models * sizeof(*newwid));
+        ckd_realloc(set->widmap, (size_t) base->n_words * set->n_models
+                    * sizeof(*set->widmap));
+    memcpy(NGRAM_SET_WIDMAP(set, wid), newwid,
+           set->n_models * sizeof(*newwid));
     ckd_free(newwid);
     return prob;
 }
@@ -853,8 +831,284 @@ ngram_model_set_free(ngram_model_t * base)
         ckd_free(set->names[i]);
     ckd_free(set->names);
     ckd_free(set->lweights);
-    ckd_free(set->maphist);
-    ckd_free_2d((void **) set->widmap);
+    ckd_free(set->widmap);
+}
+
+/*
+ * Compiling a set.  The N-Grams of the compiled model are the union of
+ * those in the submodels, each with the interpolated probability the
+ * set gives it.  Backoff weights are then recomputed order by order so
+ * that each context's distribution sums to one, as for any static
+ * mixture of backoff models.  N-Grams of each order are kept in the
+ * sorted arrays the trie is built from, with words reversed (the word
+ * itself first, then its history from the most recent), so lookups
+ * during compilation are binary searches in those arrays.
+ */
+typedef struct set_compile_s {
+    ngram_model_set_t *set;
+    int order;
+    uint32 counts[NGRAM_MAX_ORDER];
+    float32 *probs;             /**< Unigram probabilities */
+    float32 *backoffs;          /**< Unigram backoff weights */
+    ngram_raw_t *raw_ngrams[NGRAM_MAX_ORDER - 1];
+    uint32 *raw_words[NGRAM_MAX_ORDER - 1];
+} set_compile_t;
+
+/* Interpolated probability of wid following history, whatever model
+ * is currently selected in the set. */
+static float32
+set_compile_prob(ngram_model_set_t * set, int32 wid, int32 * history,
+                 int32 n_hist)
+{
+    ngram_model_t *base = &set->base;
+    int32 maphist[NGRAM_MAX_ORDER - 1];
+    int local_scores[SET_LOCAL_MODELS] = { 0 }, *scores;
+    int32 i, n_used, prob;
+
+    scores = (set->n_models > SET_LOCAL_MODELS)
+        ? ckd_calloc(set->n_models, sizeof(*scores)) : local_scores;
+    for (i = 0; i < set->n_models; ++i) {
+        set_map_hist(set, i, history, n_hist, maphist);
+        scores[i] = set->lweights[i]
+            + ngram_ng_prob(set->lms[i], NGRAM_SET_WIDMAP(set, wid)[i],
+                            maphist, n_hist, &n_used);
+    }
+    prob = logmath_add_array(base->lmath, scores, set->n_models);
+    if (scores != local_scores)
+        ckd_free(scores);
+    return (float32) prob;
+}
+
+/* Find reversed words in the N-Grams of an order, or return -1. */
+static int32
+set_compile_find(set_compile_t * comp, int order, uint32 * words)
+{
+    ngram_raw_t *raw_ngrams = comp->raw_ngrams[order - 2];
+    uint32 *raw_words = comp->raw_words[order - 2];
+    int32 lo = 0, hi = (int32) comp->counts[order - 1] - 1;
+
+    while (lo <= hi) {
+        int32 mid = lo + (hi - lo) / 2;
+        int cmp = ngram_words_compare(words, order,
+                                      ngram_raw_words(raw_words,
+                                                      &raw_ngrams[mid]),
+                                      order);
+        if (cmp == 0)
+            return mid;
+        if (cmp < 0)
+            hi = mid - 1;
+        else
+            lo = mid + 1;
+    }
+    return -1;
+}
+
+/* Probability of words[0] following the n_hist words after it in the
+ * compiled model, backing off with the weights computed so far. */
+static float32
+set_compile_score(set_compile_t * comp, uint32 * words, int n_hist)
+{
+    float32 backoff = 0.0f;
+    int32 idx;
+
+    for (; n_hist > 0; --n_hist) {
+        if ((idx = set_compile_find(comp, n_hist + 1, words)) >= 0)
+            return backoff + comp->raw_ngrams[n_hist - 1][idx].prob;
+        if (n_hist == 1)
+            backoff += comp->backoffs[words[1]];
+        else if ((idx = set_compile_find(comp, n_hist, words + 1)) >= 0)
+            backoff += comp->raw_ngrams[n_hist - 2][idx].backoff;
+    }
+    return backoff + comp->probs[words[0]];
+}
+
+static double
+set_compile_exp(logmath_t * lmath, float32 logp)
+{
+    return pow(10.0, logmath_log_float_to_log10(lmath, logp));
+}
+
+/* Collect the N-Grams of one order from all submodels. */
+static int
+set_compile_ngrams(set_compile_t * comp, int order)
+{
+    ngram_model_set_t *set = comp->set;
+    ngram_model_t *base = &set->base;
+    ngram_raw_t *raw_ngrams;
+    uint32 *raw_words, total, i, j;
+    int32 m;
+    int k;
+
+    for (total = 0, m = 0; m < set->n_models; ++m)
+        if (set->lms[m]->n >= order)
+            total += set->lms[m]->n_counts[order - 1];
+    raw_ngrams = (ngram_raw_t *) ckd_calloc(total ? total : 1,
+                                            sizeof(*raw_ngrams));
+    raw_words = (uint32 *) ckd_calloc((size_t) (total ? total : 1)
+                                      * order, sizeof(*raw_words));
+    for (i = 0, m = 0; m < set->n_models; ++m) {
+        ngram_model_t *lm = set->lms[m];
+        ngram_raw_t *lm_ngrams;
+        uint32 *lm_words;
+
+        if (lm->n < order)
+            continue;
+        if ((lm_ngrams = ngram_model_trie_raw_ngrams(lm, order,
+                                                     &lm_words)) == NULL) {
+            E_ERROR("Language model %s can't be compiled\n",
+                    set->names[m]);
+            ckd_free(raw_words);
+            ckd_free(raw_ngrams);
+            return -1;
+        }
+        for (j = 0; j < lm->n_counts[order - 1]; ++j, ++i) {
+            uint32 *in = ngram_raw_words(lm_words, &lm_ngrams[j]);
+
+            raw_ngrams[i].order = order;
+            raw_ngrams[i].offset = i;
+            for (k = 0; k < order; ++k)
+                raw_words[(size_t) i * order + k] = (uint32)
+                    ngram_wid(base, lm->word_str[in[order - 1 - k]]);
+        }
+        ckd_free(lm_words);
+        ckd_free(lm_ngrams);
+    }
+    ngrams_raw_sort(raw_ngrams, raw_words, total, order, NULL);
+
+    /* Remove duplicates and score what is left. */
+    for (i = j = 0; i < total; ++i) {
+        uint32 *words = raw_words + (size_t) i * order;
+
+        if (j > 0 && ngram_words_compare(words, order,
+                                         raw_words + (size_t) (j - 1)
+                                         * order, order) == 0)
+            continue;
+        memmove(raw_words + (size_t) j * order, words,
+                order * sizeof(*words));
+        raw_ngrams[j].order = order;
+        raw_ngrams[j].offset = j;
+        raw_ngrams[j].prob =
+            set_compile_prob(set, (int32) words[0], (int32 *) words + 1,
+                             order - 1);
+        raw_ngrams[j].backoff = 0.0f;
+        ++j;
+    }
+    comp->raw_ngrams[order - 2] = raw_ngrams;
+    comp->raw_words[order - 2] = raw_words;
+    comp->counts[order - 1] = j;
+    return 0;
+}
+
+/* Compute the backoff weights of contexts of one order. */
+static void
+set_compile_backoffs(set_compile_t * comp, int order)
+{
+    logmath_t *lmath = comp->set->base.lmath;
+    ngram_raw_t *raw_ngrams = comp->raw_ngrams[order - 1];
+    uint32 *raw_words = comp->raw_words[order - 1];
+    uint32 n_contexts = comp->counts[order - 1];
+    double *numer, *denom;
+    int32 n_clipped;
+    uint32 i;
+
+    /* Probability mass of the explicit successors of each context,
+     * and what the next lower order gives them. */
+    numer = (double *) ckd_calloc(n_contexts, sizeof(*numer));
+    denom = (double *) ckd_calloc(n_contexts, sizeof(*denom));
+    for (i = 0; i < comp->counts[order]; ++i) {
+        uint32 *words = ngram_raw_words(raw_words, &raw_ngrams[i]);
+        int32 ctx = (order == 1)
+            ? (int32) words[1] : set_compile_find(comp, order, words + 1);
+
+        if (ctx < 0)
+            continue;
+        numer[ctx] += set_compile_exp(lmath, raw_ngrams[i].prob);
+        denom[ctx] +=
+            set_compile_exp(lmath, set_compile_score(comp, words,
+                                                     order - 1));
+    }
+    n_clipped = 0;
+    for (i = 0; i < n_contexts; ++i) {
+        float32 backoff;
+
+        if (numer[i] == 0.0)
+            continue;
+        if (numer[i] > 1.0 - 1e-10 || denom[i] > 1.0 - 1e-10) {
+            ++n_clipped;
+            if (numer[i] > 1.0 - 1e-10)
+                numer[i] = 1.0 - 1e-10;
+            if (denom[i] > 1.0 - 1e-10)
+                denom[i] = 1.0 - 1e-10;
+        }
+        backoff = logmath_log10_to_log_float(lmath,
+                                             log10((1.0 - numer[i])
+                                                   / (1.0 - denom[i])));
+        if (order == 1)
+            comp->backoffs[i] = backoff;
+        else
+            comp->raw_ngrams[order - 2][i].backoff = backoff;
+    }
+    if (n_clipped)
+        E_WARN("%d %d-gram contexts leave no probability mass to back off\n",
+               n_clipped, order);
+    ckd_free(numer);
+    ckd_free(denom);
+}
+
+ngram_model_t *
+ngram_model_set_compile(cmd_ln_t * config, ngram_model_t * base)
+{
+    ngram_model_set_t *set = (ngram_model_set_t *) base;
+    ngram_model_t *model = NULL;
+    set_compile_t comp;
+    int32 i;
+    int k;
+
+    if (base->funcs != &ngram_model_set_funcs) {
+        E_ERROR("Only language model sets can be compiled\n");
+        return NULL;
+    }
+    if (base->n_classes)
+        E_WARN("Word classes are not included in a compiled model\n");
+    E_INFO("Compiling %d language models into one of order %d\n",
+           set->n_models, base->n);
+
+    memset(&comp, 0, sizeof(comp));
+    comp.set = set;
+    comp.order = base->n;
+    comp.counts[0] = base->n_words;
+    comp.probs = (float32 *) ckd_calloc(base->n_words, sizeof(*comp.probs));
+    comp.backoffs =
+        (float32 *) ckd_calloc(base->n_words, sizeof(*comp.backoffs));
+    for (i = 0; i < base->n_words; ++i)
+        comp.probs[i] = set_compile_prob(set, i, NULL, 0);
+    for (k = 2; k <= comp.order; ++k) {
+        if (set_compile_ngrams(&comp, k) < 0)
+            goto error_out;
+        E_INFO("#%d-grams: %d\n", k, comp.counts[k - 1]);
+    }
+    for (k = 1; k < comp.order; ++k)
+        set_compile_backoffs(&comp, k);
+
+    model = ngram_model_trie_build(config, base->lmath, comp.order,
+                                   comp.counts, base->word_str, comp.probs,
+                                   comp.backoffs, comp.raw_ngrams,
+                                   comp.raw_words);
+    if (model == NULL)
+        goto error_out;
+    /* Keep the set's language weight and insertion penalty. */
+    ngram_model_apply_weights(model, base->lw,
+                              (float32) logmath_exp(base->lmath,
+                                                    base->log_wip));
+
+  error_out:
+    for (k = 0; k < NGRAM_MAX_ORDER - 1; ++k) {
+        ckd_free(comp.raw_words[k]);
+        ckd_free(comp.raw_ngrams[k]);
+    }
+    ckd_free(comp.backoffs);
+    ckd_free(comp.probs);
+    return model;
 }
 
 static ngram_funcs_t ngram_model_set_funcs = {
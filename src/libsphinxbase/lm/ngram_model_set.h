@@ -55,10 +55,16 @@ typedef struct ngram_model_set_s {
     ngram_model_t **lms; /**< Language models in this set. */
     char **names;        /**< Names for language models. */
     int32 *lweights;     /**< Log interpolation weights. */
-    int32 **widmap;      /**< Word ID mapping for submodels. */
-    int32 *maphist;      /**< Word ID mapping for N-Gram history. */
+    int32 *widmap;       /**< Word ID mapping for submodels, n_models
+                              entries for each word. */
 } ngram_model_set_t;
 
+/**
+ * Word IDs in each submodel for a word in the set.
+ */
+#define NGRAM_SET_WIDMAP(set, wid) \
+    ((set)->widmap + (size_t)(wid) * (set)->n_models)
+
 /**
  * Iterator over a model set.
  */
@@ -160,6 +160,61 @@ read_1grams_arpa(lineiter_t ** li, uint32 count, ngram_model_t * base,
     return 0;
 }
 
+/* Number of threads to use for reading and building a trie, from
+ * -nthreads. */
+static int
+build_nthreads(cmd_ln_t * config)
+{
+    if (config && cmd_ln_exists_r(config, "-nthreads"))
+        return cmd_ln_int32_r(config, "-nthreads");
+    return 1;
+}
+
+/* Bits per quantized weight for each order from bigrams up, from
+ * -probbits or -bobits.  The last value given is used for any higher
+ * orders. */
+static int
+build_quant_bits(cmd_ln_t * config, const char *name, uint8 * bits)
+{
+    char const **values;
+    int i, n;
+
+    for (i = 0; i < NGRAM_MAX_ORDER - 1; i++)
+        bits[i] = LM_TRIE_QUANT_DEFAULT_BITS;
+    if (config == NULL || !cmd_ln_exists_r(config, name)
+        || (values = cmd_ln_str_list_r(config, name)) == NULL
+        || values[0] == NULL)
+        return 0;
+    for (i = n = 0; i < NGRAM_MAX_ORDER - 1; i++) {
+        int value = atoi(values[n]);
+
+        if (value < LM_TRIE_QUANT_MIN_BITS
+            || value > LM_TRIE_QUANT_MAX_BITS) {
+            E_ERROR("%s must be between %d and %d bits, not %s\n",
+                    name, LM_TRIE_QUANT_MIN_BITS, LM_TRIE_QUANT_MAX_BITS,
+                    values[n]);
+            return -1;
+        }
+        bits[i] = (uint8) value;
+        if (values[n + 1])
+            ++n;
+    }
+    return 0;
+}
+
+/* Create a trie to build, quantized as the configuration says. */
+static lm_trie_t *
+build_trie_create(cmd_ln_t * config, uint32 unigram_count, int order)
+{
+    uint8 prob_bits[NGRAM_MAX_ORDER - 1];
+    uint8 bo_bits[NGRAM_MAX_ORDER - 1];
+
+    if (build_quant_bits(config, "-probbits", prob_bits) < 0
+        || build_quant_bits(config, "-bobits", bo_bits) < 0)
+        return NULL;
+    return lm_trie_create(unigram_count, order, prob_bits, bo_bits);
+}
+
 ngram_model_t *
 ngram_model_trie_read_arpa(cmd_ln_t * config,
                            const char *path, logmath_t * lmath)
@@ -169,6 +224,7 @@ ngram_model_trie_read_arpa(cmd_ln_t * config,
     ngram_model_trie_t *model;
     ngram_model_t *base;
     ngram_raw_t **raw_ngrams;
+    uint32 *raw_words[NGRAM_MAX_ORDER - 1];
     int32 is_pipe;
     uint32 counts[NGRAM_MAX_ORDER];
     int order;
@@ -181,6 +237,7 @@ ngram_model_trie_read_arpa(cmd_ln_t * config,
     }
 
     model = (ngram_model_trie_t *) ckd_calloc(1, sizeof(*model));
+    ngram_hist_cache_reset(&model->cache);
     li = lineiter_start_clean(fp);
     /* Read n-gram counts from file */
     if (read_counts_arpa(&li, counts, &order) == -1) {
@@ -200,8 +257,9 @@ ngram_model_trie_read_arpa(cmd_ln_t * config,
                      (int32) counts[0]);
     base->writable = TRUE;
 
-    model->trie = lm_trie_create(counts[0], order);
-    if (read_1grams_arpa(&li, counts[0], base, model->trie->unigrams) < 0) {
+    if ((model->trie = build_trie_create(config, counts[0], order)) == NULL
+        || read_1grams_arpa(&li, counts[0], base,
+                            model->trie->unigrams) < 0) {
 	ngram_model_free(base);
         lineiter_free(li);
         fclose_comp(fp, is_pipe);
@@ -211,15 +269,17 @@ ngram_model_trie_read_arpa(cmd_ln_t * config,
     if (order > 1) {
         raw_ngrams =
             ngrams_raw_read_arpa(&li, base->lmath, counts, order,
-                                 base->wid);
+                                 base->wid, build_nthreads(config),
+                                 raw_words);
         if (raw_ngrams == NULL) {
             ngram_model_free(base);
             lineiter_free(li);
             fclose_comp(fp, is_pipe);
             return NULL;
         }
-        lm_trie_build(model->trie, raw_ngrams, counts, base->n_counts, order);
-        ngrams_raw_free(raw_ngrams, counts, order);
+        lm_trie_build(model->trie, raw_ngrams, raw_words, counts,
+                      base->n_counts, order, build_nthreads(config));
+        ngrams_raw_free(raw_ngrams, raw_words, order);
     }
 
     lineiter_free(li);
@@ -228,6 +288,73 @@ ngram_model_trie_read_arpa(cmd_ln_t * config,
     return base;
 }
 
+ngram_raw_t *
+ngram_model_trie_raw_ngrams(ngram_model_t * base, int order,
+                            uint32 ** out_words)
+{
+    ngram_model_trie_t *model = (ngram_model_trie_t *) base;
+    ngram_raw_t *raw_ngrams;
+    uint32 raw_ngram_idx;
+    uint32 hist[NGRAM_MAX_ORDER];
+    node_range_t range;
+
+    if (base->funcs != &ngram_model_trie_funcs || order < 2
+        || order > base->n)
+        return NULL;
+    raw_ngrams =
+        (ngram_raw_t *) ckd_calloc((size_t) base->n_counts[order - 1],
+                                   sizeof(*raw_ngrams));
+    *out_words =
+        (uint32 *) ckd_calloc((size_t) base->n_counts[order - 1] * order,
+                              sizeof(**out_words));
+    raw_ngram_idx = 0;
+    range.begin = range.end = 0;
+
+    /* we need to iterate over a trie here. recursion should do the job */
+    lm_trie_fill_raw_ngram(model->trie, raw_ngrams, *out_words,
+                           &raw_ngram_idx, base->n_counts, range, hist, 0,
+                           order, base->n);
+    assert(raw_ngram_idx == base->n_counts[order - 1]);
+    return raw_ngrams;
+}
+
+ngram_model_t *
+ngram_model_trie_build(cmd_ln_t * config, logmath_t * lmath, int order,
+                       uint32 * counts, char **word_str, float32 * probs,
+                       float32 * backoffs, ngram_raw_t ** raw_ngrams,
+                       uint32 ** raw_words)
+{
+    ngram_model_trie_t *model;
+    ngram_model_t *base;
+    uint32 i;
+
+    model = (ngram_model_trie_t *) ckd_calloc(1, sizeof(*model));
+    ngram_hist_cache_reset(&model->cache);
+    base = &model->base;
+    ngram_model_init(base, &ngram_model_trie_funcs, lmath, order,
+                     (int32) counts[0]);
+    base->writable = TRUE;
+
+    if ((model->trie = build_trie_create(config, counts[0], order)) == NULL) {
+        ngram_model_free(base);
+        return NULL;
+    }
+    for (i = 0; i < counts[0]; i++) {
+        model->trie->unigrams[i].prob = probs[i];
+        model->trie->unigrams[i].bo = backoffs[i];
+        base->word_str[i] = ckd_salloc(word_str[i]);
+        if (hash_table_enter(base->wid, base->word_str[i],
+                             (void *) (long) i) != (void *) (long) i) {
+            E_WARN("Duplicate word in dictionary: %s\n",
+                   base->word_str[i]);
+        }
+    }
+    if (order > 1)
+        lm_trie_build(model->trie, raw_ngrams, raw_words, counts,
+                      base->n_counts, order, build_nthreads(config));
+    return base;
+}
+
 int
 ngram_model_trie_write_arpa(ngram_model_t * base, const char *path)
 {
@@ -262,23 +389,10 @@ ngram_model_trie_write_arpa(ngram_model_t * base, const char *path)
     /* Write ngrams */
     if (base->n > 1) {
         for (i = 2; i <= base->n; ++i) {
+            uint32 *raw_words;
             ngram_raw_t *raw_ngrams =
-                (ngram_raw_t *) ckd_calloc((size_t) base->n_counts[i - 1],
-                                           sizeof(*raw_ngrams));
-            uint32 raw_ngram_idx;
+                ngram_model_trie_raw_ngrams(base, i, &raw_words);
             uint32 j;
-            uint32 hist[NGRAM_MAX_ORDER];
-            node_range_t range;
-            raw_ngram_idx = 0;
-            range.begin = range.end = 0;  
-
-            /* we need to iterate over a trie here. recursion should do the job */
-            lm_trie_fill_raw_ngram(model->trie, raw_ngrams,
-                           &raw_ngram_idx, base->n_counts, range, hist, 0,
-                           i, base->n);
-            assert(raw_ngram_idx == base->n_counts[i - 1]);
-            qsort(raw_ngrams, (size_t) base->n_counts[i - 1],
-                  sizeof(ngram_raw_t), &ngram_ord_comparator);
 
             fprintf(fp, "\n\\%d-grams:\n", i);
             for (j = 0; j < base->n_counts[i - 1]; j++) {
@@ -286,14 +400,15 @@ ngram_model_trie_write_arpa(ngram_model_t * base, const char *path)
                 fprintf(fp, "%.4f", logmath_log_float_to_log10(base->lmath, raw_ngrams[j].prob));
                 for (k = 0; k < i; k++) {
                     fprintf(fp, "\t%s",
-                            base->word_str[raw_ngrams[j].words[k]]);
+                            base->word_str[ngram_raw_words(raw_words,
+                                                           &raw_ngrams[j])[k]]);
                 }
-                ckd_free(raw_ngrams[j].words);
                 if (i < base->n) {
                     fprintf(fp, "\t%.4f", logmath_log_float_to_log10(base->lmath, raw_ngrams[j].backoff));
                 }
                 fprintf(fp, "\n");
             }
+            ckd_free(raw_words);
             ckd_free(raw_ngrams);
         }
     }
@@ -350,6 +465,7 @@ ngram_model_trie_read_bin(cmd_ln_t * config,
     uint32 counts[NGRAM_MAX_ORDER];
     ngram_model_trie_t *model;
     ngram_model_t *base;
+    mmio_file_t *filemem;
 
     E_INFO("Trying to read LM in trie binary format\n");
     if ((fp = fopen_comp(path, "rb", &is_pipe)) == NULL) {
@@ -367,6 +483,7 @@ ngram_model_trie_read_bin(cmd_ln_t * config,
         return NULL;
     }
     model = (ngram_model_trie_t *) ckd_calloc(1, sizeof(*model));
+    ngram_hist_cache_reset(&model->cache);
     base = &model->base;
     fread(&order, sizeof(order), 1, fp);
     for (i = 0; i < order; i++) {
@@ -378,7 +495,29 @@ ngram_model_trie_read_bin(cmd_ln_t * config,
         base->n_counts[i] = counts[i];
     }
 
-    model->trie = lm_trie_read_bin(counts, order, fp);
+    filemem = NULL;
+    if (config && cmd_ln_exists_r(config, "-mmap")
+        && cmd_ln_boolean_r(config, "-mmap")) {
+        if (is_pipe)
+            E_WARN("Cannot memory-map compressed LM file, reading it instead\n");
+        else if ((filemem = mmio_file_read(path)) == NULL)
+            E_WARN("Failed to memory-map %s, reading it instead\n", path);
+    }
+    if (filemem) {
+        E_INFO("Memory-mapping trie from %s\n", path);
+        if ((model->trie =
+             lm_trie_read_mmap(counts, order, fp, filemem)) == NULL) {
+            mmio_file_unmap(filemem);
+            fclose_comp(fp, is_pipe);
+            ngram_model_free(base);
+            return NULL;
+        }
+    }
+    else if ((model->trie = lm_trie_read_bin(counts, order, fp)) == NULL) {
+        fclose_comp(fp, is_pipe);
+        ngram_model_free(base);
+        return NULL;
+    }
     read_word_str(base, fp);
     fclose_comp(fp, is_pipe);
 
@@ -423,6 +562,122 @@ ngram_model_trie_write_bin(ngram_model_t * base, const char *path)
     return 0;
 }
 
+/* Memory budget for building a trie in bytes, from -membudget. */
+static size_t
+build_budget(cmd_ln_t * config)
+{
+    if (config && cmd_ln_exists_r(config, "-membudget"))
+        return (size_t) (cmd_ln_float32_r(config, "-membudget")
+                         * 1024 * 1024);
+    return 0;
+}
+
+int
+ngram_model_trie_convert_arpa_bin(cmd_ln_t * config,
+                                  const char *arpa_path,
+                                  const char *bin_path, logmath_t * lmath)
+{
+    FILE *fp, *out;
+    lineiter_t *li;
+    ngram_model_trie_t *model;
+    ngram_model_t *base;
+    ngram_runs_t *runs;
+    const char *tmpdir;
+    size_t budget;
+    int32 is_pipe;
+    uint32 counts[NGRAM_MAX_ORDER];
+    long counts_offset;
+    int order, rv;
+    int i;
+
+    budget = build_budget(config);
+    tmpdir = (config && cmd_ln_exists_r(config, "-tmpdir"))
+        ? cmd_ln_str_r(config, "-tmpdir") : NULL;
+    if (budget == 0) {
+        E_ERROR("No memory budget given for building %s\n", bin_path);
+        return -1;
+    }
+
+    E_INFO("Converting %s to %s using %.1f MB for N-Grams\n",
+           arpa_path, bin_path, budget / 1048576.0);
+    if ((fp = fopen_comp(arpa_path, "r", &is_pipe)) == NULL) {
+        E_ERROR("File %s not found\n", arpa_path);
+        return -1;
+    }
+
+    model = (ngram_model_trie_t *) ckd_calloc(1, sizeof(*model));
+    ngram_hist_cache_reset(&model->cache);
+    li = lineiter_start_clean(fp);
+    /* Read n-gram counts from file */
+    if (read_counts_arpa(&li, counts, &order) == -1) {
+        ckd_free(model);
+        lineiter_free(li);
+        fclose_comp(fp, is_pipe);
+        return -1;
+    }
+
+    E_INFO("LM of order %d\n", order);
+    for (i = 0; i < order; i++) {
+        E_INFO("#%d-grams: %d\n", i + 1, counts[i]);
+    }
+
+    base = &model->base;
+    ngram_model_init(base, &ngram_model_trie_funcs, lmath, order,
+                     (int32) counts[0]);
+    base->writable = TRUE;
+
+    /* Only the unigrams and word strings are kept in memory, the rest
+     * is spilled to sorted runs and merged into the output. */
+    runs = NULL;
+    if ((model->trie = build_trie_create(config, counts[0], order)) == NULL
+        || read_1grams_arpa(&li, counts[0], base,
+                            model->trie->unigrams) < 0
+        || (order > 1
+            && (runs = ngrams_raw_spill_arpa(&li, base->lmath, counts,
+                                             order, base->wid,
+                                             build_nthreads(config),
+                                             budget, tmpdir)) == NULL)) {
+	ngram_model_free(base);
+        lineiter_free(li);
+        fclose_comp(fp, is_pipe);
+        return -1;
+    }
+    lineiter_free(li);
+    fclose_comp(fp, is_pipe);
+
+    /* The trie is written out of order, so this can't be a pipe. */
+    if ((out = fopen(bin_path, "wb")) == NULL) {
+        E_ERROR_SYSTEM("Unable to open %s to write binary trie LM",
+                       bin_path);
+        ngram_runs_free(runs, order);
+        ngram_model_free(base);
+        return -1;
+    }
+    fwrite(trie_hdr, sizeof(*trie_hdr), strlen(trie_hdr), out);
+    fwrite(&base->n, sizeof(base->n), 1, out);
+    /* Counts including missing prefixes are only known at the end. */
+    counts_offset = ftell(out);
+    for (i = 0; i < order; i++)
+        fwrite(&counts[i], sizeof(counts[i]), 1, out);
+    rv = lm_trie_build_stream(model->trie, runs, counts, base->n_counts,
+                              order, budget, out);
+    ngram_runs_free(runs, order);
+    if (rv == 0) {
+        write_word_str(out, base);
+        fseek(out, counts_offset, SEEK_SET);
+        for (i = 0; i < order; i++)
+            fwrite(&base->n_counts[i], sizeof(base->n_counts[i]), 1, out);
+        if (ferror(out))
+            rv = -1;
+    }
+    if (fclose(out) != 0 || rv < 0) {
+        E_ERROR_SYSTEM("Failed to write binary trie LM to %s", bin_path);
+        rv = -1;
+    }
+    ngram_model_free(base);
+    return rv;
+}
+
 ngram_model_t *
 ngram_model_trie_read_dmp(cmd_ln_t * config,
                           const char *file_name, logmath_t * lmath)
@@ -441,6 +696,7 @@ ngram_model_trie_read_dmp(cmd_ln_t * config,
     ngram_model_trie_t *model;
     ngram_model_t *base;
     ngram_raw_t **raw_ngrams;
+    uint32 *raw_words[NGRAM_MAX_ORDER - 1];
 
     E_INFO("Trying to read LM in dmp format\n");
     if ((fp = fopen_comp(file_name, "rb", &is_pipe)) == NULL) {
@@ -527,6 +783,7 @@ ngram_model_trie_read_dmp(cmd_ln_t * config,
     E_INFO("ngrams 1=%d, 2=%d, 3=%d\n", counts[0], counts[1], counts[2]);
 
     model = (ngram_model_trie_t *) ckd_calloc(1, sizeof(*model));
+    ngram_hist_cache_reset(&model->cache);
     base = &model->base;
     if (counts[2] > 0)
         order = 3;
@@ -537,7 +794,11 @@ ngram_model_trie_read_dmp(cmd_ln_t * config,
     ngram_model_init(base, &ngram_model_trie_funcs, lmath, order,
                      (int32) counts[0]);
 
-    model->trie = lm_trie_create(counts[0], order);
+    if ((model->trie = build_trie_create(config, counts[0], order)) == NULL) {
+        ngram_model_free(base);
+        fclose_comp(fp, is_pipe);
+        return NULL;
+    }
 
     unigram_next =
         (uint32 *) ckd_calloc((int32) counts[0] + 1, sizeof(unigram_next));
@@ -567,15 +828,16 @@ ngram_model_trie_read_dmp(cmd_ln_t * config,
     if (order > 1) {
         raw_ngrams =
             ngrams_raw_read_dmp(fp, lmath, counts, order, unigram_next,
-                                do_swap);
+                                do_swap, raw_words);
         if (raw_ngrams == NULL) {
             ngram_model_free(base);
             ckd_free(unigram_next);
             fclose_comp(fp, is_pipe);
             return NULL;
         }
-        lm_trie_build(model->trie, raw_ngrams, counts, base->n_counts, order);        
-        ngrams_raw_free(raw_ngrams, counts, order);
+        lm_trie_build(model->trie, raw_ngrams, raw_words, counts,
+                      base->n_counts, order, build_nthreads(config));
+        ngrams_raw_free(raw_ngrams, raw_words, order);
     }
     
     /* Sentinel unigram and bigrams read before */
@@ -611,8 +873,9 @@ weight_score(ngram_model_t * base, int32 score)
 }
 
 static int32
-ngram_model_trie_raw_score(ngram_model_t * base, int32 wid, int32 * hist,
-                           int32 n_hist, int32 * n_used)
+ngram_model_trie_raw_score_r(ngram_model_t * base,
+                             ngram_hist_cache_t * cache, int32 wid,
+                             int32 * hist, int32 n_hist, int32 * n_used)
 {
     int32 i;
     ngram_model_trie_t *model = (ngram_model_trie_t *) base;
@@ -626,8 +889,18 @@ ngram_model_trie_raw_score(ngram_model_t * base, int32 wid, int32 * hist,
         }
     }
 
-    return (int32) lm_trie_score(model->trie, model->base.n, wid, hist,
-                                 n_hist, n_used);
+    return (int32) lm_trie_score(model->trie, cache, model->base.n, wid,
+                                 hist, n_hist, n_used);
+}
+
+static int32
+ngram_model_trie_raw_score(ngram_model_t * base, int32 wid, int32 * hist,
+                           int32 n_hist, int32 * n_used)
+{
+    ngram_model_trie_t *model = (ngram_model_trie_t *) base;
+
+    return ngram_model_trie_raw_score_r(base, &model->cache, wid, hist,
+                                        n_hist, n_used);
 }
 
 static int32
@@ -639,6 +912,71 @@ ngram_model_trie_score(ngram_model_t * base, int32 wid, int32 * hist,
                                                    n_used));
 }
 
+static int32
+ngram_model_trie_score_r(ngram_model_t * base, ngram_hist_cache_t * cache,
+                         int32 wid, int32 * hist, int32 n_hist,
+                         int32 * n_used)
+{
+    return weight_score(base,
+                        ngram_model_trie_raw_score_r(base, cache, wid, hist,
+                                                     n_hist, n_used));
+}
+
+static void
+ngram_model_trie_score_batch(ngram_model_t * base, int32 * wids,
+                             int32 ** hists, int32 * n_hists,
+                             int32 n_queries, int32 * out_scores,
+                             int32 * out_n_used)
+{
+    ngram_model_trie_t *model = (ngram_model_trie_t *) base;
+    float *probs;
+    int32 *clipped;
+    int32 i, j;
+
+    probs = (float *) ckd_calloc(n_queries, sizeof(*probs));
+    clipped = (int32 *) ckd_calloc(n_queries, sizeof(*clipped));
+    /* Same history clipping as ngram_model_trie_raw_score_r(). */
+    for (i = 0; i < n_queries; i++) {
+        clipped[i] = n_hists[i];
+        if (clipped[i] > base->n - 1)
+            clipped[i] = base->n - 1;
+        for (j = 0; j < clipped[i]; j++) {
+            if (hists[i][j] < 0) {
+                clipped[i] = j;
+                break;
+            }
+        }
+    }
+    lm_trie_score_batch(model->trie, base->n, wids, hists, clipped,
+                        n_queries, probs, out_n_used);
+    for (i = 0; i < n_queries; i++)
+        out_scores[i] = weight_score(base, (int32) probs[i]);
+    ckd_free(clipped);
+    ckd_free(probs);
+}
+
+static void
+ngram_model_trie_state_init(ngram_model_t * base, ngram_state_t * state)
+{
+    ngram_model_trie_t *model = (ngram_model_trie_t *) base;
+
+    lm_trie_state_init(model->trie, base->n, state);
+}
+
+static int32
+ngram_model_trie_score_state(ngram_model_t * base,
+                             const ngram_state_t * state, int32 wid,
+                             ngram_state_t * out_state)
+{
+    ngram_model_trie_t *model = (ngram_model_trie_t *) base;
+    int32 n_used;
+
+    return weight_score(base,
+                        (int32) lm_trie_score_state(model->trie, base->n,
+                                                    state, wid, out_state,
+                                                    &n_used));
+}
+
 static int32
 lm_trie_add_ug(ngram_model_t * base, int32 wid, int32 lweight)
 {
@@ -647,11 +985,22 @@ lm_trie_add_ug(ngram_model_t * base, int32 wid, int32 lweight)
     /* This would be very bad if this happened! */
     assert(!NGRAM_IS_CLASSWID(wid));
 
-    /* Reallocate unigram array. */
-    model->trie->unigrams =
-        (unigram_t *) ckd_realloc(model->trie->unigrams,
-                                  sizeof(*model->trie->unigrams) *
-                                  (base->n_1g_alloc + 1));
+    /* Reallocate unigram array, copying it out of the mapped file
+     * if necessary. */
+    if (model->trie->unigrams_mapped) {
+        unigram_t *unigrams =
+            (unigram_t *) ckd_calloc(base->n_1g_alloc + 1,
+                                     sizeof(*unigrams));
+        memcpy(unigrams, model->trie->unigrams,
+               (base->n_counts[0] + 1) * sizeof(*unigrams));
+        model->trie->unigrams = unigrams;
+        model->trie->unigrams_mapped = FALSE;
+    }
+    else
+        model->trie->unigrams =
+            (unigram_t *) ckd_realloc(model->trie->unigrams,
+                                      sizeof(*model->trie->unigrams) *
+                                      (base->n_1g_alloc + 1));
     memset(model->trie->unigrams + (base->n_counts[0] + 1), 0,
            (size_t) (base->n_1g_alloc -
                      base->n_counts[0]) * sizeof(*model->trie->unigrams));
@@ -677,9 +1026,7 @@ static void
 lm_trie_flush(ngram_model_t * base)
 {
     ngram_model_trie_t *model = (ngram_model_trie_t *) base;
-    lm_trie_t *trie = model->trie;
-    memset(trie->hist_cache, -1, sizeof(trie->hist_cache));
-    memset(trie->backoff_cache, 0, sizeof(trie->backoff_cache));
+    ngram_hist_cache_reset(&model->cache);
     return;
 }
 
@@ -689,5 +1036,9 @@ static ngram_funcs_t ngram_model_trie_funcs = {
     ngram_model_trie_score,     /* score */
     ngram_model_trie_raw_score, /* raw_score */
     lm_trie_add_ug,             /* add_ug */
-    lm_trie_flush               /* flush */
+    lm_trie_flush,              /* flush */
+    ngram_model_trie_score_r,   /* score_r */
+    ngram_model_trie_score_batch, /* score_batch */
+    ngram_model_trie_state_init, /* state_init */
+    ngram_model_trie_score_state /* score_state */
 };
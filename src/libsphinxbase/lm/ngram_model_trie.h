@@ -46,6 +46,7 @@
 typedef struct ngram_model_trie_s {
     ngram_model_t base;  /**< Base ngram_model_t structure */
     lm_trie_t *trie;     /**< Trie structure that stores ngram relations and weights */
+    ngram_hist_cache_t cache; /**< History cache for ngram_ng_score() */
 } ngram_model_trie_t;
 
 /**
@@ -72,6 +73,36 @@ ngram_model_t *ngram_model_trie_read_bin(cmd_ln_t * config,
  */
 int ngram_model_trie_write_bin(ngram_model_t * model, const char *path);
 
+/**
+ * Convert an ARPABO text file to a binary trie file, keeping no more
+ * than the memory budget given by -membudget for N-Grams
+ */
+int ngram_model_trie_convert_arpa_bin(cmd_ln_t * config,
+                                      const char *arpa_path,
+                                      const char *bin_path,
+                                      logmath_t * lmath);
+
+/**
+ * Get all N-Grams of one order from a trie model, with their words in
+ * the order they are written in ARPABO files.
+ * @return The N-Grams, or NULL if base is not a trie model.
+ */
+ngram_raw_t *ngram_model_trie_raw_ngrams(ngram_model_t * base, int order,
+                                         uint32 ** out_words);
+
+/**
+ * Create a trie model from unigram weights and N-Grams of higher
+ * orders, sorted as by ngrams_raw_sort().  Word strings are copied.
+ * The trie is quantized and built as -probbits, -bobits and -nthreads
+ * in config say, if it has them.
+ */
+ngram_model_t *ngram_model_trie_build(cmd_ln_t * config,
+                                      logmath_t * lmath, int order,
+                                      uint32 * counts, char **word_str,
+                                      float32 * probs, float32 * backoffs,
+                                      ngram_raw_t ** raw_ngrams,
+                                      uint32 ** raw_words);
+
 /**
  * Read N-Gram model from DMP file and arrange it in trie structure
  */
@@ -35,42 +35,213 @@
  *
  */
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
 #include <string.h>
 
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
 #include <sphinxbase/err.h>
 #include <sphinxbase/pio.h>
 #include <sphinxbase/strfuncs.h>
 #include <sphinxbase/ckd_alloc.h>
 #include <sphinxbase/byteorder.h>
+#include <sphinxbase/sbthread.h>
 
 #include "ngram_model_internal.h"
 #include "ngrams_raw.h"
 
 int
-ngram_ord_comparator(const void *a_raw, const void *b_raw)
+ngram_words_compare(const uint32 *a_words, int a_order,
+                    const uint32 *b_words, int b_order)
 {
-    ngram_raw_t *a = (ngram_raw_t *) a_raw;
-    ngram_raw_t *b = (ngram_raw_t *) b_raw;
     int a_w_ptr = 0;
     int b_w_ptr = 0;
-    while (a_w_ptr < a->order && b_w_ptr < b->order) {
-        if (a->words[a_w_ptr] == b->words[b_w_ptr]) {
+    while (a_w_ptr < a_order && b_w_ptr < b_order) {
+        if (a_words[a_w_ptr] == b_words[b_w_ptr]) {
             a_w_ptr++;
             b_w_ptr++;
             continue;
         }
-        if (a->words[a_w_ptr] < b->words[b_w_ptr])
+        if (a_words[a_w_ptr] < b_words[b_w_ptr])
             return -1;
         else
             return 1;
     }
-    return a->order - b->order;
+    return a_order - b_order;
+}
+
+/*
+ * Parallel LSD radix sort on word IDs.  The array is cut into blocks,
+ * and each pass counts the digits in every block, then moves each
+ * block's n-grams and their words to their place in second arrays.
+ * Going from the last word to the first gives the same order as
+ * ngram_words_compare.
+ */
+#define RADIX_BITS 11
+#define RADIX_SIZE (1 << RADIX_BITS)
+
+typedef struct radix_sort_s {
+    ngram_raw_t *src;
+    ngram_raw_t *dst;
+    uint32 *src_words;
+    uint32 *dst_words;
+    uint32 count;
+    uint32 block_size;
+    uint32 *hist;               /**< RADIX_SIZE counts for each block */
+    uint32 *max_wid;            /**< Largest word ID in each block */
+    int order;
+    int word;
+    int shift;
+} radix_sort_t;
+
+static void
+radix_max_blocks(void *arg, int start, int end)
+{
+    radix_sort_t *rs = (radix_sort_t *) arg;
+    int b;
+
+    for (b = start; b < end; b++) {
+        size_t i = (size_t) b * rs->block_size * rs->order;
+        size_t i_end = i + (size_t) rs->block_size * rs->order;
+        uint32 max_wid = 0;
+
+        if (i_end > (size_t) rs->count * rs->order)
+            i_end = (size_t) rs->count * rs->order;
+        for (; i < i_end; i++)
+            if (rs->src_words[i] > max_wid)
+                max_wid = rs->src_words[i];
+        rs->max_wid[b] = max_wid;
+    }
+}
+
+static void
+radix_count_blocks(void *arg, int start, int end)
+{
+    radix_sort_t *rs = (radix_sort_t *) arg;
+    int b;
+
+    for (b = start; b < end; b++) {
+        uint32 *hist = rs->hist + (size_t) b * RADIX_SIZE;
+        uint32 i = b * rs->block_size;
+        uint32 i_end = i + rs->block_size;
+
+        if (i_end > rs->count)
+            i_end = rs->count;
+        memset(hist, 0, RADIX_SIZE * sizeof(*hist));
+        for (; i < i_end; i++)
+            hist[(rs->src_words[(size_t) i * rs->order + rs->word]
+                  >> rs->shift) & (RADIX_SIZE - 1)]++;
+    }
+}
+
+static void
+radix_move_blocks(void *arg, int start, int end)
+{
+    radix_sort_t *rs = (radix_sort_t *) arg;
+    int b;
+
+    for (b = start; b < end; b++) {
+        uint32 *pos = rs->hist + (size_t) b * RADIX_SIZE;
+        uint32 i = b * rs->block_size;
+        uint32 i_end = i + rs->block_size;
+
+        if (i_end > rs->count)
+            i_end = rs->count;
+        for (; i < i_end; i++) {
+            uint32 *words = rs->src_words + (size_t) i * rs->order;
+            uint32 j = pos[(words[rs->word] >> rs->shift)
+                           & (RADIX_SIZE - 1)]++;
+
+            rs->dst[j] = rs->src[i];
+            rs->dst[j].offset = j;
+            memcpy(rs->dst_words + (size_t) j * rs->order, words,
+                   rs->order * sizeof(*words));
+        }
+    }
+}
+
+void
+ngrams_raw_sort(ngram_raw_t * raw_ngrams, uint32 * words, uint32 count,
+                int order, sbpool_t * pool)
+{
+    radix_sort_t rs;
+    ngram_raw_t *tmp;
+    uint32 *tmp_words;
+    uint32 max_wid;
+    int n_blocks, b, d;
+
+    if (count < 2)
+        return;
+    /* A few blocks per thread, but not too small to be worth it. */
+    n_blocks = pool ? sbpool_nthreads(pool) * 4 : 1;
+    if ((uint32) n_blocks > count / RADIX_SIZE + 1)
+        n_blocks = count / RADIX_SIZE + 1;
+    rs.count = count;
+    rs.block_size = (count + n_blocks - 1) / n_blocks;
+    n_blocks = (count + rs.block_size - 1) / rs.block_size;
+    rs.order = order;
+    rs.src = raw_ngrams;
+    rs.dst = tmp = (ngram_raw_t *) ckd_calloc(count, sizeof(*tmp));
+    rs.src_words = words;
+    rs.dst_words = tmp_words =
+        (uint32 *) ckd_calloc((size_t) count * order, sizeof(*tmp_words));
+    rs.hist = (uint32 *) ckd_calloc((size_t) n_blocks * RADIX_SIZE,
+                                    sizeof(*rs.hist));
+    rs.max_wid = (uint32 *) ckd_calloc(n_blocks, sizeof(*rs.max_wid));
+
+    /* Only sort on as many digits as the word IDs need. */
+    sbpool_parallel_for(pool, 0, n_blocks, 1, radix_max_blocks, &rs);
+    for (max_wid = 0, b = 0; b < n_blocks; b++)
+        if (rs.max_wid[b] > max_wid)
+            max_wid = rs.max_wid[b];
+
+    for (rs.word = order - 1; rs.word >= 0; rs.word--) {
+        for (rs.shift = 0; rs.shift < 32 && (max_wid >> rs.shift) != 0;
+             rs.shift += RADIX_BITS) {
+            uint32 pos;
+
+            sbpool_parallel_for(pool, 0, n_blocks, 1,
+                                radix_count_blocks, &rs);
+            /* Turn counts into starting positions, digit by digit,
+             * then block by block, which keeps the sort stable. */
+            for (pos = 0, d = 0; d < RADIX_SIZE; d++) {
+                for (b = 0; b < n_blocks; b++) {
+                    uint32 *hist = rs.hist + (size_t) b * RADIX_SIZE + d;
+                    uint32 n = *hist;
+
+                    *hist = pos;
+                    pos += n;
+                }
+            }
+            sbpool_parallel_for(pool, 0, n_blocks, 1,
+                                radix_move_blocks, &rs);
+            rs.dst = rs.src;
+            rs.src = (rs.src == tmp) ? raw_ngrams : tmp;
+            rs.dst_words = rs.src_words;
+            rs.src_words = (rs.src_words == tmp_words) ? words : tmp_words;
+        }
+    }
+    if (rs.src != raw_ngrams) {
+        memcpy(raw_ngrams, rs.src, count * sizeof(*raw_ngrams));
+        memcpy(words, rs.src_words,
+               (size_t) count * order * sizeof(*words));
+    }
+    ckd_free(rs.max_wid);
+    ckd_free(rs.hist);
+    ckd_free(tmp_words);
+    ckd_free(tmp);
 }
 
 static int
-ngrams_raw_read_line(lineiter_t *li, hash_table_t *wid,
+ngrams_raw_read_line(char *line, int lineno, hash_table_t *wid,
                     logmath_t *lmath, int order, int order_max,
-                    ngram_raw_t *raw_ngram)
+                    ngram_raw_t *raw_ngram, uint32 *words)
 {
     int n, i;
     int words_expected;
@@ -79,9 +250,9 @@ ngrams_raw_read_line(lineiter_t *li, hash_table_t *wid,
 
     words_expected = order + 1;
     if ((n =
-         str2words(li->buf, wptr,
+         str2words(line, wptr,
                    NGRAM_MAX_ORDER + 1)) < words_expected) {
-        E_ERROR("Format error; %d-gram ignored at line %d\n", order, li->lineno);
+        E_ERROR("Format error; %d-gram ignored at line %d\n", order, lineno);
         return -1;
     }
 
@@ -118,22 +289,149 @@ ngrams_raw_read_line(lineiter_t *li, hash_table_t *wid,
                 logmath_log10_to_log_float(lmath, backoff);
         }
     }
-    raw_ngram->words =
-        (uint32 *) ckd_calloc(order, sizeof(*raw_ngram->words));
-    for (word_out = raw_ngram->words + order - 1, i = 1;
-         word_out >= raw_ngram->words; --word_out, i++) {
+    for (word_out = words + order - 1, i = 1;
+         word_out >= words; --word_out, i++) {
         hash_table_lookup_int32(wid, wptr[i], (int32 *) word_out);
     }
     return 0;
 }
 
+/*
+ * N-gram sections are parsed in parallel.  The calling thread reads
+ * lines into a batch of text while the pool parses the previous one,
+ * so I/O and decompression overlap with parsing.  Each batch is cut
+ * into chunks of consecutive lines, which are parsed into their own
+ * slots in the section's array, so no locking is needed.  Lines which
+ * fail to parse leave an empty slot, with order 0, removed afterwards.
+ */
+#define ARPA_BATCH_BYTES (16 * 1024 * 1024)
+#define ARPA_CHUNK_BYTES (256 * 1024)
+
+typedef struct arpa_section_s arpa_section_t;
+
+typedef struct arpa_chunk_s {
+    arpa_section_t *section;
+    char *text;                 /**< Lines, each ending in a newline */
+    size_t len;
+    uint32 first;               /**< Index of the first n-gram */
+    int lineno;                 /**< Line number of the first line */
+} arpa_chunk_t;
+
+typedef struct arpa_batch_s {
+    char *text;
+    size_t len;
+    size_t alloc;
+    arpa_chunk_t *chunks;
+    int n_chunks;
+    int n_alloc;
+} arpa_batch_t;
+
+struct arpa_section_s {
+    ngram_raw_t *raw_ngrams;
+    uint32 *words;
+    hash_table_t *wid;
+    logmath_t *lmath;
+    size_t batch_bytes;         /**< Text to read in each batch */
+    int order;
+    int order_max;
+};
+
+static void
+arpa_chunk_parse(void *arg)
+{
+    arpa_chunk_t *chunk = (arpa_chunk_t *) arg;
+    arpa_section_t *s = chunk->section;
+    char *line, *end, *nl;
+    uint32 i;
+    int lineno;
+
+    end = chunk->text + chunk->len;
+    for (line = chunk->text, i = chunk->first, lineno = chunk->lineno;
+         line < end; line = nl + 1, i++, lineno++) {
+        nl = memchr(line, '\n', end - line);
+        *nl = '\0';
+        s->raw_ngrams[i].offset = i;
+        ngrams_raw_read_line(line, lineno, s->wid, s->lmath, s->order,
+                             s->order_max, s->raw_ngrams + i,
+                             s->words + (size_t) i * s->order);
+    }
+}
+
+/* Start a new chunk at the end of a batch. */
+static void
+arpa_batch_cut(arpa_batch_t * batch, arpa_section_t * s, uint32 first,
+               int lineno)
+{
+    arpa_chunk_t *chunk;
+
+    if (batch->n_chunks == batch->n_alloc) {
+        batch->n_alloc = batch->n_alloc ? batch->n_alloc * 2 : 64;
+        batch->chunks = (arpa_chunk_t *)
+            ckd_realloc(batch->chunks,
+                        batch->n_alloc * sizeof(*batch->chunks));
+    }
+    chunk = &batch->chunks[batch->n_chunks++];
+    chunk->section = s;
+    chunk->text = NULL;
+    chunk->len = batch->len;    /* Offset until the batch is full */
+    chunk->first = first;
+    chunk->lineno = lineno;
+}
+
+/*
+ * Read lines from i up to count into a batch.  Returns the index of
+ * the next n-gram, or -1 if the file ends first.
+ */
+static int64
+arpa_batch_fill(arpa_batch_t * batch, arpa_section_t * s, lineiter_t ** li,
+                uint32 i, uint32 count)
+{
+    int c, lineno;
+
+    batch->len = 0;
+    batch->n_chunks = 0;
+    lineno = -1;
+    for (; i < count && batch->len < s->batch_bytes; i++) {
+        size_t len;
+        arpa_chunk_t *chunk;
+
+        *li = lineiter_next(*li);
+        if (*li == NULL) {
+            E_ERROR("Unexpected end of ARPA file. Failed to read %d-gram\n",
+                    s->order);
+            return -1;
+        }
+        /* Chunks need contiguous line numbers for error messages. */
+        chunk = batch->n_chunks ? &batch->chunks[batch->n_chunks - 1] : NULL;
+        if (chunk == NULL || (*li)->lineno != lineno + 1
+            || batch->len - chunk->len >= ARPA_CHUNK_BYTES)
+            arpa_batch_cut(batch, s, i, (*li)->lineno);
+        lineno = (*li)->lineno;
+        len = strlen((*li)->buf);
+        if (batch->len + len + 1 > batch->alloc) {
+            /* Very long lines are rare, so grow just enough. */
+            batch->alloc = batch->len + len + 1;
+            batch->text = ckd_realloc(batch->text, batch->alloc);
+        }
+        memcpy(batch->text + batch->len, (*li)->buf, len);
+        batch->len += len;
+        batch->text[batch->len++] = '\n';
+    }
+    /* Now that the text won't move, turn offsets into pointers. */
+    for (c = 0; c < batch->n_chunks; c++) {
+        size_t next = (c + 1 < batch->n_chunks)
+            ? batch->chunks[c + 1].len : batch->len;
+        batch->chunks[c].text = batch->text + batch->chunks[c].len;
+        batch->chunks[c].len = next - batch->chunks[c].len;
+    }
+    return i;
+}
+
+/* Skip to the header of the section for order. */
 static int
-ngrams_raw_read_section(ngram_raw_t ** raw_ngrams, lineiter_t ** li,
-                      hash_table_t * wid, logmath_t * lmath, uint32 *count,
-                      int order, int order_max)
+arpa_section_start(lineiter_t ** li, int order)
 {
     char expected_header[20];
-    uint32 i, cur;
 
     sprintf(expected_header, "\\%d-grams:", order);
     while (*li && strcmp((*li)->buf, expected_header) != 0) {
@@ -144,56 +442,383 @@ ngrams_raw_read_section(ngram_raw_t ** raw_ngrams, lineiter_t ** li,
 	E_ERROR("Failed to find '%s', language model file truncated\n", expected_header);
 	return -1;
     }
-    
+    return 0;
+}
+
+/*
+ * Parse the next count lines of a section into the start of its
+ * arrays, and squeeze out the ones which fail.  Returns the number of
+ * ngrams left, or -1 if the file ends first.
+ */
+static int64
+arpa_section_parse(arpa_section_t * s, lineiter_t ** li, uint32 count,
+                   sbpool_t * pool)
+{
+    arpa_batch_t batches[2];
+    sbtaskgroup_t *group;
+    int64 next;
+    uint32 i, cur;
+    int b, c, rv;
+
+    memset(batches, 0, sizeof(batches));
+    for (b = 0; b < 2; b++) {
+        batches[b].alloc = s->batch_bytes + s->batch_bytes / 64;
+        batches[b].text = ckd_malloc(batches[b].alloc);
+    }
+
+    /* Read one batch while the other is parsed. */
+    group = sbtaskgroup_init(pool);
+    rv = 0;
+    for (next = 0, b = 0; next < count; b = !b) {
+        next = arpa_batch_fill(&batches[b], s, li, (uint32) next, count);
+        sbtaskgroup_wait(group);
+        if (next < 0) {
+            rv = -1;
+            break;
+        }
+        for (c = 0; c < batches[b].n_chunks; c++)
+            sbtaskgroup_run(group, arpa_chunk_parse, &batches[b].chunks[c]);
+    }
+    sbtaskgroup_free(group);
+    for (b = 0; b < 2; b++) {
+        ckd_free(batches[b].text);
+        ckd_free(batches[b].chunks);
+    }
+    if (rv < 0)
+        return rv;
+
+    /* Squeeze out the lines that failed to parse. */
+    for (i = 0, cur = 0; i < count; i++) {
+        if (s->raw_ngrams[i].order == 0)
+            continue;
+        if (cur != i) {
+            s->raw_ngrams[cur] = s->raw_ngrams[i];
+            s->raw_ngrams[cur].offset = cur;
+            memcpy(s->words + (size_t) cur * s->order,
+                   s->words + (size_t) i * s->order,
+                   s->order * sizeof(*s->words));
+        }
+        cur++;
+    }
+    return cur;
+}
+
+static int
+ngrams_raw_read_section(ngram_raw_t ** raw_ngrams, uint32 ** words,
+                      lineiter_t ** li,
+                      hash_table_t * wid, logmath_t * lmath, uint32 *count,
+                      int order, int order_max, sbpool_t * pool)
+{
+    arpa_section_t section;
+    int64 n;
+
+    if (arpa_section_start(li, order) < 0)
+        return -1;
     *raw_ngrams = (ngram_raw_t *) ckd_calloc(*count, sizeof(ngram_raw_t));
-    for (i = 0, cur = 0; i < *count && *li != NULL; i++) {
-	*li = lineiter_next(*li);
-        if (*li == NULL) {
-	    E_ERROR("Unexpected end of ARPA file. Failed to read %d-gram\n",
-                order);
-    	    return -1;
-	}
-        if (ngrams_raw_read_line(*li, wid, lmath, order, order_max,
-                                *raw_ngrams + cur) == 0) {
-            cur++;
+    *words = (uint32 *) ckd_calloc((size_t) *count * order, sizeof(**words));
+    section.raw_ngrams = *raw_ngrams;
+    section.words = *words;
+    section.wid = wid;
+    section.lmath = lmath;
+    section.batch_bytes = ARPA_BATCH_BYTES;
+    section.order = order;
+    section.order_max = order_max;
+    if ((n = arpa_section_parse(&section, li, *count, pool)) < 0)
+        return -1;
+    *count = (uint32) n;
+    ngrams_raw_sort(*raw_ngrams, *words, *count, order, pool);
+    return 0;
+}
+
+/* Check for the end-mark after the last section. */
+static int
+arpa_read_end(lineiter_t ** li)
+{
+    if (*li == NULL) {
+        E_ERROR("ARPA file ends without end-mark\n");
+        return -1;
+    } else {
+        *li = lineiter_next(*li);
+	if (*li == NULL || strcmp((*li)->buf, "\\end\\") != 0) {
+    	    E_WARN
+        	("Finished reading ARPA file. Expecting end mark but found '%s'\n",
+        	 *li ? (*li)->buf : "end of file");
         }
     }
-    *count = cur;
-    qsort(*raw_ngrams, *count, sizeof(ngram_raw_t), &ngram_ord_comparator);
     return 0;
 }
 
 ngram_raw_t **
 ngrams_raw_read_arpa(lineiter_t ** li, logmath_t * lmath, uint32 * counts,
-                     int order, hash_table_t * wid)
+                     int order, hash_table_t * wid, int nthreads,
+                     uint32 ** raw_words)
 {
     ngram_raw_t **raw_ngrams;
+    sbpool_t *pool;
     int order_it;
 
     raw_ngrams =
         (ngram_raw_t **) ckd_calloc(order - 1, sizeof(*raw_ngrams));
+    memset(raw_words, 0, (order - 1) * sizeof(*raw_words));
 
+    pool = sbpool_init(NULL, nthreads);
     for (order_it = 2; order_it <= order; order_it++) {
-        if (ngrams_raw_read_section(&raw_ngrams[order_it - 2], li, wid, lmath,
-                              counts + order_it - 1, order_it, order) < 0)
+        if (ngrams_raw_read_section(&raw_ngrams[order_it - 2],
+                              &raw_words[order_it - 2], li, wid, lmath,
+                              counts + order_it - 1, order_it, order,
+                              pool) < 0)
         break;
     }
+    sbpool_free(pool);
 
-    /* Check if we found ARPA end-mark */
-    if (*li == NULL) {
-        E_ERROR("ARPA file ends without end-mark\n");
-	ngrams_raw_free(raw_ngrams, counts, order);
+    if (arpa_read_end(li) < 0) {
+	ngrams_raw_free(raw_ngrams, raw_words, order);
         return NULL;
-    } else {
-        *li = lineiter_next(*li);
-	if (strcmp((*li)->buf, "\\end\\") != 0) {
-    	    E_WARN
-        	("Finished reading ARPA file. Expecting end mark but found '%s'\n",
-        	 (*li)->buf);
+    }
+    return raw_ngrams;
+}
+
+/*
+ * Sections too big for memory are parsed a run at a time.  Each run
+ * is sorted and written to its own temporary file as records of word
+ * indexes followed by the probability and backoff weight, which are
+ * merged when the trie is built.  The smallest batch and run sizes
+ * keep tiny budgets from doing silly amounts of I/O.
+ */
+#define RUN_MIN_BATCH_BYTES 4096
+#define RUN_MIN_NGRAMS 64
+
+static FILE *
+ngram_run_tmpfile(const char *tmpdir)
+{
+    FILE *fp;
+
+#ifdef HAVE_UNISTD_H
+    if (tmpdir) {
+        char *path;
+        int fd;
+
+        path = string_join(tmpdir, "/sphinx_lm.XXXXXX", NULL);
+        fp = NULL;
+        if ((fd = mkstemp(path)) >= 0) {
+            /* Nobody else needs it, so it goes away when closed. */
+            unlink(path);
+            if ((fp = fdopen(fd, "w+b")) == NULL)
+                close(fd);
         }
+        if (fp == NULL)
+            E_ERROR_SYSTEM("Failed to create temporary file in %s", tmpdir);
+        ckd_free(path);
+        return fp;
     }
+#else
+    if (tmpdir)
+        E_WARN("Cannot choose directory for temporary files, ignoring %s\n",
+               tmpdir);
+#endif
+    if ((fp = tmpfile()) == NULL)
+        E_ERROR_SYSTEM("Failed to create temporary file");
+    return fp;
+}
 
-    return raw_ngrams;
+/* Write sorted raw ngrams to a new temporary file. */
+static FILE *
+ngram_run_write(ngram_raw_t * raw_ngrams, uint32 * words, uint32 count,
+                int order, const char *tmpdir)
+{
+    FILE *fp;
+    uint32 i;
+
+    if ((fp = ngram_run_tmpfile(tmpdir)) == NULL)
+        return NULL;
+    for (i = 0; i < count; i++) {
+        fwrite(ngram_raw_words(words, &raw_ngrams[i]), sizeof(*words),
+               order, fp);
+        fwrite(&raw_ngrams[i].prob, sizeof(raw_ngrams[i].prob), 1, fp);
+        fwrite(&raw_ngrams[i].backoff, sizeof(raw_ngrams[i].backoff), 1,
+               fp);
+    }
+    if (fflush(fp) != 0 || ferror(fp)) {
+        E_ERROR_SYSTEM("Failed to write temporary file");
+        fclose(fp);
+        return NULL;
+    }
+    return fp;
+}
+
+static int
+ngrams_raw_spill_section(ngram_runs_t * runs, lineiter_t ** li,
+                         hash_table_t * wid, logmath_t * lmath,
+                         uint32 * count, int order, int order_max,
+                         size_t budget, const char *tmpdir,
+                         sbpool_t * pool)
+{
+    arpa_section_t section;
+    size_t ngram_size;
+    uint32 cap, i, n, total;
+    int64 valid;
+    int rv;
+
+    if (arpa_section_start(li, order) < 0)
+        return -1;
+    /* Two batches of text, then a run and the copy made to sort it. */
+    section.batch_bytes = budget / 8;
+    if (section.batch_bytes > ARPA_BATCH_BYTES)
+        section.batch_bytes = ARPA_BATCH_BYTES;
+    if (section.batch_bytes < RUN_MIN_BATCH_BYTES)
+        section.batch_bytes = RUN_MIN_BATCH_BYTES;
+    ngram_size = 2 * (sizeof(ngram_raw_t) + order * sizeof(uint32));
+    cap = RUN_MIN_NGRAMS;
+    if (budget > 2 * section.batch_bytes
+        && (budget - 2 * section.batch_bytes) / ngram_size > cap)
+        cap = (budget - 2 * section.batch_bytes) / ngram_size;
+    if (cap > *count)
+        cap = *count ? *count : 1;
+
+    section.raw_ngrams = (ngram_raw_t *) ckd_calloc(cap, sizeof(ngram_raw_t));
+    section.words = (uint32 *) ckd_calloc((size_t) cap * order,
+                                          sizeof(*section.words));
+    section.wid = wid;
+    section.lmath = lmath;
+    section.order = order;
+    section.order_max = order_max;
+
+    rv = 0;
+    for (i = 0, total = 0; i < *count; i += n) {
+        n = (*count - i < cap) ? *count - i : cap;
+        memset(section.raw_ngrams, 0, n * sizeof(*section.raw_ngrams));
+        if ((valid = arpa_section_parse(&section, li, n, pool)) < 0) {
+            rv = -1;
+            break;
+        }
+        if (valid == 0)
+            continue;
+        ngrams_raw_sort(section.raw_ngrams, section.words, (uint32) valid,
+                        order, pool);
+        runs->files = (FILE **) ckd_realloc(runs->files,
+                                            (runs->n_runs + 1)
+                                            * sizeof(*runs->files));
+        runs->counts = (uint32 *) ckd_realloc(runs->counts,
+                                              (runs->n_runs + 1)
+                                              * sizeof(*runs->counts));
+        runs->files[runs->n_runs] =
+            ngram_run_write(section.raw_ngrams, section.words,
+                            (uint32) valid, order, tmpdir);
+        if (runs->files[runs->n_runs] == NULL) {
+            rv = -1;
+            break;
+        }
+        runs->counts[runs->n_runs++] = (uint32) valid;
+        total += (uint32) valid;
+    }
+    ckd_free(section.raw_ngrams);
+    ckd_free(section.words);
+    if (rv < 0)
+        return rv;
+    E_INFO("Wrote %d sorted runs of %d-grams\n", runs->n_runs, order);
+    *count = total;
+    return 0;
+}
+
+ngram_runs_t *
+ngrams_raw_spill_arpa(lineiter_t ** li, logmath_t * lmath, uint32 * counts,
+                      int order, hash_table_t * wid, int nthreads,
+                      size_t budget, const char *tmpdir)
+{
+    ngram_runs_t *runs;
+    sbpool_t *pool;
+    int order_it, rv;
+
+    runs = (ngram_runs_t *) ckd_calloc(order - 1, sizeof(*runs));
+    pool = sbpool_init(NULL, nthreads);
+    rv = 0;
+    for (order_it = 2; order_it <= order; order_it++) {
+        if ((rv = ngrams_raw_spill_section(&runs[order_it - 2], li, wid,
+                                           lmath, counts + order_it - 1,
+                                           order_it, order, budget, tmpdir,
+                                           pool)) < 0)
+            break;
+    }
+    sbpool_free(pool);
+
+    if (rv < 0 || arpa_read_end(li) < 0) {
+        ngram_runs_free(runs, order);
+        return NULL;
+    }
+    return runs;
+}
+
+void
+ngram_runs_free(ngram_runs_t * runs, int order)
+{
+    int order_it, r;
+
+    if (runs == NULL)
+        return;
+    for (order_it = 0; order_it < order - 1; order_it++) {
+        for (r = 0; r < runs[order_it].n_runs; r++)
+            fclose(runs[order_it].files[r]);
+        ckd_free(runs[order_it].files);
+        ckd_free(runs[order_it].counts);
+    }
+    ckd_free(runs);
+}
+
+void
+ngram_run_reader_init(ngram_run_reader_t * reader, FILE * fp, uint32 count,
+                      int order, size_t buf_size)
+{
+    size_t rec_size = (order + 2) * sizeof(uint32);
+
+    memset(reader, 0, sizeof(*reader));
+    reader->fp = fp;
+    reader->left = count;
+    reader->n_buf = buf_size / rec_size;
+    if (reader->n_buf > count)
+        reader->n_buf = count;
+    if (reader->n_buf == 0)
+        reader->n_buf = 1;
+    reader->buf = (uint32 *) ckd_calloc(reader->n_buf, rec_size);
+    reader->raw.order = order;
+    rewind(fp);
+}
+
+int
+ngram_run_reader_next(ngram_run_reader_t * reader)
+{
+    int order = reader->raw.order;
+    uint32 *rec;
+
+    if (reader->pos == reader->avail) {
+        uint32 n = (reader->left < reader->n_buf)
+            ? reader->left : reader->n_buf;
+
+        if (n == 0)
+            return 0;
+        if (fread(reader->buf, (order + 2) * sizeof(uint32), n, reader->fp)
+            != n) {
+            E_ERROR_SYSTEM("Failed to read temporary file");
+            reader->error = TRUE;
+            reader->left = 0;
+            return 0;
+        }
+        reader->left -= n;
+        reader->avail = n;
+        reader->pos = 0;
+    }
+    rec = reader->buf + (size_t) reader->pos++ * (order + 2);
+    memcpy(reader->words, rec, order * sizeof(*rec));
+    memcpy(&reader->raw.prob, rec + order, sizeof(reader->raw.prob));
+    memcpy(&reader->raw.backoff, rec + order + 1,
+           sizeof(reader->raw.backoff));
+    return 1;
+}
+
+void
+ngram_run_reader_free(ngram_run_reader_t * reader)
+{
+    ckd_free(reader->buf);
+    reader->buf = NULL;
 }
 
 static void
@@ -234,17 +859,21 @@ read_dmp_weight_array(FILE * fp, logmath_t * lmath, uint8 do_swap,
 
 ngram_raw_t **
 ngrams_raw_read_dmp(FILE * fp, logmath_t * lmath, uint32 * counts,
-                    int order, uint32 * unigram_next, uint8 do_swap)
+                    int order, uint32 * unigram_next, uint8 do_swap,
+                    uint32 ** raw_words)
 {
     uint32 j, ngram_idx;
     uint16 *bigrams_next;
     ngram_raw_t **raw_ngrams =
         (ngram_raw_t **) ckd_calloc(order - 1, sizeof(*raw_ngrams));
 
+    memset(raw_words, 0, (order - 1) * sizeof(*raw_words));
     /* read bigrams */
     raw_ngrams[0] =
         (ngram_raw_t *) ckd_calloc((size_t) (counts[1] + 1),
                                    sizeof(*raw_ngrams[0]));
+    raw_words[0] =
+        (uint32 *) ckd_calloc((size_t) counts[1] * 2, sizeof(*raw_words[0]));
     bigrams_next =
         (uint16 *) ckd_calloc((size_t) (counts[1] + 1),
                               sizeof(*bigrams_next));
@@ -262,10 +891,9 @@ ngrams_raw_read_dmp(FILE * fp, logmath_t * lmath, uint32 * counts,
         }
 	
 	if (j != counts[1]) {
-            raw_ngram->words =
-    		(uint32 *) ckd_calloc(2, sizeof(*raw_ngram->words));
-    	    raw_ngram->words[0] = (uint32) wid;
-	    raw_ngram->words[1] = (uint32) ngram_idx - 1;
+            raw_ngram->offset = j;
+    	    raw_words[0][j * 2] = (uint32) wid;
+	    raw_words[0][j * 2 + 1] = (uint32) ngram_idx - 1;
 	}
 
         fread(&prob_idx, sizeof(prob_idx), 1, fp);
@@ -286,7 +914,7 @@ ngrams_raw_read_dmp(FILE * fp, logmath_t * lmath, uint32 * counts,
     if (ngram_idx < counts[0]) {
         E_ERROR("Corrupted model, not enough unigrams %d %d\n", ngram_idx, counts[0]);
         ckd_free(bigrams_next);
-        ngrams_raw_free(raw_ngrams, counts, order);
+        ngrams_raw_free(raw_ngrams, raw_words, order);
         return NULL;
     }
 
@@ -295,6 +923,9 @@ ngrams_raw_read_dmp(FILE * fp, logmath_t * lmath, uint32 * counts,
         raw_ngrams[1] =
             (ngram_raw_t *) ckd_calloc((size_t) counts[2],
                                        sizeof(*raw_ngrams[1]));
+        raw_words[1] =
+            (uint32 *) ckd_calloc((size_t) counts[2] * 3,
+                                  sizeof(*raw_words[1]));
         for (j = 0; j < (int32) counts[2]; j++) {
             uint16 wid, prob_idx;
             ngram_raw_t *raw_ngram = &raw_ngrams[1][j];
@@ -307,9 +938,8 @@ ngrams_raw_read_dmp(FILE * fp, logmath_t * lmath, uint32 * counts,
             }
             
     	    raw_ngram->order = 3;
-            raw_ngram->words =
-                (uint32 *) ckd_calloc(3, sizeof(*raw_ngram->words));
-            raw_ngram->words[0] = (uint32) wid;
+            raw_ngram->offset = j;
+            raw_words[1][j * 3] = (uint32) wid;
             raw_ngram->prob = prob_idx + 0.5f; /* keep index in float. ugly but avoiding using extra memory */
         }
     }
@@ -343,10 +973,9 @@ ngrams_raw_read_dmp(FILE * fp, logmath_t * lmath, uint32 * counts,
                 (uint32) (tseg_base[j >> BIGRAM_SEGMENT_SIZE] +
                           bigrams_next[j]);
             while (ngram_idx < next_ngram_idx) {
-                raw_ngrams[1][ngram_idx].words[1] =
-                    raw_ngrams[0][j - 1].words[0];
-                raw_ngrams[1][ngram_idx].words[2] =
-                    raw_ngrams[0][j - 1].words[1];
+                raw_words[1][ngram_idx * 3 + 1] = raw_words[0][(j - 1) * 2];
+                raw_words[1][ngram_idx * 3 + 2] =
+                    raw_words[0][(j - 1) * 2 + 1];
                 ngram_idx++;
             }
         }
@@ -355,33 +984,28 @@ ngrams_raw_read_dmp(FILE * fp, logmath_t * lmath, uint32 * counts,
         if (ngram_idx < counts[2]) {
       	    E_ERROR("Corrupted model, some trigrams have no corresponding bigram\n");
     	    ckd_free(bigrams_next);
-    	    ngrams_raw_free(raw_ngrams, counts, order);
+    	    ngrams_raw_free(raw_ngrams, raw_words, order);
     	    return NULL;
         }
     }
     ckd_free(bigrams_next);
 
     /* sort raw ngrams for reverse trie */
-    qsort(raw_ngrams[0], (size_t) counts[1], sizeof(*raw_ngrams[0]),
-          &ngram_ord_comparator);
+    ngrams_raw_sort(raw_ngrams[0], raw_words[0], counts[1], 2, NULL);
     if (order > 2) {
-        qsort(raw_ngrams[1], (size_t) counts[2], sizeof(*raw_ngrams[1]),
-              &ngram_ord_comparator);
+        ngrams_raw_sort(raw_ngrams[1], raw_words[1], counts[2], 3, NULL);
     }
     return raw_ngrams;
 }
 
 void
-ngrams_raw_free(ngram_raw_t ** raw_ngrams, uint32 * counts, int order)
+ngrams_raw_free(ngram_raw_t ** raw_ngrams, uint32 ** raw_words, int order)
 {
-    uint32 num;
     int order_it;
 
     for (order_it = 0; order_it < order - 1; order_it++) {
-        for (num = 0; num < counts[order_it + 1]; num++) {
-            ckd_free(raw_ngrams[order_it][num].words);
-        }
         ckd_free(raw_ngrams[order_it]);
+        ckd_free(raw_words[order_it]);
     }
     ckd_free(raw_ngrams);
 }
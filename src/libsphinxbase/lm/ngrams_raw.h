@@ -43,23 +43,42 @@
 #include <sphinxbase/prim_type.h>
 #include <sphinxbase/pio.h>
 #include <sphinxbase/err.h>
+#include <sphinxbase/sbthread.h>
 
+/*
+ * Word indexes of raw ngrams are kept in one array for each order, with
+ * order words for each ngram, rather than being allocated separately.
+ */
 typedef struct ngram_raw_s {
-    uint32 *words;              /* array of word indexes, length corresponds to ngram order */
+    uint32 offset;              /* position of word indexes in the array for this order, in units of order */
     float32 prob;
     float32 backoff;
     uint32 order;
 } ngram_raw_t;
 
+/**
+ * Word indexes of a raw ngram, given the array for its order
+ */
+#define ngram_raw_words(words, raw) ((words) + (size_t)(raw)->offset * (raw)->order)
+
 typedef union {
     float32 f;
     int32 l;
 } dmp_weight_t;
 
 /**
- * Raw ordered ngrams comparator
+ * Compares word indexes of raw ordered ngrams
+ */
+int ngram_words_compare(const uint32 *a_words, int a_order,
+                        const uint32 *b_words, int b_order);
+
+/**
+ * Sort raw ngrams in the order given by ngram_words_compare, using
+ * the threads in pool if it is not NULL. Word indexes are moved along
+ * with ngrams, so that afterwards those of ngram i are at i * order
  */
-int ngram_ord_comparator(const void *a_raw, const void *b_raw);
+void ngrams_raw_sort(ngram_raw_t * raw_ngrams, uint32 * words,
+                     uint32 count, int order, sbpool_t * pool);
 
 /**
  * Read ngrams of order > 1 from ARPA file
@@ -68,11 +87,14 @@ int ngram_ord_comparator(const void *a_raw, const void *b_raw);
  * @param lmath  [in] log math used for log convertions
  * @param counts [in] amount of ngrams for each order
  * @param order  [in] maximum order of ngrams
+ * @param nthreads [in] number of threads to parse and sort with
+ * @param raw_words [out] word indexes of ngrams of each order bigger than 1
  * @return            raw ngrams of order bigger than 1
  */
 ngram_raw_t **ngrams_raw_read_arpa(lineiter_t ** li, logmath_t * lmath,
                                    uint32 * counts, int order,
-                                   hash_table_t * wid);
+                                   hash_table_t * wid, int nthreads,
+                                   uint32 ** raw_words);
 
 /**
  * Reads ngrams of order > 1 from DMP file.
@@ -82,13 +104,75 @@ ngram_raw_t **ngrams_raw_read_arpa(lineiter_t ** li, logmath_t * lmath,
  * @param order        [in] maximum order of ngrams
  * @param unigram_next [in] array of next word pointers for unigrams. Needed to define forst word of bigrams
  * @param do_swap      [in] wether to do swap of bits
+ * @param raw_words    [out] word indexes of ngrams of each order bigger than 1
  * @return                  raw ngrams of order bigger than 1
  */
 ngram_raw_t **ngrams_raw_read_dmp(FILE * fp, logmath_t * lmath,
                                   uint32 * counts, int order,
-                                  uint32 * unigram_next, uint8 do_swap);
+                                  uint32 * unigram_next, uint8 do_swap,
+                                  uint32 ** raw_words);
 
-void ngrams_raw_free(ngram_raw_t ** raw_ngrams, uint32 * counts,
+void ngrams_raw_free(ngram_raw_t ** raw_ngrams, uint32 ** raw_words,
                      int order);
 
+/**
+ * Sorted runs of raw ngrams of one order, spilled to temporary files
+ * so that models bigger than memory can be built into a trie.
+ */
+typedef struct ngram_runs_s {
+    FILE **files;               /**< One file for each run */
+    uint32 *counts;             /**< Number of ngrams in each run */
+    int n_runs;
+} ngram_runs_t;
+
+/**
+ * Reads back the ngrams of one run in order
+ */
+typedef struct ngram_run_reader_s {
+    FILE *fp;
+    uint32 *buf;                /**< Records read ahead */
+    uint32 n_buf;               /**< Capacity of buf, in records */
+    uint32 pos;                 /**< Next record in buf */
+    uint32 avail;               /**< Records in buf */
+    uint32 left;                /**< Records not yet read from fp */
+    int error;                  /**< Set if fp ended too early */
+    ngram_raw_t raw;            /**< Current ngram */
+    uint32 words[NGRAM_MAX_ORDER]; /**< Its word indexes */
+} ngram_run_reader_t;
+
+/**
+ * Read ngrams of order > 1 from ARPA file and write them out as sorted
+ * runs, using no more than about budget bytes of memory at a time.
+ * @param li       [in] line iterator that points to bigram description in ARPA file
+ * @param lmath    [in] log math used for log convertions
+ * @param counts   [in,out] amount of ngrams for each order, updated to the number read
+ * @param order    [in] maximum order of ngrams
+ * @param wid      [in] hashtable that maps string word representation to id
+ * @param nthreads [in] number of threads to parse and sort with
+ * @param budget   [in] memory to use for each run, in bytes
+ * @param tmpdir   [in] directory for temporary files, or NULL for the default one
+ * @return              runs of ngrams of order bigger than 1
+ */
+ngram_runs_t *ngrams_raw_spill_arpa(lineiter_t ** li, logmath_t * lmath,
+                                    uint32 * counts, int order,
+                                    hash_table_t * wid, int nthreads,
+                                    size_t budget, const char *tmpdir);
+
+void ngram_runs_free(ngram_runs_t * runs, int order);
+
+/**
+ * Start reading count ngrams of the given order from the beginning of
+ * fp, buffering about buf_size bytes of them.
+ */
+void ngram_run_reader_init(ngram_run_reader_t * reader, FILE * fp,
+                           uint32 count, int order, size_t buf_size);
+
+/**
+ * Move on to the next ngram of a run.
+ * @return 1 if there is one, or 0 at the end of the run or on error
+ */
+int ngram_run_reader_next(ngram_run_reader_t * reader);
+
+void ngram_run_reader_free(ngram_run_reader_t * reader);
+
 #endif                          /* __LM_NGRAMS_RAW_H__ */
@@ -80,6 +80,7 @@
 #include <stdio.h>
 
 #include "sphinxbase/genrand.h"
+#include "sphinxbase/ckd_alloc.h"
 
 /* Period parameters */
 #define N 624
@@ -88,6 +89,14 @@
 #define UPPER_MASK 0x80000000UL /* most significant w-r bits */
 #define LOWER_MASK 0x7fffffffUL /* least significant r bits */
 
+struct genrand_s {
+    uint32 mt[N];               /* the array for the state vector  */
+    int mti;                    /* mti==N+1 means mt[N] is not initialized */
+};
+
+/* State used by the non-reentrant functions. */
+static genrand_t genrand_global = { { 0 }, N + 1 };
+
 void init_genrand(unsigned long s);
 
 void
@@ -96,14 +105,35 @@ genrand_seed(unsigned long s)
     init_genrand(s);
 }
 
-
-static unsigned long mt[N];     /* the array for the state vector  */
-static int mti = N + 1;         /* mti==N+1 means mt[N] is not initialized */
-
 /* initializes mt[N] with a seed */
 void
 init_genrand(unsigned long s)
 {
+    genrand_seed_r(&genrand_global, s);
+}
+
+genrand_t *
+genrand_init(unsigned long s)
+{
+    genrand_t *g;
+
+    g = ckd_calloc(1, sizeof(*g));
+    genrand_seed_r(g, s);
+    return g;
+}
+
+void
+genrand_free(genrand_t *g)
+{
+    ckd_free(g);
+}
+
+void
+genrand_seed_r(genrand_t *g, unsigned long s)
+{
+    uint32 *mt = g->mt;
+    int mti;
+
     mt[0] = s & 0xffffffffUL;
     for (mti = 1; mti < N; mti++) {
         mt[mti] =
@@ -115,52 +145,113 @@ init_genrand(unsigned long s)
         mt[mti] &= 0xffffffffUL;
         /* for >32 bit machines */
     }
+    g->mti = mti;
 }
 
-/* generates a random number on [0,0xffffffff]-interval */
-unsigned long
-genrand_int32(void)
+/* generate N words at one time */
+static void
+genrand_next_state(genrand_t *g)
 {
-    unsigned long y;
-    static unsigned long mag01[2] = { 0x0UL, MATRIX_A };
+    static const uint32 mag01[2] = { 0x0UL, MATRIX_A };
     /* mag01[x] = x * MATRIX_A  for x=0,1 */
+    uint32 *mt = g->mt;
+    uint32 y;
+    int kk;
+
+    if (g->mti == N + 1)        /* if init_genrand() has not been called, */
+        genrand_seed_r(g, 5489UL);      /* a default initial seed is used */
 
-    if (mti >= N) {             /* generate N words at one time */
-        int kk;
+    for (kk = 0; kk < N - M; kk++) {
+        y = (mt[kk] & UPPER_MASK) | (mt[kk + 1] & LOWER_MASK);
+        mt[kk] = mt[kk + M] ^ (y >> 1) ^ mag01[y & 0x1UL];
+    }
+    for (; kk < N - 1; kk++) {
+        y = (mt[kk] & UPPER_MASK) | (mt[kk + 1] & LOWER_MASK);
+        mt[kk] = mt[kk + (M - N)] ^ (y >> 1) ^ mag01[y & 0x1UL];
+    }
+    y = (mt[N - 1] & UPPER_MASK) | (mt[0] & LOWER_MASK);
+    mt[N - 1] = mt[M - 1] ^ (y >> 1) ^ mag01[y & 0x1UL];
 
-        if (mti == N + 1)       /* if init_genrand() has not been called, */
-            init_genrand(5489UL);       /* a default initial seed is used */
+    g->mti = 0;
+}
 
-        for (kk = 0; kk < N - M; kk++) {
-            y = (mt[kk] & UPPER_MASK) | (mt[kk + 1] & LOWER_MASK);
-            mt[kk] = mt[kk + M] ^ (y >> 1) ^ mag01[y & 0x1UL];
-        }
-        for (; kk < N - 1; kk++) {
-            y = (mt[kk] & UPPER_MASK) | (mt[kk + 1] & LOWER_MASK);
-            mt[kk] = mt[kk + (M - N)] ^ (y >> 1) ^ mag01[y & 0x1UL];
-        }
-        y = (mt[N - 1] & UPPER_MASK) | (mt[0] & LOWER_MASK);
-        mt[N - 1] = mt[M - 1] ^ (y >> 1) ^ mag01[y & 0x1UL];
+/* Tempering */
+#define GENRAND_TEMPER(y) do {                  \
+        (y) ^= ((y) >> 11);                     \
+        (y) ^= ((y) << 7) & 0x9d2c5680UL;       \
+        (y) ^= ((y) << 15) & 0xefc60000UL;      \
+        (y) ^= ((y) >> 18);                     \
+    } while (0)
+
+uint32
+genrand_int32_r(genrand_t *g)
+{
+    uint32 y;
 
-        mti = 0;
+    if (g->mti >= N)
+        genrand_next_state(g);
+    y = g->mt[g->mti++];
+    GENRAND_TEMPER(y);
+    return y;
+}
+
+void
+genrand_fill_r(genrand_t *g, uint32 *out, size_t n)
+{
+    while (n > 0) {
+        uint32 const *mt;
+        size_t i, len;
+
+        if (g->mti >= N)
+            genrand_next_state(g);
+        len = N - g->mti;
+        if (len > n)
+            len = n;
+        /* No dependencies between iterations, so this vectorizes. */
+        mt = g->mt + g->mti;
+        for (i = 0; i < len; ++i) {
+            uint32 y = mt[i];
+            GENRAND_TEMPER(y);
+            out[i] = y;
+        }
+        g->mti += len;
+        out += len;
+        n -= len;
     }
+}
 
-    y = mt[mti++];
+long
+genrand_int31_r(genrand_t *g)
+{
+    return (long) (genrand_int32_r(g) >> 1);
+}
 
-    /* Tempering */
-    y ^= (y >> 11);
-    y ^= (y << 7) & 0x9d2c5680UL;
-    y ^= (y << 15) & 0xefc60000UL;
-    y ^= (y >> 18);
+double
+genrand_real3_r(genrand_t *g)
+{
+    return (((double) genrand_int32_r(g)) + 0.5) * (1.0 / 4294967296.0);
+    /* divided by 2^32 */
+}
 
-    return y;
+double
+genrand_res53_r(genrand_t *g)
+{
+    uint32 a = genrand_int32_r(g) >> 5, b = genrand_int32_r(g) >> 6;
+    return (a * 67108864.0 + b) * (1.0 / 9007199254740992.0);
+}
+
+/* generates a random number on [0,0xffffffff]-interval */
+unsigned long
+genrand_int32(void)
+{
+    return genrand_int32_r(&genrand_global);
 }
 
 /* generates a random number on [0,0x7fffffff]-interval */
 long
 genrand_int31(void)
 {
-    return (long) (genrand_int32() >> 1);
+    return genrand_int31_r(&genrand_global);
 }
 
 /* generates a random number on [0,1]-real-interval */
@@ -183,16 +274,14 @@ genrand_real2(void)
 double
 genrand_real3(void)
 {
-    return (((double) genrand_int32()) + 0.5) * (1.0 / 4294967296.0);
-    /* divided by 2^32 */
+    return genrand_real3_r(&genrand_global);
 }
 
 /* generates a random number on [0,1) with 53-bit resolution*/
 double
 genrand_res53(void)
 {
-    unsigned long a = genrand_int32() >> 5, b = genrand_int32() >> 6;
-    return (a * 67108864.0 + b) * (1.0 / 9007199254740992.0);
+    return genrand_res53_r(&genrand_global);
 }
 
 /* These real versions are due to Isaku Wada, 2002/01/09 added */
@@ -99,58 +99,50 @@
 #include "sphinxbase/case.h"
 
 
-#if 0
-static void
-prime_sieve(int32 max)
+/*
+ * The table uses open addressing with linear probing and Robin Hood
+ * insertion: an entry being inserted displaces any entry that is
+ * closer to its home slot than it is, which keeps probe sequences
+ * short and lets unsuccessful lookups stop early.  The full hash of
+ * each entry is kept in a separate array, so probing only touches
+ * that array, and keys are compared only when the hashes match.
+ * Deletion shifts the following entries of the probe sequence back
+ * by one slot, so no tombstones are needed.
+ *
+ * The number of slots is always a power of two, and the table is
+ * doubled whenever it becomes more than 3/4 full.
+ */
+
+/* Stored hashes have their top bit set, so that 0 means empty. */
+#define HASH_USED       0x80000000U
+#define HASH_MIN_SIZE   8
+
+#define slot_mask(h)    ((uint32)(h)->size - 1)
+#define probe_dist(h, hash, pos) (((pos) - (hash)) & slot_mask(h))
+
+
+static int32
+table_size(int32 size)
 {
-    char *notprime;
-    int32 p, pp;
-
-    notprime = (char *) ckd_calloc(max + 1, 1);
-    p = 2;
-    for (;;) {
-        printf("%d\n", p);
-        for (pp = p + p; pp <= max; pp += p)
-            notprime[pp] = 1;
-        for (++p; (p <= max) && notprime[p]; p++);
-        if (p > max)
+    int32 n;
+
+    /* Enough room to hold size entries at 3/4 load. */
+    for (n = HASH_MIN_SIZE; n < size + (size / 3) + 1; n <<= 1) {
+        if (n >= 0x40000000) {
+            E_WARN("Very large hash table requested (%d entries)\n", size);
             break;
+        }
     }
+    return n;
 }
-#endif
 
 
-/*
- * HACK!!  Initial hash table size is restricted by this set of primes.  (Of course,
- * collision resolution by chaining will accommodate more entries indefinitely, but
- * efficiency will drop.)
- */
-const int32 prime[] = {
-    101, 211, 307, 401, 503, 601, 701, 809, 907,
-    1009, 1201, 1601, 2003, 2411, 3001, 4001, 5003, 6007, 7001, 8009,
-    9001,
-    10007, 12007, 16001, 20011, 24001, 30011, 40009, 50021, 60013,
-    70001, 80021, 90001,
-    100003, 120011, 160001, 200003, 240007, 300007, 400009, 500009,
-    600011, 700001, 800011, 900001,
-    -1
-};
-
-
-/**
- * This function returns a very large prime. 
- */
-static int32
-prime_size(int32 size)
+static void
+table_alloc(hash_table_t * h, int32 size)
 {
-    int32 i;
-
-    for (i = 0; (prime[i] > 0) && (prime[i] < size); i++);
-    if (prime[i] <= 0) {
-        E_WARN("Very large hash table requested (%d entries)\n", size);
-        --i;
-    }
-    return (prime[i]);
+    h->size = size;
+    h->table = (hash_entry_t *) ckd_calloc(h->size, sizeof(*h->table));
+    h->hashes = (uint32 *) ckd_calloc(h->size, sizeof(*h->hashes));
 }
 
 
@@ -160,73 +152,75 @@ hash_table_new(int32 size, int32 casearg)
     hash_table_t *h;
 
     h = (hash_table_t *) ckd_calloc(1, sizeof(hash_table_t));
-    h->size = prime_size(size + (size >> 1));
     h->nocase = (casearg == HASH_CASE_NO);
-    h->table = (hash_entry_t *) ckd_calloc(h->size, sizeof(hash_entry_t));
-    /* The above calloc clears h->table[*].key and .next to NULL, i.e. an empty table */
+    table_alloc(h, table_size(size));
+    /* The above calloc clears h->hashes[*] to 0, i.e. an empty table */
 
     return h;
 }
 
 
 /*
- * Compute hash value for given key string.
- * Somewhat tuned for English text word strings.
+ * Mix the bits of a 64-bit word (the MurmurHash3 finalizer).
  */
-static uint32
-key2hash(hash_table_t * h, const char *key)
+static uint64
+mix64(uint64 x)
 {
-
-    register const char *cp;
-
-    /* This is a hack because the best way to solve it is to make sure 
-       all character representation is unsigned character in the first place.        
-       (or better unicode.) */
-    register unsigned char c;
-    register int32 s;
-    register uint32 hash;
-
-    hash = 0;
-    s = 0;
-
-    if (h->nocase) {
-        for (cp = key; *cp; cp++) {
-            c = *cp;
-            c = UPPER_CASE(c);
-            hash += c << s;
-            s += 5;
-            if (s >= 25)
-                s -= 24;
-        }
-    }
-    else {
-        for (cp = key; *cp; cp++) {
-            hash += (*cp) << s;
-            s += 5;
-            if (s >= 25)
-                s -= 24;
-        }
-    }
-
-    return (hash % h->size);
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
 }
 
 
-static char *
-makekey(uint8 * data, size_t len, char *key)
+/*
+ * Compute the full hash value for a key of len bytes.  Keys are
+ * consumed 8 bytes at a time, so the common case of a single integer
+ * key is one load and one mix.  Case-insensitive tables fold 7-bit
+ * ASCII letters to upper case first.
+ */
+static uint32
+key2hash(hash_table_t * h, const char *key, size_t len)
 {
+    uint64 hash, word;
+    uint32 word32;
     size_t i, j;
 
-    if (!key)
-        key = (char *) ckd_calloc(len * 2 + 1, sizeof(char));
+    hash = len;
+    if (h->nocase) {
+        for (i = 0; i < len; i += sizeof(word)) {
+            word = 0;
+            for (j = i; j < len && j < i + sizeof(word); ++j) {
+                unsigned char c = key[j];
+                word = (word << 8) | UPPER_CASE(c);
+            }
+            hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+            hash ^= hash >> 32;
+        }
+        return (uint32) (mix64(hash) >> 32) | HASH_USED;
+    }
 
-    for (i = 0, j = 0; i < len; i++, j += 2) {
-        key[j] = 'A' + (data[i] & 0x000f);
-        key[j + 1] = 'J' + ((data[i] >> 4) & 0x000f);
+    for (i = 0; i + sizeof(word) <= len; i += sizeof(word)) {
+        memcpy(&word, key + i, sizeof(word));
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+        hash ^= hash >> 32;
+    }
+    if (i < len) {
+        /* Fixed-size copies here, so they are inlined. */
+        word = 0;
+        if (len - i >= sizeof(word32)) {
+            memcpy(&word32, key + i, sizeof(word32));
+            word = word32;
+            i += sizeof(word32);
+        }
+        for (; i < len; ++i)
+            word = (word << 8) | (uint8) key[i];
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
     }
-    key[j] = '\0';
 
-    return key;
+    return (uint32) (mix64(hash) >> 32) | HASH_USED;
 }
 
 
@@ -254,68 +248,106 @@ keycmp_nocase(hash_entry_t * entry, const char *key)
 static int32
 keycmp_case(hash_entry_t * entry, const char *key)
 {
-    char c1, c2;
-    int32 i;
-    const char *str;
-
-    str = entry->key;
-    for (i = 0; i < entry->len; i++) {
-        c1 = *(str++);
-        c2 = *(key++);
-        if (c1 != c2)
-            return (c1 - c2);
-    }
-
-    return 0;
+    return memcmp(entry->key, key, entry->len);
 }
 
 
 /*
- * Lookup entry with hash-value hash in table h for given key
- * Return value: hash_entry_t for key
+ * Find the slot holding key, which has hash value hash.
+ * Return value: slot index, or -1 if not found.
  */
-static hash_entry_t *
+static int32
 lookup(hash_table_t * h, uint32 hash, const char *key, size_t len)
 {
-    hash_entry_t *entry;
+    uint32 pos, dist, mask;
+
+    mask = slot_mask(h);
+    for (pos = hash & mask, dist = 0;; pos = (pos + 1) & mask, ++dist) {
+        uint32 cur = h->hashes[pos];
+
+        /* An empty slot, or an entry closer to its home than we are
+         * to ours, means the key would have been placed before it. */
+        if (cur == 0 || probe_dist(h, cur, pos) < dist)
+            return -1;
+        if (cur == hash && h->table[pos].len == len
+            && (h->nocase ? keycmp_nocase(&h->table[pos], key)
+                : keycmp_case(&h->table[pos], key)) == 0)
+            return pos;
+    }
+}
 
-    entry = &(h->table[hash]);
-    if (entry->key == NULL)
-        return NULL;
 
-    if (h->nocase) {
-        while (entry && ((entry->len != len)
-                         || (keycmp_nocase(entry, key) != 0)))
-            entry = entry->next;
-    }
-    else {
-        while (entry && ((entry->len != len)
-                         || (keycmp_case(entry, key) != 0)))
-            entry = entry->next;
+/*
+ * Place an entry known not to be in the table yet.
+ */
+static void
+insert(hash_table_t * h, uint32 hash, hash_entry_t * entry)
+{
+    uint32 pos, dist, mask;
+    hash_entry_t tmp;
+
+    mask = slot_mask(h);
+    for (pos = hash & mask, dist = 0;; pos = (pos + 1) & mask, ++dist) {
+        uint32 cur = h->hashes[pos];
+        uint32 cur_dist;
+
+        if (cur == 0) {
+            h->hashes[pos] = hash;
+            h->table[pos] = *entry;
+            return;
+        }
+        /* Robin Hood: take the slot from a richer entry and carry
+         * that one along instead. */
+        cur_dist = probe_dist(h, cur, pos);
+        if (cur_dist < dist) {
+            h->hashes[pos] = hash;
+            hash = cur;
+            tmp = h->table[pos];
+            h->table[pos] = *entry;
+            *entry = tmp;
+            dist = cur_dist;
+        }
     }
-
-    return entry;
 }
 
 
-int32
-hash_table_lookup(hash_table_t * h, const char *key, void ** val)
+static void
+grow(hash_table_t * h)
 {
-    hash_entry_t *entry;
-    uint32 hash;
-    size_t len;
+    hash_entry_t *old_table;
+    uint32 *old_hashes;
+    int32 i, old_size;
+
+    old_table = h->table;
+    old_hashes = h->hashes;
+    old_size = h->size;
+    table_alloc(h, old_size * 2);
+    for (i = 0; i < old_size; i++)
+        if (old_hashes[i])
+            insert(h, old_hashes[i], &old_table[i]);
+    ckd_free(old_table);
+    ckd_free(old_hashes);
+}
 
-    hash = key2hash(h, key);
-    len = strlen(key);
 
-    entry = lookup(h, hash, key, len);
-    if (entry) {
-        if (val)
-            *val = entry->val;
-        return 0;
-    }
-    else
+static int32
+lookup_key(hash_table_t * h, const char *key, size_t len, void ** val)
+{
+    int32 pos;
+
+    pos = lookup(h, key2hash(h, key, len), key, len);
+    if (pos < 0)
         return -1;
+    if (val)
+        *val = h->table[pos].val;
+    return 0;
+}
+
+
+int32
+hash_table_lookup(hash_table_t * h, const char *key, void ** val)
+{
+    return lookup_key(h, key, strlen(key), val);
 }
 
 int32
@@ -336,22 +368,7 @@ hash_table_lookup_int32(hash_table_t * h, const char *key, int32 *val)
 int32
 hash_table_lookup_bkey(hash_table_t * h, const char *key, size_t len, void ** val)
 {
-    hash_entry_t *entry;
-    uint32 hash;
-    char *str;
-
-    str = makekey((uint8 *) key, len, NULL);
-    hash = key2hash(h, str);
-    ckd_free(str);
-
-    entry = lookup(h, hash, key, len);
-    if (entry) {
-        if (val)
-            *val = entry->val;
-        return 0;
-    }
-    else
-        return -1;
+    return lookup_key(h, key, len, val);
 }
 
 int32
@@ -370,11 +387,15 @@ hash_table_lookup_bkey_int32(hash_table_t * h, const char *key, size_t len, int3
 
 
 static void *
-enter(hash_table_t * h, uint32 hash, const char *key, size_t len, void *val, int32 replace)
+enter(hash_table_t * h, const char *key, size_t len, void *val, int32 replace)
 {
-    hash_entry_t *cur, *new;
+    hash_entry_t entry;
+    uint32 hash;
+    int32 pos;
 
-    if ((cur = lookup(h, hash, key, len)) != NULL) {
+    hash = key2hash(h, key, len);
+    if ((pos = lookup(h, hash, key, len)) >= 0) {
+        hash_entry_t *cur = &h->table[pos];
         void *oldval;
         /* Key already exists. */
         oldval = cur->val;
@@ -388,93 +409,42 @@ enter(hash_table_t * h, uint32 hash, const char *key, size_t len, void *val, int
         return oldval;
     }
 
-    cur = &(h->table[hash]);
-    if (cur->key == NULL) {
-        /* Empty slot at hashed location; add this entry */
-        cur->key = key;
-        cur->len = len;
-        cur->val = val;
-
-        /* Added by ARCHAN at 20050515. This allows deletion could work. */
-        cur->next = NULL;
-
-    }
-    else {
-        /* Key collision; create new entry and link to hashed location */
-        new = (hash_entry_t *) ckd_calloc(1, sizeof(hash_entry_t));
-        new->key = key;
-        new->len = len;
-        new->val = val;
-        new->next = cur->next;
-        cur->next = new;
-    }
+    if ((h->inuse + 1) * 4 > h->size * 3)
+        grow(h);
+    entry.key = key;
+    entry.len = len;
+    entry.val = val;
+    insert(h, hash, &entry);
     ++h->inuse;
+    ++h->mods;
 
     return val;
 }
 
-/* 20050523 Added by ARCHAN  to delete a key from a hash table */
 static void *
-delete(hash_table_t * h, uint32 hash, const char *key, size_t len)
+delete(hash_table_t * h, const char *key, size_t len)
 {
-    hash_entry_t *entry, *prev;
+    uint32 pos, next, mask;
+    int32 found;
     void *val;
 
-    prev = NULL;
-    entry = &(h->table[hash]);
-    if (entry->key == NULL)
-        return NULL;
-
-    if (h->nocase) {
-        while (entry && ((entry->len != len)
-                         || (keycmp_nocase(entry, key) != 0))) {
-            prev = entry;
-            entry = entry->next;
-        }
-    }
-    else {
-        while (entry && ((entry->len != len)
-                         || (keycmp_case(entry, key) != 0))) {
-            prev = entry;
-            entry = entry->next;
-        }
-    }
-
-    if (entry == NULL)
+    if ((found = lookup(h, key2hash(h, key, len), key, len)) < 0)
         return NULL;
-
-    /* At this point, entry will be the one required to be deleted, prev
-       will contain the previous entry
-     */
-    val = entry->val;
-
-    if (prev == NULL) {
-        /* That is to say the entry in the hash table (not the chain) matched the key. */
-        /* We will then copy the things from the next entry to the hash table */
-        prev = entry;
-        if (entry->next) {      /* There is a next entry, great, copy it. */
-            entry = entry->next;
-            prev->key = entry->key;
-            prev->len = entry->len;
-            prev->val = entry->val;
-            prev->next = entry->next;
-            ckd_free(entry);
-        }
-        else {                  /* There is not a next entry, just set the key to null */
-            prev->key = NULL;
-            prev->len = 0;
-            prev->next = NULL;
-        }
-
-    }
-    else {                      /* This case is simple */
-        prev->next = entry->next;
-        ckd_free(entry);
+    val = h->table[found].val;
+
+    /* Shift the rest of the probe sequence back by one slot. */
+    mask = slot_mask(h);
+    pos = found;
+    for (next = (pos + 1) & mask;
+         h->hashes[next] != 0 && probe_dist(h, h->hashes[next], next) != 0;
+         pos = next, next = (next + 1) & mask) {
+        h->hashes[pos] = h->hashes[next];
+        h->table[pos] = h->table[next];
     }
-
-    /* Do wiring and free the entry */
-
+    h->hashes[pos] = 0;
+    memset(&h->table[pos], 0, sizeof(h->table[pos]));
     --h->inuse;
+    ++h->mods;
 
     return val;
 }
@@ -482,92 +452,47 @@ delete(hash_table_t * h, uint32 hash, const char *key, size_t len)
 void
 hash_table_empty(hash_table_t *h)
 {
-    hash_entry_t *e, *e2;
-    int32 i;
-
-    for (i = 0; i < h->size; i++) {
-        /* Free collision lists. */
-        for (e = h->table[i].next; e; e = e2) {
-            e2 = e->next;
-            ckd_free((void *) e);
-        }
-        memset(&h->table[i], 0, sizeof(h->table[i]));
-    }
+    memset(h->table, 0, h->size * sizeof(*h->table));
+    memset(h->hashes, 0, h->size * sizeof(*h->hashes));
     h->inuse = 0;
+    ++h->mods;
 }
 
 
 void *
 hash_table_enter(hash_table_t * h, const char *key, void *val)
 {
-    uint32 hash;
-    size_t len;
-
-    hash = key2hash(h, key);
-    len = strlen(key);
-    return (enter(h, hash, key, len, val, 0));
+    return (enter(h, key, strlen(key), val, 0));
 }
 
 void *
 hash_table_replace(hash_table_t * h, const char *key, void *val)
 {
-    uint32 hash;
-    size_t len;
-
-    hash = key2hash(h, key);
-    len = strlen(key);
-    return (enter(h, hash, key, len, val, 1));
+    return (enter(h, key, strlen(key), val, 1));
 }
 
 void *
 hash_table_delete(hash_table_t * h, const char *key)
 {
-    uint32 hash;
-    size_t len;
-
-    hash = key2hash(h, key);
-    len = strlen(key);
-
-    return (delete(h, hash, key, len));
+    return (delete(h, key, strlen(key)));
 }
 
 void *
 hash_table_enter_bkey(hash_table_t * h, const char *key, size_t len, void *val)
 {
-    uint32 hash;
-    char *str;
-
-    str = makekey((uint8 *) key, len, NULL);
-    hash = key2hash(h, str);
-    ckd_free(str);
-
-    return (enter(h, hash, key, len, val, 0));
+    return (enter(h, key, len, val, 0));
 }
 
 void *
 hash_table_replace_bkey(hash_table_t * h, const char *key, size_t len, void *val)
 {
-    uint32 hash;
-    char *str;
-
-    str = makekey((uint8 *) key, len, NULL);
-    hash = key2hash(h, str);
-    ckd_free(str);
-
-    return (enter(h, hash, key, len, val, 1));
+    return (enter(h, key, len, val, 1));
 }
 
 void *
 hash_table_delete_bkey(hash_table_t * h, const char *key, size_t len)
 {
-    uint32 hash;
-    char *str;
-
-    str = makekey((uint8 *) key, len, NULL);
-    hash = key2hash(h, str);
-    ckd_free(str);
-
-    return (delete(h, hash, key, len));
+    return (delete(h, key, len));
 }
 
 void
@@ -577,35 +502,20 @@ hash_table_display(hash_table_t * h, int32 showdisplay)
     int i, j;
     j = 0;
 
-    printf("Hash with chaining representation of the hash table\n");
+    printf("Hash with open addressing representation of the hash table\n");
 
     for (i = 0; i < h->size; i++) {
+        if (h->hashes[i] == 0)
+            continue;
         e = &(h->table[i]);
-        if (e->key != NULL) {
-            printf("|key:");
-            if (showdisplay)
-                printf("%s", e->key);
-            else
-                printf("%p", e->key);
-
-            printf("|len:%zd|val=%ld|->", e->len, (long)e->val);
-            if (e->next == NULL) {
-                printf("NULL\n");
-            }
-            j++;
-
-            for (e = e->next; e; e = e->next) {
-                printf("|key:");
-                if (showdisplay)
-                    printf("%s", e->key);
-
-                printf("|len:%zd|val=%ld|->", e->len, (long)e->val);
-                if (e->next == NULL) {
-                    printf("NULL\n");
-                }
-                j++;
-            }
-        }
+        printf("%d|key:", i);
+        if (showdisplay)
+            printf("%s", e->key);
+        else
+            printf("%p", e->key);
+        printf("|len:%zd|val=%ld|dist=%u\n", e->len, (long)e->val,
+               probe_dist(h, h->hashes[i], (uint32)i));
+        j++;
     }
 
     printf("The total number of keys =%d\n", j);
@@ -616,23 +526,15 @@ glist_t
 hash_table_tolist(hash_table_t * h, int32 * count)
 {
     glist_t g;
-    hash_entry_t *e;
     int32 i, j;
 
     g = NULL;
 
     j = 0;
     for (i = 0; i < h->size; i++) {
-        e = &(h->table[i]);
-
-        if (e->key != NULL) {
-            g = glist_add_ptr(g, (void *) e);
+        if (h->hashes[i] != 0) {
+            g = glist_add_ptr(g, (void *) &h->table[i]);
             j++;
-
-            for (e = e->next; e; e = e->next) {
-                g = glist_add_ptr(g, (void *) e);
-                j++;
-            }
         }
     }
 
@@ -649,32 +551,29 @@ hash_table_iter(hash_table_t *h)
 
 	itor = ckd_calloc(1, sizeof(*itor));
 	itor->ht = h;
+	itor->mods = h->mods;
 	return hash_table_iter_next(itor);
 }
 
 hash_iter_t *
 hash_table_iter_next(hash_iter_t *itor)
 {
-	/* If there is an entry, walk down its list. */
-	if (itor->ent)
-		itor->ent = itor->ent->next;
-	/* If we got to the end of the chain, or we had no entry, scan
-	 * forward in the table to find the next non-empty bucket. */
-	if (itor->ent == NULL) {
-		while (itor->idx < itor->ht->size
-		       && itor->ht->table[itor->idx].key == NULL) 
-			++itor->idx;
-		/* If we did not find one then delete the iterator and
-		 * return NULL. */
-		if (itor->idx == itor->ht->size) {
-			hash_table_iter_free(itor);
-			return NULL;
-		}
-		/* Otherwise use this next entry. */
-		itor->ent = itor->ht->table + itor->idx;
-		/* Increase idx for the next time around. */
+	/* Entries move when others are inserted or deleted. */
+	assert(itor->mods == itor->ht->mods);
+	/* Scan forward in the table to find the next non-empty slot. */
+	while (itor->idx < itor->ht->size
+	       && itor->ht->hashes[itor->idx] == 0)
 		++itor->idx;
+	/* If we did not find one then delete the iterator and
+	 * return NULL. */
+	if (itor->idx == itor->ht->size) {
+		hash_table_iter_free(itor);
+		return NULL;
 	}
+	/* Otherwise use this next entry. */
+	itor->ent = itor->ht->table + itor->idx;
+	/* Increase idx for the next time around. */
+	++itor->idx;
 	return itor;
 }
 
@@ -687,20 +586,10 @@ hash_table_iter_free(hash_iter_t *itor)
 void
 hash_table_free(hash_table_t * h)
 {
-    hash_entry_t *e, *e2;
-    int32 i;
-
     if (h == NULL)
         return;
 
-    /* Free additional entries created for key collision cases */
-    for (i = 0; i < h->size; i++) {
-        for (e = h->table[i].next; e; e = e2) {
-            e2 = e->next;
-            ckd_free((void *) e);
-        }
-    }
-
     ckd_free((void *) h->table);
+    ckd_free((void *) h->hashes);
     ckd_free((void *) h);
 }
@@ -65,7 +65,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <assert.h>
 
 #include "sphinxbase/heap.h"
 #include "sphinxbase/err.h"
@@ -78,141 +77,210 @@ typedef struct heapnode_s {
     void *data;                 /**< Application data at this node */
     int32 val;                  /**< Associated with above application data; according to which
                                    heap is sorted (in ascending order) */
-    int32 nl, nr;               /**< left/right descendants of this node (for balancing heap) */
-    struct heapnode_s *l;       /**< Root of left descendant heap */
-    struct heapnode_s *r;       /**< Root of right descendant heap */
+    int32 handle;               /**< Handle for this node, or -1 if none */
 } heapnode_t;
 
 /**
  * Internal heap data structure.
+ *
+ * The nodes are kept in an implicit binary heap: the children of
+ * node i are nodes 2i+1 and 2i+2.  Nodes inserted with a handle have
+ * their position tracked in pos, so they can be found again in
+ * constant time.
  */
 struct heap_s {
-    heapnode_t *top;
+    heapnode_t *nodes;          /**< Heap-ordered nodes */
+    size_t n_nodes;             /**< Number of nodes in use */
+    size_t n_alloc;             /**< Number of nodes allocated */
+    int32 *pos;                 /**< Position of each handle, or -1 if free */
+    int32 n_handles;            /**< Number of handles allocated */
+    int32 *free_handles;        /**< Stack of handles available for reuse */
+    int32 n_free;               /**< Number of handles on the stack */
 };
 
 
-#if 0
+heap_t *
+heap_new(void)
+{
+    heap_t *h = ckd_calloc(1, sizeof(*h));
+    return h;
+}
+
+
+/* Store node at position i, keeping its handle up to date. */
+static void
+heap_set(heap_t *heap, size_t i, heapnode_t const *node)
+{
+    heap->nodes[i] = *node;
+    if (node->handle >= 0)
+        heap->pos[node->handle] = (int32) i;
+}
+
+
+/* Move node up from position i until its parent is no greater. */
 static void
-heap_dump(heapnode_t * top, int32 level)
+heap_sift_up(heap_t *heap, size_t i, heapnode_t const *node)
 {
-    int32 i;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (heap->nodes[parent].val <= node->val)
+            break;
+        heap_set(heap, i, &heap->nodes[parent]);
+        i = parent;
+    }
+    heap_set(heap, i, node);
+}
+
+
+/* Move node down from position i until its children are no smaller. */
+static void
+heap_sift_down(heap_t *heap, size_t i, heapnode_t const *node)
+{
+    size_t child;
+
+    while ((child = 2 * i + 1) < heap->n_nodes) {
+        if (child + 1 < heap->n_nodes
+            && heap->nodes[child + 1].val < heap->nodes[child].val)
+            ++child;
+        if (node->val <= heap->nodes[child].val)
+            break;
+        heap_set(heap, i, &heap->nodes[child]);
+        i = child;
+    }
+    heap_set(heap, i, node);
+}
 
-    if (!top)
+
+/* Put node at position i, moving it whichever way it needs to go. */
+static void
+heap_place(heap_t *heap, size_t i, heapnode_t const *node)
+{
+    if (i > 0 && heap->nodes[(i - 1) / 2].val > node->val)
+        heap_sift_up(heap, i, node);
+    else
+        heap_sift_down(heap, i, node);
+}
+
+
+static void
+heap_reserve(heap_t *heap, size_t n)
+{
+    if (n <= heap->n_alloc)
         return;
+    if (n < heap->n_alloc * 2)
+        n = heap->n_alloc * 2;
+    if (n < 16)
+        n = 16;
+    heap->nodes = ckd_realloc(heap->nodes, n * sizeof(*heap->nodes));
+    heap->n_alloc = n;
+}
 
-    for (i = 0; i < level; i++)
-        printf("  ");
-    /* print top info */
-    heap_dump(top->l, level + 1);
-    heap_dump(top->r, level + 1);
+
+static int32
+heap_new_handle(heap_t *heap)
+{
+    int32 handle;
+
+    if (heap->n_free > 0)
+        return heap->free_handles[--heap->n_free];
+    handle = heap->n_handles++;
+    heap->pos = ckd_realloc(heap->pos, heap->n_handles * sizeof(*heap->pos));
+    heap->free_handles = ckd_realloc(heap->free_handles,
+                                     heap->n_handles
+                                     * sizeof(*heap->free_handles));
+    return handle;
 }
-#endif
 
 
-heap_t *
-heap_new(void)
+static void
+heap_free_handle(heap_t *heap, int32 handle)
 {
-    heap_t *h = ckd_calloc(1, sizeof(*h));
-    return h;
+    heap->pos[handle] = -1;
+    heap->free_handles[heap->n_free++] = handle;
 }
 
 
-static heapnode_t *
-subheap_insert(heapnode_t * root, void *data, int32 val)
+/* Remove the node at position i. */
+static void
+heap_delete(heap_t *heap, size_t i)
 {
-    heapnode_t *h;
-    void *tmpdata;
-    int32 tmpval;
-
-    if (!root) {
-        h = (heapnode_t *) ckd_calloc(1, sizeof(heapnode_t));
-        h->data = data;
-        h->val = val;
-        h->l = h->r = NULL;
-        h->nl = h->nr = 0;
-        return h;
+    if (heap->nodes[i].handle >= 0)
+        heap_free_handle(heap, heap->nodes[i].handle);
+    if (i != --heap->n_nodes) {
+        heapnode_t last = heap->nodes[heap->n_nodes];
+        heap_place(heap, i, &last);
     }
+}
 
-    /* Root already exists; if new value is less, replace root node */
-    if (root->val > val) {
-        tmpdata = root->data;
-        tmpval = root->val;
-        root->data = data;
-        root->val = val;
-        data = tmpdata;
-        val = tmpval;
-    }
 
-    /* Insert new or old (replaced) node in right or left subtree; keep them balanced */
-    if (root->nl > root->nr) {
-        root->r = subheap_insert(root->r, data, val);
-        root->nr++;
-    }
-    else {
-        root->l = subheap_insert(root->l, data, val);
-        root->nl++;
-    }
+static void
+heap_add(heap_t *heap, void *data, int32 val, int32 handle)
+{
+    heapnode_t node;
 
-    return root;
+    node.data = data;
+    node.val = val;
+    node.handle = handle;
+    heap_reserve(heap, heap->n_nodes + 1);
+    heap_sift_up(heap, heap->n_nodes++, &node);
 }
 
 
 int
 heap_insert(heap_t *heap, void *data, int32 val)
 {
-    heap->top = subheap_insert(heap->top, data, val);
+    heap_add(heap, data, val, -1);
     return 0;
 }
 
 
-static heapnode_t *
-subheap_pop(heapnode_t * root)
+int32
+heap_insert_handle(heap_t *heap, void *data, int32 val)
 {
-    heapnode_t *l, *r;
+    int32 handle = heap_new_handle(heap);
+    heap_add(heap, data, val, handle);
+    return handle;
+}
 
-    /* Propagate best value from below into root, if any */
-    l = root->l;
-    r = root->r;
 
-    if (!l) {
-        if (!r) {
-            ckd_free((char *) root);
-            return NULL;
-        }
-        else {
-            root->data = r->data;
-            root->val = r->val;
-            root->r = subheap_pop(r);
-            root->nr--;
-        }
+int
+heap_insert_array(heap_t *heap, void **data, int32 const *vals, size_t n)
+{
+    size_t i;
+
+    heap_reserve(heap, heap->n_nodes + n);
+    for (i = 0; i < n; ++i) {
+        heapnode_t *node = &heap->nodes[heap->n_nodes + i];
+        node->data = data[i];
+        node->val = vals[i];
+        node->handle = -1;
     }
-    else {
-        if ((!r) || (l->val < r->val)) {
-            root->data = l->data;
-            root->val = l->val;
-            root->l = subheap_pop(l);
-            root->nl--;
-        }
-        else {
-            root->data = r->data;
-            root->val = r->val;
-            root->r = subheap_pop(r);
-            root->nr--;
+    /* Adding a few nodes one by one is cheaper than heapifying
+     * everything again. */
+    if (n < heap->n_nodes) {
+        for (i = 0; i < n; ++i) {
+            heapnode_t node = heap->nodes[heap->n_nodes];
+            heap_sift_up(heap, heap->n_nodes++, &node);
         }
+        return 0;
     }
-
-    return root;
+    heap->n_nodes += n;
+    for (i = heap->n_nodes / 2; i > 0; --i) {
+        heapnode_t node = heap->nodes[i - 1];
+        heap_sift_down(heap, i - 1, &node);
+    }
+    return 0;
 }
 
 
 int
 heap_pop(heap_t *heap, void **data, int32 * val)
 {
-    if (heap->top == NULL)
+    if (heap->n_nodes == 0)
         return 0;
-    *data = heap->top->data;
-    *val = heap->top->val;
-    heap->top = subheap_pop(heap->top);
+    *data = heap->nodes[0].data;
+    *val = heap->nodes[0].val;
+    heap_delete(heap, 0);
     return 1;
 }
 
@@ -220,72 +288,71 @@ heap_pop(heap_t *heap, void **data, int32 * val)
 int
 heap_top(heap_t *heap, void **data, int32 * val)
 {
-    if (heap->top == NULL)
+    if (heap->n_nodes == 0)
         return 0;
-    *data = heap->top->data;
-    *val = heap->top->val;
+    *data = heap->nodes[0].data;
+    *val = heap->nodes[0].val;
     return 1;
 }
 
-static int
-heap_remove_one(heap_t *heap, heapnode_t *top, void *data)
+int
+heap_remove(heap_t *heap, void *data)
 {
-    if (top == NULL)
-        return -1;
-    else if (top->data == data) {
-        assert(top == heap->top);
-        heap->top = subheap_pop(heap->top);
-        return 0;
-    }
-    if (top->l) {
-        if (top->l->data == data) {
-            top->l = subheap_pop(top->l);
-            --top->nl;
-            return 0;
-        }
-        else if (heap_remove_one(heap, top->l, data) == 0) {
-            --top->nl;
-            return 0;
-        }
-    }
-    if (top->r) {
-        if (top->r->data == data) {
-            top->r = subheap_pop(top->r);
-            --top->nr;
-            return 0;
-        }
-        else if (heap_remove_one(heap, top->r, data) == 0) {
-            --top->nr;
+    size_t i;
+
+    for (i = 0; i < heap->n_nodes; ++i) {
+        if (heap->nodes[i].data == data) {
+            heap_delete(heap, i);
             return 0;
         }
     }
     return -1;
 }
 
+static int
+heap_handle_valid(heap_t *heap, int32 handle)
+{
+    return handle >= 0 && handle < heap->n_handles
+        && heap->pos[handle] >= 0;
+}
+
 int
-heap_remove(heap_t *heap, void *data)
+heap_update(heap_t *heap, int32 handle, int32 val)
 {
-    return heap_remove_one(heap, heap->top, data);
+    heapnode_t node;
+    size_t i;
+
+    if (!heap_handle_valid(heap, handle))
+        return -1;
+    i = heap->pos[handle];
+    node = heap->nodes[i];
+    node.val = val;
+    heap_place(heap, i, &node);
+    return 0;
+}
+
+int
+heap_remove_handle(heap_t *heap, int32 handle)
+{
+    if (!heap_handle_valid(heap, handle))
+        return -1;
+    heap_delete(heap, heap->pos[handle]);
+    return 0;
 }
 
 
 size_t
 heap_size(heap_t *heap)
 {
-    if (heap->top == NULL)
-        return 0;
-    return heap->top->nl + heap->top->nr + 1;
+    return heap->n_nodes;
 }
 
 int
 heap_destroy(heap_t *heap)
 {
-    void *data;
-    int32 val;
-
-    /* Empty the heap and free it */
-    while (heap_pop(heap, &data, &val) > 0)
-        ;
+    ckd_free(heap->nodes);
+    ckd_free(heap->pos);
+    ckd_free(heap->free_handles);
     ckd_free(heap);
 
     return 0;
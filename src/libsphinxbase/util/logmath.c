@@ -435,6 +435,53 @@ logmath_add(logmath_t *lmath, int logb_x, int logb_y)
     return r;
 }
 
+int
+logmath_add_array(logmath_t *lmath, const int *logb_x, int n)
+{
+    logadd_t *t = LOGMATH_TABLE(lmath);
+    int i, r, d;
+
+    if (n <= 0)
+        return lmath->zero;
+    if (t->table == NULL) {
+        for (r = logb_x[0], i = 1; i < n; ++i)
+            r = logmath_add(lmath, r, logb_x[i]);
+        return r;
+    }
+    /* Same as adding them one at a time with logmath_add(), but
+     * without looking up the table for each one. */
+    for (r = logb_x[0], i = 1; i < n; ++i) {
+        int y = logb_x[i];
+
+        if (r <= lmath->zero) {
+            r = y;
+            continue;
+        }
+        if (y <= lmath->zero)
+            continue;
+        if (r < y) {
+            d = y - r;
+            r = y;
+        }
+        else
+            d = r - y;
+        if (d < 0 || (size_t)d >= t->table_size)
+            continue;
+        switch (t->width) {
+        case 1:
+            r += ((uint8 *)t->table)[d];
+            break;
+        case 2:
+            r += ((uint16 *)t->table)[d];
+            break;
+        case 4:
+            r += ((uint32 *)t->table)[d];
+            break;
+        }
+    }
+    return r;
+}
+
 int
 logmath_add_exact(logmath_t *lmath, int logb_p, int logb_q)
 {
@@ -63,19 +63,18 @@ struct sbthread_s {
     DWORD tid;
 };
 
-struct sbmsgq_s {
-    /* Ringbuffer for passing messages. */
-    char *data;
-    size_t depth;
-    size_t out;
-    size_t nbytes;
-
-    /* Current message is stored here. */
-    char *msg;
-    size_t msglen;
-    CRITICAL_SECTION mtx;
-    HANDLE evt;
-};
+/* Wait queue for ring buffers, see sbwait_prepare() below. */
+typedef struct sbwait_s {
+    volatile LONG seq;
+    volatile LONG nwaiters;
+    HANDLE sem;
+} sbwait_t;
+
+/* When a timed sbwait_sleep() gives up, see sbwait_deadline(). */
+typedef struct sbwait_deadline_s {
+    DWORD start;
+    DWORD ms;
+} sbwait_deadline_t;
 
 struct sbevent_s {
     HANDLE evt;
@@ -223,142 +222,141 @@ sbmtx_free(sbmtx_t *mtx)
     ckd_free(mtx);
 }
 
-sbmsgq_t *
-sbmsgq_init(size_t depth)
+static size_t
+sbatomic_load(volatile size_t *p)
 {
-    sbmsgq_t *msgq;
+    size_t v = *p;
+    MemoryBarrier();
+    return v;
+}
 
-    msgq = ckd_calloc(1, sizeof(*msgq));
-    msgq->depth = depth;
-    msgq->evt = CreateEventW(NULL, FALSE, FALSE, NULL);
-    if (msgq->evt == NULL) {
-        ckd_free(msgq);
-        return NULL;
-    }
-    InitializeCriticalSection(&msgq->mtx);
-    msgq->data = ckd_calloc(depth, 1);
-    msgq->msg = ckd_calloc(depth, 1);
-    return msgq;
+static void
+sbatomic_store(volatile size_t *p, size_t v)
+{
+    MemoryBarrier();
+    *p = v;
 }
 
-void
-sbmsgq_free(sbmsgq_t *msgq)
+static int
+sbatomic_cas(volatile size_t *p, size_t oldv, size_t newv)
 {
-    CloseHandle(msgq->evt);
-    ckd_free(msgq->data);
-    ckd_free(msgq->msg);
-    ckd_free(msgq);
+    return InterlockedCompareExchangePointer((PVOID volatile *)p,
+                                             (PVOID)newv, (PVOID)oldv)
+        == (PVOID)oldv;
 }
 
-int
-sbmsgq_send(sbmsgq_t *q, size_t len, void const *data)
+static void
+sbatomic_fence(void)
 {
-    char const *cdata = (char const *)data;
-    size_t in;
+    MemoryBarrier();
+}
 
-    /* Don't allow things bigger than depth to be sent! */
-    if (len + sizeof(len) > q->depth)
-        return -1;
+static void
+sbthread_yield(void)
+{
+    SwitchToThread();
+}
 
-    if (q->nbytes + len + sizeof(len) > q->depth)
-        WaitForSingleObject(q->evt, INFINITE);
-
-    /* Lock things while we manipulate the buffer (FIXME: this
-       actually should have been atomic with the wait above ...) */
-    EnterCriticalSection(&q->mtx);
-    in = (q->out + q->nbytes) % q->depth;
-    /* First write the size of the message. */
-    if (in + sizeof(len) > q->depth) {
-        /* Handle the annoying case where the size field gets wrapped around. */
-        size_t len1 = q->depth - in;
-        memcpy(q->data + in, &len, len1);
-        memcpy(q->data, ((char *)&len) + len1, sizeof(len) - len1);
-        q->nbytes += sizeof(len);
-        in = sizeof(len) - len1;
-    }
-    else {
-        memcpy(q->data + in, &len, sizeof(len));
-        q->nbytes += sizeof(len);
-        in += sizeof(len);
-    }
+static int
+sbwait_init(sbwait_t *w)
+{
+    w->seq = 0;
+    w->nwaiters = 0;
+    w->sem = CreateSemaphoreW(NULL, 0, 0x7fffffff, NULL);
+    return w->sem == NULL ? -1 : 0;
+}
 
-    /* Now write the message body. */
-    if (in + len > q->depth) {
-        /* Handle wraparound. */
-        size_t len1 = q->depth - in;
-        memcpy(q->data + in, cdata, len1);
-        q->nbytes += len1;
-        cdata += len1;
-        len -= len1;
-        in = 0;
-    }
-    memcpy(q->data + in, cdata, len);
-    q->nbytes += len;
+static void
+sbwait_destroy(sbwait_t *w)
+{
+    CloseHandle(w->sem);
+}
 
-    /* Signal the condition variable. */
-    SetEvent(q->evt);
-    /* Unlock. */
-    LeaveCriticalSection(&q->mtx);
+static uint32
+sbwait_prepare(sbwait_t *w)
+{
+    InterlockedIncrement(&w->nwaiters);
+    return (uint32)w->seq;
+}
 
-    return 0;
+static void
+sbwait_cancel(sbwait_t *w)
+{
+    InterlockedDecrement(&w->nwaiters);
 }
 
-void *
-sbmsgq_wait(sbmsgq_t *q, size_t *out_len, int sec, int nsec)
+static sbwait_deadline_t *
+sbwait_deadline(sbwait_deadline_t *d, int sec, int nsec)
 {
-    char *outptr;
-    size_t len;
+    d->start = GetTickCount();
+    d->ms = sec * 1000 + nsec / (1000*1000);
+    return d;
+}
 
-    /* Wait for data to be available. */
-    if (q->nbytes == 0) {
-        if (cond_timed_wait(q->evt, sec, nsec) == WAIT_FAILED)
-            /* Timed out or something... */
-            return NULL;
+static int
+sbwait_sleep(sbwait_t *w, uint32 key, sbwait_deadline_t const *d)
+{
+    DWORD ms = INFINITE;
+
+    if (d) {
+        /* Unsigned arithmetic makes this safe across wraparound. */
+        DWORD elapsed = GetTickCount() - d->start;
+        if (elapsed >= d->ms)
+            return -1;
+        ms = d->ms - elapsed;
     }
-    /* Lock to manipulate the queue (FIXME) */
-    EnterCriticalSection(&q->mtx);
-    /* Get the message size. */
-    if (q->out + sizeof(q->msglen) > q->depth) {
-        /* Handle annoying wraparound case. */
-        size_t len1 = q->depth - q->out;
-        memcpy(&q->msglen, q->data + q->out, len1);
-        memcpy(((char *)&q->msglen) + len1, q->data,
-               sizeof(q->msglen) - len1);
-        q->out = sizeof(q->msglen) - len1;
+    if ((uint32)w->seq != key)
+        return 0;
+    /* Extra releases from wakeups nobody slept for can make this
+     * return early, the callers check their condition again. */
+    return WaitForSingleObject(w->sem, ms) == WAIT_OBJECT_0 ? 0 : -1;
+}
+
+static void
+sbwait_wake(sbwait_t *w)
+{
+    LONG n;
+
+    MemoryBarrier();
+    if ((n = w->nwaiters) > 0) {
+        InterlockedIncrement(&w->seq);
+        ReleaseSemaphore(w->sem, n, NULL);
     }
-    else {
-        memcpy(&q->msglen, q->data + q->out, sizeof(q->msglen));
-        q->out += sizeof(q->msglen);
-    }
-    q->nbytes -= sizeof(q->msglen);
-    /* Get the message body. */
-    outptr = q->msg;
-    len = q->msglen;
-    if (q->out + q->msglen > q->depth) {
-        /* Handle wraparound. */
-        size_t len1 = q->depth - q->out;
-        memcpy(outptr, q->data + q->out, len1);
-        outptr += len1;
-        len -= len1;
-        q->nbytes -= len1;
-        q->out = 0;
-    }
-    memcpy(outptr, q->data + q->out, len);
-    q->nbytes -= len;
-    q->out += len;
-
-    /* Signal the condition variable. */
-    SetEvent(q->evt);
-    /* Unlock. */
-    LeaveCriticalSection(&q->mtx);
-    if (out_len)
-        *out_len = q->msglen;
-    return q->msg;
+}
+
+/* Thread-local storage for thread pools. */
+typedef DWORD sbtls_t;
+
+static int
+sbtls_init(sbtls_t *key)
+{
+    *key = TlsAlloc();
+    return *key == TLS_OUT_OF_INDEXES ? -1 : 0;
+}
+
+static void
+sbtls_free(sbtls_t key)
+{
+    TlsFree(key);
+}
+
+static void
+sbtls_set(sbtls_t key, void *val)
+{
+    TlsSetValue(key, val);
+}
+
+static void *
+sbtls_get(sbtls_t key)
+{
+    return TlsGetValue(key);
 }
 
 #else /* POSIX */
 #include <pthread.h>
+#include <sched.h>
 #include <sys/time.h>
+#include <time.h>
 
 struct sbthread_s {
     cmd_ln_t *config;
@@ -368,19 +366,28 @@ struct sbthread_s {
     pthread_t th;
 };
 
-struct sbmsgq_s {
-    /* Ringbuffer for passing messages. */
-    char *data;
-    size_t depth;
-    size_t out;
-    size_t nbytes;
-
-    /* Current message is stored here. */
-    char *msg;
-    size_t msglen;
+#if defined(__linux__) && defined(__GNUC__)
+#define SBWAIT_FUTEX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+/* Wait queue for ring buffers, see sbwait_prepare() below. */
+typedef struct sbwait_s {
+    uint32 seq;
+    uint32 nwaiters;
+#ifndef SBWAIT_FUTEX
     pthread_mutex_t mtx;
     pthread_cond_t cond;
-};
+#endif
+} sbwait_t;
+
+/* When a timed sbwait_sleep() gives up, see sbwait_deadline(). */
+typedef struct sbwait_deadline_s {
+    struct timespec end;
+} sbwait_deadline_t;
 
 struct sbevent_s {
     pthread_mutex_t mtx;
@@ -440,171 +447,291 @@ sbthread_wait(sbthread_t *th)
     return (int)(long)exit;
 }
 
-sbmsgq_t *
-sbmsgq_init(size_t depth)
+static int
+cond_timed_wait(pthread_cond_t *cond, pthread_mutex_t *mtx, int sec, int nsec)
 {
-    sbmsgq_t *msgq;
-
-    msgq = ckd_calloc(1, sizeof(*msgq));
-    msgq->depth = depth;
-    if (pthread_cond_init(&msgq->cond, NULL) != 0) {
-        ckd_free(msgq);
-        return NULL;
+    int rv;
+    if (sec == -1) {
+        rv = pthread_cond_wait(cond, mtx);
     }
-    if (pthread_mutex_init(&msgq->mtx, NULL) != 0) {
-        pthread_cond_destroy(&msgq->cond);
-        ckd_free(msgq);
-        return NULL;
+    else {
+        struct timeval now;
+        struct timespec end;
+
+        gettimeofday(&now, NULL);
+        end.tv_sec = now.tv_sec + sec;
+        end.tv_nsec = now.tv_usec * 1000 + nsec;
+        if (end.tv_nsec >= (1000*1000*1000)) {
+            end.tv_sec += end.tv_nsec / (1000*1000*1000);
+            end.tv_nsec = end.tv_nsec % (1000*1000*1000);
+        }
+        rv = pthread_cond_timedwait(cond, mtx, &end);
     }
-    msgq->data = ckd_calloc(depth, 1);
-    msgq->msg = ckd_calloc(depth, 1);
-    return msgq;
+    return rv;
 }
 
-void
-sbmsgq_free(sbmsgq_t *msgq)
+#ifdef __GNUC__
+static size_t
+sbatomic_load(volatile size_t *p)
 {
-    pthread_mutex_destroy(&msgq->mtx);
-    pthread_cond_destroy(&msgq->cond);
-    ckd_free(msgq->data);
-    ckd_free(msgq->msg);
-    ckd_free(msgq);
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
 }
 
-int
-sbmsgq_send(sbmsgq_t *q, size_t len, void const *data)
+static void
+sbatomic_store(volatile size_t *p, size_t v)
 {
-    size_t in;
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
 
-    /* Don't allow things bigger than depth to be sent! */
-    if (len + sizeof(len) > q->depth)
+static int
+sbatomic_cas(volatile size_t *p, size_t oldv, size_t newv)
+{
+    return __atomic_compare_exchange_n(p, &oldv, newv, FALSE,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+static void
+sbatomic_fence(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static uint32
+sbatomic_add32(uint32 *p, int32 v)
+{
+    return __atomic_add_fetch(p, v, __ATOMIC_SEQ_CST);
+}
+
+static uint32
+sbatomic_load32(uint32 *p)
+{
+    return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+#else /* !__GNUC__ */
+/* No atomic operations known for this compiler, use a lock. */
+static pthread_mutex_t sbatomic_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t
+sbatomic_load(volatile size_t *p)
+{
+    size_t v;
+    pthread_mutex_lock(&sbatomic_mtx);
+    v = *p;
+    pthread_mutex_unlock(&sbatomic_mtx);
+    return v;
+}
+
+static void
+sbatomic_store(volatile size_t *p, size_t v)
+{
+    pthread_mutex_lock(&sbatomic_mtx);
+    *p = v;
+    pthread_mutex_unlock(&sbatomic_mtx);
+}
+
+static int
+sbatomic_cas(volatile size_t *p, size_t oldv, size_t newv)
+{
+    int rv;
+    pthread_mutex_lock(&sbatomic_mtx);
+    if ((rv = (*p == oldv)))
+        *p = newv;
+    pthread_mutex_unlock(&sbatomic_mtx);
+    return rv;
+}
+
+static void
+sbatomic_fence(void)
+{
+    pthread_mutex_lock(&sbatomic_mtx);
+    pthread_mutex_unlock(&sbatomic_mtx);
+}
+
+static uint32
+sbatomic_add32(uint32 *p, int32 v)
+{
+    uint32 rv;
+    pthread_mutex_lock(&sbatomic_mtx);
+    rv = (*p += v);
+    pthread_mutex_unlock(&sbatomic_mtx);
+    return rv;
+}
+
+static uint32
+sbatomic_load32(uint32 *p)
+{
+    uint32 v;
+    pthread_mutex_lock(&sbatomic_mtx);
+    v = *p;
+    pthread_mutex_unlock(&sbatomic_mtx);
+    return v;
+}
+#endif /* !__GNUC__ */
+
+static void
+sbthread_yield(void)
+{
+    sched_yield();
+}
+
+static int
+sbwait_init(sbwait_t *w)
+{
+    w->seq = 0;
+    w->nwaiters = 0;
+#ifndef SBWAIT_FUTEX
+    if (pthread_cond_init(&w->cond, NULL) != 0)
+        return -1;
+    if (pthread_mutex_init(&w->mtx, NULL) != 0) {
+        pthread_cond_destroy(&w->cond);
         return -1;
+    }
+#endif
+    return 0;
+}
 
-    /* Lock the condition variable while we manipulate the buffer. */
-    pthread_mutex_lock(&q->mtx);
-    if (q->nbytes + len + sizeof(len) > q->depth) {
-        /* Unlock and wait for space to be available. */
-        if (pthread_cond_wait(&q->cond, &q->mtx) != 0) {
-            /* Timed out, don't send anything. */
-            pthread_mutex_unlock(&q->mtx);
-            return -1;
-        }
-        /* Condition is now locked again. */
+static void
+sbwait_destroy(sbwait_t *w)
+{
+#ifndef SBWAIT_FUTEX
+    pthread_mutex_destroy(&w->mtx);
+    pthread_cond_destroy(&w->cond);
+#endif
+}
+
+static uint32
+sbwait_prepare(sbwait_t *w)
+{
+    sbatomic_add32(&w->nwaiters, 1);
+    return sbatomic_load32(&w->seq);
+}
+
+static void
+sbwait_cancel(sbwait_t *w)
+{
+    sbatomic_add32(&w->nwaiters, -1);
+}
+
+static void
+sbwait_now(struct timespec *now)
+{
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, now);
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    now->tv_sec = tv.tv_sec;
+    now->tv_nsec = tv.tv_usec * 1000;
+#endif
+}
+
+static sbwait_deadline_t *
+sbwait_deadline(sbwait_deadline_t *d, int sec, int nsec)
+{
+    sbwait_now(&d->end);
+    d->end.tv_sec += sec + nsec / (1000*1000*1000);
+    d->end.tv_nsec += nsec % (1000*1000*1000);
+    if (d->end.tv_nsec >= (1000*1000*1000)) {
+        d->end.tv_sec += 1;
+        d->end.tv_nsec -= (1000*1000*1000);
     }
-    in = (q->out + q->nbytes) % q->depth;
+    return d;
+}
 
-    /* First write the size of the message. */
-    if (in + sizeof(len) > q->depth) {
-        /* Handle the annoying case where the size field gets wrapped around. */
-        size_t len1 = q->depth - in;
-        memcpy(q->data + in, &len, len1);
-        memcpy(q->data, ((char *)&len) + len1, sizeof(len) - len1);
-        q->nbytes += sizeof(len);
-        in = sizeof(len) - len1;
+/* Time left before d in rem, or -1 if there is none. */
+static int
+sbwait_remaining(sbwait_deadline_t const *d, struct timespec *rem)
+{
+    struct timespec now;
+
+    sbwait_now(&now);
+    rem->tv_sec = d->end.tv_sec - now.tv_sec;
+    rem->tv_nsec = d->end.tv_nsec - now.tv_nsec;
+    if (rem->tv_nsec < 0) {
+        rem->tv_sec -= 1;
+        rem->tv_nsec += (1000*1000*1000);
     }
-    else {
-        memcpy(q->data + in, &len, sizeof(len));
-        q->nbytes += sizeof(len);
-        in += sizeof(len);
-    }
-
-    /* Now write the message body. */
-    if (in + len > q->depth) {
-        /* Handle wraparound. */
-        size_t len1 = q->depth - in;
-        memcpy(q->data + in, data, len1);
-        q->nbytes += len1;
-        data = (char const *)data + len1;
-        len -= len1;
-        in = 0;
-    }
-    memcpy(q->data + in, data, len);
-    q->nbytes += len;
-
-    /* Signal the condition variable. */
-    pthread_cond_signal(&q->cond);
-    /* Unlock it, we have nothing else to do. */
-    pthread_mutex_unlock(&q->mtx);
+    if (rem->tv_sec < 0 || (rem->tv_sec == 0 && rem->tv_nsec == 0))
+        return -1;
     return 0;
 }
 
 static int
-cond_timed_wait(pthread_cond_t *cond, pthread_mutex_t *mtx, int sec, int nsec)
+sbwait_sleep(sbwait_t *w, uint32 key, sbwait_deadline_t const *d)
 {
-    int rv;
-    if (sec == -1) {
-        rv = pthread_cond_wait(cond, mtx);
-    }
-    else {
-        struct timeval now;
-        struct timespec end;
+    struct timespec rem;
 
-        gettimeofday(&now, NULL);
-        end.tv_sec = now.tv_sec + sec;
-        end.tv_nsec = now.tv_usec * 1000 + nsec;
-        if (end.tv_nsec > (1000*1000*1000)) {
-            sec += end.tv_nsec / (1000*1000*1000);
-            end.tv_nsec = end.tv_nsec % (1000*1000*1000);
-        }
-        rv = pthread_cond_timedwait(cond, mtx, &end);
+#ifdef SBWAIT_FUTEX
+    if (d && sbwait_remaining(d, &rem) < 0)
+        return -1;
+    /* Returns immediately if seq is no longer key. */
+    if (syscall(SYS_futex, &w->seq, FUTEX_WAIT_PRIVATE, key,
+                d ? &rem : NULL, NULL, 0) < 0
+        && errno == ETIMEDOUT)
+        return -1;
+    return 0;
+#else
+    int rv = 0;
+
+    pthread_mutex_lock(&w->mtx);
+    while (rv == 0 && w->seq == key) {
+        if (d == NULL)
+            rv = pthread_cond_wait(&w->cond, &w->mtx);
+        else if (sbwait_remaining(d, &rem) < 0)
+            rv = ETIMEDOUT;
+        else
+            rv = cond_timed_wait(&w->cond, &w->mtx,
+                                 rem.tv_sec, rem.tv_nsec);
     }
-    return rv;
+    pthread_mutex_unlock(&w->mtx);
+    return rv == 0 ? 0 : -1;
+#endif
 }
 
-void *
-sbmsgq_wait(sbmsgq_t *q, size_t *out_len, int sec, int nsec)
+static void
+sbwait_wake(sbwait_t *w)
 {
-    char *outptr;
-    size_t len;
+    sbatomic_fence();
+    if (sbatomic_load32(&w->nwaiters) == 0)
+        return;
+#ifdef SBWAIT_FUTEX
+    sbatomic_add32(&w->seq, 1);
+    syscall(SYS_futex, &w->seq, FUTEX_WAKE_PRIVATE, 0x7fffffff,
+            NULL, NULL, 0);
+#else
+    pthread_mutex_lock(&w->mtx);
+    sbatomic_add32(&w->seq, 1);
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->mtx);
+#endif
+}
 
-    /* Lock the condition variable while we manipulate nmsg. */
-    pthread_mutex_lock(&q->mtx);
-    if (q->nbytes == 0) {
-        /* Unlock the condition variable and wait for a signal. */
-        if (cond_timed_wait(&q->cond, &q->mtx, sec, nsec) != 0) {
-            /* Timed out or something... */
-            pthread_mutex_unlock(&q->mtx);
-            return NULL;
-        }
-        /* Condition variable is now locked again. */
-    }
-    /* Get the message size. */
-    if (q->out + sizeof(q->msglen) > q->depth) {
-        /* Handle annoying wraparound case. */
-        size_t len1 = q->depth - q->out;
-        memcpy(&q->msglen, q->data + q->out, len1);
-        memcpy(((char *)&q->msglen) + len1, q->data,
-               sizeof(q->msglen) - len1);
-        q->out = sizeof(q->msglen) - len1;
-    }
-    else {
-        memcpy(&q->msglen, q->data + q->out, sizeof(q->msglen));
-        q->out += sizeof(q->msglen);
-    }
-    q->nbytes -= sizeof(q->msglen);
-    /* Get the message body. */
-    outptr = q->msg;
-    len = q->msglen;
-    if (q->out + q->msglen > q->depth) {
-        /* Handle wraparound. */
-        size_t len1 = q->depth - q->out;
-        memcpy(outptr, q->data + q->out, len1);
-        outptr += len1;
-        len -= len1;
-        q->nbytes -= len1;
-        q->out = 0;
-    }
-    memcpy(outptr, q->data + q->out, len);
-    q->nbytes -= len;
-    q->out += len;
-
-    /* Signal the condition variable. */
-    pthread_cond_signal(&q->cond);
-    /* Unlock the condition variable, we are done. */
-    pthread_mutex_unlock(&q->mtx);
-    if (out_len)
-        *out_len = q->msglen;
-    return q->msg;
+/* Thread-local storage for thread pools. */
+typedef pthread_key_t sbtls_t;
+
+static int
+sbtls_init(sbtls_t *key)
+{
+    return pthread_key_create(key, NULL) == 0 ? 0 : -1;
+}
+
+static void
+sbtls_free(sbtls_t key)
+{
+    pthread_key_delete(key);
+}
+
+static void
+sbtls_set(sbtls_t key, void *val)
+{
+    pthread_setspecific(key, val);
+}
+
+static void *
+sbtls_get(sbtls_t key)
+{
+    return pthread_getspecific(key);
 }
 
 sbevent_t *
@@ -706,6 +833,288 @@ sbmtx_free(sbmtx_t *mtx)
 }
 #endif /* not WIN32 */
 
+/*
+ * Ring buffers.
+ *
+ * Producers claim space by advancing head, fill it in, and then
+ * publish it by advancing committed.  Reservations are published in
+ * the order they were made, so the consumer only ever sees complete
+ * messages between tail and committed, and nothing in the buffer
+ * needs to be cleared after use.  Each message starts with a header,
+ * and a message which would run off the end of the buffer is
+ * preceded by padding, so that all messages are contiguous.
+ */
+#define SBRING_ALIGN 8
+#define SBRING_PAD ((size_t)-1)
+#define sbring_align(n) (((n) + SBRING_ALIGN - 1) & ~(size_t)(SBRING_ALIGN - 1))
+
+typedef struct sbring_hdr_s {
+    size_t len;         /**< Message length, or SBRING_PAD */
+    size_t start;       /**< Start of reservation, including padding */
+    size_t end;         /**< End of reservation */
+} sbring_hdr_t;
+
+#define SBRING_HDR sbring_align(sizeof(sbring_hdr_t))
+
+struct sbring_s {
+    char *data;
+    size_t size;                /**< Size of data, a power of two */
+    int multi_producer;
+    /* Producer and consumer positions are on separate cache lines. */
+    char pad0[64];
+    volatile size_t head;       /**< End of reserved space */
+    volatile size_t committed;  /**< End of published messages */
+    char pad1[64];
+    volatile size_t tail;       /**< End of consumed messages */
+    sbring_hdr_t *cur;          /**< Message being read, if any */
+    char pad2[64];
+    sbwait_t not_empty;
+    sbwait_t not_full;
+};
+
+sbring_t *
+sbring_init(size_t size, int multi_producer)
+{
+    sbring_t *r;
+    size_t n;
+
+    for (n = 128; n < size; n <<= 1)
+        ;
+    r = ckd_calloc(1, sizeof(*r));
+    r->size = n;
+    r->multi_producer = multi_producer;
+    if (sbwait_init(&r->not_empty) < 0) {
+        ckd_free(r);
+        return NULL;
+    }
+    if (sbwait_init(&r->not_full) < 0) {
+        sbwait_destroy(&r->not_empty);
+        ckd_free(r);
+        return NULL;
+    }
+    r->data = ckd_calloc(n, 1);
+    return r;
+}
+
+void
+sbring_free(sbring_t *r)
+{
+    if (r == NULL)
+        return;
+    sbwait_destroy(&r->not_empty);
+    sbwait_destroy(&r->not_full);
+    ckd_free(r->data);
+    ckd_free(r);
+}
+
+size_t
+sbring_max_len(sbring_t *r)
+{
+    /* With padding, a reservation can take up to twice its size. */
+    return r->size / 2 - SBRING_HDR;
+}
+
+/* Try to reserve space for len bytes, return NULL if full. */
+static sbring_hdr_t *
+sbring_try_reserve(sbring_t *r, size_t len)
+{
+    size_t need = SBRING_HDR + sbring_align(len);
+
+    for (;;) {
+        size_t head = r->multi_producer ? sbatomic_load(&r->head) : r->head;
+        size_t tail = sbatomic_load(&r->tail);
+        size_t off = head & (r->size - 1);
+        size_t pad = (off + need > r->size) ? r->size - off : 0;
+        sbring_hdr_t *hdr;
+
+        if (head - tail + pad + need > r->size)
+            return NULL;
+        if (r->multi_producer) {
+            if (!sbatomic_cas(&r->head, head, head + pad + need))
+                continue;
+        }
+        else
+            r->head = head + pad + need;
+        /* Padding too small for a header is skipped implicitly. */
+        if (pad >= SBRING_HDR)
+            ((sbring_hdr_t *)(r->data + off))->len = SBRING_PAD;
+        hdr = (sbring_hdr_t *)(r->data + ((head + pad) & (r->size - 1)));
+        hdr->len = len;
+        hdr->start = head;
+        hdr->end = head + pad + need;
+        return hdr;
+    }
+}
+
+void *
+sbring_reserve(sbring_t *r, size_t len, int sec, int nsec)
+{
+    sbwait_deadline_t end, *deadline = NULL;
+    sbring_hdr_t *hdr;
+
+    if (len > sbring_max_len(r)) {
+        E_ERROR("Message of %lu bytes does not fit in ring of %lu bytes\n",
+                (unsigned long)len, (unsigned long)r->size);
+        return NULL;
+    }
+    while ((hdr = sbring_try_reserve(r, len)) == NULL) {
+        uint32 key = sbwait_prepare(&r->not_full);
+        int rv;
+
+        /* Check again now that the consumer knows to wake us up. */
+        if ((hdr = sbring_try_reserve(r, len)) != NULL) {
+            sbwait_cancel(&r->not_full);
+            break;
+        }
+        if (deadline == NULL && sec != -1)
+            deadline = sbwait_deadline(&end, sec, nsec);
+        rv = sbwait_sleep(&r->not_full, key, deadline);
+        sbwait_cancel(&r->not_full);
+        if (rv < 0)
+            return NULL;
+    }
+    return (char *)hdr + SBRING_HDR;
+}
+
+int
+sbring_commit(sbring_t *r, void *ptr, size_t len)
+{
+    sbring_hdr_t *hdr = (sbring_hdr_t *)((char *)ptr - SBRING_HDR);
+
+    int rv = 0;
+
+    if (len > hdr->len) {
+        E_ERROR("Committed %lu bytes but only reserved %lu\n",
+                (unsigned long)len, (unsigned long)hdr->len);
+        rv = -1;
+    }
+    else
+        hdr->len = len;
+    /* Wait for earlier reservations to be published first. */
+    if (r->multi_producer) {
+        int spins = 0;
+        while (sbatomic_load(&r->committed) != hdr->start) {
+            if (++spins > 100)
+                sbthread_yield();
+        }
+    }
+    sbatomic_store(&r->committed, hdr->end);
+    sbwait_wake(&r->not_empty);
+    return rv;
+}
+
+/* Return the next message, or NULL if there is none. */
+static sbring_hdr_t *
+sbring_try_peek(sbring_t *r)
+{
+    size_t committed = sbatomic_load(&r->committed);
+
+    while (r->tail != committed) {
+        size_t off = r->tail & (r->size - 1);
+        sbring_hdr_t *hdr = (sbring_hdr_t *)(r->data + off);
+
+        if (r->size - off < SBRING_HDR || hdr->len == SBRING_PAD) {
+            /* Skip padding at the end of the buffer. */
+            sbatomic_store(&r->tail, r->tail + r->size - off);
+            continue;
+        }
+        return hdr;
+    }
+    return NULL;
+}
+
+void *
+sbring_peek(sbring_t *r, size_t *out_len, int sec, int nsec)
+{
+    sbwait_deadline_t end, *deadline = NULL;
+    sbring_hdr_t *hdr;
+
+    if (r->cur)
+        sbring_release(r);
+    while ((hdr = sbring_try_peek(r)) == NULL) {
+        uint32 key = sbwait_prepare(&r->not_empty);
+        int rv;
+
+        if ((hdr = sbring_try_peek(r)) != NULL) {
+            sbwait_cancel(&r->not_empty);
+            break;
+        }
+        if (deadline == NULL && sec != -1)
+            deadline = sbwait_deadline(&end, sec, nsec);
+        rv = sbwait_sleep(&r->not_empty, key, deadline);
+        sbwait_cancel(&r->not_empty);
+        if (rv < 0)
+            return NULL;
+    }
+    r->cur = hdr;
+    if (out_len)
+        *out_len = hdr->len;
+    return (char *)hdr + SBRING_HDR;
+}
+
+void
+sbring_release(sbring_t *r)
+{
+    if (r->cur == NULL)
+        return;
+    sbatomic_store(&r->tail, r->cur->end);
+    r->cur = NULL;
+    sbwait_wake(&r->not_full);
+}
+
+/*
+ * Message queues are multi-producer rings with an extra copy of the
+ * message on the way in.
+ */
+struct sbmsgq_s {
+    sbring_t *ring;
+    size_t depth;
+};
+
+sbmsgq_t *
+sbmsgq_init(size_t depth)
+{
+    sbmsgq_t *msgq;
+
+    msgq = ckd_calloc(1, sizeof(*msgq));
+    msgq->depth = depth;
+    /* Make sure that any message up to depth will fit. */
+    if ((msgq->ring = sbring_init(depth * 2 + SBRING_HDR * 2, TRUE)) == NULL) {
+        ckd_free(msgq);
+        return NULL;
+    }
+    return msgq;
+}
+
+void
+sbmsgq_free(sbmsgq_t *msgq)
+{
+    sbring_free(msgq->ring);
+    ckd_free(msgq);
+}
+
+int
+sbmsgq_send(sbmsgq_t *q, size_t len, void const *data)
+{
+    void *ptr;
+
+    /* Don't allow things bigger than depth to be sent! */
+    if (len + sizeof(len) > q->depth)
+        return -1;
+    if ((ptr = sbring_reserve(q->ring, len, -1, -1)) == NULL)
+        return -1;
+    memcpy(ptr, data, len);
+    return sbring_commit(q->ring, ptr, len);
+}
+
+void *
+sbmsgq_wait(sbmsgq_t *q, size_t *out_len, int sec, int nsec)
+{
+    /* The previous message is released here, so it stays valid
+     * until the next call. */
+    return sbring_peek(q->ring, out_len, sec, nsec);
+}
+
 cmd_ln_t *
 sbthread_config(sbthread_t *th)
 {
@@ -737,3 +1146,427 @@ sbthread_free(sbthread_t *th)
     sbmsgq_free(th->msgq);
     ckd_free(th);
 }
+
+/*
+ * Thread pools.
+ *
+ * Each worker thread has a deque of tasks.  It pushes the tasks it
+ * spawns onto the bottom and pops them from there, so it works
+ * depth-first on recent tasks whose data are still in its cache,
+ * while idle threads steal from the top of other workers' deques,
+ * where the oldest and usually largest tasks are.  Tasks spawned by
+ * threads outside the pool go into a shared queue instead.  Idle
+ * workers sleep until more tasks arrive, and threads waiting for a
+ * task group run tasks themselves until it is finished.
+ */
+#define SBDEQUE_SIZE 1024
+
+typedef struct sbtask_s sbtask_t;
+struct sbtask_s {
+    sbtask_func func;           /**< Function for a single task, or */
+    sbrange_func range_func;    /**< function for a range of indices */
+    void *arg;
+    int start, end, grain;      /**< Range and largest piece of it */
+    sbtaskgroup_t *group;
+    sbtask_t *next;             /**< Next task in the shared queue */
+};
+
+/* Deque of tasks (Chase and Lev, SPAA 2005, without growing). */
+typedef struct sbdeque_s {
+    volatile size_t top;        /**< Next task to steal */
+    char pad0[64];
+    volatile size_t bottom;     /**< Next free slot */
+    char pad1[64];
+    sbtask_t *volatile tasks[SBDEQUE_SIZE];
+} sbdeque_t;
+
+typedef struct sbworker_s {
+    sbpool_t *pool;
+    sbthread_t *th;
+    int id;
+    sbdeque_t deque;
+} sbworker_t;
+
+struct sbpool_s {
+    int nthreads;
+    sbworker_t *workers;        /**< Workers, starting from 1 */
+    sbtls_t self;               /**< Current thread's worker, if any */
+    sbmtx_t *mtx;               /**< Lock for the shared queue */
+    sbtask_t *queue_head;
+    sbtask_t *queue_tail;
+    volatile size_t n_queued;
+    volatile size_t stop;
+    sbwait_t work;              /**< Tasks were spawned */
+    sbwait_t done;              /**< A task group was finished */
+};
+
+struct sbtaskgroup_s {
+    sbpool_t *pool;
+    volatile size_t pending;    /**< Tasks spawned but not finished */
+};
+
+static size_t
+sbatomic_add(volatile size_t *p, size_t v)
+{
+    size_t old;
+
+    do {
+        old = sbatomic_load(p);
+    } while (!sbatomic_cas(p, old, old + v));
+    return old + v;
+}
+
+/* Push a task onto the bottom of a deque, by its owner only. */
+static int
+sbdeque_push(sbdeque_t *d, sbtask_t *task)
+{
+    size_t bottom = d->bottom;
+
+    if (bottom - sbatomic_load(&d->top) >= SBDEQUE_SIZE)
+        return -1;
+    d->tasks[bottom & (SBDEQUE_SIZE - 1)] = task;
+    sbatomic_store(&d->bottom, bottom + 1);
+    return 0;
+}
+
+/* Pop a task from the bottom of a deque, by its owner only. */
+static sbtask_t *
+sbdeque_pop(sbdeque_t *d)
+{
+    size_t bottom = d->bottom - 1;
+    size_t top;
+    sbtask_t *task;
+
+    sbatomic_store(&d->bottom, bottom);
+    sbatomic_fence();
+    top = sbatomic_load(&d->top);
+    if ((long)(bottom - top) < 0) {
+        /* Empty. */
+        sbatomic_store(&d->bottom, top);
+        return NULL;
+    }
+    task = d->tasks[bottom & (SBDEQUE_SIZE - 1)];
+    if (bottom != top)
+        return task;
+    /* Last task, race thieves for it. */
+    if (!sbatomic_cas(&d->top, top, top + 1))
+        task = NULL;
+    sbatomic_store(&d->bottom, top + 1);
+    return task;
+}
+
+/* Steal a task from the top of a deque, by any thread. */
+static sbtask_t *
+sbdeque_steal(sbdeque_t *d)
+{
+    size_t top, bottom;
+    sbtask_t *task;
+
+    top = sbatomic_load(&d->top);
+    sbatomic_fence();
+    bottom = sbatomic_load(&d->bottom);
+    if ((long)(bottom - top) <= 0)
+        return NULL;
+    task = d->tasks[top & (SBDEQUE_SIZE - 1)];
+    /* Somebody else got it first if this fails. */
+    if (!sbatomic_cas(&d->top, top, top + 1))
+        return NULL;
+    return task;
+}
+
+static void
+sbpool_push(sbpool_t *pool, sbtask_t *task)
+{
+    sbworker_t *self = sbtls_get(pool->self);
+
+    if (self == NULL || sbdeque_push(&self->deque, task) < 0) {
+        task->next = NULL;
+        sbmtx_lock(pool->mtx);
+        if (pool->queue_tail)
+            pool->queue_tail->next = task;
+        else
+            pool->queue_head = task;
+        pool->queue_tail = task;
+        sbatomic_add(&pool->n_queued, 1);
+        sbmtx_unlock(pool->mtx);
+    }
+    sbwait_wake(&pool->work);
+}
+
+/* Find a task to run: our own, then a shared one, then a stolen one. */
+static sbtask_t *
+sbpool_find(sbpool_t *pool, sbworker_t *self)
+{
+    sbtask_t *task;
+    int nworkers, i;
+
+    if (self && (task = sbdeque_pop(&self->deque)) != NULL)
+        return task;
+    if (sbatomic_load(&pool->n_queued) > 0) {
+        sbmtx_lock(pool->mtx);
+        if ((task = pool->queue_head) != NULL) {
+            if ((pool->queue_head = task->next) == NULL)
+                pool->queue_tail = NULL;
+            sbatomic_add(&pool->n_queued, (size_t)-1);
+        }
+        sbmtx_unlock(pool->mtx);
+        if (task)
+            return task;
+    }
+    /* Start with the next worker along, so thieves spread out. */
+    nworkers = pool->nthreads - 1;
+    for (i = 1; i <= nworkers; ++i) {
+        int victim = 1 + ((self ? self->id : 0) + i - 1) % nworkers;
+        if (self && victim == self->id)
+            continue;
+        if ((task = sbdeque_steal(&pool->workers[victim].deque)) != NULL)
+            return task;
+    }
+    return NULL;
+}
+
+static void
+sbtaskgroup_spawn(sbtaskgroup_t *g, sbtask_t *task)
+{
+    task->group = g;
+    sbatomic_add(&g->pending, 1);
+    sbpool_push(g->pool, task);
+}
+
+static void
+sbtask_run(sbpool_t *pool, sbtask_t *task)
+{
+    sbtaskgroup_t *g = task->group;
+
+    if (task->range_func) {
+        int start = task->start, end = task->end;
+
+        /* Leave the second half of the range for somebody else. */
+        while (end - start > task->grain) {
+            sbtask_t *half = ckd_calloc(1, sizeof(*half));
+            int mid = start + (end - start) / 2;
+
+            *half = *task;
+            half->start = mid;
+            half->end = end;
+            sbtaskgroup_spawn(g, half);
+            end = mid;
+        }
+        (*task->range_func)(task->arg, start, end);
+    }
+    else
+        (*task->func)(task->arg);
+    ckd_free(task);
+    /* The group may be freed as soon as this reaches zero. */
+    if (sbatomic_add(&g->pending, (size_t)-1) == 0)
+        sbwait_wake(&pool->done);
+}
+
+static int
+sbpool_worker_main(sbthread_t *th)
+{
+    sbworker_t *self = sbthread_arg(th);
+    sbpool_t *pool = self->pool;
+
+    sbtls_set(pool->self, self);
+    for (;;) {
+        sbtask_t *task;
+        uint32 key;
+
+        if ((task = sbpool_find(pool, self)) != NULL) {
+            sbtask_run(pool, task);
+            continue;
+        }
+        key = sbwait_prepare(&pool->work);
+        sbatomic_fence();
+        if (sbatomic_load(&pool->stop)) {
+            sbwait_cancel(&pool->work);
+            break;
+        }
+        /* Check again now that spawners know to wake us up. */
+        if ((task = sbpool_find(pool, self)) != NULL) {
+            sbwait_cancel(&pool->work);
+            sbtask_run(pool, task);
+            continue;
+        }
+        sbwait_sleep(&pool->work, key, NULL);
+        sbwait_cancel(&pool->work);
+    }
+    return 0;
+}
+
+sbpool_t *
+sbpool_init(cmd_ln_t *config, int nthreads)
+{
+    sbpool_t *pool;
+    int i;
+
+    if (nthreads <= 0 && config && cmd_ln_exists_r(config, "-nthreads"))
+        nthreads = cmd_ln_int32_r(config, "-nthreads");
+    if (nthreads < 1)
+        nthreads = 1;
+
+    pool = ckd_calloc(1, sizeof(*pool));
+    if (sbtls_init(&pool->self) < 0) {
+        E_ERROR("Failed to allocate thread-local storage\n");
+        ckd_free(pool);
+        return NULL;
+    }
+    if (sbwait_init(&pool->work) < 0) {
+        sbtls_free(pool->self);
+        ckd_free(pool);
+        return NULL;
+    }
+    if (sbwait_init(&pool->done) < 0) {
+        sbwait_destroy(&pool->work);
+        sbtls_free(pool->self);
+        ckd_free(pool);
+        return NULL;
+    }
+    pool->mtx = sbmtx_init();
+    pool->nthreads = nthreads;
+    pool->workers = ckd_calloc(nthreads, sizeof(*pool->workers));
+    /* The calling thread makes up the numbers. */
+    for (i = 1; i < nthreads; ++i) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].id = i;
+        if ((pool->workers[i].th = sbthread_start(config, sbpool_worker_main,
+                                                  &pool->workers[i]))
+            == NULL) {
+            E_WARN("Failed to start thread %d, continuing without it\n", i);
+            pool->nthreads = i;
+            break;
+        }
+    }
+    return pool;
+}
+
+void
+sbpool_free(sbpool_t *pool)
+{
+    int i;
+
+    if (pool == NULL)
+        return;
+    sbatomic_store(&pool->stop, TRUE);
+    sbwait_wake(&pool->work);
+    for (i = 1; i < pool->nthreads; ++i)
+        sbthread_free(pool->workers[i].th);
+    while (pool->queue_head) {
+        sbtask_t *next = pool->queue_head->next;
+        ckd_free(pool->queue_head);
+        pool->queue_head = next;
+    }
+    ckd_free(pool->workers);
+    sbmtx_free(pool->mtx);
+    sbwait_destroy(&pool->work);
+    sbwait_destroy(&pool->done);
+    sbtls_free(pool->self);
+    ckd_free(pool);
+}
+
+int
+sbpool_nthreads(sbpool_t *pool)
+{
+    return pool->nthreads;
+}
+
+int
+sbpool_worker(sbpool_t *pool)
+{
+    sbworker_t *self = sbtls_get(pool->self);
+
+    return self ? self->id : 0;
+}
+
+sbtaskgroup_t *
+sbtaskgroup_init(sbpool_t *pool)
+{
+    sbtaskgroup_t *g;
+
+    g = ckd_calloc(1, sizeof(*g));
+    g->pool = pool;
+    return g;
+}
+
+void
+sbtaskgroup_free(sbtaskgroup_t *g)
+{
+    if (g == NULL)
+        return;
+    sbtaskgroup_wait(g);
+    ckd_free(g);
+}
+
+void
+sbtaskgroup_run(sbtaskgroup_t *g, sbtask_func func, void *arg)
+{
+    sbtask_t *task;
+
+    task = ckd_calloc(1, sizeof(*task));
+    task->func = func;
+    task->arg = arg;
+    sbtaskgroup_spawn(g, task);
+}
+
+void
+sbtaskgroup_wait(sbtaskgroup_t *g)
+{
+    sbpool_t *pool = g->pool;
+    sbworker_t *self = sbtls_get(pool->self);
+
+    while (sbatomic_load(&g->pending) != 0) {
+        sbtask_t *task;
+        uint32 key;
+
+        /* Help out rather than waiting idly. */
+        if ((task = sbpool_find(pool, self)) != NULL) {
+            sbtask_run(pool, task);
+            continue;
+        }
+        key = sbwait_prepare(&pool->done);
+        sbatomic_fence();
+        if (sbatomic_load(&g->pending) == 0) {
+            sbwait_cancel(&pool->done);
+            break;
+        }
+        if ((task = sbpool_find(pool, self)) != NULL) {
+            sbwait_cancel(&pool->done);
+            sbtask_run(pool, task);
+            continue;
+        }
+        sbwait_sleep(&pool->done, key, NULL);
+        sbwait_cancel(&pool->done);
+    }
+}
+
+void
+sbpool_parallel_for(sbpool_t *pool, int start, int end, int grain,
+                    sbrange_func func, void *arg)
+{
+    sbtaskgroup_t g;
+    sbtask_t *task;
+
+    if (end <= start)
+        return;
+    if (pool == NULL || pool->nthreads == 1) {
+        (*func)(arg, start, end);
+        return;
+    }
+    /* By default, make a few pieces per thread to even out the load. */
+    if (grain < 1)
+        grain = (end - start) / (pool->nthreads * 4);
+    if (grain < 1)
+        grain = 1;
+    g.pool = pool;
+    g.pending = 1;
+    task = ckd_calloc(1, sizeof(*task));
+    task->range_func = func;
+    task->arg = arg;
+    task->start = start;
+    task->end = end;
+    task->grain = grain;
+    task->group = &g;
+    sbtask_run(pool, task);
+    sbtaskgroup_wait(&g);
+}
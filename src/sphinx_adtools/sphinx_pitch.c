@@ -146,6 +146,11 @@ static arg_t defn[] = {
     "0.2",
     "Fraction of the best local estimate to use as a search range for smoothing." },
 
+  { "-fft",
+    ARG_BOOLEAN,
+    "no",
+    "Compute the difference function with an FFT (much faster for long frames, requires floating-point)." },
+
   { NULL, 0, NULL, NULL }
 };
 
@@ -424,9 +429,11 @@ extract_pitch(const char *in, const char *out)
     sps = cmd_ln_int32("-samprate");
     flen = (size_t)(0.5 + sps * cmd_ln_float32("-flen"));
     fshift = (size_t)(0.5 + sps * cmd_ln_float32("-fshift"));
-    yin = yin_init(flen, cmd_ln_float32("-voice_thresh"),
-                   cmd_ln_float32("-search_range"),
-                   cmd_ln_int32("-smooth_window"));
+    yin = yin_init_method(flen, cmd_ln_float32("-voice_thresh"),
+                          cmd_ln_float32("-search_range"),
+                          cmd_ln_int32("-smooth_window"),
+                          cmd_ln_boolean("-fft")
+                          ? YIN_DIFF_FFT : YIN_DIFF_DIRECT);
     if (yin == NULL) {
         E_ERROR("Failed to initialize YIN\n");
         goto error_out;
@@ -53,6 +53,8 @@
 #include <sphinxbase/ckd_alloc.h>
 #include <sphinxbase/byteorder.h>
 #include <sphinxbase/hash_table.h>
+#include <sphinxbase/sbthread.h>
+#include <sphinxbase/mmio.h>
 
 #include "sphinx_wave2feat.h"
 #include "cmd_ln_defn.h"
@@ -328,10 +330,10 @@ detect_sphinx_mfc(sphinx_wave2feat_t *wtf)
             fclose(fh);
             return -1;
         }
-        /* Set the input endianness to the opposite of the machine endianness... */
-        cmd_ln_set_str_r(wtf->config, "-input_endian",
-                         (0 == strcmp("big", cmd_ln_str_r(wtf->config, "-mach_endian"))
-                          ? "little" : "big"));
+        /* The input endianness is the opposite of the machine
+         * endianness.  Don't change -input_endian for this, as the
+         * config is shared with other files and threads. */
+        wtf->byteswap = TRUE;
     }
 
     fseek(fh, 4, SEEK_SET);
@@ -373,6 +375,54 @@ mixnpick_channels(int16 *buf, int32 nsamp, int32 nchans, int32 whichchan)
     return i/nchans;
 }
 
+/**
+ * Compute and write features for a block of PCM audio.
+ *
+ * @return number of values written, or -1 on error.
+ */
+static int
+process_pcm(sphinx_wave2feat_t *wtf, int16 const *inspeech, size_t nsamp)
+{
+    int32 n, nfr;
+    int nfloat = 0;
+
+    /* Consume all samples. */
+    while (nsamp) {
+        nfr = wtf->featsize;
+        fe_process_frames_batch(wtf->fe, &inspeech, &nsamp, wtf->feat, &nfr, NULL);
+        if (nfr) {
+            if ((n = (*wtf->ot->output_frames)(wtf, wtf->feat, nfr)) < 0)
+                return -1;
+            nfloat += n;
+        }
+    }
+    return nfloat;
+}
+
+/**
+ * Write features for any leftover audio and close the input file.
+ *
+ * @return number of values written, or -1 on error.
+ */
+static int
+finish_pcm(sphinx_wave2feat_t *wtf)
+{
+    int32 n, nfr;
+    int nfloat = 0;
+
+    fe_end_utt(wtf->fe, wtf->feat[0], &nfr);
+    if (nfr) {
+        if ((n = (*wtf->ot->output_frames)(wtf, wtf->feat, nfr)) < 0)
+            return -1;
+        nfloat += n;
+    }
+
+    if (fclose(wtf->infh) == EOF)
+        E_ERROR_SYSTEM("Failed to close input file");
+    wtf->infh = NULL;
+    return nfloat;
+}
+
 /**
  * Process PCM audio from a filehandle.  Assume that wtf->infh is
  * positioned just after the file header.
@@ -381,7 +431,7 @@ static int
 decode_pcm(sphinx_wave2feat_t *wtf)
 {
     size_t nsamp;
-    int32 n, nfr, nchans, whichchan;
+    int32 n, nchans, whichchan;
     uint32 nfloat;
 
     nchans = cmd_ln_int32_r(wtf->config, "-nchans");
@@ -390,45 +440,83 @@ decode_pcm(sphinx_wave2feat_t *wtf)
     fe_start_utt(wtf->fe);
     nfloat = 0;
     while ((nsamp = fread(wtf->audio, sizeof(int16), wtf->blocksize, wtf->infh)) != 0) {
-        size_t nvec;
-        int16 const *inspeech;
-
-        /* Byteswap stuff here if necessary. */
-        if (wtf->byteswap) {
-            for (n = 0; n < nsamp; ++n)
-                SWAP_INT16(wtf->audio + n);
-        }
-
-        /* Mix or pick channels. */
-        if (nchans > 1)
+        /* Mix or pick channels.  The front end does byteswapping
+         * itself, so only do it here in order to mix, then undo it. */
+        if (nchans > 1) {
+            if (wtf->byteswap) {
+                for (n = 0; n < nsamp; ++n)
+                    SWAP_INT16(wtf->audio + n);
+            }
             nsamp = mixnpick_channels(wtf->audio, nsamp, nchans, whichchan);
-
-        inspeech = wtf->audio;
-        nvec = wtf->featsize;
-        /* Consume all samples. */
-        while (nsamp) {
-            nfr = nvec;
-            fe_process_frames(wtf->fe, &inspeech, &nsamp, wtf->feat, &nfr, NULL);
-            if (nfr) {
-                if ((n = (*wtf->ot->output_frames)(wtf, wtf->feat, nfr)) < 0)
-                    return -1;
-                nfloat += n;
+            if (wtf->byteswap) {
+                for (n = 0; n < nsamp; ++n)
+                    SWAP_INT16(wtf->audio + n);
             }
         }
-        inspeech = wtf->audio;
+
+        if ((n = process_pcm(wtf, wtf->audio, nsamp)) < 0)
+            return -1;
+        nfloat += n;
     }
     /* Now process any leftover audio frames. */
-    fe_end_utt(wtf->fe, wtf->feat[0], &nfr);
-    if (nfr) {
-        if ((n = (*wtf->ot->output_frames)(wtf, wtf->feat, nfr)) < 0)
+    if ((n = finish_pcm(wtf)) < 0)
+        return -1;
+    nfloat += n;
+
+    return nfloat;
+}
+
+/**
+ * Process PCM audio by memory-mapping the input file and passing the
+ * samples directly to the front end, which byteswaps them in its own
+ * frame buffer if necessary.  Falls back to decode_pcm() for
+ * multi-channel audio or if the file cannot be mapped.  Assume that
+ * wtf->infh is positioned just after the file header.
+ */
+static int
+decode_pcm_mmap(sphinx_wave2feat_t *wtf)
+{
+    mmio_file_t *mf;
+    int16 const *inspeech;
+    long offset, flen;
+    size_t nsamp, nblock;
+    int n, nfloat;
+
+    if (cmd_ln_int32_r(wtf->config, "-nchans") > 1)
+        return decode_pcm(wtf);
+    /* Find the size of the PCM data. */
+    if ((offset = ftell(wtf->infh)) < 0 || offset % sizeof(int16) != 0)
+        return decode_pcm(wtf);
+    if (fseek(wtf->infh, 0, SEEK_END) < 0
+        || (flen = ftell(wtf->infh)) < offset + (long)sizeof(int16)
+        || (mf = mmio_file_read(wtf->infile)) == NULL) {
+        fseek(wtf->infh, offset, SEEK_SET);
+        return decode_pcm(wtf);
+    }
+
+    fe_start_stream(wtf->fe);
+    fe_start_utt(wtf->fe);
+    inspeech = (int16 const *)((char const *)mmio_file_ptr(mf) + offset);
+    nsamp = (flen - offset) / sizeof(int16);
+    /* Feed the mapped samples in -blocksize pieces, so that output
+     * (e.g. dithering) is the same as when reading the file. */
+    nfloat = 0;
+    while (nsamp) {
+        nblock = nsamp < (size_t)wtf->blocksize ? nsamp : wtf->blocksize;
+        if ((n = process_pcm(wtf, inspeech, nblock)) < 0) {
+            mmio_file_unmap(mf);
             return -1;
+        }
         nfloat += n;
+        inspeech += nblock;
+        nsamp -= nblock;
     }
+    mmio_file_unmap(mf);
+    /* Now process any leftover audio frames. */
+    if ((n = finish_pcm(wtf)) < 0)
+        return -1;
 
-    if (fclose(wtf->infh) == EOF)
-        E_ERROR_SYSTEM("Failed to close input file");
-    wtf->infh = NULL;
-    return nfloat;
+    return nfloat + n;
 }
 
 /**
@@ -483,9 +571,9 @@ decode_sphinx_mfc(sphinx_wave2feat_t *wtf)
 }
 
 static const audio_type_t types[] = {
-    { "-mswav", &detect_riff, &decode_pcm },
-    { "-nist", &detect_nist, &decode_pcm },
-    { "-raw", &detect_raw, &decode_pcm },
+    { "-mswav", &detect_riff, &decode_pcm_mmap },
+    { "-nist", &detect_nist, &decode_pcm_mmap },
+    { "-raw", &detect_raw, &decode_pcm_mmap },
     { "-sph2pipe", &detect_sph2pipe, &decode_pcm }
 };
 static const int ntypes = sizeof(types)/sizeof(types[0]);
@@ -792,14 +880,14 @@ sphinx_wave2feat_convert_file(sphinx_wave2feat_t *wtf,
 
     wtf->infile = ckd_salloc(infile);
 
+    /* Determine whether to byteswap input (detection may override). */
+    wtf->byteswap = strcmp(cmd_ln_str_r(wtf->config, "-mach_endian"),
+                           cmd_ln_str_r(wtf->config, "-input_endian"));
+
     /* Detect input file type. */
     if ((atype = detect_audio_type(wtf)) == NULL)
         return -1;
 
-    /* Determine whether to byteswap input. */
-    wtf->byteswap = strcmp(cmd_ln_str_r(wtf->config, "-mach_endian"),
-                           cmd_ln_str_r(wtf->config, "-input_endian"));
-
     /* Get the output frame size (if not already set). */
     if (wtf->veclen == 0)
         wtf->veclen = fe_get_output_size(wtf->fe);
@@ -934,14 +1022,84 @@ build_filenames(cmd_ln_t *config, char const *basename,
     }
 }
 
+/**
+ * List of files to convert from a control file, shared by the
+ * threads converting them.
+ */
+typedef struct ctl_jobs_s {
+    char **infiles;   /**< Input files, in control file order. */
+    char **outfiles;  /**< Corresponding output files. */
+    int njobs;        /**< Number of files. */
+    sbpool_t *pool;   /**< Threads converting them. */
+    sphinx_wave2feat_t **wtfs; /**< Converter for each thread. */
+} ctl_jobs_t;
+
+static void
+ctl_convert_files(void *arg, int start, int end)
+{
+    ctl_jobs_t *jobs = (ctl_jobs_t *)arg;
+    sphinx_wave2feat_t *wtf = jobs->wtfs[sbpool_worker(jobs->pool)];
+    int i;
+
+    for (i = start; i < end; ++i)
+        sphinx_wave2feat_convert_file(wtf, jobs->infiles[i],
+                                      jobs->outfiles[i]);
+}
+
+/**
+ * Convert all files in jobs with nthreads threads (including the
+ * calling one), each with its own converter and front end.
+ */
+static int
+run_jobs(sphinx_wave2feat_t *wtf, ctl_jobs_t *jobs, int nthreads)
+{
+    int i, rv;
+
+    if (nthreads > jobs->njobs)
+        nthreads = jobs->njobs;
+    if (nthreads < 1)
+        nthreads = 1;
+
+    /* The calling thread uses the first converter.  Create all of
+     * them here, as reference counting isn't thread-safe. */
+    jobs->wtfs = ckd_calloc(nthreads, sizeof(*jobs->wtfs));
+    jobs->wtfs[0] = sphinx_wave2feat_retain(wtf);
+    for (i = 1; i < nthreads; ++i) {
+        if ((jobs->wtfs[i] = sphinx_wave2feat_init(wtf->config)) == NULL) {
+            E_ERROR("Failed to initialize wave2feat object for thread %d\n", i);
+            nthreads = i;
+            break;
+        }
+    }
+    if ((jobs->pool = sbpool_init(wtf->config, nthreads)) != NULL) {
+        if (sbpool_nthreads(jobs->pool) > 1)
+            E_INFO("Converting %d files with %d threads\n", jobs->njobs,
+                   sbpool_nthreads(jobs->pool));
+        /* Files take long enough to convert that each is a task. */
+        sbpool_parallel_for(jobs->pool, 0, jobs->njobs, 1,
+                            ctl_convert_files, jobs);
+        sbpool_free(jobs->pool);
+        rv = 0;
+    }
+    else
+        rv = -1;
+    for (i = 0; i < nthreads; ++i)
+        sphinx_wave2feat_free(jobs->wtfs[i]);
+    ckd_free(jobs->wtfs);
+    jobs->wtfs = NULL;
+    jobs->pool = NULL;
+
+    return rv;
+}
+
 static int
 run_control_file(sphinx_wave2feat_t *wtf, char const *ctlfile)
 {
     hash_table_t *files;
-    hash_iter_t *itor;
     lineiter_t *li;
     FILE *ctlfh;
-    int nskip, runlen, npart;
+    ctl_jobs_t jobs;
+    int nskip, runlen, npart, nalloc, i;
 
     if ((ctlfh = fopen(ctlfile, "r")) == NULL) {
         E_ERROR_SYSTEM("Failed to open control file %s", ctlfile);
@@ -966,11 +1124,18 @@ run_control_file(sphinx_wave2feat_t *wtf, char const *ctlfile)
     if (runlen != -1){
         E_INFO("Processing %d utterances at position %d\n", runlen, nskip);
         files = hash_table_new(runlen, HASH_CASE_YES);
+        nalloc = runlen;
     }
     else {
         E_INFO("Processing all remaining utterances at position %d\n", nskip);
         files = hash_table_new(1000, HASH_CASE_YES);
+        nalloc = 1000;
     }
+    if (nalloc < 1)
+        nalloc = 1;
+    memset(&jobs, 0, sizeof(jobs));
+    jobs.infiles = ckd_calloc(nalloc, sizeof(*jobs.infiles));
+    jobs.outfiles = ckd_calloc(nalloc, sizeof(*jobs.outfiles));
     for (li = lineiter_start(ctlfh); li; li = lineiter_next(li)) {
         char *c, *infile, *outfile;
 
@@ -991,18 +1156,34 @@ run_control_file(sphinx_wave2feat_t *wtf, char const *ctlfile)
     	    continue;
         }
         build_filenames(wtf->config, li->buf, &infile, &outfile);
-        if (hash_table_lookup(files, infile, NULL) == 0)
+        if (hash_table_lookup(files, infile, NULL) == 0) {
+            ckd_free(infile);
+            ckd_free(outfile);
             continue;
-        sphinx_wave2feat_convert_file(wtf, infile, outfile);
+        }
         hash_table_enter(files, infile, outfile);
+        if (jobs.njobs == nalloc) {
+            nalloc *= 2;
+            jobs.infiles = ckd_realloc(jobs.infiles,
+                                       nalloc * sizeof(*jobs.infiles));
+            jobs.outfiles = ckd_realloc(jobs.outfiles,
+                                        nalloc * sizeof(*jobs.outfiles));
+        }
+        jobs.infiles[jobs.njobs] = infile;
+        jobs.outfiles[jobs.njobs] = outfile;
+        ++jobs.njobs;
     }
-    for (itor = hash_table_iter(files); itor;
-         itor = hash_table_iter_next(itor)) {
-        ckd_free((void *)hash_entry_key(itor->ent));
-        ckd_free(hash_entry_val(itor->ent));
+    fclose(ctlfh);
+
+    run_jobs(wtf, &jobs, cmd_ln_int32_r(wtf->config, "-nthreads"));
+
+    for (i = 0; i < jobs.njobs; ++i) {
+        ckd_free(jobs.infiles[i]);
+        ckd_free(jobs.outfiles[i]);
     }
+    ckd_free(jobs.infiles);
+    ckd_free(jobs.outfiles);
     hash_table_free(files);
-    fclose(ctlfh);
 
     return 0;
 }
@@ -91,9 +91,111 @@ static const arg_t defn[] = {
     "no",
     "Use memory-mapped I/O for reading binary LM files"},
 
+  { "-nthreads",
+    ARG_INT32,
+    "1",
+    "Number of threads to use for parsing and building the trie from text or DMP files"},
+
+  { "-membudget",
+    ARG_FLOAT32,
+    "0",
+    "Megabytes of memory to use for N-Grams when converting text to binary, spilling the rest to temporary files (0 to read the whole model into memory)"},
+
+  { "-tmpdir",
+    ARG_STRING,
+    NULL,
+    "Directory for temporary files used with -membudget"},
+
+  { "-probbits",
+    ARG_STRING_LIST,
+    "16",
+    "Comma-separated list of bits per quantized N-Gram probability, from bigrams up, when building a binary model from text or DMP (the last value is used for any higher orders)"},
+
+  { "-bobits",
+    ARG_STRING_LIST,
+    "16",
+    "Comma-separated list of bits per quantized N-Gram backoff weight, from bigrams up, when building a binary model from text or DMP (the last value is used for any higher orders)"},
+
+  { "-mix",
+    ARG_STRING_LIST,
+    NULL,
+    "Comma-separated list of language models to interpolate with the input model into a single model"},
+
+  { "-mixw",
+    ARG_STRING_LIST,
+    NULL,
+    "Comma-separated list of interpolation weights for the input model followed by the -mix models (uniform if not specified)"},
+
   { NULL, 0, NULL, NULL }
 };
 
+/* Configuration for reading models to interpolate, which are only
+ * quantized with -probbits and -bobits once they are compiled. */
+static cmd_ln_t *
+full_width_config(cmd_ln_t *config)
+{
+    char nthreads[16];
+
+    sprintf(nthreads, "%d", cmd_ln_int32_r(config, "-nthreads"));
+    return cmd_ln_init(NULL, defn, TRUE,
+                       "-i", cmd_ln_str_r(config, "-i"),
+                       "-o", cmd_ln_str_r(config, "-o"),
+                       "-mmap", cmd_ln_boolean_r(config, "-mmap") ? "yes" : "no",
+                       "-nthreads", nthreads, NULL);
+}
+
+static ngram_model_t *
+mix_models(cmd_ln_t *config, cmd_ln_t *read_config, ngram_model_t *lm,
+           logmath_t *lmath)
+{
+    char const **mix, **mixw;
+    ngram_model_t **models, *set, *compiled = NULL;
+    char **names;
+    float32 *weights = NULL;
+    int32 i, n_models, n_weights;
+
+    mix = cmd_ln_str_list_r(config, "-mix");
+    for (n_models = 1; mix[n_models - 1]; ++n_models)
+        ;
+    models = ckd_calloc(n_models, sizeof(*models));
+    names = ckd_calloc(n_models, sizeof(*names));
+    models[0] = lm;
+    names[0] = (char *)cmd_ln_str_r(config, "-i");
+    for (i = 1; i < n_models; ++i) {
+        names[i] = (char *)mix[i - 1];
+        if ((models[i] = ngram_model_read(read_config, names[i],
+                                          NGRAM_AUTO, lmath)) == NULL) {
+            E_ERROR("Failed to read the model from the file '%s'\n", names[i]);
+            goto error_out;
+        }
+    }
+    if ((mixw = cmd_ln_str_list_r(config, "-mixw")) != NULL) {
+        for (n_weights = 0; mixw[n_weights]; ++n_weights)
+            ;
+        if (n_weights != n_models) {
+            E_ERROR("-mixw has %d weights for %d models\n",
+                    n_weights, n_models);
+            goto error_out;
+        }
+        weights = ckd_calloc(n_models, sizeof(*weights));
+        for (i = 0; i < n_models; ++i)
+            weights[i] = (float32)atof_c(mixw[i]);
+    }
+    if ((set = ngram_model_set_init(config, models, names,
+                                    weights, n_models)) == NULL)
+        goto error_out;
+    compiled = ngram_model_set_compile(config, set);
+    ngram_model_free(set);
+
+error_out:
+    for (i = 1; i < n_models; ++i)
+        ngram_model_free(models[i]);
+    ckd_free(models);
+    ckd_free(names);
+    ckd_free(weights);
+    return compiled;
+}
+
 static void
 usagemsg(char *pgm)
 {
@@ -108,7 +210,7 @@ usagemsg(char *pgm)
 int
 main(int argc, char *argv[])
 {
-	cmd_ln_t *config;
+	cmd_ln_t *config, *read_config = NULL;
 	ngram_model_t *lm = NULL;
 	logmath_t *lmath;
         int itype, otype;
@@ -132,18 +234,54 @@ main(int argc, char *argv[])
             goto error_out;
         }	    
 	
+        /* Convert through temporary files if memory is limited. */
+        if (cmd_ln_float32_r(config, "-membudget") > 0) {
+            if (cmd_ln_str_r(config, "-case")) {
+                E_ERROR("-case is not supported with -membudget\n");
+                goto error_out;
+            }
+            if (cmd_ln_str_list_r(config, "-mix")) {
+                E_ERROR("-mix is not supported with -membudget\n");
+                goto error_out;
+            }
+            if ((cmd_ln_str_r(config, "-ifmt")
+                 ? ngram_str_to_type(cmd_ln_str_r(config, "-ifmt"))
+                 : NGRAM_ARPA) != NGRAM_ARPA
+                || (cmd_ln_str_r(config, "-ofmt")
+                    ? ngram_str_to_type(cmd_ln_str_r(config, "-ofmt"))
+                    : ngram_file_name_to_type(cmd_ln_str_r(config, "-o")))
+                != NGRAM_BIN) {
+                E_ERROR("-membudget only converts ARPA files to binary\n");
+                goto error_out;
+            }
+            if (ngram_model_convert_arpa_bin(config, cmd_ln_str_r(config, "-i"),
+                                             cmd_ln_str_r(config, "-o"),
+                                             lmath) < 0) {
+                E_ERROR("Failed to convert %s to %s\n",
+                        cmd_ln_str_r(config, "-i"), cmd_ln_str_r(config, "-o"));
+                goto error_out;
+            }
+            logmath_free(lmath);
+            cmd_ln_free_r(config);
+            return 0;
+        }
+
 	/* Load the input language model. */
+        read_config = cmd_ln_str_list_r(config, "-mix")
+            ? full_width_config(config) : cmd_ln_retain(config);
+        if (read_config == NULL)
+            goto error_out;
         if (cmd_ln_str_r(config, "-ifmt")) {
             if ((itype = ngram_str_to_type(cmd_ln_str_r(config, "-ifmt")))
                 == NGRAM_INVALID) {
                 E_ERROR("Invalid input type %s\n", cmd_ln_str_r(config, "-ifmt"));
                 goto error_out;
             }
-            lm = ngram_model_read(config, cmd_ln_str_r(config, "-i"),
+            lm = ngram_model_read(read_config, cmd_ln_str_r(config, "-i"),
                                   itype, lmath);
         }
         else {
-            lm = ngram_model_read(config, cmd_ln_str_r(config, "-i"),
+            lm = ngram_model_read(read_config, cmd_ln_str_r(config, "-i"),
                                   NGRAM_AUTO, lmath);
 	}
 
@@ -152,6 +290,17 @@ main(int argc, char *argv[])
 	    goto error_out;
 	}
 
+        /* Interpolate with other models if requested. */
+        if (cmd_ln_str_list_r(config, "-mix")) {
+            ngram_model_t *mixed = mix_models(config, read_config, lm, lmath);
+
+            ngram_model_free(lm);
+            if ((lm = mixed) == NULL) {
+                E_ERROR("Failed to interpolate language models\n");
+                goto error_out;
+            }
+        }
+
         /* Guess or set the output language model type. */
         if (cmd_ln_str_r(config, "-ofmt")) {
             if ((otype = ngram_str_to_type(cmd_ln_str_r(config, "-ofmt")))
@@ -187,6 +336,9 @@ main(int argc, char *argv[])
 
         /* That's all folks! */
         ngram_model_free(lm);
+        if (read_config) {
+            cmd_ln_free_r(read_config);
+        }
         if (lmath) {
             logmath_free(lmath);
         }
@@ -197,6 +349,9 @@ main(int argc, char *argv[])
 
 error_out:
         ngram_model_free(lm);
+        if (read_config) {
+            cmd_ln_free_r(read_config);
+        }
         if (lmath) {
             logmath_free(lmath);
         }
@@ -45,6 +45,7 @@
 #include <sphinxbase/err.h>
 #include <sphinxbase/pio.h>
 #include <sphinxbase/strfuncs.h>
+#include <sphinxbase/sbthread.h>
 
 #include <stdio.h>
 #include <string.h>
@@ -66,6 +67,11 @@ static const arg_t defn[] = {
     NULL,
     "Language model file"},
 
+  { "-reflm",
+    ARG_STRING,
+    NULL,
+    "Reference language model to compare perplexity against, such as the -lm model converted with more bits per weight"},
+
   { "-probdef",
     ARG_STRING,
     NULL,
@@ -110,6 +116,11 @@ static const arg_t defn[] = {
     "no",
     "Print details of perplexity calculation" },
 
+  { "-nthreads",
+    ARG_INT32,
+    "1",
+    "Number of threads to use for evaluating a transcription file" },
+
   /* FIXME: Support -lmstartsym, -lmendsym, -lmctlfn, -ctl_lm */
   { NULL, 0, NULL, NULL }
 };
@@ -117,7 +128,8 @@ static const arg_t defn[] = {
 static int verbose;
 
 static int
-calc_entropy(ngram_model_t *lm, char **words, int32 n,
+calc_entropy(ngram_model_t *lm, ngram_hist_cache_t *cache,
+	     char **words, int32 n,
 	     int32 *out_n_ccs, int32 *out_n_oovs, int32 *out_lm_score)
 {
 	int32 *wids;
@@ -154,9 +166,9 @@ calc_entropy(ngram_model_t *lm, char **words, int32 n,
 			continue;
 		}
 		/* Sum up information for each N-gram */
-		prob = ngram_ng_score(lm,
-				      wids[i], wids + i + 1,
-				      n - i - 1, &n_used);
+		prob = ngram_ng_score_r(lm, cache,
+					wids[i], wids + i + 1,
+					n - i - 1, &n_used);
                 if (verbose) {
                     int m;
                     printf("log P(%s|", ngram_word(lm, wids[i]));
@@ -183,50 +195,119 @@ calc_entropy(ngram_model_t *lm, char **words, int32 n,
 	return ch / n;
 }
 
+/**
+ * Results for one line of a transcription file.
+ */
+typedef struct line_score_s {
+	char *line;
+	int32 n, ch, nccs, noovs, lscr;
+} line_score_t;
+
+/**
+ * Lines of a transcription file, scored in parallel.
+ */
+typedef struct eval_jobs_s {
+	ngram_model_t *lm;
+	line_score_t *lines;
+	sbpool_t *pool;
+	ngram_hist_cache_t **caches; /**< History cache for each thread. */
+} eval_jobs_t;
+
 static void
-evaluate_file(ngram_model_t *lm, logmath_t *lmath, const char *lsnfn)
+score_lines(void *arg, int start, int end)
 {
-	FILE *fh;
-        lineiter_t *litor;
-	int32 nccs, noovs, nwords, lscr;
-	float64 ch, log_to_log2;;
+	eval_jobs_t *jobs = arg;
+	ngram_hist_cache_t *cache = jobs->caches[sbpool_worker(jobs->pool)];
+	int i;
 
-	if ((fh = fopen(lsnfn, "r")) == NULL)
-		E_FATAL_SYSTEM("failed to open transcript file %s", lsnfn);
-
-	/* We have to keep ch in floating-point to avoid overflows, so
-	 * we might as well use log2. */
-	log_to_log2 = log(logmath_get_base(lmath)) / log(2);
-	lscr = nccs = noovs = nwords = 0;
-	ch = 0.0;
-        for (litor = lineiter_start(fh); litor; litor = lineiter_next(litor)) {
+	for (i = start; i < end; ++i) {
+		line_score_t *ls = &jobs->lines[i];
 		char **words;
-		int32 n, tmp_ch, tmp_noovs, tmp_nccs, tmp_lscr;
+		int32 n;
 
-		n = str2words(litor->buf, NULL, 0);
+		n = str2words(ls->line, NULL, 0);
 		if (n < 0)
 			E_FATAL("str2words(line, NULL, 0) = %d, should not happen\n", n);
 		if (n == 0) /* Do nothing! */
 			continue;
 		words = ckd_calloc(n, sizeof(*words));
-		str2words(litor->buf, words, n);
+		str2words(ls->line, words, n);
 
 		/* Remove any utterance ID (FIXME: has to be a single "word") */
 		if (words[n-1][0] == '('
 		    && words[n-1][strlen(words[n-1])-1] == ')')
 			n = n - 1;
 
-		tmp_ch = calc_entropy(lm, words, n, &tmp_nccs,
-                                      &tmp_noovs, &tmp_lscr);
-
-		ch += (float64) tmp_ch * (n - tmp_nccs - tmp_noovs) * log_to_log2;
-		nccs += tmp_nccs;
-		noovs += tmp_noovs;
-                lscr += tmp_lscr;
-		nwords += n;
-		
+		ls->ch = calc_entropy(jobs->lm, cache, words, n, &ls->nccs,
+				      &ls->noovs, &ls->lscr);
+		ls->n = n;
 		ckd_free(words);
 	}
+}
+
+static float64
+evaluate_file(ngram_model_t *lm, logmath_t *lmath, const char *lsnfn,
+	      int nthreads)
+{
+	FILE *fh;
+        lineiter_t *litor;
+	eval_jobs_t jobs;
+	int32 nccs, noovs, nwords, lscr, nlines, nalloc, i;
+	float64 ch, log_to_log2;;
+
+	if ((fh = fopen(lsnfn, "r")) == NULL)
+		E_FATAL_SYSTEM("failed to open transcript file %s", lsnfn);
+
+	/* Read all the lines, so that they can be scored in any order. */
+	nlines = 0;
+	nalloc = 1024;
+	memset(&jobs, 0, sizeof(jobs));
+	jobs.lm = lm;
+	jobs.lines = ckd_calloc(nalloc, sizeof(*jobs.lines));
+        for (litor = lineiter_start(fh); litor; litor = lineiter_next(litor)) {
+		if (nlines == nalloc) {
+			nalloc *= 2;
+			jobs.lines = ckd_realloc(jobs.lines,
+						 nalloc * sizeof(*jobs.lines));
+		}
+		memset(&jobs.lines[nlines], 0, sizeof(*jobs.lines));
+		jobs.lines[nlines++].line = ckd_salloc(litor->buf);
+	}
+	fclose(fh);
+
+	/* Details would come out jumbled from several threads. */
+	if (verbose)
+		nthreads = 1;
+	if ((jobs.pool = sbpool_init(NULL, nthreads)) == NULL)
+		E_FATAL("Failed to create thread pool\n");
+	jobs.caches = ckd_calloc(sbpool_nthreads(jobs.pool),
+				 sizeof(*jobs.caches));
+	for (i = 0; i < sbpool_nthreads(jobs.pool); ++i)
+		jobs.caches[i] = ngram_hist_cache_init();
+	sbpool_parallel_for(jobs.pool, 0, nlines, 0, score_lines, &jobs);
+
+	/* We have to keep ch in floating-point to avoid overflows, so
+	 * we might as well use log2. */
+	log_to_log2 = log(logmath_get_base(lmath)) / log(2);
+	lscr = nccs = noovs = nwords = 0;
+	ch = 0.0;
+	/* Add up in file order so the results don't depend on threads. */
+	for (i = 0; i < nlines; ++i) {
+		line_score_t *ls = &jobs.lines[i];
+
+		ch += (float64) ls->ch * (ls->n - ls->nccs - ls->noovs)
+			* log_to_log2;
+		nccs += ls->nccs;
+		noovs += ls->noovs;
+                lscr += ls->lscr;
+		nwords += ls->n;
+		ckd_free(ls->line);
+	}
+	for (i = 0; i < sbpool_nthreads(jobs.pool); ++i)
+		ngram_hist_cache_free(jobs.caches[i]);
+	ckd_free(jobs.caches);
+	sbpool_free(jobs.pool);
+	ckd_free(jobs.lines);
 
 	ch /= (nwords - nccs - noovs);
 	printf("cross-entropy: %f bits\n", ch);
@@ -239,9 +320,11 @@ evaluate_file(ngram_model_t *lm, logmath_t *lmath, const char *lsnfn)
 	printf("%d words evaluated\n", nwords);
 	printf("%d OOVs (%.2f%%), %d context cues removed\n",
 	       noovs, (double)noovs / nwords * 100, nccs);
+
+	return pow(2.0, ch);
 }
 
-static void
+static float64
 evaluate_string(ngram_model_t *lm, logmath_t *lmath, const char *text)
 {
 	char *textfoo;
@@ -253,12 +336,14 @@ evaluate_string(ngram_model_t *lm, logmath_t *lmath, const char *text)
 	n = str2words(textfoo, NULL, 0);
 	if (n < 0)
 		E_FATAL("str2words(textfoo, NULL, 0) = %d, should not happen\n", n);
-	if (n == 0) /* Do nothing! */
-		return;
+	if (n == 0) { /* Do nothing! */
+		ckd_free(textfoo);
+		return 0.0;
+	}
 	words = ckd_calloc(n, sizeof(*words));
 	str2words(textfoo, words, n);
 
-	ch = calc_entropy(lm, words, n, &nccs, &noovs, &lscr);
+	ch = calc_entropy(lm, NULL, words, n, &nccs, &noovs, &lscr);
 
 	printf("input: %s\n", text);
 	printf("cross-entropy: %f bits\n",
@@ -275,15 +360,36 @@ evaluate_string(ngram_model_t *lm, logmath_t *lmath, const char *text)
 
 	ckd_free(textfoo);
 	ckd_free(words);
+
+	return logmath_exp(lmath, ch);
+}
+
+static ngram_model_t *
+load_lm(cmd_ln_t *config, const char *lmfn, logmath_t *lmath)
+{
+	ngram_model_t *lm;
+	const char *probdefn;
+
+	if ((lm = ngram_model_read(config, lmfn,
+				   NGRAM_AUTO, lmath)) == NULL) {
+		E_FATAL("Failed to load language model from %s\n", lmfn);
+	}
+        if ((probdefn = cmd_ln_str_r(config, "-probdef")) != NULL)
+            ngram_model_read_classdef(lm, probdefn);
+        ngram_model_apply_weights(lm,
+                                  cmd_ln_float32_r(config, "-lw"),
+                                  cmd_ln_float32_r(config, "-wip"));
+	return lm;
 }
 
 int
 main(int argc, char *argv[])
 {
 	cmd_ln_t *config;
-	ngram_model_t *lm = NULL;
+	ngram_model_t *lm = NULL, *reflm = NULL;
 	logmath_t *lmath;
-	const char *lmfn, *probdefn, *lsnfn, *text;
+	const char *lmfn, *reflmfn, *lsnfn, *text;
+	float64 pplx = 0.0, refpplx = 0.0;
 
 	if ((config = cmd_ln_parse_r(NULL, defn, argc, argv, TRUE)) == NULL)
 		return 1;
@@ -296,29 +402,41 @@ main(int argc, char *argv[])
 		E_FATAL("Failed to initialize log math\n");
 	}
 
-	/* Load the language model. */
-	lmfn = cmd_ln_str_r(config, "-lm");
-	if (lmfn == NULL
-	    || (lm = ngram_model_read(config, lmfn,
-				      NGRAM_AUTO, lmath)) == NULL) {
-		E_FATAL("Failed to load language model from %s\n",
-			cmd_ln_str_r(config, "-lm"));
-	}
-        if ((probdefn = cmd_ln_str_r(config, "-probdef")) != NULL)
-            ngram_model_read_classdef(lm, probdefn);
-        ngram_model_apply_weights(lm,
-                                  cmd_ln_float32_r(config, "-lw"),
-                                  cmd_ln_float32_r(config, "-wip"));
+	/* Load the language models. */
+	if ((lmfn = cmd_ln_str_r(config, "-lm")) == NULL)
+		E_FATAL("No language model given with -lm\n");
+	lm = load_lm(config, lmfn, lmath);
+	if ((reflmfn = cmd_ln_str_r(config, "-reflm")) != NULL)
+		reflm = load_lm(config, reflmfn, lmath);
 
 	/* Now evaluate some text. */
 	lsnfn = cmd_ln_str_r(config, "-lsn");
 	text = cmd_ln_str_r(config, "-text");
 	if (lsnfn) {
-		evaluate_file(lm, lmath, lsnfn);
+		if (reflm) {
+			printf("reference model %s:\n", reflmfn);
+			refpplx = evaluate_file(reflm, lmath, lsnfn,
+						cmd_ln_int32_r(config, "-nthreads"));
+			printf("model %s:\n", lmfn);
+		}
+		pplx = evaluate_file(lm, lmath, lsnfn,
+				     cmd_ln_int32_r(config, "-nthreads"));
 	}
 	else if (text) {
-		evaluate_string(lm, lmath, text);
+		if (reflm) {
+			printf("reference model %s:\n", reflmfn);
+			refpplx = evaluate_string(reflm, lmath, text);
+			printf("model %s:\n", lmfn);
+		}
+		pplx = evaluate_string(lm, lmath, text);
+	}
+	/* Report the change from the reference model. */
+	if (reflm && (lsnfn || text) && refpplx > 0.0) {
+		printf("perplexity delta: %+f (%+.3f%%)\n",
+		       pplx - refpplx, (pplx - refpplx) / refpplx * 100);
 	}
+	ngram_model_free(reflm);
+	ngram_model_free(lm);
 
 	return 0;
 }
@@ -0,0 +1,42 @@
+#!/bin/sh
+. ./testfuncs.sh
+
+tmpout="test-sphinx_fe-threads.out"
+
+echo "WAVE2FEAT THREADS TEST"
+# Dither is reseeded for each file, so the output should not depend
+# on which thread converted it or what it converted before.
+for nthreads in 1 3; do
+    run_program sphinx_fe/sphinx_fe \
+	-samprate 11025 \
+	-frate 105 \
+	-wlen 0.024 \
+	-alpha 0.97 \
+	-ncep 13 \
+	-nfft 512 \
+	-nfilt 36 \
+	-upperf 5400 \
+	-lowerf 130 \
+	-dither yes \
+	-seed 1234 \
+	-nthreads $nthreads \
+	-c $tests/regression/chan3.ctl \
+	-di $tests/regression \
+	-do threads$nthreads \
+	-eo mfc \
+	-input_endian little \
+	>> $tmpout 2>&1
+done
+
+for f in chan3.raw chan3.wav chan3.sph; do
+    if ! cmp threads1/$f.mfc threads3/$f.mfc; then
+	fail "$f single and multi-threaded compare"
+    fi
+done
+if ! cmp threads3/chan3.raw.mfc threads3/chan3.wav.mfc; then
+    fail "WAV and RAW compare"
+fi
+if ! cmp threads3/chan3.raw.mfc threads3/chan3.sph.mfc; then
+    fail "SPH and RAW compare"
+fi
+rm -rf threads1 threads3
@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "fe.h"
+#include "cmd_ln.h"
+#include "ckd_alloc.h"
+#include "profile.h"
+#include "err.h"
+
+#include "fe_internal.h"
+#include "test_macros.h"
+
+/*
+ * FFT and front-end benchmark.  This is not run by "make check",
+ * build it with "make bench_fe" and run it by hand.  For chan3.raw at
+ * several FFT sizes, it reports the time per transform for
+ * fe_fft_real() and for the radix-2 FFT it replaced, after checking
+ * that they agree, then the time per frame for the whole front end,
+ * both one frame at a time and in blocks.
+ */
+
+#define N_ITER 50
+#define FFT_TOLERANCE 1e-6
+
+#ifdef FIXED_POINT
+#define FLOAT2COS(x) FLOAT2FIX_ANY(x,30)
+#define COSMUL(x,y) FIXMUL_ANY(x,y,30)
+#else
+#define FLOAT2COS(x) (x)
+#define COSMUL(x,y) ((x)*(y))
+#endif
+
+/* The FFT as it was before fe_create_twiddle() built per-stage
+ * tables, with ccc and sss holding W[0] to W[n/4 - 1]. */
+static void
+ref_fft_real(frame_t *x, int m, int n, frame_t const *ccc,
+             frame_t const *sss)
+{
+    int i, j, k;
+    frame_t xt;
+
+    /* Bit-reverse the input. */
+    j = 0;
+    for (i = 0; i < n - 1; ++i) {
+        if (i < j) {
+            xt = x[j];
+            x[j] = x[i];
+            x[i] = xt;
+        }
+        k = n / 2;
+        while (k <= j) {
+            j -= k;
+            k /= 2;
+        }
+        j += k;
+    }
+
+    /* Basic butterflies (2-point FFT, real twiddle factors). */
+    for (i = 0; i < n; i += 2) {
+        xt = x[i];
+        x[i] = (xt + x[i + 1]);
+        x[i + 1] = (xt - x[i + 1]);
+    }
+
+    /* The rest of the butterflies, in stages from 1..m */
+    for (k = 1; k < m; ++k) {
+        int n1, n2, n4;
+
+        n4 = k - 1;
+        n2 = k;
+        n1 = k + 1;
+        for (i = 0; i < n; i += (1 << n1)) {
+            xt = x[i];
+            x[i] = (xt + x[i + (1 << n2)]);
+            x[i + (1 << n2)] = (xt - x[i + (1 << n2)]);
+            x[i + (1 << n2) + (1 << n4)] = -x[i + (1 << n2) + (1 << n4)];
+            for (j = 1; j < (1 << n4); ++j) {
+                frame_t cc, ss, t1, t2;
+                int i1, i2, i3, i4;
+
+                i1 = i + j;
+                i2 = i + (1 << n2) - j;
+                i3 = i + (1 << n2) + j;
+                i4 = i + (1 << n2) + (1 << n2) - j;
+                cc = ccc[j << (m - n1)];
+                ss = sss[j << (m - n1)];
+                t1 = COSMUL(x[i3], cc) + COSMUL(x[i4], ss);
+                t2 = COSMUL(x[i3], ss) - COSMUL(x[i4], cc);
+                x[i4] = (x[i2] - t2);
+                x[i3] = (-x[i2] - t2);
+                x[i2] = (x[i1] - t1);
+                x[i1] = (x[i1] + t1);
+            }
+        }
+    }
+}
+
+static void
+load_frame(frame_t *x, int16 const *buf, int n)
+{
+    int i;
+
+    for (i = 0; i < n; ++i)
+        x[i] = buf[i];
+}
+
+static void
+check_fft(fe_t *fe, int16 const *buf, size_t nsamp,
+          frame_t const *ccc, frame_t const *sss)
+{
+    frame_t *ref;
+    int n = fe->fft_size;
+    size_t start;
+
+    ref = ckd_calloc(n, sizeof(*ref));
+    for (start = 0; start + n <= nsamp; start += n) {
+        float64 peak;
+        int i;
+
+        load_frame(fe->frame, buf + start, n);
+        load_frame(ref, buf + start, n);
+        fe_fft_real(fe);
+        ref_fft_real(ref, fe->fft_order, n, ccc, sss);
+        peak = 0;
+        for (i = 0; i < n; ++i)
+            if (fabs((float64) ref[i]) > peak)
+                peak = fabs((float64) ref[i]);
+        for (i = 0; i < n; ++i)
+            TEST_ASSERT(fabs((float64) fe->frame[i] - (float64) ref[i])
+                        <= FFT_TOLERANCE * (peak + 1));
+    }
+    ckd_free(ref);
+}
+
+static float64
+bench_fft(fe_t *fe, int16 const *buf, size_t nsamp,
+          frame_t const *ccc, frame_t const *sss)
+{
+    ptmr_t tmr;
+    int n = fe->fft_size;
+    int32 nfft;
+    size_t start;
+    int i;
+
+    ptmr_init(&tmr);
+    ptmr_start(&tmr);
+    nfft = 0;
+    for (i = 0; i < N_ITER; ++i) {
+        for (start = 0; start + n <= nsamp; start += n) {
+            load_frame(fe->frame, buf + start, n);
+            if (ccc)
+                ref_fft_real(fe->frame, fe->fft_order, n, ccc, sss);
+            else
+                fe_fft_real(fe);
+            ++nfft;
+        }
+    }
+    ptmr_stop(&tmr);
+
+    return nfft ? tmr.t_cpu * 1e6 / nfft : 0.0;
+}
+
+typedef int (*process_frames_f)(fe_t *fe, int16 const **inout_spch,
+                                size_t *inout_nsamps, mfcc_t **buf_cep,
+                                int32 *inout_nframes, int32 *out_frameidx);
+
+static float64
+bench_process(fe_t *fe, process_frames_f process,
+              int16 const *buf, size_t nsamp, mfcc_t **cep, int32 maxfr)
+{
+    ptmr_t tmr;
+    int32 nfr, total_fr;
+    int i;
+
+    ptmr_init(&tmr);
+    ptmr_start(&tmr);
+    total_fr = 0;
+    for (i = 0; i < N_ITER; ++i) {
+        int16 const *inptr = buf;
+        size_t nleft = nsamp;
+
+        fe_start_utt(fe);
+        nfr = maxfr;
+        TEST_ASSERT((*process)(fe, &inptr, &nleft, cep, &nfr, NULL) >= 0);
+        total_fr += nfr;
+        TEST_ASSERT(fe_end_utt(fe, cep[0], &nfr) >= 0);
+    }
+    ptmr_stop(&tmr);
+
+    return total_fr ? tmr.t_cpu * 1e6 / total_fr : 0.0;
+}
+
+static void
+bench_nfft(int16 const *buf, size_t nsamp, char const *nfft,
+           char const *samprate, char const *upperf)
+{
+    static const arg_t fe_args[] = {
+        waveform_to_cepstral_command_line_macro(),
+        { NULL, 0, NULL, NULL }
+    };
+    cmd_ln_t *config;
+    fe_t *fe;
+    mfcc_t **cep;
+    frame_t *ccc, *sss;
+    int32 maxfr;
+    int i;
+
+    TEST_ASSERT(config = cmd_ln_init(NULL, fe_args, TRUE,
+                                     "-nfft", nfft,
+                                     "-samprate", samprate,
+                                     "-upperf", upperf,
+                                     "-remove_noise", "no",
+                                     NULL));
+    TEST_ASSERT(fe = fe_init_auto_r(config));
+
+    ccc = ckd_calloc(fe->fft_size / 4, sizeof(*ccc));
+    sss = ckd_calloc(fe->fft_size / 4, sizeof(*sss));
+    for (i = 0; i < fe->fft_size / 4; ++i) {
+        float64 a = 2 * M_PI * i / fe->fft_size;
+        ccc[i] = FLOAT2COS(cos(a));
+        sss[i] = FLOAT2COS(sin(a));
+    }
+    check_fft(fe, buf, nsamp, ccc, sss);
+    printf("nfft %5s: %.3f usec/FFT, %.3f usec/FFT radix-2\n", nfft,
+           bench_fft(fe, buf, nsamp, NULL, NULL),
+           bench_fft(fe, buf, nsamp, ccc, sss));
+    ckd_free(ccc);
+    ckd_free(sss);
+
+    maxfr = nsamp / 80 + 1;
+    cep = ckd_calloc_2d(maxfr, fe_get_output_size(fe), sizeof(**cep));
+
+    printf("nfft %5s: %.3f usec/frame, %.3f usec/frame batched\n", nfft,
+           bench_process(fe, fe_process_frames, buf, nsamp, cep, maxfr),
+           bench_process(fe, fe_process_frames_batch, buf, nsamp, cep, maxfr));
+
+    ckd_free_2d(cep);
+    fe_free(fe);
+    cmd_ln_free_r(config);
+}
+
+int
+main(int argc, char *argv[])
+{
+    FILE *raw;
+    int16 *buf;
+    size_t nsamp;
+
+    err_set_logfp(NULL);
+    TEST_ASSERT(raw = fopen(TESTDATADIR "/chan3.raw", "rb"));
+    fseek(raw, 0, SEEK_END);
+    nsamp = ftell(raw) / 2;
+    buf = ckd_calloc(nsamp, 2);
+    fseek(raw, 0, SEEK_SET);
+    TEST_EQUAL(nsamp, fread(buf, 2, nsamp, raw));
+    fclose(raw);
+
+    bench_nfft(buf, nsamp, "256", "8000", "3500");
+    bench_nfft(buf, nsamp, "512", "16000", "6800");
+    bench_nfft(buf, nsamp, "1024", "16000", "6800");
+
+    ckd_free(buf);
+    return 0;
+}
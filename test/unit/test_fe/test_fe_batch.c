@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fe.h"
+#include "cmd_ln.h"
+#include "ckd_alloc.h"
+
+#include "test_macros.h"
+
+typedef int (*process_frames_f)(fe_t *fe, int16 const **inout_spch,
+                                size_t *inout_nsamps, mfcc_t **buf_cep,
+                                int32 *inout_nframes, int32 *out_frameidx);
+
+/* Process the whole buffer in chunks of chunk_nsamps samples with at
+ * most chunk_nfr output frames per call. */
+static int32
+process_all(fe_t *fe, process_frames_f process, int16 const *buf,
+            size_t nsamp, size_t chunk_nsamps, int32 chunk_nfr,
+            mfcc_t **cep, int32 *frameidx)
+{
+    int16 const *inptr;
+    int32 nfr, total, idx;
+
+    fe_start_stream(fe);
+    fe_start_utt(fe);
+    inptr = buf;
+    total = 0;
+    while (inptr < buf + nsamp) {
+        size_t nchunk = chunk_nsamps;
+        if (nchunk > (size_t)(buf + nsamp - inptr))
+            nchunk = buf + nsamp - inptr;
+        while (nchunk > 0) {
+            nfr = chunk_nfr;
+            idx = -1;
+            TEST_ASSERT((*process)(fe, &inptr, &nchunk, cep + total,
+                                   &nfr, &idx) >= 0);
+            if (nfr)
+                frameidx[total] = idx;
+            total += nfr;
+        }
+    }
+    TEST_ASSERT(fe_end_utt(fe, cep[total], &nfr) >= 0);
+    return total + nfr;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const arg_t fe_args[] = {
+        waveform_to_cepstral_command_line_macro(),
+        { NULL, 0, NULL, NULL }
+    };
+    static const char *chunks[][2] = {
+        /* nsamps, nframes */
+        { "2048", "10" },
+        { "2048", "3" },
+        { "100000", "1" },
+        { "1000000", "1000" }
+    };
+    cmd_ln_t *config;
+    fe_t *fe;
+    FILE *raw;
+    int16 *buf;
+    size_t nsamp;
+    mfcc_t **cep1, **cep2;
+    int32 *idx1, *idx2;
+    int32 maxfr, nfr1, nfr2, i, j;
+
+    TEST_ASSERT(raw = fopen(TESTDATADIR "/chan3.raw", "rb"));
+    fseek(raw, 0, SEEK_END);
+    nsamp = ftell(raw) / 2;
+    buf = ckd_calloc(nsamp, 2);
+    fseek(raw, 0, SEEK_SET);
+    TEST_EQUAL(nsamp, fread(buf, 2, nsamp, raw));
+    fclose(raw);
+
+    TEST_ASSERT(config = cmd_ln_init(NULL, fe_args, TRUE,
+                                     "-samprate", "11025",
+                                     "-upperf", "5000",
+                                     "-remove_silence", "yes",
+                                     NULL));
+    TEST_ASSERT(fe = fe_init_auto_r(config));
+
+    maxfr = nsamp / 100 + 1;
+    cep1 = ckd_calloc_2d(maxfr, fe_get_output_size(fe), sizeof(**cep1));
+    cep2 = ckd_calloc_2d(maxfr, fe_get_output_size(fe), sizeof(**cep2));
+    idx1 = ckd_calloc(maxfr, sizeof(*idx1));
+    idx2 = ckd_calloc(maxfr, sizeof(*idx2));
+
+    for (i = 0; i < (int32)(sizeof(chunks) / sizeof(chunks[0])); ++i) {
+        size_t chunk_nsamps = atoi(chunks[i][0]);
+        int32 chunk_nfr = atoi(chunks[i][1]);
+
+        memset(idx1, 0, maxfr * sizeof(*idx1));
+        memset(idx2, 0, maxfr * sizeof(*idx2));
+        nfr1 = process_all(fe, fe_process_frames, buf, nsamp,
+                           chunk_nsamps, chunk_nfr, cep1, idx1);
+        nfr2 = process_all(fe, fe_process_frames_batch, buf, nsamp,
+                           chunk_nsamps, chunk_nfr, cep2, idx2);
+        printf("chunk %s/%s: %d frames, %d frames batched\n",
+               chunks[i][0], chunks[i][1], nfr1, nfr2);
+        TEST_ASSERT(nfr1 > 0);
+        TEST_EQUAL(nfr1, nfr2);
+        for (j = 0; j < nfr1; ++j) {
+            TEST_EQUAL(idx1[j], idx2[j]);
+            TEST_EQUAL(0, memcmp(cep1[j], cep2[j],
+                                 fe_get_output_size(fe) * sizeof(**cep1)));
+        }
+    }
+
+    ckd_free_2d(cep1);
+    ckd_free_2d(cep2);
+    ckd_free(idx1);
+    ckd_free(idx2);
+    ckd_free(buf);
+    fe_free(fe);
+    cmd_ln_free_r(config);
+
+    return 0;
+}
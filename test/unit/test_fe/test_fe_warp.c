@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "fe.h"
+#include "cmd_ln.h"
+#include "ckd_alloc.h"
+
+#include "test_macros.h"
+
+/* Compute features for the whole buffer with the given warping
+ * parameters (or none). */
+static int32
+warped_features(int16 const *buf, size_t nsamp, char const *warp_type,
+                char const *warp_params, mfcc_t **cep, int32 maxfr)
+{
+    static const arg_t fe_args[] = {
+        waveform_to_cepstral_command_line_macro(),
+        { NULL, 0, NULL, NULL }
+    };
+    cmd_ln_t *config;
+    fe_t *fe;
+    int32 nfr, nlast;
+
+    TEST_ASSERT(config = cmd_ln_init(NULL, fe_args, TRUE,
+                                     "-samprate", "11025",
+                                     "-upperf", "5000",
+                                     "-warp_type", warp_type,
+                                     "-remove_silence", "no",
+                                     NULL));
+    if (warp_params)
+        cmd_ln_set_str_r(config, "-warp_params", warp_params);
+    TEST_ASSERT(fe = fe_init_auto_r(config));
+    TEST_ASSERT(fe_start_utt(fe) >= 0);
+    nfr = maxfr;
+    TEST_ASSERT(fe_process_frames(fe, &buf, &nsamp, cep, &nfr, NULL) >= 0);
+    TEST_ASSERT(fe_end_utt(fe, cep[nfr], &nlast) >= 0);
+    nfr += nlast;
+    fe_free(fe);
+    cmd_ln_free_r(config);
+    return nfr;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const char *warps[][2] = {
+        { "inverse_linear", "0.9" },
+        { "affine", "1.1 20" },
+        { "piecewise_linear", "0.95 4000" }
+    };
+    FILE *raw;
+    int16 *buf;
+    size_t nsamp;
+    mfcc_t **cep;
+    mfcc_t *warped, *plain;
+    int32 maxfr, nfr, ncep, i;
+
+    TEST_ASSERT(raw = fopen(TESTDATADIR "/chan3.raw", "rb"));
+    fseek(raw, 0, SEEK_END);
+    nsamp = ftell(raw) / 2;
+    buf = ckd_calloc(nsamp, 2);
+    fseek(raw, 0, SEEK_SET);
+    TEST_EQUAL(nsamp, fread(buf, 2, nsamp, raw));
+    fclose(raw);
+
+    maxfr = nsamp / 100 + 2;
+    ncep = 13;
+    cep = ckd_calloc_2d(maxfr, ncep, sizeof(**cep));
+    warped = ckd_calloc(maxfr * ncep, sizeof(*warped));
+    plain = ckd_calloc(maxfr * ncep, sizeof(*plain));
+
+    for (i = 0; i < (int32)(sizeof(warps) / sizeof(warps[0])); ++i) {
+        printf("%s %s\n", warps[i][0], warps[i][1]);
+        /* Warped, then unwarped, then warped again with the same
+         * parameters: each front end must see only its own warp. */
+        nfr = warped_features(buf, nsamp, warps[i][0], warps[i][1],
+                              cep, maxfr);
+        memcpy(warped, cep[0], nfr * ncep * sizeof(*warped));
+        TEST_EQUAL(nfr, warped_features(buf, nsamp, warps[i][0], NULL,
+                                        cep, maxfr));
+        memcpy(plain, cep[0], nfr * ncep * sizeof(*plain));
+        TEST_ASSERT(memcmp(warped, plain, nfr * ncep * sizeof(*plain)) != 0);
+        TEST_EQUAL(nfr, warped_features(buf, nsamp, warps[i][0], warps[i][1],
+                                        cep, maxfr));
+        TEST_EQUAL(0, memcmp(warped, cep[0], nfr * ncep * sizeof(*warped)));
+    }
+
+    ckd_free_2d(cep);
+    ckd_free(warped);
+    ckd_free(plain);
+    ckd_free(buf);
+
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <fsg_model.h>
+#include <genrand.h>
+#include <profile.h>
+#include <err.h>
+
+#include "test_macros.h"
+
+/*
+ * FSG loading benchmark.  This is not run by "make check", build it
+ * with "make bench_fsg" and run it by hand.  It writes a large random
+ * grammar to a temporary file and reports the time taken to read it
+ * (including the null transition closure) and to look up every
+ * transition in it again.
+ */
+
+#define N_STATE 5000
+#define N_TRANS 40
+#define N_WORD 1000
+#define N_ITER 5
+
+static FILE *
+make_fsg(void)
+{
+    FILE *fp;
+    int i, j;
+
+    TEST_ASSERT(fp = tmpfile());
+    fprintf(fp, "FSG_BEGIN bench\nNUM_STATES %d\n"
+            "START_STATE 0\nFINAL_STATE %d\n", N_STATE, N_STATE - 1);
+    genrand_seed(42);
+    for (i = 0; i < N_STATE; ++i) {
+        for (j = 0; j < N_TRANS; ++j)
+            fprintf(fp, "TRANSITION %d %d 0.025 w%d\n", i,
+                    (int)(genrand_int31() % N_STATE),
+                    (int)(genrand_int31() % N_WORD));
+        /* Sparse null transitions, so the closure stays small. */
+        if (i % 50 < 5 && i + 1 < N_STATE)
+            fprintf(fp, "TRANSITION %d %d 0.5\n", i, i + 1);
+    }
+    fprintf(fp, "FSG_END\n");
+    rewind(fp);
+    return fp;
+}
+
+int
+main(int argc, char *argv[])
+{
+    logmath_t *lmath;
+    fsg_model_t *fsg;
+    ptmr_t tmr_read, tmr_lookup;
+    FILE *fp;
+    int32 nfound;
+    int i, j, k;
+
+    err_set_logfp(NULL);
+    lmath = logmath_init(1.0001, 0, 0);
+    fp = make_fsg();
+
+    ptmr_init(&tmr_read);
+    ptmr_init(&tmr_lookup);
+    nfound = 0;
+    for (k = 0; k < N_ITER; ++k) {
+        rewind(fp);
+        ptmr_start(&tmr_read);
+        TEST_ASSERT(fsg = fsg_model_read(fp, lmath, 7.5));
+        ptmr_stop(&tmr_read);
+
+        ptmr_start(&tmr_lookup);
+        for (i = 0; i < N_STATE; ++i)
+            for (j = 0; j < N_STATE; ++j)
+                if (fsg_model_trans(fsg, i, j))
+                    ++nfound;
+        ptmr_stop(&tmr_lookup);
+        fsg_model_free(fsg);
+    }
+    fclose(fp);
+
+    printf("read %d states, %d transitions: %.3f sec\n",
+           N_STATE, N_STATE * N_TRANS, tmr_read.t_cpu / N_ITER);
+    printf("%d lookups (%d found): %.3f sec\n", N_STATE * N_STATE,
+           nfound / N_ITER, tmr_lookup.t_cpu / N_ITER);
+
+    logmath_free(lmath);
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include <jsgf.h>
 #include <fsg_model.h>
+#include <stdio.h>
 #include <string.h>
 
 #include "test_macros.h"
@@ -49,6 +50,27 @@ main(int argc, char *argv[])
 	fsg_model_free(fsg);
 	jsgf_grammar_free(jsgf);
 
+	/* Test importing enough rules to grow the rule table. */
+	jsgf = jsgf_parse_file(LMDIR "/importall.gram", NULL);
+	TEST_ASSERT(jsgf);
+	{
+		char name[32];
+		int i;
+
+		for (i = 0; i < 61; ++i) {
+			sprintf(name, "main.r%d", i);
+			TEST_ASSERT(jsgf_get_rule(jsgf, name));
+		}
+	}
+	rule = jsgf_get_rule(jsgf, "main.all");
+	TEST_ASSERT(rule);
+	fsg = jsgf_build_fsg(jsgf, rule, lmath, 1.0);
+	TEST_ASSERT(fsg);
+	TEST_ASSERT(fsg_model_word_id(fsg, "word0") >= 0);
+	TEST_ASSERT(fsg_model_word_id(fsg, "word60") >= 0);
+	fsg_model_free(fsg);
+	jsgf_grammar_free(jsgf);
+
 	logmath_free(lmath);
 
 	return 0;
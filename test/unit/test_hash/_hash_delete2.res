@@ -1,7 +1,9 @@
-Hash with chaining representation of the hash table
-|key:-bla|len:4|val=8|->NULL
-|key:-hmmdump|len:8|val=1|->|key:-outlatdir|len:10|val=3|->NULL
-|key:-svq4svq|len:8|val=2|->|key:-lminmemory|len:11|val=6|->NULL
-|key:-lm|len:3|val=4|->NULL
-|key:-beam|len:5|val=5|->NULL
+Hash with open addressing representation of the hash table
+14|key:-outlatdir|len:10|val=3|dist=0
+34|key:-bla|len:4|val=8|dist=0
+41|key:-beam|len:5|val=5|dist=0
+58|key:-hmmdump|len:8|val=1|dist=0
+80|key:-lminmemory|len:11|val=6|dist=0
+84|key:-svq4svq|len:8|val=2|dist=0
+117|key:-lm|len:3|val=4|dist=0
 The total number of keys =7
@@ -0,0 +1,106 @@
+/**
+ * @file test_hash_grow.c Test hash table growth and deletion
+ */
+
+#include "hash_table.h"
+#include "ckd_alloc.h"
+#include "test_macros.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N_KEYS 10000
+
+int
+main(int argc, char *argv[])
+{
+	hash_table_t *h;
+	hash_iter_t *itor;
+	char **keys;
+	int32 *ikeys;
+	char buf[32];
+	int32 i, n, val;
+
+	/* Start small, so that the table has to grow many times. */
+	TEST_ASSERT(h = hash_table_new(1, HASH_CASE_NO));
+	keys = ckd_calloc(N_KEYS, sizeof(*keys));
+	for (i = 0; i < N_KEYS; ++i) {
+		sprintf(buf, "word%d", i);
+		keys[i] = ckd_salloc(buf);
+		TEST_EQUAL(i, hash_table_enter_int32(h, keys[i], i));
+	}
+	TEST_EQUAL(N_KEYS, hash_table_inuse(h));
+	TEST_EQUAL(0, hash_table_size(h) & (hash_table_size(h) - 1));
+	TEST_ASSERT(hash_table_inuse(h) * 4 <= hash_table_size(h) * 3);
+
+	/* Every key can be found, in any case. */
+	for (i = 0; i < N_KEYS; ++i) {
+		sprintf(buf, "WORD%d", i);
+		TEST_EQUAL(0, hash_table_lookup_int32(h, buf, &val));
+		TEST_EQUAL(i, val);
+	}
+	TEST_EQUAL(-1, hash_table_lookup_int32(h, "word", &val));
+
+	/* Delete every other key, the rest must still be found. */
+	for (i = 0; i < N_KEYS; i += 2)
+		TEST_EQUAL(i, (int32)(long)hash_table_delete(h, keys[i]));
+	TEST_EQUAL(NULL, hash_table_delete(h, keys[0]));
+	TEST_EQUAL(N_KEYS / 2, hash_table_inuse(h));
+	for (i = 0; i < N_KEYS; ++i) {
+		if (i & 1) {
+			TEST_EQUAL(0, hash_table_lookup_int32(h, keys[i], &val));
+			TEST_EQUAL(i, val);
+		}
+		else {
+			TEST_EQUAL(-1, hash_table_lookup(h, keys[i], NULL));
+		}
+	}
+	n = 0;
+	for (itor = hash_table_iter(h); itor; itor = hash_table_iter_next(itor)) {
+		TEST_EQUAL(1, (int32)(long)hash_entry_val(itor->ent) & 1);
+		++n;
+	}
+	TEST_EQUAL(N_KEYS / 2, n);
+
+	/* Re-enter the deleted keys. */
+	for (i = 0; i < N_KEYS; i += 2)
+		TEST_EQUAL(i, hash_table_enter_int32(h, keys[i], i));
+	TEST_EQUAL(N_KEYS, hash_table_inuse(h));
+	hash_table_free(h);
+
+	/* Integer binary keys. */
+	TEST_ASSERT(h = hash_table_new(10, HASH_CASE_YES));
+	ikeys = ckd_calloc(N_KEYS, sizeof(*ikeys));
+	for (i = 0; i < N_KEYS; ++i) {
+		ikeys[i] = i * 1024;
+		TEST_EQUAL(i, hash_table_enter_bkey_int32(h, (char *)&ikeys[i],
+							  sizeof(ikeys[i]), i));
+	}
+	for (i = 0; i < N_KEYS; i += 3)
+		TEST_EQUAL(i, (int32)(long)hash_table_delete_bkey
+			   (h, (char *)&ikeys[i], sizeof(ikeys[i])));
+	for (i = 0; i < N_KEYS; ++i) {
+		int32 key = i * 1024;
+		if (i % 3) {
+			TEST_EQUAL(0, hash_table_lookup_bkey_int32
+				   (h, (char *)&key, sizeof(key), &val));
+			TEST_EQUAL(i, val);
+		}
+		else {
+			TEST_EQUAL(-1, hash_table_lookup_bkey_int32
+				   (h, (char *)&key, sizeof(key), &val));
+		}
+	}
+	hash_table_empty(h);
+	TEST_EQUAL(0, hash_table_inuse(h));
+	TEST_EQUAL(NULL, hash_table_iter(h));
+	hash_table_free(h);
+
+	for (i = 0; i < N_KEYS; ++i)
+		ckd_free(keys[i]);
+	ckd_free(keys);
+	ckd_free(ikeys);
+
+	return 0;
+}
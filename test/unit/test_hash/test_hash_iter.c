@@ -16,6 +16,7 @@ main(int argc, char *argv[])
 {
 	hash_table_t *h;
 	hash_iter_t *itor;
+	uint32 mods;
 	char *foo2 = ckd_salloc("foo");
 	char *foo3 = ckd_salloc("foo");
 
@@ -45,6 +46,20 @@ main(int argc, char *argv[])
 			TEST_EQUAL(itor->ent->val, (void*)0xbabababa);
 		}
 	}
+
+	/* Replacing values does not move entries, so it is allowed
+	 * during iteration, but inserting and deleting keys are not. */
+	mods = h->mods;
+	for (itor = hash_table_iter(h); itor; itor = hash_table_iter_next(itor))
+		hash_table_replace(h, itor->ent->key, NULL);
+	TEST_EQUAL(mods, h->mods);
+	TEST_EQUAL(NULL, hash_table_delete(h, "quux"));
+	TEST_ASSERT(h->mods != mods);
+	mods = h->mods;
+	hash_table_enter(h, "quux", NULL);
+	TEST_ASSERT(h->mods != mods);
+
+	hash_table_free(h);
 	ckd_free(foo2);
 	ckd_free(foo3);
 
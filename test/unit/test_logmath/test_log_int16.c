@@ -40,6 +40,25 @@ main(int argc, char *argv[])
 				   logmath_log(lmath, 42)),
 		       logmath_log(lmath, 42));
 
+	{
+		/* Adding an array gives the same as adding one by one. */
+		int vals[5];
+		vals[0] = logmath_get_zero(lmath);
+		vals[1] = logmath_log(lmath, 1e-3);
+		vals[2] = logmath_log(lmath, 5e-3);
+		vals[3] = logmath_log(lmath, 1e-48);
+		vals[4] = logmath_log(lmath, 42);
+		TEST_EQUAL(logmath_add_array(lmath, vals, 5),
+			   logmath_add(lmath,
+				       logmath_add(lmath,
+						   logmath_add(lmath, vals[1],
+							       vals[2]),
+						   vals[3]), vals[4]));
+		TEST_EQUAL(logmath_add_array(lmath, vals, 1), vals[0]);
+		TEST_EQUAL(logmath_add_array(lmath, vals, 0),
+			   logmath_get_zero(lmath));
+	}
+
 	rv = logmath_write(lmath, "tmp.logadd");
 	TEST_EQUAL(rv, 0);
 	logmath_free(lmath);
@@ -1,6 +1,7 @@
 #include <ngram_model.h>
 #include <logmath.h>
 #include <strfuncs.h>
+#include <cmd_ln.h>
 
 #include "test_macros.h"
 
@@ -45,6 +46,12 @@ test_lm_ug_vals(ngram_model_t *model)
 int
 main(int argc, char *argv[])
 {
+	static const arg_t args[] = {
+		{ "-mmap", ARG_BOOLEAN, "no", "Use memory-mapped I/O" },
+		{ "-nthreads", ARG_INT32, "1", "Threads for building the trie" },
+		{ NULL, 0, NULL, NULL }
+	};
+	cmd_ln_t *config;
 	logmath_t *lmath;
 	ngram_model_t *model;
 
@@ -87,6 +94,35 @@ main(int argc, char *argv[])
 	test_lm_vals(model);
 	TEST_EQUAL(0, ngram_model_free(model));
 
+	/* Read a memory-mapped language model */
+	config = cmd_ln_init(NULL, args, TRUE, "-mmap", "yes", NULL);
+	model = ngram_model_read(config, LMDIR "/100.lm.bin", NGRAM_BIN, lmath);
+	test_lm_vals(model);
+	/* Adding a word copies the unigrams out of the mapped file. */
+	TEST_ASSERT(ngram_model_add_word(model, "foobie", 1.0) != NGRAM_INVALID_WID);
+	TEST_ASSERT(ngram_score(model, "foobie", NULL) < 0);
+	test_lm_vals(model);
+	TEST_EQUAL(0, ngram_model_free(model));
+	cmd_ln_free_r(config);
+
+	/* Build the trie with several threads */
+	config = cmd_ln_init(NULL, args, TRUE, "-nthreads", "3", NULL);
+	model = ngram_model_read(config, LMDIR "/100.lm.bz2", NGRAM_ARPA, lmath);
+	test_lm_vals(model);
+	TEST_EQUAL(0, ngram_model_free(model));
+	model = ngram_model_read(config, LMDIR "/100.lm.dmp", NGRAM_BIN, lmath);
+	test_lm_vals(model);
+	TEST_EQUAL(0, ngram_model_free(model));
+	/* Bad lines are skipped and truncated files fail when parsing
+	 * in parallel too. */
+	model = ngram_model_read(config, LMDIR "/104.lm.gz", NGRAM_ARPA, lmath);
+	TEST_EQUAL(0, ngram_model_free(model));
+	model = ngram_model_read(config, LMDIR "/105.lm.gz", NGRAM_ARPA, lmath);
+	TEST_EQUAL(NULL, model);
+	model = ngram_model_read(config, LMDIR "/107.lm.gz", NGRAM_ARPA, lmath);
+	TEST_EQUAL(0, ngram_model_free(model));
+	cmd_ln_free_r(config);
+
 	/* Read a language model */
 	model = ngram_model_read(NULL, LMDIR "/100.lm.dmp", NGRAM_BIN, lmath);
 	test_lm_vals(model);
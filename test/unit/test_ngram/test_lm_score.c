@@ -1,6 +1,7 @@
 #include <ngram_model.h>
 #include <logmath.h>
 #include <strfuncs.h>
+#include <sbthread.h>
 
 #include "test_macros.h"
 
@@ -67,6 +68,265 @@ run_tests(ngram_model_t *model)
 	TEST_EQUAL(n_used, 3);
 }
 
+#define N_THREADS 4
+
+/* Word, history for each test trigram, and its score. */
+static int32 test_wids[4][3];
+static int32 test_scores[4];
+
+/* A thread scoring the test trigrams with its own history cache. */
+typedef struct scorer_s {
+	ngram_model_t *model;
+	ngram_hist_cache_t *cache;
+} scorer_t;
+
+static int
+score_thread(sbthread_t *th)
+{
+	scorer_t *scorer = sbthread_arg(th);
+	ngram_model_t *model = scorer->model;
+	ngram_hist_cache_t *cache = scorer->cache;
+	int i, j, errors = 0;
+
+	for (i = 0; i < 1000; ++i) {
+		for (j = 0; j < 4; ++j) {
+			int32 hist[2], n_used;
+			hist[0] = test_wids[j][1];
+			hist[1] = test_wids[j][2];
+			if (ngram_ng_score_r(model, cache, test_wids[j][0],
+					     hist, 2, &n_used) != test_scores[j])
+				++errors;
+		}
+	}
+	return errors;
+}
+
+static void
+run_scorers(ngram_model_t *model, ngram_hist_cache_t **caches)
+{
+	sbthread_t *threads[N_THREADS];
+	scorer_t scorers[N_THREADS];
+	int i;
+
+	for (i = 0; i < N_THREADS; ++i) {
+		scorers[i].model = model;
+		scorers[i].cache = caches[i] = ngram_hist_cache_init();
+		threads[i] = sbthread_start(NULL, score_thread, &scorers[i]);
+	}
+	for (i = 0; i < N_THREADS; ++i) {
+		TEST_EQUAL(0, sbthread_wait(threads[i]));
+		sbthread_free(threads[i]);
+	}
+}
+
+void
+test_cache(ngram_model_t *model)
+{
+	static const char *words[][3] = {
+		{ "daines", "huggins", "david" },
+		{ "huggins", "david", "david" },
+		{ "david", "david", "david" },
+		{ "daines", "huggins", "huggins" }
+	};
+	ngram_hist_cache_t *cache1, *cache2, *caches[N_THREADS];
+	int32 n_used, hist[2];
+	int i, j;
+
+	for (i = 0; i < 4; ++i) {
+		for (j = 0; j < 3; ++j)
+			test_wids[i][j] = ngram_wid(model, words[i][j]);
+		hist[0] = test_wids[i][1];
+		hist[1] = test_wids[i][2];
+		test_scores[i] = ngram_ng_score(model, test_wids[i][0],
+						hist, 2, &n_used);
+	}
+
+	/* Interleaving histories between two caches gives the same
+	 * scores as the model's own cache. */
+	cache1 = ngram_hist_cache_init();
+	cache2 = ngram_hist_cache_init();
+	for (i = 0; i < 8; ++i) {
+		ngram_hist_cache_t *cache = (i & 1) ? cache1 : cache2;
+		hist[0] = test_wids[i % 4][1];
+		hist[1] = test_wids[i % 4][2];
+		TEST_EQUAL(test_scores[i % 4],
+			   ngram_ng_score_r(model, cache, test_wids[i % 4][0],
+					    hist, 2, &n_used));
+	}
+	ngram_hist_cache_free(cache1);
+	ngram_hist_cache_free(cache2);
+
+	/* Several threads can share one model. */
+	run_scorers(model, caches);
+	for (i = 0; i < N_THREADS; ++i)
+		ngram_hist_cache_free(caches[i]);
+}
+
+#define N_BATCH 500
+
+void
+test_batch(ngram_model_t *model)
+{
+	static int32 wids[N_BATCH], hists[N_BATCH][3], n_hists[N_BATCH];
+	static int32 *hist_ptrs[N_BATCH], scores[N_BATCH], n_used[N_BATCH];
+	int32 n_words, seed, i, j;
+
+	/* Mix of words and history lengths, including ones longer than
+	 * the model order, unknown history words and backoffs. */
+	n_words = ngram_model_get_counts(model)[0];
+	seed = 42;
+	for (i = 0; i < N_BATCH; ++i) {
+		seed = seed * 1103515245 + 12345;
+		wids[i] = ((uint32)seed >> 8) % n_words;
+		n_hists[i] = i % 4;
+		for (j = 0; j < 3; ++j) {
+			seed = seed * 1103515245 + 12345;
+			hists[i][j] = ((uint32)seed >> 8) % (n_words + 1);
+			if (hists[i][j] == n_words)
+				hists[i][j] = NGRAM_INVALID_WID;
+		}
+		hist_ptrs[i] = hists[i];
+	}
+	/* And some that are known to be in the model. */
+	wids[0] = ngram_wid(model, "daines");
+	hists[0][0] = ngram_wid(model, "huggins");
+	hists[0][1] = ngram_wid(model, "david");
+	n_hists[0] = 2;
+	wids[1] = ngram_wid(model, "huggins");
+	hists[1][0] = ngram_wid(model, "david");
+	n_hists[1] = 1;
+	wids[2] = NGRAM_INVALID_WID;
+
+	ngram_ng_score_batch(model, wids, hist_ptrs, n_hists, N_BATCH,
+			     scores, n_used);
+	TEST_EQUAL(n_used[0], 3);
+	TEST_EQUAL(n_used[1], 2);
+	for (i = 0; i < N_BATCH; ++i) {
+		int32 score, used = 0;
+		score = ngram_ng_score(model, wids[i], hists[i],
+				       n_hists[i], &used);
+		TEST_EQUAL(score, scores[i]);
+		TEST_EQUAL(used, n_used[i]);
+	}
+}
+
+void
+test_state(ngram_model_t *model)
+{
+	static const char *words[] = {
+		"<s>", "huggins", "daines", "huggins", "david", "david",
+		"blorglehurfle", "daines", "huggins", "david", "</s>"
+	};
+	ngram_state_t state, state2;
+	int32 hist[2], n_hist, n_words, seed, i;
+
+	/* Known sentence, with an unknown word in it. */
+	hist[0] = ngram_wid(model, words[0]);
+	n_hist = 1;
+	ngram_state_init(model, &state, hist, n_hist);
+	for (i = 1; i < sizeof(words) / sizeof(words[0]); ++i) {
+		int32 wid = ngram_wid(model, words[i]);
+		int32 n_used;
+		TEST_EQUAL(ngram_ng_score(model, wid, hist, n_hist, &n_used),
+			   ngram_score_state(model, &state, wid, &state));
+		if (wid == NGRAM_INVALID_WID) {
+			n_hist = 0;
+			TEST_EQUAL(0, state.n_hist);
+			continue;
+		}
+		hist[1] = hist[0];
+		hist[0] = wid;
+		if (n_hist < 2)
+			++n_hist;
+	}
+
+	/* Random word sequences. */
+	n_words = ngram_model_get_counts(model)[0];
+	seed = 42;
+	n_hist = 0;
+	ngram_state_init(model, &state, NULL, 0);
+	for (i = 0; i < 2000; ++i) {
+		int32 wid, n_used;
+		seed = seed * 1103515245 + 12345;
+		wid = ((uint32)seed >> 8) % n_words;
+		/* Sometimes repeat a known trigram. */
+		if (i % 7 == 0)
+			wid = ngram_wid(model, "daines");
+		else if (i % 7 == 1)
+			wid = ngram_wid(model, "huggins");
+		else if (i % 7 == 2)
+			wid = ngram_wid(model, "david");
+		TEST_EQUAL(ngram_ng_score(model, wid, hist, n_hist, &n_used),
+			   ngram_score_state(model, &state, wid, &state2));
+		hist[1] = hist[0];
+		hist[0] = wid;
+		if (n_hist < 2)
+			++n_hist;
+		/* Equal contexts give equal states. */
+		ngram_state_init(model, &state, hist, n_hist);
+		TEST_ASSERT(ngram_state_equal(&state, &state2));
+		state = state2;
+	}
+}
+
+void
+test_score_cache(ngram_model_t *model)
+{
+	ngram_hist_cache_t *caches[N_THREADS];
+	uint64 hits, misses;
+	int32 n_used, first_n_used[4], hist[2], score;
+	int i;
+
+	TEST_EQUAL(0, ngram_model_cache_init(model, 1000));
+	ngram_model_cache_stats(model, NULL, 0, &hits, &misses);
+	TEST_EQUAL(0, hits);
+	TEST_EQUAL(0, misses);
+
+	/* Second lookups come from the cache and give the same scores. */
+	for (i = 0; i < 8; ++i) {
+		hist[0] = test_wids[i % 4][1];
+		hist[1] = test_wids[i % 4][2];
+		TEST_EQUAL(test_scores[i % 4],
+			   ngram_ng_score(model, test_wids[i % 4][0],
+					  hist, 2, &n_used));
+		if (i < 4)
+			first_n_used[i] = n_used;
+		else
+			TEST_EQUAL(first_n_used[i % 4], n_used);
+	}
+	ngram_model_cache_stats(model, NULL, 0, &hits, &misses);
+	TEST_EQUAL(4, hits);
+	TEST_EQUAL(4, misses);
+
+	/* Changing the weights flushes it. */
+	ngram_model_apply_weights(model, 2.0, 1.0);
+	hist[0] = test_wids[0][1];
+	hist[1] = test_wids[0][2];
+	score = ngram_ng_score(model, test_wids[0][0], hist, 2, &n_used);
+	TEST_EQUAL(score, test_scores[0] * 2);
+	ngram_model_apply_weights(model, 1.0, 1.0);
+	TEST_EQUAL(test_scores[0],
+		   ngram_ng_score(model, test_wids[0][0], hist, 2, &n_used));
+	ngram_model_flush(model);
+	TEST_EQUAL(test_scores[0],
+		   ngram_ng_score(model, test_wids[0][0], hist, 2, &n_used));
+	ngram_model_cache_stats(model, NULL, 0, &hits, &misses);
+	TEST_EQUAL(4, hits);
+	TEST_EQUAL(7, misses);
+
+	/* Threads can share it, and count their own lookups. */
+	run_scorers(model, caches);
+	ngram_model_cache_stats(model, NULL, 0, &hits, &misses);
+	TEST_EQUAL(11, hits + misses);
+	ngram_model_cache_stats(model, caches, N_THREADS, &hits, &misses);
+	TEST_EQUAL(N_THREADS * 4000 + 11, hits + misses);
+	TEST_ASSERT(hits >= N_THREADS * 4000 - 4);
+	for (i = 0; i < N_THREADS; ++i)
+		ngram_hist_cache_free(caches[i]);
+
+	TEST_EQUAL(0, ngram_model_cache_init(model, 0));
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -77,10 +337,16 @@ main(int argc, char *argv[])
 
 	model = ngram_model_read(NULL, LMDIR "/100.lm.bin", NGRAM_BIN, lmath);
 	run_tests(model);
+	test_cache(model);
+	test_score_cache(model);
+	test_batch(model);
+	test_state(model);
 	ngram_model_free(model);
 
 	model = ngram_model_read(NULL, LMDIR "/100.lm.gz", NGRAM_ARPA, lmath);
 	run_tests(model);
+	test_batch(model);
+	test_state(model);
 	ngram_model_free(model);
 
 	logmath_free(lmath);
@@ -1,6 +1,7 @@
 #include <ngram_model.h>
 #include <logmath.h>
 #include <strfuncs.h>
+#include <cmd_ln.h>
 
 #include "test_macros.h"
 
@@ -9,6 +10,19 @@
 #include <string.h>
 #include <math.h>
 
+static long
+file_size(const char *path)
+{
+	FILE *fh;
+	long size;
+
+	TEST_ASSERT(fh = fopen(path, "rb"));
+	fseek(fh, 0, SEEK_END);
+	size = ftell(fh);
+	fclose(fh);
+	return size;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -90,6 +104,70 @@ main(int argc, char *argv[])
 				   + 0.4 * (2.0 / 3.0) * pow(10, -2.8192)));
 	ngram_model_free(lmset);
 
+	/* Test compiling an interpolated set into a single model. */
+	lms[0] = ngram_model_read(NULL, LMDIR "/100.lm.dmp", NGRAM_BIN, lmath);
+	lms[1] = ngram_model_read(NULL, LMDIR "/102.lm.dmp", NGRAM_BIN, lmath);
+	lmset = ngram_model_set_init(NULL, lms, (char **)names, weights, 2);
+	{
+		ngram_model_t *lm;
+
+		TEST_ASSERT(lm = ngram_model_set_compile(NULL, lmset));
+		TEST_EQUAL(ngram_model_get_size(lm), ngram_model_get_size(lmset));
+		TEST_EQUAL(ngram_score(lm, "sphinxtrain", NULL),
+			   ngram_score(lmset, "sphinxtrain", NULL));
+		TEST_EQUAL_LOG(ngram_score(lm, "huggins", "david", NULL),
+			       ngram_score(lmset, "huggins", "david", NULL));
+		TEST_EQUAL_LOG(ngram_score(lm, "daines", "huggins", "david", NULL),
+			       ngram_score(lmset, "daines", "huggins", "david", NULL));
+		/* Backed-off scores are close to the set's, and
+		 * recomputed backoff weights keep the total probability
+		 * of a context the same as the set's.  (That is not
+		 * quite one, since a word missing from one of the
+		 * models gets its unknown word probability.) */
+		TEST_EQUAL_LOG(ngram_score(lm, "david", "sphinxtrain", NULL),
+			       ngram_score(lmset, "david", "sphinxtrain", NULL));
+		{
+			double sum = 0.0, set_sum = 0.0;
+			int32 i, hist = ngram_wid(lm, "david");
+			int32 n_used;
+
+			for (i = 0; i < ngram_model_get_counts(lm)[0]; ++i) {
+				sum += logmath_exp(lmath,
+						   ngram_ng_prob(lm, i, &hist, 1, &n_used));
+				set_sum += logmath_exp(lmath,
+						       ngram_ng_prob(lmset, i, &hist, 1, &n_used));
+			}
+			printf("compiled sum = %f set sum = %f\n", sum, set_sum);
+			TEST_ASSERT(fabs(sum - set_sum) < 0.01);
+		}
+		TEST_EQUAL(0, ngram_model_write(lm, "mix.tmp.lm.bin", NGRAM_BIN));
+		ngram_model_free(lm);
+	}
+	/* The compiled model is quantized as the configuration says. */
+	{
+		static const arg_t args[] = {
+			{ "-probbits", ARG_STRING_LIST, NULL, "Bits per probability" },
+			{ "-bobits", ARG_STRING_LIST, NULL, "Bits per backoff weight" },
+			{ NULL, 0, NULL, NULL }
+		};
+		cmd_ln_t *config;
+		ngram_model_t *lm;
+
+		config = cmd_ln_init(NULL, args, TRUE,
+				     "-probbits", "8", "-bobits", "8", NULL);
+		TEST_ASSERT(lm = ngram_model_set_compile(config, lmset));
+		TEST_ASSERT(abs(ngram_score(lm, "huggins", "david", NULL)
+				- ngram_score(lmset, "huggins", "david", NULL)) < 500);
+		TEST_EQUAL(0, ngram_model_write(lm, "mix.tmp.lm.DMP", NGRAM_BIN));
+		ngram_model_free(lm);
+		cmd_ln_free_r(config);
+		TEST_ASSERT(file_size("mix.tmp.lm.DMP")
+			    < file_size("mix.tmp.lm.bin"));
+	}
+	ngram_model_free(lms[0]);
+	ngram_model_free(lms[1]);
+	ngram_model_free(lmset);
+
 	/* Test adding and removing language models with preserved
 	 * word ID mappings. */
 	lms[0] = ngram_model_read(NULL, LMDIR "/100.lm.dmp", NGRAM_BIN, lmath);
@@ -111,6 +189,17 @@ main(int argc, char *argv[])
 		TEST_EQUAL(lms[1], ngram_model_set_remove(lmset, "102", TRUE));
 		ngram_model_free(lms[1]);
 		TEST_EQUAL(wid, ngram_wid(lmset, "sphinxtrain"));
+		/* Remaining mappings are still right. */
+		ngram_model_set_select(lmset, "100");
+		TEST_EQUAL(ngram_wid(lms[0], "sphinxtrain"),
+			   ngram_model_set_current_wid(lmset, wid));
+		ngram_model_set_select(lmset, "turtle");
+		TEST_EQUAL(ngram_wid(lms[2], "sphinxtrain"),
+			   ngram_model_set_current_wid(lmset, wid));
+		TEST_EQUAL(ngram_wid(lms[2], "<s>"),
+			   ngram_model_set_current_wid(lmset,
+						       ngram_wid(lmset, "<s>")));
+		ngram_model_set_interp(lmset, NULL, NULL);
 		/* Now enable remapping of word IDs and verify that it works. */
 		TEST_EQUAL(lms[2], ngram_model_set_remove(lmset, "turtle", TRUE));
 		TEST_ASSERT(ngram_model_set_add(lmset, lms[2], "turtle", 1.0, FALSE));
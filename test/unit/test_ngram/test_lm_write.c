@@ -1,4 +1,5 @@
 #include <ngram_model.h>
+#include <cmd_ln.h>
 #include <logmath.h>
 #include <strfuncs.h>
 #include <err.h>
@@ -8,6 +9,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 static int
 test_lm_vals(ngram_model_t *model)
@@ -37,11 +39,75 @@ test_lm_vals(ngram_model_t *model)
 	return 0;
 }
 
+static int
+test_same_file(const char *a_path, const char *b_path)
+{
+	FILE *a, *b;
+	int ac, bc;
+
+	a = fopen(a_path, "rb");
+	b = fopen(b_path, "rb");
+	TEST_ASSERT(a && b);
+	do {
+		ac = fgetc(a);
+		bc = fgetc(b);
+		TEST_EQUAL(ac, bc);
+	} while (ac != EOF);
+	fclose(a);
+	fclose(b);
+	return 0;
+}
+
+/* Compare two ARPA files, allowing numbers to differ by tolerance. */
+static int
+test_same_arpa(const char *a_path, const char *b_path, double tolerance)
+{
+	FILE *a, *b;
+	char a_line[1024], b_line[1024];
+	char *a_words[8], *b_words[8];
+
+	a = fopen(a_path, "r");
+	b = fopen(b_path, "r");
+	TEST_ASSERT(a && b);
+	while (fgets(a_line, sizeof(a_line), a)) {
+		int i, n;
+
+		TEST_ASSERT(fgets(b_line, sizeof(b_line), b));
+		n = str2words(a_line, a_words, 8);
+		TEST_EQUAL(n, str2words(b_line, b_words, 8));
+		for (i = 0; i < n; ++i) {
+			char *a_end, *b_end;
+			double a_val = strtod(a_words[i], &a_end);
+			double b_val = strtod(b_words[i], &b_end);
+
+			if (*a_end == '\0' && *b_end == '\0'
+			    && a_end != a_words[i] && b_end != b_words[i]) {
+				TEST_ASSERT(fabs(a_val - b_val) <= tolerance);
+			}
+			else {
+				TEST_EQUAL(0, strcmp(a_words[i], b_words[i]));
+			}
+		}
+	}
+	TEST_ASSERT(fgets(b_line, sizeof(b_line), b) == NULL);
+	fclose(a);
+	fclose(b);
+	return 0;
+}
+
 int
 main(int argc, char *argv[])
 {
+	static const arg_t args[] = {
+		{ "-membudget", ARG_FLOAT32, "0", "Memory for N-Grams in MB" },
+		{ "-tmpdir", ARG_STRING, NULL, "Directory for temporary files" },
+		{ "-probbits", ARG_STRING_LIST, NULL, "Bits per probability" },
+		{ "-bobits", ARG_STRING_LIST, NULL, "Bits per backoff weight" },
+		{ NULL, 0, NULL, NULL }
+	};
 	logmath_t *lmath;
 	ngram_model_t *model;
+	cmd_ln_t *config;
 
 	/* Initialize a logmath object to pass to ngram_read */
 	lmath = logmath_init(1.0001, 0, 0);
@@ -85,6 +151,68 @@ main(int argc, char *argv[])
 	TEST_EQUAL(0, ngram_model_write(model, "turtle.ug.tmp.lm.bin", NGRAM_BIN));
 	ngram_model_free(model);
 
+	/* Small enough for two runs of bigrams and three of trigrams, big
+	 * enough to train the quantizer on all of them, so the result is
+	 * the same as converting in memory. */
+	E_INFO("Converting ARPA to BIN through temporary files\n");
+	config = cmd_ln_init(NULL, args, TRUE, "-membudget", "0.04", NULL);
+	TEST_EQUAL(0, ngram_model_convert_arpa_bin(config, LMDIR "/100.lm.bz2",
+						   "100.tmp.lm.bin", lmath));
+	model = ngram_model_read(NULL, LMDIR "/100.lm.bz2", NGRAM_ARPA, lmath);
+	TEST_EQUAL(0, ngram_model_write(model, "100.tmp.lm.DMP", NGRAM_BIN));
+	ngram_model_free(model);
+	test_same_file("100.tmp.lm.bin", "100.tmp.lm.DMP");
+	model = ngram_model_read(NULL, "100.tmp.lm.bin", NGRAM_BIN, lmath);
+	test_lm_vals(model);
+	ngram_model_free(model);
+
+	E_INFO("Converting unigram ARPA to BIN through temporary files\n");
+	TEST_EQUAL(0, ngram_model_convert_arpa_bin(config, LMDIR "/turtle.ug.lm",
+						   "turtle.ug.tmp.lm.bin", lmath));
+	model = ngram_model_read(NULL, LMDIR "/turtle.ug.lm", NGRAM_ARPA, lmath);
+	TEST_EQUAL(0, ngram_model_write(model, "turtle.ug.tmp.lm.DMP", NGRAM_BIN));
+	ngram_model_free(model);
+	test_same_file("turtle.ug.tmp.lm.bin", "turtle.ug.tmp.lm.DMP");
+	cmd_ln_free_r(config);
+
+	/* Small enough for many runs of each order, and to train the
+	 * quantizer on a sample, so the N-Grams are the same but the
+	 * weights are only as close as a hundred-odd samples allow. */
+	E_INFO("Converting ARPA to BIN through many temporary files\n");
+	config = cmd_ln_init(NULL, args, TRUE, "-membudget", "0.01", NULL);
+	TEST_EQUAL(0, ngram_model_convert_arpa_bin(config, LMDIR "/100.lm.bz2",
+						   "100.tmp.lm.bin", lmath));
+	cmd_ln_free_r(config);
+	model = ngram_model_read(NULL, "100.tmp.lm.bin", NGRAM_BIN, lmath);
+	test_lm_vals(model);
+	TEST_EQUAL(0, ngram_model_write(model, "100.tmp.spill.lm", NGRAM_ARPA));
+	ngram_model_free(model);
+	model = ngram_model_read(NULL, LMDIR "/100.lm.bz2", NGRAM_ARPA, lmath);
+	TEST_EQUAL(0, ngram_model_write(model, "100.tmp.lm", NGRAM_ARPA));
+	ngram_model_free(model);
+	test_same_arpa("100.tmp.lm", "100.tmp.spill.lm", 1.0);
+
+	E_INFO("Converting ARPA to BIN with fewer bits per weight\n");
+	config = cmd_ln_init(NULL, args, TRUE,
+			     "-probbits", "8,6", "-bobits", "4", NULL);
+	model = ngram_model_read(config, LMDIR "/100.lm.bz2", NGRAM_ARPA, lmath);
+	TEST_ASSERT(model);
+	TEST_EQUAL(0, ngram_model_write(model, "100.tmp.lm.DMP", NGRAM_BIN));
+	ngram_model_free(model);
+	model = ngram_model_read(NULL, "100.tmp.lm.DMP", NGRAM_BIN, lmath);
+	TEST_ASSERT(model);
+	/* Scores are close to those with 16 bits. */
+	TEST_ASSERT(abs(ngram_score(model, "huggins", "david", NULL)
+			- -831) < 100);
+	TEST_ASSERT(abs(ngram_score(model, "daines", "huggins", "david", NULL)
+			- -9450) < 100);
+	ngram_model_free(model);
+	cmd_ln_free_r(config);
+	config = cmd_ln_init(NULL, args, TRUE, "-probbits", "17", NULL);
+	TEST_EQUAL(NULL, ngram_model_read(config, LMDIR "/100.lm.bz2",
+					  NGRAM_ARPA, lmath));
+	cmd_ln_free_r(config);
+
 	logmath_free(lmath);
 	return 0;
 }
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sbthread.h>
+#include <ckd_alloc.h>
+#include <err.h>
+
+#include "test_macros.h"
+
+#define N_ITEMS 100000
+#define GRAIN 100
+
+typedef struct range_s {
+	sbpool_t *pool;
+	int *visits;
+	int grain;
+	int too_big;
+	int bad_worker;
+} range_t;
+
+static void
+visit_range(void *arg, int start, int end)
+{
+	range_t *r = arg;
+	int i, worker;
+
+	/* Only written by the thread owning these indices. */
+	for (i = start; i < end; ++i)
+		++r->visits[i];
+	if (end - start > r->grain && sbpool_nthreads(r->pool) > 1)
+		r->too_big = TRUE;
+	worker = sbpool_worker(r->pool);
+	if (worker < 0 || worker >= sbpool_nthreads(r->pool))
+		r->bad_worker = TRUE;
+}
+
+typedef struct fib_s {
+	sbpool_t *pool;
+	int n;
+	int result;
+} fib_t;
+
+/* Spawn tasks recursively and wait for them from inside tasks. */
+static void
+fib(void *arg)
+{
+	fib_t *f = arg;
+	fib_t a, b;
+	sbtaskgroup_t *g;
+
+	if (f->n < 2) {
+		f->result = f->n;
+		return;
+	}
+	a.pool = b.pool = f->pool;
+	a.n = f->n - 1;
+	b.n = f->n - 2;
+	g = sbtaskgroup_init(f->pool);
+	sbtaskgroup_run(g, fib, &a);
+	sbtaskgroup_run(g, fib, &b);
+	sbtaskgroup_wait(g);
+	sbtaskgroup_free(g);
+	f->result = a.result + b.result;
+}
+
+static void
+test_pool(sbpool_t *pool)
+{
+	range_t r;
+	fib_t f;
+	int i;
+
+	memset(&r, 0, sizeof(r));
+	r.pool = pool;
+	r.visits = ckd_calloc(N_ITEMS, sizeof(*r.visits));
+	r.grain = GRAIN;
+	sbpool_parallel_for(pool, 0, N_ITEMS, GRAIN, visit_range, &r);
+	for (i = 0; i < N_ITEMS; ++i)
+		TEST_EQUAL(r.visits[i], 1);
+	TEST_EQUAL(r.too_big, FALSE);
+	TEST_EQUAL(r.bad_worker, FALSE);
+
+	/* Default grain, and an empty range. */
+	r.grain = N_ITEMS;
+	sbpool_parallel_for(pool, 10, N_ITEMS, 0, visit_range, &r);
+	sbpool_parallel_for(pool, 5, 5, 0, visit_range, &r);
+	for (i = 0; i < N_ITEMS; ++i)
+		TEST_EQUAL(r.visits[i], i < 10 ? 1 : 2);
+	ckd_free(r.visits);
+
+	f.pool = pool;
+	f.n = 18;
+	fib(&f);
+	TEST_EQUAL(f.result, 2584);
+}
+
+static const arg_t args[] = {
+	{ "-nthreads",
+	  ARG_INT32,
+	  "3",
+	  "Number of threads" },
+	{ NULL, 0, NULL, NULL }
+};
+
+int
+main(int argc, char *argv[])
+{
+	sbpool_t *pool;
+	cmd_ln_t *config;
+	int i;
+
+	E_INFO("Testing pool of 1 thread\n");
+	TEST_ASSERT(pool = sbpool_init(NULL, 1));
+	TEST_EQUAL(sbpool_nthreads(pool), 1);
+	test_pool(pool);
+	sbpool_free(pool);
+
+	E_INFO("Testing pool of 4 threads\n");
+	TEST_ASSERT(pool = sbpool_init(NULL, 4));
+	TEST_EQUAL(sbpool_nthreads(pool), 4);
+	TEST_EQUAL(sbpool_worker(pool), 0);
+	for (i = 0; i < 10; ++i)
+		test_pool(pool);
+	sbpool_free(pool);
+
+	E_INFO("Testing pool sized from -nthreads\n");
+	config = cmd_ln_parse_r(NULL, args, 0, NULL, FALSE);
+	TEST_ASSERT(pool = sbpool_init(config, 0));
+	TEST_EQUAL(sbpool_nthreads(pool), 3);
+	test_pool(pool);
+	sbpool_free(pool);
+	cmd_ln_free_r(config);
+
+	return 0;
+}
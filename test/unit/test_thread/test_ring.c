@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sbthread.h>
+#include <profile.h>
+#include <err.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+#include "test_macros.h"
+
+#define N_PRODUCERS 4
+#define N_MESSAGES 20000
+
+typedef struct producer_s {
+	sbring_t *ring;
+	int id;
+} producer_t;
+
+/* Message length and contents depend on the sender and sequence number. */
+static size_t
+msg_len(int id, int seq)
+{
+	return 1 + (id * 7 + seq * 13) % 120;
+}
+
+static int
+producer_main(sbthread_t *th)
+{
+	producer_t *p = sbthread_arg(th);
+	int seq;
+
+	for (seq = 0; seq < N_MESSAGES; ++seq) {
+		size_t len = msg_len(p->id, seq);
+		unsigned char *msg;
+
+		/* Reserve a bit more than needed to test short commits. */
+		msg = sbring_reserve(p->ring, len + 8, -1, -1);
+		if (msg == NULL)
+			return -1;
+		msg[0] = p->id;
+		memset(msg + 1, seq & 0xff, len - 1);
+		if (sbring_commit(p->ring, msg, len) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static void
+check_messages(sbring_t *ring, int n_producers)
+{
+	int seq[N_PRODUCERS];
+	int i, total;
+
+	memset(seq, 0, sizeof(seq));
+	for (total = 0; total < n_producers * N_MESSAGES; ++total) {
+		unsigned char *msg;
+		size_t len;
+		int id;
+
+		msg = sbring_peek(ring, &len, -1, -1);
+		TEST_ASSERT(msg != NULL);
+		id = msg[0];
+		TEST_ASSERT(id < n_producers);
+		TEST_EQUAL(len, msg_len(id, seq[id]));
+		for (i = 1; i < (int)len; ++i)
+			TEST_EQUAL(msg[i], (seq[id] & 0xff));
+		++seq[id];
+	}
+	sbring_release(ring);
+	for (i = 0; i < n_producers; ++i)
+		TEST_EQUAL(seq[i], N_MESSAGES);
+}
+
+static void
+run_producers(int n_producers, int multi_producer)
+{
+	sbthread_t *threads[N_PRODUCERS];
+	producer_t producers[N_PRODUCERS];
+	sbring_t *ring;
+	int i;
+
+	/* Small, so that producers have to wait for space. */
+	ring = sbring_init(1024, multi_producer);
+	for (i = 0; i < n_producers; ++i) {
+		producers[i].ring = ring;
+		producers[i].id = i;
+		threads[i] = sbthread_start(NULL, producer_main, &producers[i]);
+		TEST_ASSERT(threads[i] != NULL);
+	}
+	check_messages(ring, n_producers);
+	for (i = 0; i < n_producers; ++i) {
+		TEST_EQUAL(0, sbthread_wait(threads[i]));
+		sbthread_free(threads[i]);
+	}
+	/* Nothing left. */
+	TEST_EQUAL(NULL, sbring_peek(ring, NULL, 0, 1000));
+	sbring_free(ring);
+}
+
+#ifndef _WIN32
+static volatile int stop_waking;
+
+static void
+on_wake(int sig)
+{
+}
+
+/* Interrupt the consumer's waits every millisecond, for at most
+ * three seconds. */
+static int
+waker_main(sbthread_t *th)
+{
+	pthread_t *consumer = sbthread_arg(th);
+	int i;
+
+	for (i = 0; i < 3000 && !stop_waking; ++i) {
+		pthread_kill(*consumer, SIGUSR1);
+		usleep(1000);
+	}
+	return 0;
+}
+
+/* Waiting must give up on time even if it keeps being woken up. */
+static void
+test_peek_interrupted(void)
+{
+	struct sigaction sa;
+	pthread_t self = pthread_self();
+	sbthread_t *waker;
+	sbring_t *ring;
+	ptmr_t tmr;
+
+	/* Without SA_RESTART, every signal cuts the wait short. */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_wake;
+	sigemptyset(&sa.sa_mask);
+	TEST_EQUAL(0, sigaction(SIGUSR1, &sa, NULL));
+
+	ring = sbring_init(200, FALSE);
+	waker = sbthread_start(NULL, waker_main, &self);
+	TEST_ASSERT(waker != NULL);
+	ptmr_init(&tmr);
+	ptmr_start(&tmr);
+	TEST_EQUAL(NULL, sbring_peek(ring, NULL, 0, 100 * 1000 * 1000));
+	ptmr_stop(&tmr);
+	stop_waking = TRUE;
+	TEST_EQUAL(0, sbthread_wait(waker));
+	sbthread_free(waker);
+	sbring_free(ring);
+	E_INFO("Timed out after %.3f seconds\n", tmr.t_elapsed);
+	TEST_ASSERT(tmr.t_elapsed < 1.0);
+}
+#endif
+
+int
+main(int argc, char *argv[])
+{
+	sbring_t *ring;
+	char *msg, *msg2;
+	size_t len;
+	int i;
+
+	/* Single thread: wraparound, timeouts and size limits. */
+	ring = sbring_init(200, FALSE);
+	TEST_EQUAL(NULL, sbring_peek(ring, &len, 0, 1000));
+	TEST_EQUAL(NULL, sbring_reserve(ring, sbring_max_len(ring) + 1, 0, 0));
+	for (i = 0; i < 100; ++i) {
+		TEST_ASSERT((msg = sbring_reserve(ring, i % 50 + 1, 0, 0)) != NULL);
+		memset(msg, i, i % 50 + 1);
+		TEST_EQUAL(0, sbring_commit(ring, msg, i % 50 + 1));
+		TEST_ASSERT((msg2 = sbring_peek(ring, &len, 0, 0)) != NULL);
+		TEST_EQUAL(msg, msg2);
+		TEST_EQUAL(len, i % 50 + 1);
+		TEST_EQUAL(msg2[len - 1], i);
+	}
+	sbring_release(ring);
+	/* Fill it up, then check that reserving times out. */
+	while ((msg = sbring_reserve(ring, 20, 0, 1000)) != NULL)
+		TEST_EQUAL(0, sbring_commit(ring, msg, 20));
+	TEST_ASSERT((msg = sbring_peek(ring, &len, 0, 0)) != NULL);
+	sbring_release(ring);
+	TEST_ASSERT((msg = sbring_reserve(ring, 20, 0, 0)) != NULL);
+	TEST_EQUAL(-1, sbring_commit(ring, msg, 21));
+	sbring_free(ring);
+
+#ifndef _WIN32
+	E_INFO("Testing timeout with interruptions\n");
+	test_peek_interrupted();
+#endif
+
+	E_INFO("Testing single producer\n");
+	run_producers(1, FALSE);
+	E_INFO("Testing %d producers\n", N_PRODUCERS);
+	run_producers(N_PRODUCERS, TRUE);
+
+	return 0;
+}
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <heap.h>
+#include <genrand.h>
+#include <profile.h>
+#include <ckd_alloc.h>
+
+#include "test_macros.h"
+
+/*
+ * Heap benchmark.  This is not run by "make check", build it with
+ * "make bench_heap" and run it by hand.  It times sorting a large
+ * number of values through the heap, and keeping the best few out of
+ * a long stream of candidates.
+ */
+
+#define N_SORT 1000000
+#define N_STREAM 10000000
+#define N_BEST 100
+
+int
+main(int argc, char *argv[])
+{
+    heap_t *heap;
+    ptmr_t tmr;
+    void **data;
+    int32 *vals;
+    void *d;
+    int32 val, prev;
+    int i;
+
+    genrand_seed(42);
+    data = ckd_calloc(N_SORT, sizeof(*data));
+    vals = ckd_calloc(N_SORT, sizeof(*vals));
+    for (i = 0; i < N_SORT; ++i) {
+        data[i] = (void *)(long)i;
+        vals[i] = genrand_int31();
+    }
+
+    ptmr_init(&tmr);
+    ptmr_start(&tmr);
+    heap = heap_new();
+    for (i = 0; i < N_SORT; ++i)
+        heap_insert(heap, data[i], vals[i]);
+    prev = -1;
+    while (heap_pop(heap, &d, &val) == 1) {
+        TEST_ASSERT(val >= prev);
+        prev = val;
+    }
+    heap_destroy(heap);
+    ptmr_stop(&tmr);
+    printf("insert and pop %d values: %.3f sec\n", N_SORT, tmr.t_cpu);
+
+    ptmr_init(&tmr);
+    ptmr_start(&tmr);
+    heap = heap_new();
+    heap_insert_array(heap, data, vals, N_SORT);
+    prev = -1;
+    while (heap_pop(heap, &d, &val) == 1) {
+        TEST_ASSERT(val >= prev);
+        prev = val;
+    }
+    heap_destroy(heap);
+    ptmr_stop(&tmr);
+    printf("heapify and pop %d values: %.3f sec\n", N_SORT, tmr.t_cpu);
+
+    /* Keep the N_BEST largest values, the worst of them on top. */
+    ptmr_init(&tmr);
+    ptmr_start(&tmr);
+    heap = heap_new();
+    for (i = 0; i < N_STREAM; ++i) {
+        val = genrand_int31();
+        if (heap_size(heap) < N_BEST)
+            heap_insert(heap, NULL, val);
+        else {
+            int32 worst;
+            heap_top(heap, &d, &worst);
+            if (val > worst) {
+                heap_pop(heap, &d, &worst);
+                heap_insert(heap, NULL, val);
+            }
+        }
+    }
+    TEST_EQUAL(heap_size(heap), N_BEST);
+    heap_destroy(heap);
+    ptmr_stop(&tmr);
+    printf("best %d of %d values: %.3f sec\n", N_BEST, N_STREAM, tmr.t_cpu);
+
+    ckd_free(data);
+    ckd_free(vals);
+    return 0;
+}
@@ -14,6 +14,10 @@ int
 main(int argc, char *argv[])
 {
 	heap_t *heap;
+	int32 handles[25];
+	void *data[100];
+	int32 vals[100];
+	int32 prev;
 	int i;
 
 	heap = heap_new();
@@ -36,5 +40,56 @@ main(int argc, char *argv[])
 	TEST_EQUAL(0, heap_remove(heap, (void *)(long)9));
 	TEST_EQUAL(0, heap_remove(heap, (void *)(long)0));
 	TEST_EQUAL(heap_size(heap), 21);
+	TEST_EQUAL(0, heap_destroy(heap));
+
+	/* Handles and changing values */
+	heap = heap_new();
+	for (i = 0; i < 25; ++i)
+		handles[i] = heap_insert_handle(heap, (void *)(long)i, i * 10);
+	TEST_EQUAL(0, heap_update(heap, handles[20], -5));
+	TEST_EQUAL(0, heap_update(heap, handles[0], 1000));
+	TEST_EQUAL(0, heap_remove_handle(heap, handles[7]));
+	TEST_EQUAL(-1, heap_remove_handle(heap, handles[7]));
+	TEST_EQUAL(-1, heap_update(heap, handles[7], 0));
+	TEST_EQUAL(heap_size(heap), 24);
+	{
+		int32 val;
+		void *data;
+		TEST_EQUAL(1, heap_top(heap, &data, &val));
+		TEST_EQUAL(val, -5);
+		TEST_EQUAL((int)(long)data, 20);
+		prev = -1000;
+		while (heap_pop(heap, &data, &val) == 1) {
+			TEST_ASSERT(val >= prev);
+			TEST_ASSERT((int)(long)data != 7);
+			prev = val;
+		}
+		TEST_EQUAL(val, 1000);
+		TEST_EQUAL((int)(long)data, 0);
+	}
+	/* Popped handles are no longer valid. */
+	TEST_EQUAL(-1, heap_update(heap, handles[3], 0));
+	TEST_EQUAL(0, heap_size(heap));
+	TEST_EQUAL(0, heap_destroy(heap));
+
+	/* Bulk insertion */
+	heap = heap_new();
+	for (i = 0; i < 100; ++i) {
+		data[i] = (void *)(long)i;
+		vals[i] = (i * 37) % 100;
+	}
+	heap_insert(heap, (void *)(long)-1, 50);
+	TEST_EQUAL(0, heap_insert_array(heap, data, vals, 100));
+	TEST_EQUAL(0, heap_insert_array(heap, data, vals, 10));
+	TEST_EQUAL(heap_size(heap), 111);
+	prev = -1;
+	for (i = 0; i < 111; ++i) {
+		int32 val;
+		void *d;
+		TEST_EQUAL(1, heap_pop(heap, &d, &val));
+		TEST_ASSERT(val >= prev);
+		prev = val;
+	}
+	TEST_EQUAL(0, heap_destroy(heap));
 	return 0;
 }